@@ -3,29 +3,86 @@
 
 
 struct sp_bp_queue_t {
-	BPQueueElement * elements;
+	BPQueueElement * elements; // elements[0] is the highest element in both implementations
 	int size;
 	int maxSize;
+	SP_BPQUEUE_IMPL impl;
+	bool sorted; // the elements are sorted from highest to lowest (always in SP_BPQUEUE_SORTED and small queues)
+	bool small; // a small SP_BPQUEUE_HEAP queue (maxSize <= SP_BPQUEUE_SMALL_MAX), kept sorted like SP_BPQUEUE_SORTED
+	BPQueueElement inlineElements[]; // the elements of a small queue, allocated with the struct
 };
 
+// the implementation of new queues
+static SP_BPQUEUE_IMPL defaultImpl = SP_BPQUEUE_HEAP;
+
 //Inner function indicating one queue element is greater than the other
 bool isGreater(BPQueueElement el1, BPQueueElement el2) {
 	// returns true if el1 > el2 (compares value and then index)
 	return (el1.value > el2.value) || ((el1.value == el2.value) && (el1.index > el2.index));
 }
 
-SPBPQueue* spBPQueueCreate(int mSize) {
+//Inner function moving elements[i] down the max heap until it is not lower than its children
+static void siftDown(BPQueueElement* elements, int size, int i) {
+	BPQueueElement element = elements[i];
+	int child;
+	while ((child = 2*i + 1) < size) {
+		if (child + 1 < size && isGreater(elements[child + 1], elements[child]))
+			child++;
+		if (!isGreater(elements[child], element))
+			break;
+		elements[i] = elements[child];
+		i = child;
+	}
+	elements[i] = element;
+}
+
+//Inner function sorting the max heap of a queue from highest to lowest, which keeps it a max heap
+static void sortHeap(SPBPQueue* source) {
+	BPQueueElement tmp;
+	int i;
+	if (source->sorted)
+		return;
+	// heap sort, from lowest to highest
+	for (i=source->size-1; i>0; i--) {
+		tmp = source->elements[0];
+		source->elements[0] = source->elements[i];
+		source->elements[i] = tmp;
+		siftDown(source->elements, i, 0);
+	}
+	// reverse
+	for (i=0; i<source->size/2; i++) {
+		tmp = source->elements[i];
+		source->elements[i] = source->elements[source->size-1-i];
+		source->elements[source->size-1-i] = tmp;
+	}
+	source->sorted = true;
+}
+
+bool spBPQueueSetImplementation(SP_BPQUEUE_IMPL impl) {
+	if (impl != SP_BPQUEUE_SORTED && impl != SP_BPQUEUE_HEAP)
+		return false;
+	defaultImpl = impl;
+	return true;
+}
+
+SP_BPQUEUE_IMPL spBPQueueGetImplementation() {
+	return defaultImpl;
+}
+
+//Inner function allocating an empty queue of the given implementation
+static SPBPQueue* bpQueueCreate(int mSize, SP_BPQUEUE_IMPL impl) {
 	if (mSize <=0)
 		return NULL;
+	bool small = impl == SP_BPQUEUE_HEAP && mSize <= SP_BPQUEUE_SMALL_MAX;
 
-	// allocate priority queue struct
-	SPBPQueue *res = (SPBPQueue*) malloc(sizeof(*res));
+	// allocate priority queue struct, with the elements of a small queue
+	SPBPQueue *res = (SPBPQueue*) malloc(sizeof(*res) + (small ? mSize * sizeof(BPQueueElement) : 0));
 	if (res == NULL) { //Allocation failure
 		return NULL;
 	}
 
 	// allocate elements array
-	res->elements = (BPQueueElement*) malloc(mSize * sizeof(BPQueueElement));
+	res->elements = small ? res->inlineElements : (BPQueueElement*) malloc(mSize * sizeof(BPQueueElement));
 	if (res->elements == NULL) { //Allocation failure - need to free(res)
 		free(res);
 		return NULL;
@@ -34,18 +91,26 @@ SPBPQueue* spBPQueueCreate(int mSize) {
 	// initialize members
 	res->maxSize = mSize;
 	res->size = 0;
+	res->impl = impl;
+	res->sorted = true;
+	res->small = small;
 	return res;
 }
 
+SPBPQueue* spBPQueueCreate(int mSize) {
+	return bpQueueCreate(mSize, defaultImpl);
+}
+
 SPBPQueue* spBPQueueCopy(SPBPQueue* source) {
 	int i;
 	if (source == NULL)
 		return NULL;
 
-	SPBPQueue *res = spBPQueueCreate(source->maxSize);
+	SPBPQueue *res = bpQueueCreate(source->maxSize, source->impl);
 	if (res == NULL)
 		return NULL;
 	res->size = source->size;
+	res->sorted = source->sorted;
 
 	for (i=0; i<source->size; i++)
 		res->elements[i] = source->elements[i];
@@ -54,14 +119,17 @@ SPBPQueue* spBPQueueCopy(SPBPQueue* source) {
 
 void spBPQueueDestroy(SPBPQueue* source) {
 	if (source != NULL) {
-		free(source->elements);
+		if (!source->small)
+			free(source->elements);
 		free(source);
 	}
 }
 
 void spBPQueueClear(SPBPQueue* source) {
-	if (source != NULL)
+	if (source != NULL) {
 		source->size = 0;
+		source->sorted = true;
+	}
 }
 
 int spBPQueueSize(SPBPQueue* source) {
@@ -82,6 +150,37 @@ SP_BPQUEUE_MSG spBPQueueEnqueue(SPBPQueue* source, int index, double value) {
 
 	BPQueueElement element = {index, value};
 
+	if (source->small && source->maxSize == 1) { // running minimum
+		if (source->size == 0 || !isGreater(element, source->elements[0])) {
+			source->elements[0] = element;
+			source->size = 1;
+		}
+		return SP_BPQUEUE_SUCCESS;
+	}
+	if (source->impl == SP_BPQUEUE_HEAP && !source->small) {
+		if (spBPQueueIsFull(source)) { // is full
+			// ignore elements with value greater than maximum
+			if (isGreater(element, source->elements[0]))
+				return SP_BPQUEUE_SUCCESS;
+
+			// replace the maximum
+			source->elements[0] = element;
+			siftDown(source->elements, source->size, 0);
+		}
+		else { // is not full - move the new element up from the end
+			int i = source->size;
+			while (i>0 && isGreater(element, source->elements[(i-1)/2])) {
+				source->elements[i] = source->elements[(i-1)/2];
+				i = (i-1)/2;
+			}
+			source->elements[i] = element;
+			source->size++;
+		}
+		source->sorted = source->size <= 1;
+		return SP_BPQUEUE_SUCCESS;
+	}
+
+	// sorted array
 	if (spBPQueueIsFull(source)) { // is full
 		// ignore elements with value greater than maximum
 		if (isGreater(element, source->elements[0]))
@@ -120,6 +219,7 @@ SP_BPQUEUE_MSG spBPQueueDequeue(SPBPQueue* source) {
 	if (spBPQueueIsEmpty(source))
 		return SP_BPQUEUE_EMPTY;
 
+	sortHeap(source); // the lowest element is last
 	source->size--;
 	return SP_BPQUEUE_SUCCESS;
 }
@@ -131,6 +231,7 @@ SP_BPQUEUE_MSG spBPQueuePeek(SPBPQueue* source, BPQueueElement* res) {
 	if (source->size <= 0)
 		return SP_BPQUEUE_EMPTY;
 
+	sortHeap(source);
 	res->index = source->elements[source->size-1].index;
 	res->value = source->elements[source->size-1].value;
 	return SP_BPQUEUE_SUCCESS;
@@ -153,6 +254,7 @@ double spBPQueueMinValue(SPBPQueue* source) {
         return -1;
 	if(spBPQueueIsEmpty(source))
         return -1;
+	sortHeap(source);
 	return source->elements[source->size-1].value;
 }
 
@@ -161,7 +263,7 @@ double spBPQueueMaxValue(SPBPQueue* source) {
         return -1;
     if(source->size == 0)
         return -1;
-	return source->elements[0].value;
+    return source->elements[0].value;
 }
 
 bool spBPQueueIsEmpty(SPBPQueue* source) {
@@ -11,8 +11,20 @@
  * removed from the queue and the new element is put in. If the value of the new element is not
  * smaller than the maximum, it is not added to the queue.
  *
+ * Two implementations are available - a sorted array (SP_BPQUEUE_SORTED), whose insertion shifts up to
+ * maxSize elements, and a binary max heap (SP_BPQUEUE_HEAP), whose insertion takes O(log(maxSize)).
+ * The heap is sorted the first time the lowest element is needed (spBPQueuePeek, spBPQueueDequeue or
+ * spBPQueueMinValue), so emptying a queue from the lowest element takes O(maxSize*log(maxSize)) in total.
+ * Both hold exactly the same elements, the highest element is always found immediately, and equal values
+ * are ordered by index in both. New queues use the implementation selected by spBPQueueSetImplementation.
+ * A heap queue of at most SP_BPQUEUE_SMALL_MAX elements (a small queue) is a sorted array instead,
+ * allocated together with the queue - at this size shifting the few elements lower than a new element
+ * is faster than sifting it through a heap, and a queue of one element just keeps the running minimum.
+ *
  * The following functions are supported:
  *
+ * spBPQueueSetImplementation - Selects the implementation of new queues.
+ * spBPQueueGetImplementation - A getter of the implementation of new queues.
  * spBPQueueCreate      - Initializes a new queue.
  * spBPQueueCopy 		- Copies a queue.
  * spBPQueueDestroy		- Frees all allocated memory in a queue.
@@ -38,6 +50,15 @@ typedef struct sp_bpq_element_t {
 	double value;
 } BPQueueElement;
 
+/** Heap queues of at most this number of elements are small queues, kept sorted **/
+#define SP_BPQUEUE_SMALL_MAX 16
+
+/** The available implementations **/
+typedef enum sp_bp_queue_impl_t {
+	SP_BPQUEUE_SORTED,
+	SP_BPQUEUE_HEAP
+} SP_BPQUEUE_IMPL;
+
 /** type for error reporting **/
 typedef enum sp_bp_queue_msg_t {
 	SP_BPQUEUE_OUT_OF_MEMORY,
@@ -48,7 +69,24 @@ typedef enum sp_bp_queue_msg_t {
 } SP_BPQUEUE_MSG;
 
 /**
- * Allocates a new empty priority queue in the memory.
+ * Selects the implementation of the queues created from now on (SP_BPQUEUE_HEAP unless selected).
+ * Existing queues, and their copies, keep their implementation.
+ * Not thread safe - meant to be called once, before any queue is created.
+ *
+ * @param impl - the implementation
+ * @return false if impl is not an implementation (the selection is unchanged), true otherwise
+ */
+bool spBPQueueSetImplementation(SP_BPQUEUE_IMPL impl);
+
+/**
+ * A getter of the implementation of new queues.
+ *
+ * @return The selected implementation
+ */
+SP_BPQUEUE_IMPL spBPQueueGetImplementation();
+
+/**
+ * Allocates a new empty priority queue in the memory, of the selected implementation.
  * @param maxSize - the maximum size of the queue.
  *
  * @return
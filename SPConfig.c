@@ -20,9 +20,26 @@ struct sp_config_t{
 	int spPCADimension;					// in [10,28]		default 20
 	char spPCAFilename[STR_LEN];		// no spaces		default pca.yml
 	int spNumOfFeatures;				// >0				default 100
+	int spPCADescriptorCache;			// >=0				default 1048576
 	bool spExtractionMode;				// 					default true
+	bool spFeaturesDB;					//					default false
+	char spFeaturesDBFilename[STR_LEN];	// no spaces		default features.db
+	bool spFeaturesFloat32;				//					default false
 	int spNumOfSimilarImages;			// >0				default 1
 	KD_METHOD spKDTreeSplitMethod;		//					default MAX_SPREAD
+	bool spKDTreeFlatLayout;			//					default false (true with quantized features or an index file)
+	int spKDTreeLeafSize;				// >0				default 1
+	bool spKDTreeInPlaceBuild;			//					default false
+	bool spBPQueueHeap;					//					default true
+	int spKDTreeMaxLeafChecks;			// >=0				default 0 (exact search)
+	int spKDTreeNumOfTrees;				// >0				default 1
+	int spPQNumOfSubspaces;				// >=0				default 0 (no PQ index)
+	int spPQRerankCandidates;			// >=0				default 0 (approximate distances)
+	bool spQuantizedFeatures;			//					default false
+	int spQuantizedRerankCandidates;	// >=0				default 0 (approximate distances)
+	int spNumOfThreads;					// >=0				default 0 (all cores)
+	char spKDTreeIndexFilename[STR_LEN];// no spaces		default kdtree.index
+	KD_INDEX_MODE spKDTreeIndexMode;	//					default REBUILD
 	int spKNN;							// >0				default 1
 	bool spMinimalGUI;					// 					default false
 	int spLoggerLevel;					// in {1,2,3,4}		default 3
@@ -158,6 +175,23 @@ SP_CONFIG_MSG spConfigParseKDEnum(const char *val, KD_METHOD *valptr) {
 	return SP_CONFIG_SUCCESS;
 }
 
+/*
+ * Parse KD_INDEX_MODE value and assign to configuration field.
+ *
+ * @param val - a string containing the configuration value
+ * @param valptr - pointer to the configuration field
+ *
+ * @return	SP_CONFIG_INVALID_STRING if val is not one of the enum values
+ *			SP_CONFIG_SUCCESS - in case of success
+ */
+SP_CONFIG_MSG spConfigParseIndexEnum(const char *val, KD_INDEX_MODE *valptr) {
+	if (streq(val,"REBUILD"))		*valptr = KD_INDEX_REBUILD;
+	else if (streq(val,"SAVE"))		*valptr = KD_INDEX_SAVE;
+	else if (streq(val,"LOAD"))		*valptr = KD_INDEX_LOAD;
+	else							return SP_CONFIG_INVALID_STRING;
+	return SP_CONFIG_SUCCESS;
+}
+
 SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 	/*** PARSER SETUP ***/
 	/********************/
@@ -185,18 +219,37 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 	// set default values
 	config->spPCADimension		=	SP_CONFIG_DEFAULT_PCA_DIMENSIONS;
 	config->spNumOfFeatures		=	SP_CONFIG_DEFAULT_NUM_OF_FEATURES;
+	config->spPCADescriptorCache=	SP_CONFIG_DEFAULT_PCA_DESCRIPTOR_CACHE;
 	config->spExtractionMode	=	SP_CONFIG_DEFAULT_EXTRACTION_MODE;
+	config->spFeaturesDB		=	SP_CONFIG_DEFAULT_FEATURES_DB;
+	config->spFeaturesFloat32	=	SP_CONFIG_DEFAULT_FEATURES_FLOAT32;
 	config->spMinimalGUI		=	SP_CONFIG_DEFAULT_MINIMAL_GUI;
 	config->spNumOfSimilarImages=	SP_CONFIG_DEFAULT_NUM_OF_SIMILAR_IMAGES;
 	config->spKNN				=	SP_CONFIG_DEFAULT_KNN;
 	config->spKDTreeSplitMethod	=	SP_CONFIG_DEFAULT_KD_TREE_SPLIT_METHOD;
+	config->spKDTreeFlatLayout	=	SP_CONFIG_DEFAULT_KD_TREE_FLAT_LAYOUT;
+	config->spKDTreeLeafSize	=	SP_CONFIG_DEFAULT_KD_TREE_LEAF_SIZE;
+	config->spKDTreeInPlaceBuild=	SP_CONFIG_DEFAULT_KD_TREE_IN_PLACE_BUILD;
+	config->spBPQueueHeap		=	SP_CONFIG_DEFAULT_BPQUEUE_HEAP;
+	config->spKDTreeMaxLeafChecks=	SP_CONFIG_DEFAULT_KD_TREE_MAX_LEAF_CHECKS;
+	config->spKDTreeNumOfTrees	=	SP_CONFIG_DEFAULT_KD_TREE_NUM_OF_TREES;
+	config->spPQNumOfSubspaces	=	SP_CONFIG_DEFAULT_PQ_NUM_OF_SUBSPACES;
+	config->spPQRerankCandidates=	SP_CONFIG_DEFAULT_PQ_RERANK_CANDIDATES;
+	config->spQuantizedFeatures	=	SP_CONFIG_DEFAULT_QUANTIZED_FEATURES;
+	config->spQuantizedRerankCandidates=	SP_CONFIG_DEFAULT_QUANTIZED_RERANK_CANDIDATES;
+	config->spNumOfThreads		=	SP_CONFIG_DEFAULT_NUM_OF_THREADS;
+	config->spKDTreeIndexMode	=	SP_CONFIG_DEFAULT_KD_TREE_INDEX_MODE;
 	config->spLoggerLevel		=	SP_CONFIG_DEFAULT_LOGGER_LEVEL;
 	strcpy(config->spPCAFilename, SP_CONFIG_DEFAULT_PCA_FILENAME);
+	strcpy(config->spFeaturesDBFilename, SP_CONFIG_DEFAULT_FEATURES_DB_FILENAME);
+	strcpy(config->spKDTreeIndexFilename, SP_CONFIG_DEFAULT_KD_TREE_INDEX_FILENAME);
 	strcpy(config->spLoggerFilename, SP_CONFIG_DEFAULT_LOGGER_FILENAME);
 
 	// must set values
 	bool setImagesDirectory = false, setImagesPrefix = false,
 		 setImagesSuffix = false, setNumOfImages = false;
+	// variables whose default depends on other variables
+	bool setKDTreeFlatLayout = false;
 
 	/*** START PARSING ***/
 	/*********************/
@@ -251,6 +304,10 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 		else if (streq(var, "spPCAFilename"))
 			*msg = spConfigParseString(val, config->spPCAFilename, NULL, 0);
 
+		// spPCADescriptorCache
+		else if (streq(var, "spPCADescriptorCache"))
+			*msg = spConfigParseInt(val, &(config->spPCADescriptorCache), 0, INT_MAX);
+
 		// spNumOfFeatures
 		else if (streq(var, "spNumOfFeatures"))
 			*msg = spConfigParseInt(val, &(config->spNumOfFeatures),1, INT_MAX);
@@ -259,6 +316,18 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 		else if (streq(var, "spExtractionMode"))
 			*msg = spConfigParseBool(val, &(config->spExtractionMode));
 
+		// spFeaturesDB
+		else if (streq(var, "spFeaturesDB"))
+			*msg = spConfigParseBool(val, &(config->spFeaturesDB));
+
+		// spFeaturesDBFilename
+		else if (streq(var, "spFeaturesDBFilename"))
+			*msg = spConfigParseString(val, config->spFeaturesDBFilename, NULL, 0);
+
+		// spFeaturesFloat32
+		else if (streq(var, "spFeaturesFloat32"))
+			*msg = spConfigParseBool(val, &(config->spFeaturesFloat32));
+
 		// spNumOfSimilarImages
 		else if (streq(var, "spNumOfSimilarImages"))
 			*msg = spConfigParseInt(val, &(config->spNumOfSimilarImages),1, INT_MAX);
@@ -267,6 +336,60 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 		else if (streq(var, "spKDTreeSplitMethod"))
 			*msg = spConfigParseKDEnum(val, &(config->spKDTreeSplitMethod));
 
+		// spKDTreeFlatLayout
+		else if (streq(var, "spKDTreeFlatLayout")) {
+			*msg = spConfigParseBool(val, &(config->spKDTreeFlatLayout));
+			setKDTreeFlatLayout = true;
+		}
+
+		// spKDTreeLeafSize
+		else if (streq(var, "spKDTreeLeafSize"))
+			*msg = spConfigParseInt(val, &(config->spKDTreeLeafSize), 1, INT_MAX);
+
+		// spKDTreeInPlaceBuild
+		else if (streq(var, "spKDTreeInPlaceBuild"))
+			*msg = spConfigParseBool(val, &(config->spKDTreeInPlaceBuild));
+
+		// spBPQueueHeap
+		else if (streq(var, "spBPQueueHeap"))
+			*msg = spConfigParseBool(val, &(config->spBPQueueHeap));
+
+		// spKDTreeMaxLeafChecks
+		else if (streq(var, "spKDTreeMaxLeafChecks"))
+			*msg = spConfigParseInt(val, &(config->spKDTreeMaxLeafChecks), 0, INT_MAX);
+
+		// spKDTreeNumOfTrees
+		else if (streq(var, "spKDTreeNumOfTrees"))
+			*msg = spConfigParseInt(val, &(config->spKDTreeNumOfTrees), 1, INT_MAX);
+
+		// spPQNumOfSubspaces
+		else if (streq(var, "spPQNumOfSubspaces"))
+			*msg = spConfigParseInt(val, &(config->spPQNumOfSubspaces), 0, SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX);
+
+		// spPQRerankCandidates
+		else if (streq(var, "spPQRerankCandidates"))
+			*msg = spConfigParseInt(val, &(config->spPQRerankCandidates), 0, INT_MAX);
+
+		// spQuantizedFeatures
+		else if (streq(var, "spQuantizedFeatures"))
+			*msg = spConfigParseBool(val, &(config->spQuantizedFeatures));
+
+		// spQuantizedRerankCandidates
+		else if (streq(var, "spQuantizedRerankCandidates"))
+			*msg = spConfigParseInt(val, &(config->spQuantizedRerankCandidates), 0, INT_MAX);
+
+		// spNumOfThreads
+		else if (streq(var, "spNumOfThreads"))
+			*msg = spConfigParseInt(val, &(config->spNumOfThreads), 0, INT_MAX);
+
+		// spKDTreeIndexFilename
+		else if (streq(var, "spKDTreeIndexFilename"))
+			*msg = spConfigParseString(val, config->spKDTreeIndexFilename, NULL, 0);
+
+		// spKDTreeIndexMode
+		else if (streq(var, "spKDTreeIndexMode"))
+			*msg = spConfigParseIndexEnum(val, &(config->spKDTreeIndexMode));
+
 		// spKNN
 		else if (streq(var, "spKNN"))
 			*msg = spConfigParseInt(val, &(config->spKNN), 1, INT_MAX);
@@ -305,10 +428,29 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg) {
 	else if (!setImagesSuffix) *msg = SP_CONFIG_MISSING_SUFFIX;
 	else if (!setNumOfImages) *msg = SP_CONFIG_MISSING_NUM_IMAGES;
 
-	// print error message
+	// the quantized features are scanned at the leaves of a single tree in the flat layout (the PQ index builds
+	// no tree), and the index file holds such a tree
+	else if (config->spQuantizedFeatures && config->spPQNumOfSubspaces > 0) {
+		*msg = SP_CONFIG_CONFLICT;
+		errmsg = SP_CONFIG_CONFLICT_QUANTIZED_PQ_MSG;
+	}
+	else if (config->spQuantizedFeatures && config->spKDTreeNumOfTrees > 1) {
+		*msg = SP_CONFIG_CONFLICT;
+		errmsg = SP_CONFIG_CONFLICT_QUANTIZED_FOREST_MSG;
+	}
+	else if (config->spQuantizedFeatures || config->spKDTreeIndexMode != KD_INDEX_REBUILD) {
+		if (!setKDTreeFlatLayout)
+			config->spKDTreeFlatLayout = true;
+		else if (!config->spKDTreeFlatLayout) {
+			*msg = SP_CONFIG_CONFLICT;
+			errmsg = SP_CONFIG_CONFLICT_FLAT_LAYOUT_MSG;
+		}
+	}
+
+	// print error message (a conflict is not on one line)
 	if (*msg != SP_CONFIG_SUCCESS) {
 		printf("File: %s\n", filename);
-		printf("Line: %d\n", lineNum);
+		if (*msg != SP_CONFIG_CONFLICT) printf("Line: %d\n", lineNum);
 		if (errmsg != NULL) printf("Message: %s\n", errmsg);
 		spConfigDestroy(config);
 		config = NULL;
@@ -335,6 +477,14 @@ bool spConfigIsExtractionMode(const SPConfig config, SP_CONFIG_MSG* msg) {
 	return (spConfigValidate(config, msg) && config->spExtractionMode);
 }
 
+bool spConfigIsFeaturesDB(const SPConfig config, SP_CONFIG_MSG* msg) {
+	return (spConfigValidate(config, msg) && config->spFeaturesDB);
+}
+
+bool spConfigIsFeaturesFloat32(const SPConfig config, SP_CONFIG_MSG* msg) {
+	return (spConfigValidate(config, msg) && config->spFeaturesFloat32);
+}
+
 bool spConfigMinimalGui(const SPConfig config, SP_CONFIG_MSG* msg) {
 	return (spConfigValidate(config, msg) && config->spMinimalGUI);
 }
@@ -370,6 +520,77 @@ KD_METHOD spConfigGetKDSplitMethod(const SPConfig config, SP_CONFIG_MSG* msg) {
 	return SP_CONFIG_DEFAULT_KD_TREE_SPLIT_METHOD;
 }
 
+bool spConfigIsKDTreeFlatLayout(const SPConfig config, SP_CONFIG_MSG* msg) {
+	return (spConfigValidate(config, msg) && config->spKDTreeFlatLayout);
+}
+
+int spConfigGetKDTreeLeafSize(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spKDTreeLeafSize;
+	return -1;
+}
+
+bool spConfigIsKDTreeInPlaceBuild(const SPConfig config, SP_CONFIG_MSG* msg) {
+	return (spConfigValidate(config, msg) && config->spKDTreeInPlaceBuild);
+}
+
+bool spConfigIsBPQueueHeap(const SPConfig config, SP_CONFIG_MSG* msg) {
+	return (spConfigValidate(config, msg) && config->spBPQueueHeap);
+}
+
+int spConfigGetKDTreeMaxLeafChecks(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spKDTreeMaxLeafChecks;
+	return -1;
+}
+
+int spConfigGetKDTreeNumOfTrees(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spKDTreeNumOfTrees;
+	return -1;
+}
+
+int spConfigGetPQNumOfSubspaces(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spPQNumOfSubspaces;
+	return -1;
+}
+
+int spConfigGetPQRerankCandidates(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spPQRerankCandidates;
+	return -1;
+}
+
+bool spConfigIsQuantizedFeatures(const SPConfig config, SP_CONFIG_MSG* msg) {
+	return (spConfigValidate(config, msg) && config->spQuantizedFeatures);
+}
+
+int spConfigGetQuantizedRerankCandidates(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spQuantizedRerankCandidates;
+	return -1;
+}
+
+int spConfigGetPCADescriptorCache(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spPCADescriptorCache;
+	return -1;
+}
+
+int spConfigGetNumOfThreads(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spNumOfThreads;
+	return -1;
+}
+
+KD_INDEX_MODE spConfigGetKDTreeIndexMode(const SPConfig config, SP_CONFIG_MSG* msg) {
+	if (spConfigValidate(config, msg))
+		return config->spKDTreeIndexMode;
+	// return default mode if fails
+	return SP_CONFIG_DEFAULT_KD_TREE_INDEX_MODE;
+}
+
 int spConfigGetKNN(const SPConfig config, SP_CONFIG_MSG* msg) {
 	if (spConfigValidate(config, msg))
 		return config->spKNN;
@@ -404,6 +625,20 @@ SP_CONFIG_MSG spConfigGetPCAPath(char* pcaPath, const SPConfig config) {
 	return SP_CONFIG_SUCCESS;
 }
 
+SP_CONFIG_MSG spConfigGetFeaturesDBPath(char* dbPath, const SPConfig config) {
+	if (config == NULL || dbPath == NULL)
+		return SP_CONFIG_INVALID_ARGUMENT;
+	sprintf(dbPath,"%s%s",config->spImagesDirectory, config->spFeaturesDBFilename);
+	return SP_CONFIG_SUCCESS;
+}
+
+SP_CONFIG_MSG spConfigGetKDTreeIndexPath(char* indexPath, const SPConfig config) {
+	if (config == NULL || indexPath == NULL)
+		return SP_CONFIG_INVALID_ARGUMENT;
+	sprintf(indexPath,"%s%s",config->spImagesDirectory, config->spKDTreeIndexFilename);
+	return SP_CONFIG_SUCCESS;
+}
+
 SP_CONFIG_MSG spConfigInitLogger(const SPConfig config, SP_LOGGER_MSG* loggerMsg) {
 	if (config == NULL || loggerMsg == NULL)
 		return SP_CONFIG_INVALID_ARGUMENT;
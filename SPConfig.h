@@ -10,6 +10,12 @@ typedef enum kd_method {
 	INCREMENTAL
 } KD_METHOD;
 
+typedef enum kd_index_mode {
+	KD_INDEX_REBUILD,	// build the kd tree, don't use an index file
+	KD_INDEX_SAVE,		// build the kd tree and save it to the index file
+	KD_INDEX_LOAD		// load the kd tree from the index file, build and save it if it can't be loaded
+} KD_INDEX_MODE;
+
 
 /**
  * A data-structure which is used for configuring the system.
@@ -27,6 +33,7 @@ typedef enum sp_config_msg_t {
 	SP_CONFIG_INVALID_LINE,
 	SP_CONFIG_INVALID_ARGUMENT,
 	SP_CONFIG_INDEX_OUT_OF_RANGE,
+	SP_CONFIG_CONFLICT,
 	SP_CONFIG_SUCCESS
 } SP_CONFIG_MSG;
 
@@ -55,6 +62,7 @@ typedef struct sp_config_t* SPConfig;
  * - SP_CONFIG_MISSING_PREFIX - if spImagesPrefix is missing
  * - SP_CONFIG_MISSING_SUFFIX - if spImagesSuffix is missing 
  * - SP_CONFIG_MISSING_NUM_IMAGES - if spNumOfImages is missing
+ * - SP_CONFIG_CONFLICT - if the values of several variables cannot be used together
  * - SP_CONFIG_SUCCESS - in case of success
  *
  *
@@ -76,6 +84,41 @@ SPConfig spConfigCreate(const char* filename, SP_CONFIG_MSG* msg);
  */
 bool spConfigIsExtractionMode(const SPConfig config, SP_CONFIG_MSG* msg);
 
+/*
+ * Returns true if spFeaturesDB = true, false otherwise.
+ * If true, the features of all the images are saved to / loaded from one feature database
+ * (see spConfigGetFeaturesDBPath) instead of a features file per image.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return true if spFeaturesDB = true, false otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+bool spConfigIsFeaturesDB(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/*
+ * Returns true if spFeaturesFloat32 = true, false otherwise.
+ * If true, the features are kept, saved and searched as floats (SP_FEATURE_STORE_FLOAT32 and
+ * SP_FEATURES_FLOAT32) - half the memory and bandwidth of doubles, the precision of the PCA output.
+ * Such a kd tree is not saved to the kd tree index file.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return true if spFeaturesFloat32 = true, false otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+bool spConfigIsFeaturesFloat32(const SPConfig config, SP_CONFIG_MSG* msg);
+
 /*
  * Returns true if spMinimalGUI = true, false otherwise.
  *
@@ -169,6 +212,250 @@ int spConfigGetPCADim(const SPConfig config, SP_CONFIG_MSG* msg);
  */
 KD_METHOD spConfigGetKDSplitMethod(const SPConfig config, SP_CONFIG_MSG* msg);
 
+/**
+ * Returns true if spKDTreeFlatLayout = true, false otherwise.
+ * In the flat layout the KDTree nodes are kept in one array (see spKDTreeInitFlat). The default is the
+ * pointer layout, whose tree (and the RANDOM split dimensions drawn for it) is the tree of earlier releases.
+ * The quantized features (spQuantizedFeatures) and the index file (spKDTreeIndexMode SAVE or LOAD) need
+ * the flat layout, so they turn it on when spKDTreeFlatLayout is not set. Setting spKDTreeFlatLayout = false
+ * with either of them is a conflict (SP_CONFIG_CONFLICT) when the configuration is created.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return true if spKDTreeFlatLayout = true, false otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+bool spConfigIsKDTreeFlatLayout(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the maximal number of features in a leaf of the KDTree - spKDTreeLeafSize.
+ * Only used in the flat layout, where a leaf holds a bucket of features (see spKDTreeInitFlat), and by a forest.
+ * The default 1 keeps the shape of the pointer tree; larger buckets have to be tuned per deployment. Another value
+ * with the pointer layout is logged as a warning by the preprocessing, and not used.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDTreeLeafSize(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the maximal number of leaves of the KDTree checked when searching for the closest features
+ * to a query feature - spKDTreeMaxLeafChecks. 0 searches exactly; a positive number searches
+ * best-bin-first (see kNearestNeighboursBestBinFirst), which is faster and may miss some of the
+ * closest features - the fewer leaves are checked, the faster and the less accurate the search.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return non-negative integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDTreeMaxLeafChecks(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of randomized KDTrees built over the features - spKDTreeNumOfTrees.
+ * More than 1 builds a forest of randomized trees in the flat layout (see spKDTreeInitForest), which the
+ * best-bin-first search (spKDTreeMaxLeafChecks) searches together. A forest is not saved to the index file.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return positive integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetKDTreeNumOfTrees(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of subspaces of the product quantization index of the features - spPQNumOfSubspaces,
+ * the bytes kept for every feature. 0 builds no index; a positive number, at most spPCADimension, builds an
+ * index which is searched instead of the KDTree - faster, with approximate distances (see spPQRerankCandidates).
+ * No KDTree is built (see spKDTreeInitPQ), so spKDTreeNumOfTrees, spKDTreeMaxLeafChecks and the layout of the
+ * tree are not used, and without re-ranking the features are freed once they are encoded - only the
+ * spPQNumOfSubspaces bytes and the image index of every feature stay in memory. With re-ranking the features
+ * stay in memory, so the index saves no memory. An index file (spKDTreeIndexMode SAVE/LOAD) is the exception:
+ * the KDTree is built to be saved, or loaded, and the index is built over its features - a loaded tree keeps them
+ * in the mapped file, read only by re-ranking. The quantized features (spQuantizedFeatures) are a conflict
+ * (SP_CONFIG_CONFLICT) when the configuration is created.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return non-negative integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetPQNumOfSubspaces(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of the closest features by the product quantization index (spPQNumOfSubspaces)
+ * re-ranked by their exact distances - spPQRerankCandidates. 0 keeps the approximate distances of the index.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return non-negative integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetPQRerankCandidates(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns true if spQuantizedFeatures = true, false otherwise.
+ * If true, the features of a single flat KDTree are also kept as one byte per coordinate
+ * (see spKDTreeSetQuantized), and the leaves are scanned by these codes instead of the
+ * coordinates - an eighth of the memory read, with approximate distances (see spQuantizedRerankCandidates).
+ * Without re-ranking the features are freed once the codes are built (and the index file is saved - see
+ * spKDTreeReleaseFeatures), so only the codes, an eighth of the memory of the features, stay in memory.
+ * With re-ranking the features stay in memory next to the codes, so the memory grows by an eighth.
+ * The flat layout is turned on (see spConfigIsKDTreeFlatLayout), and a forest (spKDTreeNumOfTrees > 1) or the
+ * product quantization index (spPQNumOfSubspaces > 0) is a conflict (SP_CONFIG_CONFLICT) when the configuration
+ * is created.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return true if spQuantizedFeatures = true, false otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+bool spConfigIsQuantizedFeatures(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of the closest features by the quantized codes (spQuantizedFeatures)
+ * re-ranked by their exact distances - spQuantizedRerankCandidates. 0 keeps the approximate distances.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return non-negative integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetQuantizedRerankCandidates(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the maximal number of SIFT descriptors kept from fitting the PCA in extraction mode
+ * - spPCADescriptorCache. The features of the images whose descriptors are kept are extracted
+ * without reading and describing the images again; the rest are read and described again.
+ * 0 keeps no descriptors.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return non-negative integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetPCADescriptorCache(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the number of threads to use in the preprocessing and in batch mode - spNumOfThreads.
+ * 0 means one thread for every processor (see spParallelNumOfThreads).
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return non-negative integer in success, negative integer otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+int spConfigGetNumOfThreads(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns true if spKDTreeInPlaceBuild = true, false otherwise.
+ * The in-place build selects the median of every node in one permutation of the features,
+ * instead of splitting kd arrays (see spKDTreeInitFlatInPlace). Only used in the flat layout - true with the
+ * pointer layout is logged as a warning by the preprocessing, and not used.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return true if spKDTreeInPlaceBuild = true, false otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+bool spConfigIsKDTreeInPlaceBuild(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns true if spBPQueueHeap = true, false otherwise.
+ * The bounded priority queues of the kNN searches are binary max heaps, or sorted arrays
+ * if false (see spBPQueueSetImplementation). Both find exactly the same closest features.
+ * Queues of at most SP_BPQUEUE_SMALL_MAX elements (spKNN) are sorted arrays either way.
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return true if spBPQueueHeap = true, false otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+bool spConfigIsBPQueueHeap(const SPConfig config, SP_CONFIG_MSG* msg);
+
+/**
+ * Returns the use of the kd tree index file - spKDTreeIndexMode (see SPKDTreeIndex).
+ * REBUILD builds the kd tree on every run, SAVE builds it and saves it to the index file, and
+ * LOAD loads it from the index file - when not in extraction mode and the index matches the
+ * configuration - or else builds it and saves it. The index only holds a single tree of float64 features
+ * in the flat layout: SAVE and LOAD turn the flat layout on (see spConfigIsKDTreeFlatLayout), so the loaded
+ * tree is the tree the configuration builds, and the index is not used (with a warning) for a forest
+ * (spKDTreeNumOfTrees > 1) or float32 features (spFeaturesFloat32).
+ *
+ * @param config - the configuration structure
+ * @assert msg != NULL
+ * @param msg - pointer in which the msg returned by the function is stored
+ *
+ * @return the index mode in success, the default mode otherwise.
+ *
+ * The resulting value stored in msg is as follow:
+ * - SP_CONFIG_INVALID_ARGUMENT - if config == NULL
+ * - SP_CONFIG_SUCCESS - in case of success
+ */
+KD_INDEX_MODE spConfigGetKDTreeIndexMode(const SPConfig config, SP_CONFIG_MSG* msg);
+
 /**
  * Returns the number of images to hold in the queue - KNN
  *
@@ -259,6 +546,46 @@ SP_CONFIG_MSG spConfigGetFeaturesPath(char* featsPath, const SPConfig config,
  */
 SP_CONFIG_MSG spConfigGetPCAPath(char* pcaPath, const SPConfig config);
 
+/**
+ * The function stores in dbPath the full path of the feature database.
+ *
+ * For example given the values of:
+ *  spImagesDirectory = "./images/"
+ *  spFeaturesDBFilename = "features.db"
+ *
+ * The functions stores "./images/features.db" to the address given by dbPath.
+ * Thus the address given by dbPath must contain enough space to
+ * store the resulting string.
+ *
+ * @param dbPath - an address to store the result in, it must contain enough space.
+ * @param config - the configuration structure
+ *
+ * @return
+ *  - SP_CONFIG_INVALID_ARGUMENT - if dbPath == NULL or config == NULL
+ *  - SP_CONFIG_SUCCESS - in case of success
+ */
+SP_CONFIG_MSG spConfigGetFeaturesDBPath(char* dbPath, const SPConfig config);
+
+/**
+ * The function stores in indexPath the full path of the kd tree index file.
+ *
+ * For example given the values of:
+ *  spImagesDirectory = "./images/"
+ *  spKDTreeIndexFilename = "kdtree.index"
+ *
+ * The functions stores "./images/kdtree.index" to the address given by indexPath.
+ * Thus the address given by indexPath must contain enough space to
+ * store the resulting string.
+ *
+ * @param indexPath - an address to store the result in, it must contain enough space.
+ * @param config - the configuration structure
+ *
+ * @return
+ *  - SP_CONFIG_INVALID_ARGUMENT - if indexPath == NULL or config == NULL
+ *  - SP_CONFIG_SUCCESS - in case of success
+ */
+SP_CONFIG_MSG spConfigGetKDTreeIndexPath(char* indexPath, const SPConfig config);
+
 
 /*
  * Initiates the program logger (if not already initiated) based on
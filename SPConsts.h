@@ -11,6 +11,7 @@
 #define STR_LEN 1025
 #define CONFIG_DEFAULT_FILE "spcbir.config"
 #define QUERY_EXIT_STR "<>"
+#define BATCH_STDIN_STR "-" // batch mode - read the queries from the standard input
 
 // Configuration default values and constranits
 #define SP_CONFIG_DEFAULT_PCA_DIMENSIONS 20
@@ -18,11 +19,28 @@
 #define SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX 28
 #define SP_CONFIG_DEFAULT_PCA_FILENAME "pca.yml"
 #define SP_CONFIG_DEFAULT_NUM_OF_FEATURES 100
+#define SP_CONFIG_DEFAULT_PCA_DESCRIPTOR_CACHE 1048576 // 512MB of SIFT descriptors
 #define SP_CONFIG_DEFAULT_EXTRACTION_MODE true
+#define SP_CONFIG_DEFAULT_FEATURES_DB false
+#define SP_CONFIG_DEFAULT_FEATURES_DB_FILENAME "features.db"
+#define SP_CONFIG_DEFAULT_FEATURES_FLOAT32 false
 #define SP_CONFIG_DEFAULT_MINIMAL_GUI false
 #define SP_CONFIG_DEFAULT_NUM_OF_SIMILAR_IMAGES 1
 #define SP_CONFIG_DEFAULT_KNN 1
 #define SP_CONFIG_DEFAULT_KD_TREE_SPLIT_METHOD MAX_SPREAD
+#define SP_CONFIG_DEFAULT_KD_TREE_FLAT_LAYOUT false
+#define SP_CONFIG_DEFAULT_KD_TREE_LEAF_SIZE 1
+#define SP_CONFIG_DEFAULT_KD_TREE_IN_PLACE_BUILD false
+#define SP_CONFIG_DEFAULT_BPQUEUE_HEAP true
+#define SP_CONFIG_DEFAULT_KD_TREE_MAX_LEAF_CHECKS 0
+#define SP_CONFIG_DEFAULT_KD_TREE_NUM_OF_TREES 1
+#define SP_CONFIG_DEFAULT_PQ_NUM_OF_SUBSPACES 0
+#define SP_CONFIG_DEFAULT_PQ_RERANK_CANDIDATES 0
+#define SP_CONFIG_DEFAULT_QUANTIZED_FEATURES false
+#define SP_CONFIG_DEFAULT_QUANTIZED_RERANK_CANDIDATES 0
+#define SP_CONFIG_DEFAULT_NUM_OF_THREADS 0
+#define SP_CONFIG_DEFAULT_KD_TREE_INDEX_FILENAME "kdtree.index"
+#define SP_CONFIG_DEFAULT_KD_TREE_INDEX_MODE KD_INDEX_REBUILD
 #define SP_CONFIG_DEFAULT_LOGGER_LEVEL 3
 #define SP_CONFIG_CONSTRAINT_LOGGER_LEVEL_MIN 1
 #define SP_CONFIG_CONSTRAINT_LOGGER_LEVEL_MAX 4
@@ -30,11 +48,19 @@
 #define SP_CONFIG_CONSTRAINT_IMAGES_PREFIX_NUM 4
 #define SP_CONFIG_CONSTRAINT_IMAGES_PREFIX_VAL {".jpg",".png",".bmp",".gif"}
 #define SP_FEATURES_SUFFIX ".feats"
+#define SP_EXTRACTION_IMAGES_PER_THREAD 4 // the images extracted in parallel per thread, before they are saved in order
+#define SP_BATCH_QUERIES_PER_THREAD 16 // the queries answered in parallel per thread, before they are printed in order
+#define SP_SEARCH_FEATURES_PER_TASK 8 // the query features searched by one task of a query searched on several threads
+#define SP_KDTREE_FOREST_SPLIT_DIMENSIONS 5 // a node of a randomized tree is split by one of the dimensions of highest variance
+#define SP_KDTREE_BOUND_TOLERANCE 1e-10 // the relative rounding error of a subtree bound kept along the kNN search is far below it
 
 
 // Error / Info messages
 #define SP_CONFIG_INVAlID_LINE_MSG "Invalid configuration line"
 #define SP_CONFIG_INVAlID_VAL_MSG "Invalid value - constraint not met"
+#define SP_CONFIG_CONFLICT_FLAT_LAYOUT_MSG "spQuantizedFeatures and spKDTreeIndexMode SAVE/LOAD need spKDTreeFlatLayout = true"
+#define SP_CONFIG_CONFLICT_QUANTIZED_FOREST_MSG "spQuantizedFeatures needs spKDTreeNumOfTrees = 1"
+#define SP_CONFIG_CONFLICT_QUANTIZED_PQ_MSG "spQuantizedFeatures needs spPQNumOfSubspaces = 0"
 
 #define ERRORMSG_NULL_ARGS "NULL arguments passed"
 #define ERRORMSG_INVALID_ARGS "Invalid arguments passed"
@@ -43,8 +69,9 @@
 #define ERRORMSG_UNKOWN "Unknown error!"
 #define ERRORMSG_ALLOCATION "Allocation error"
 #define ERRORMSG_CONFIG_GET "Couldn't config parameter"
+#define WARNINGMSG_THREAD_CREATE "Could not create all the requested threads"
 
-#define ERRORMSG_INIT_USAGE "Invalid command line : use -c <config_filename>"
+#define ERRORMSG_INIT_USAGE "Invalid command line : use -c <config_filename> [-b <queries_filename> | -s <socket_filename>]"
 #define ERRORMSG_CONFIG_FILE "The configuration file %s could not be opened"
 #define ERRORMSG_CONFIG_DEFAULT "The default configuration file %s could not be opened"
 #define ERRORMSG_INIT_LOGGER "Failed initializing logger"
@@ -56,6 +83,9 @@
 #define ERRORMSG_FEATS_INDEX "Index %d out of range"
 #define ERRORMSG_FEATS_SAVE_OPEN "Could not open %s features file for writing"
 #define INFOMSG_FEATS_SAVE_SUCCESS "Successfully saved image %d features file"
+#define INFOMSG_FEATS_DB_LOAD_SUCCESS "Successfully loaded %d features from feature database %s"
+#define INFOMSG_FEATS_DB_SAVE_SUCCESS "Successfully saved %d features to feature database %s"
+#define ERRORMSG_FEATS_DB_GET "Failed loading feature database %s"
 #define DEBUGMSG_FEATS_EXPECTED_NOF "Expected number of features: %d"
 #define DEBUGMSG_FEATS_LOADED_NOF "Loaded number of features: %d"
 
@@ -63,13 +93,49 @@
 #define ERRORMSG_KDTREE_CREATE "Failed initializing features kd-tree"
 #define INFOMSG_START_PRE "Starting preprocessing"
 #define INFOMSG_DONE_PRE "Done preprocessing"
+#define INFOMSG_EXTRACTION "Extracting features of %d images on %d threads"
+#define INFOMSG_DISTANCE_KERNEL "Using %s distance kernel"
+#define INFOMSG_BPQUEUE_IMPL "Using %s bounded priority queues"
+#define INFOMSG_FEATURES_FLOAT32 "Keeping the features as floats"
+#define INFOMSG_KDTREE_FLAT "Building flat kd-tree with leaf size %d on %d threads"
+#define WARNINGMSG_KDTREE_FLAT_UNUSED "spKDTreeLeafSize and spKDTreeInPlaceBuild are not used - they need spKDTreeFlatLayout = true"
+#define INFOMSG_KDTREE_FOREST "Building a forest of %d randomized kd-trees with leaf size %d on %d threads"
+#define INFOMSG_KDTREE_APPROXIMATE "Searching the kd-tree best-bin-first, checking up to %d leaves per feature"
+#define INFOMSG_PQ_INDEX "Building a product quantization index of %d bytes per feature on %d threads"
+#define INFOMSG_PQ_INDEX_RERANK "Re-ranking the %d closest features of the product quantization index by their exact distances"
+#define INFOMSG_PQ_INDEX_ONLY "Building no kd-tree, only the product quantization index is searched"
+#define INFOMSG_PQ_INDEX_RELEASE "Freeing the features, only their product quantization codes are kept"
+#define ERRORMSG_PQ_INDEX_CREATE "Failed building the product quantization index"
+#define INFOMSG_QUANTIZED "Quantizing the features into one byte per coordinate"
+#define INFOMSG_QUANTIZED_RERANK "Re-ranking the %d closest features of the quantized codes by their exact distances"
+#define INFOMSG_QUANTIZED_RELEASE "Freeing the features, only their quantized codes are kept"
+#define ERRORMSG_QUANTIZED_CREATE "Failed quantizing the features"
+#define ERRORMSG_QUANTIZED_LAYOUT "Only a single kd-tree in the flat layout can be quantized"
+#define INFOMSG_KDTREE_INDEX_LOAD "Loaded kd-tree index %s"
+#define INFOMSG_KDTREE_INDEX_SAVE "Saved kd-tree index %s"
+#define WARNINGMSG_KDTREE_INDEX_LOAD "Could not load kd-tree index %s, building the kd-tree"
+#define WARNINGMSG_KDTREE_INDEX_SAVE "Could not save kd-tree index %s"
+#define WARNINGMSG_KDTREE_INDEX_UNUSED "The kd-tree index %s is not used - it holds a single kd-tree of float64 features in the flat layout"
+#define ERRORMSG_KDTREE_INDEX_LOAD_OPEN "Could not open %s kd-tree index file for reading"
+#define ERRORMSG_KDTREE_INDEX_LOAD_FRMT "Index file %s does not match the configuration or is damaged"
+#define ERRORMSG_KDTREE_INDEX_SAVE_OPEN "Could not write %s kd-tree index file"
 
 #define ERRORMSG_COLSEST_IMAGE_SEARCH "Failed searching for closest images"
+#define ERRORMSG_BATCH_OPEN "Could not open %s queries file for reading"
+#define INFOMSG_BATCH "Answering batch queries on %d threads"
+#define INFOMSG_BATCH_DONE "Answered %d batch queries, %d failed"
+#define ERRORMSG_QUERY_SERVER_LISTEN "Could not listen on query socket %s"
+#define ERRORMSG_QUERY_CLIENT_CONNECT "Could not connect to query socket %s"
+#define ERRORMSG_QUERY_FRAME "Query message too large"
+#define WARNINGMSG_QUERY_SERVER_ACCEPT "Could not accept a query connection, retrying"
+#define INFOMSG_QUERY_SERVER "Answering queries on socket %s with %d threads"
+#define INFOMSG_QUERY_SERVER_STOP "Stopped answering queries on socket %s"
 
 #define OUTPUTMSG_QUERY_PROCESS "Query image could not be processed\n"
 #define OUTPUTMSG_EXITING "Exiting...\n"
 #define OUTPUTMSG_QUERY "Please enter an image path:\n"
 #define OUTPUTMSG_NON_MINIMAL_GUI "Best candidates for - %s - are:\n"
+#define OUTPUTMSG_BATCH_FAILED "ERROR"
 
 
 #endif /* SPCONSTS_H_ */
@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include "SPDistance.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SP_DISTANCE_X86
+#include <immintrin.h>
+#endif
+
+// The distances must be rounded the same way in every kernel and build, so a multiplication
+// followed by an addition must not be fused into one instruction (FMA)
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+// Number of partial sums kept by every kernel (see the summary in SPDistance.h)
+#define SP_DISTANCE_LANES 8
+// Number of partial sums kept by every float kernel - twice as many floats fit in a register
+#define SP_DISTANCE_FLOAT_LANES 16
+
+typedef double (*SPDistanceFunc)(const double* a, const double* b, int dim);
+typedef void (*SPDistanceBatchFunc)(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances);
+typedef double (*SPDistanceFloatFunc)(const float* a, const float* b, int dim);
+typedef void (*SPDistanceBatchFloatFunc)(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances);
+typedef void (*SPDistanceBatchCodeFunc)(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances);
+
+/*
+ * Adds the eight partial sums pairwise. All the kernels end with this reduction.
+ */
+static inline double spDistanceReduce(const double* lanes) {
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+			((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+/*
+ * Adds the sixteen partial sums of a float kernel pairwise. All the float kernels end with this reduction.
+ */
+static inline double spDistanceReduceFloat(const float* lanes) {
+	return (((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]))) +
+			(((lanes[8] + lanes[9]) + (lanes[10] + lanes[11])) + ((lanes[12] + lanes[13]) + (lanes[14] + lanes[15])));
+}
+
+/*** Scalar kernel - the reference for the vectorized kernels ***/
+
+static inline double spDistanceL2SquaredScalar(const double* a, const double* b, int dim) {
+	double lanes[SP_DISTANCE_LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+	for (int i=0; i<dim; i++)
+		lanes[i % SP_DISTANCE_LANES] += (a[i] - b[i])*(a[i] - b[i]);
+	return spDistanceReduce(lanes);
+}
+
+static void spDistanceL2SquaredBatchScalar(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredScalar(query, rows + (size_t) i * stride, dim);
+}
+
+static inline double spDistanceL2SquaredFloatScalar(const float* a, const float* b, int dim) {
+	float lanes[SP_DISTANCE_FLOAT_LANES] = {0};
+	for (int i=0; i<dim; i++)
+		lanes[i % SP_DISTANCE_FLOAT_LANES] += (a[i] - b[i])*(a[i] - b[i]);
+	return spDistanceReduceFloat(lanes);
+}
+
+static void spDistanceL2SquaredBatchFloatScalar(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredFloatScalar(query, rows + (size_t) i * stride, dim);
+}
+
+static void spDistanceL2SquaredBatchCodeScalar(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int r=0; r<numOfRows; r++) {
+		const unsigned char* row = rows + (size_t) r * stride;
+		long long sum = 0;
+		for (int i=0; i<dim; i++) {
+			int diff = query[i] - scales[i] * row[i];
+			sum += diff * diff;
+		}
+		distances[r] = (double) sum;
+	}
+}
+
+#ifdef SP_DISTANCE_X86
+
+/*
+ * The vectorized kernels run over the padded length. The padding coordinates add (0-0)^2 = +0
+ * to their partial sums, which leaves them unchanged, so the results match the scalar kernel.
+ * The padded length is a multiple of 4, so the last block is either 8 or 4 coordinates long
+ * (and 12, 8 or 4 coordinates long in the float kernels).
+ */
+
+/*** SSE2 kernel - four registers of two partial sums ***/
+
+__attribute__((target("sse2")))
+static inline double spDistanceL2SquaredSSE2(const double* a, const double* b, int dim) {
+	int padded = spDistancePaddedDim(dim), i = 0;
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	__m128d acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd();
+	for (; i + SP_DISTANCE_LANES <= padded; i += SP_DISTANCE_LANES) {
+		__m128d d0 = _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+		__m128d d1 = _mm_sub_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2));
+		__m128d d2 = _mm_sub_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4));
+		__m128d d3 = _mm_sub_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6));
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+		acc2 = _mm_add_pd(acc2, _mm_mul_pd(d2, d2));
+		acc3 = _mm_add_pd(acc3, _mm_mul_pd(d3, d3));
+	}
+	if (i < padded) { // last block of 4
+		__m128d d0 = _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+		__m128d d1 = _mm_sub_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2));
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+	}
+	double lanes[SP_DISTANCE_LANES];
+	_mm_storeu_pd(lanes, acc0);
+	_mm_storeu_pd(lanes + 2, acc1);
+	_mm_storeu_pd(lanes + 4, acc2);
+	_mm_storeu_pd(lanes + 6, acc3);
+	return spDistanceReduce(lanes);
+}
+
+__attribute__((target("sse2")))
+static void spDistanceL2SquaredBatchSSE2(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredSSE2(query, rows + (size_t) i * stride, dim);
+}
+
+__attribute__((target("sse2")))
+static inline double spDistanceL2SquaredFloatSSE2(const float* a, const float* b, int dim) {
+	int padded = spDistancePaddedDim(dim), i = 0;
+	__m128 acc[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+	for (; i + SP_DISTANCE_FLOAT_LANES <= padded; i += SP_DISTANCE_FLOAT_LANES) {
+		for (int j=0; j<4; j++) {
+			__m128 d = _mm_sub_ps(_mm_loadu_ps(a + i + 4*j), _mm_loadu_ps(b + i + 4*j));
+			acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(d, d));
+		}
+	}
+	for (int j=0; i<padded; i += 4, j++) { // last blocks of 4
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(d, d));
+	}
+	float lanes[SP_DISTANCE_FLOAT_LANES];
+	for (int j=0; j<4; j++)
+		_mm_storeu_ps(lanes + 4*j, acc[j]);
+	return spDistanceReduceFloat(lanes);
+}
+
+__attribute__((target("sse2")))
+static void spDistanceL2SquaredBatchFloatSSE2(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredFloatSSE2(query, rows + (size_t) i * stride, dim);
+}
+
+/*
+ * Sums the integer partial sums of a code kernel. Every partial sum is of at most
+ * SP_DISTANCE_CODE_MAX_DIM/4 squares of at most 4095^2, so it fits in an int.
+ */
+static inline double spDistanceReduceCode(const int* lanes, int numOfLanes) {
+	long long sum = 0;
+	for (int i=0; i<numOfLanes; i++)
+		sum += lanes[i];
+	return (double) sum;
+}
+
+__attribute__((target("sse2")))
+static inline double spDistanceL2SquaredCodeSSE2(const short* query, const short* scales, const unsigned char* row, int dim) {
+	int padded = spDistancePaddedCodeDim(dim);
+	__m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+	for (int i = 0; i < padded; i += SP_DISTANCE_CODE_PAD) {
+		__m128i codes = _mm_loadu_si128((const __m128i*) (row + i));
+		__m128i s0 = _mm_mullo_epi16(_mm_unpacklo_epi8(codes, zero), _mm_loadu_si128((const __m128i*) (scales + i)));
+		__m128i s1 = _mm_mullo_epi16(_mm_unpackhi_epi8(codes, zero), _mm_loadu_si128((const __m128i*) (scales + i + 8)));
+		__m128i d0 = _mm_sub_epi16(_mm_loadu_si128((const __m128i*) (query + i)), s0);
+		__m128i d1 = _mm_sub_epi16(_mm_loadu_si128((const __m128i*) (query + i + 8)), s1);
+		acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(d0, d0), _mm_madd_epi16(d1, d1)));
+	}
+	int lanes[4];
+	_mm_storeu_si128((__m128i*) lanes, acc);
+	return spDistanceReduceCode(lanes, 4);
+}
+
+__attribute__((target("sse2")))
+static void spDistanceL2SquaredBatchCodeSSE2(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredCodeSSE2(query, scales, rows + (size_t) i * stride, dim);
+}
+
+/*** AVX2 kernel - two registers of four partial sums ***/
+
+__attribute__((target("avx2")))
+static inline double spDistanceL2SquaredAVX2(const double* a, const double* b, int dim) {
+	int padded = spDistancePaddedDim(dim), i = 0;
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	for (; i + SP_DISTANCE_LANES <= padded; i += SP_DISTANCE_LANES) {
+		__m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+		__m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(d0, d0));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(d1, d1));
+	}
+	if (i < padded) { // last block of 4
+		__m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(d0, d0));
+	}
+	double lanes[SP_DISTANCE_LANES];
+	_mm256_storeu_pd(lanes, acc0);
+	_mm256_storeu_pd(lanes + 4, acc1);
+	return spDistanceReduce(lanes);
+}
+
+__attribute__((target("avx2")))
+static void spDistanceL2SquaredBatchAVX2(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredAVX2(query, rows + (size_t) i * stride, dim);
+}
+
+__attribute__((target("avx2")))
+static inline double spDistanceL2SquaredFloatAVX2(const float* a, const float* b, int dim) {
+	int padded = spDistancePaddedDim(dim), i = 0;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	for (; i + SP_DISTANCE_FLOAT_LANES <= padded; i += SP_DISTANCE_FLOAT_LANES) {
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(d1, d1));
+	}
+	if (i + 8 <= padded) { // last block of 8
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+		i += 8;
+	}
+	float lanes[SP_DISTANCE_FLOAT_LANES];
+	_mm256_storeu_ps(lanes, acc0);
+	_mm256_storeu_ps(lanes + 8, acc1);
+	if (i < padded) { // last block of 4, added to the partial sums it belongs to
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		float* part = lanes + i % SP_DISTANCE_FLOAT_LANES;
+		_mm_storeu_ps(part, _mm_add_ps(_mm_loadu_ps(part), _mm_mul_ps(d, d)));
+	}
+	return spDistanceReduceFloat(lanes);
+}
+
+__attribute__((target("avx2")))
+static void spDistanceL2SquaredBatchFloatAVX2(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredFloatAVX2(query, rows + (size_t) i * stride, dim);
+}
+
+__attribute__((target("avx2")))
+static inline double spDistanceL2SquaredCodeAVX2(const short* query, const short* scales, const unsigned char* row, int dim) {
+	int padded = spDistancePaddedCodeDim(dim);
+	__m256i acc = _mm256_setzero_si256();
+	for (int i = 0; i < padded; i += SP_DISTANCE_CODE_PAD) {
+		__m256i codes = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (row + i))),
+				_mm256_loadu_si256((const __m256i*) (scales + i)));
+		__m256i d = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*) (query + i)), codes);
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+	}
+	int lanes[8];
+	_mm256_storeu_si256((__m256i*) lanes, acc);
+	return spDistanceReduceCode(lanes, 8);
+}
+
+__attribute__((target("avx2")))
+static void spDistanceL2SquaredBatchCodeAVX2(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredCodeAVX2(query, scales, rows + (size_t) i * stride, dim);
+}
+
+/*** AVX-512 kernel - one register of eight partial sums ***/
+
+__attribute__((target("avx512f")))
+static inline double spDistanceL2SquaredAVX512(const double* a, const double* b, int dim) {
+	int padded = spDistancePaddedDim(dim), i = 0;
+	__m512d acc = _mm512_setzero_pd();
+	for (; i + SP_DISTANCE_LANES <= padded; i += SP_DISTANCE_LANES) {
+		__m512d d = _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+		acc = _mm512_add_pd(acc, _mm512_mul_pd(d, d));
+	}
+	if (i < padded) { // last block of 4 - the masked lanes are not read
+		__m512d d = _mm512_sub_pd(_mm512_maskz_loadu_pd(0x0F, a + i), _mm512_maskz_loadu_pd(0x0F, b + i));
+		acc = _mm512_add_pd(acc, _mm512_mul_pd(d, d));
+	}
+	double lanes[SP_DISTANCE_LANES];
+	_mm512_storeu_pd(lanes, acc);
+	return spDistanceReduce(lanes);
+}
+
+__attribute__((target("avx512f")))
+static void spDistanceL2SquaredBatchAVX512(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredAVX512(query, rows + (size_t) i * stride, dim);
+}
+
+__attribute__((target("avx512f")))
+static inline double spDistanceL2SquaredFloatAVX512(const float* a, const float* b, int dim) {
+	int padded = spDistancePaddedDim(dim), i = 0;
+	__m512 acc = _mm512_setzero_ps();
+	for (; i + SP_DISTANCE_FLOAT_LANES <= padded; i += SP_DISTANCE_FLOAT_LANES) {
+		__m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+		acc = _mm512_add_ps(acc, _mm512_mul_ps(d, d));
+	}
+	if (i < padded) { // last block of 12, 8 or 4 - the masked lanes are not read
+		__mmask16 mask = (__mmask16) ((1u << (padded - i)) - 1);
+		__m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+		acc = _mm512_add_ps(acc, _mm512_mul_ps(d, d));
+	}
+	float lanes[SP_DISTANCE_FLOAT_LANES];
+	_mm512_storeu_ps(lanes, acc);
+	return spDistanceReduceFloat(lanes);
+}
+
+__attribute__((target("avx512f")))
+static void spDistanceL2SquaredBatchFloatAVX512(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredFloatAVX512(query, rows + (size_t) i * stride, dim);
+}
+
+/*** AVX-512 VNNI code kernel - the squares are multiplied and added in one instruction (vpdpwssd) ***/
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static inline double spDistanceL2SquaredCodeVNNI(const short* query, const short* scales, const unsigned char* row, int dim) {
+	int padded = spDistancePaddedCodeDim(dim), i = 0;
+	__m512i acc = _mm512_setzero_si512();
+	for (; i + 2 * SP_DISTANCE_CODE_PAD <= padded; i += 2 * SP_DISTANCE_CODE_PAD) {
+		__m512i codes = _mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*) (row + i))),
+				_mm512_loadu_si512((const void*) (scales + i)));
+		__m512i d = _mm512_sub_epi16(_mm512_loadu_si512((const void*) (query + i)), codes);
+		acc = _mm512_dpwssd_epi32(acc, d, d);
+	}
+	if (i < padded) { // last block of 16, in the lower half of the register
+		__m256i codes = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (row + i))),
+				_mm256_loadu_si256((const __m256i*) (scales + i)));
+		__m256i d = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*) (query + i)), codes);
+		__m512i d512 = _mm512_zextsi256_si512(d);
+		acc = _mm512_dpwssd_epi32(acc, d512, d512);
+	}
+	int lanes[16];
+	_mm512_storeu_si512((void*) lanes, acc);
+	return spDistanceReduceCode(lanes, 16);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void spDistanceL2SquaredBatchCodeVNNI(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	for (int i=0; i<numOfRows; i++)
+		distances[i] = spDistanceL2SquaredCodeVNNI(query, scales, rows + (size_t) i * stride, dim);
+}
+
+/*
+ * The AVX-512 kernel uses the VNNI code kernel if the processor has AVX-512 VNNI, otherwise the AVX2 one.
+ */
+static bool spDistanceHasVNNI() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+}
+
+#endif /* SP_DISTANCE_X86 */
+
+/*** Non inline entry points of the kernels ***/
+
+static double spDistanceScalarEntry(const double* a, const double* b, int dim) {
+	return spDistanceL2SquaredScalar(a, b, dim);
+}
+
+static double spDistanceFloatScalarEntry(const float* a, const float* b, int dim) {
+	return spDistanceL2SquaredFloatScalar(a, b, dim);
+}
+
+#ifdef SP_DISTANCE_X86
+__attribute__((target("sse2")))
+static double spDistanceSSE2Entry(const double* a, const double* b, int dim) {
+	return spDistanceL2SquaredSSE2(a, b, dim);
+}
+
+__attribute__((target("sse2")))
+static double spDistanceFloatSSE2Entry(const float* a, const float* b, int dim) {
+	return spDistanceL2SquaredFloatSSE2(a, b, dim);
+}
+
+__attribute__((target("avx2")))
+static double spDistanceAVX2Entry(const double* a, const double* b, int dim) {
+	return spDistanceL2SquaredAVX2(a, b, dim);
+}
+
+__attribute__((target("avx2")))
+static double spDistanceFloatAVX2Entry(const float* a, const float* b, int dim) {
+	return spDistanceL2SquaredFloatAVX2(a, b, dim);
+}
+
+__attribute__((target("avx512f")))
+static double spDistanceAVX512Entry(const double* a, const double* b, int dim) {
+	return spDistanceL2SquaredAVX512(a, b, dim);
+}
+
+__attribute__((target("avx512f")))
+static double spDistanceFloatAVX512Entry(const float* a, const float* b, int dim) {
+	return spDistanceL2SquaredFloatAVX512(a, b, dim);
+}
+#endif
+
+/*** Dispatch ***/
+
+static double spDistanceResolve(const double* a, const double* b, int dim);
+static void spDistanceBatchResolve(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances);
+static double spDistanceFloatResolve(const float* a, const float* b, int dim);
+static void spDistanceBatchFloatResolve(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances);
+static void spDistanceBatchCodeResolve(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances);
+
+// The selected kernel. Until a kernel is selected these point to functions selecting one.
+// The selection may happen while other threads calculate distances, so the pointers are read
+// and written atomically (all the kernels return the same distances, so either one will do).
+static SP_DISTANCE_KERNEL spDistanceKernel = SP_DISTANCE_SCALAR;
+static SPDistanceFunc spDistanceFunc = spDistanceResolve;
+static SPDistanceBatchFunc spDistanceBatchFunc = spDistanceBatchResolve;
+static SPDistanceFloatFunc spDistanceFloatFunc = spDistanceFloatResolve;
+static SPDistanceBatchFloatFunc spDistanceBatchFloatFunc = spDistanceBatchFloatResolve;
+static SPDistanceBatchCodeFunc spDistanceBatchCodeFunc = spDistanceBatchCodeResolve;
+// Selects the best kernel the first time a distance is calculated, unless one was selected before
+static pthread_once_t spDistanceOnce = PTHREAD_ONCE_INIT;
+
+#define SP_DISTANCE_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define SP_DISTANCE_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+
+/*
+ * @return the best kernel supported by the processor
+ */
+static SP_DISTANCE_KERNEL spDistanceBestKernel() {
+	if (spDistanceIsSupported(SP_DISTANCE_AVX512))
+		return SP_DISTANCE_AVX512;
+	if (spDistanceIsSupported(SP_DISTANCE_AVX2))
+		return SP_DISTANCE_AVX2;
+	if (spDistanceIsSupported(SP_DISTANCE_SSE2))
+		return SP_DISTANCE_SSE2;
+	return SP_DISTANCE_SCALAR;
+}
+
+/*
+ * Points the dispatch pointers at the functions of a supported kernel.
+ */
+static void spDistanceAssign(SP_DISTANCE_KERNEL kernel) {
+	switch (kernel) {
+#ifdef SP_DISTANCE_X86
+	case SP_DISTANCE_SSE2:
+		SP_DISTANCE_STORE(spDistanceFunc, spDistanceSSE2Entry);
+		SP_DISTANCE_STORE(spDistanceBatchFunc, spDistanceL2SquaredBatchSSE2);
+		SP_DISTANCE_STORE(spDistanceFloatFunc, spDistanceFloatSSE2Entry);
+		SP_DISTANCE_STORE(spDistanceBatchFloatFunc, spDistanceL2SquaredBatchFloatSSE2);
+		SP_DISTANCE_STORE(spDistanceBatchCodeFunc, spDistanceL2SquaredBatchCodeSSE2);
+		break;
+	case SP_DISTANCE_AVX2:
+		SP_DISTANCE_STORE(spDistanceFunc, spDistanceAVX2Entry);
+		SP_DISTANCE_STORE(spDistanceBatchFunc, spDistanceL2SquaredBatchAVX2);
+		SP_DISTANCE_STORE(spDistanceFloatFunc, spDistanceFloatAVX2Entry);
+		SP_DISTANCE_STORE(spDistanceBatchFloatFunc, spDistanceL2SquaredBatchFloatAVX2);
+		SP_DISTANCE_STORE(spDistanceBatchCodeFunc, spDistanceL2SquaredBatchCodeAVX2);
+		break;
+	case SP_DISTANCE_AVX512:
+		SP_DISTANCE_STORE(spDistanceFunc, spDistanceAVX512Entry);
+		SP_DISTANCE_STORE(spDistanceBatchFunc, spDistanceL2SquaredBatchAVX512);
+		SP_DISTANCE_STORE(spDistanceFloatFunc, spDistanceFloatAVX512Entry);
+		SP_DISTANCE_STORE(spDistanceBatchFloatFunc, spDistanceL2SquaredBatchFloatAVX512);
+		SP_DISTANCE_STORE(spDistanceBatchCodeFunc,
+				spDistanceHasVNNI() ? spDistanceL2SquaredBatchCodeVNNI : spDistanceL2SquaredBatchCodeAVX2);
+		break;
+#endif
+	default:
+		SP_DISTANCE_STORE(spDistanceFunc, spDistanceScalarEntry);
+		SP_DISTANCE_STORE(spDistanceBatchFunc, spDistanceL2SquaredBatchScalar);
+		SP_DISTANCE_STORE(spDistanceFloatFunc, spDistanceFloatScalarEntry);
+		SP_DISTANCE_STORE(spDistanceBatchFloatFunc, spDistanceL2SquaredBatchFloatScalar);
+		SP_DISTANCE_STORE(spDistanceBatchCodeFunc, spDistanceL2SquaredBatchCodeScalar);
+		break;
+	}
+	SP_DISTANCE_STORE(spDistanceKernel, kernel);
+}
+
+static void spDistanceSelectBest() {
+	spDistanceAssign(spDistanceBestKernel());
+}
+
+static double spDistanceResolve(const double* a, const double* b, int dim) {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest);
+	return SP_DISTANCE_LOAD(spDistanceFunc)(a, b, dim);
+}
+
+static void spDistanceBatchResolve(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest);
+	SP_DISTANCE_LOAD(spDistanceBatchFunc)(query, rows, stride, numOfRows, dim, distances);
+}
+
+static double spDistanceFloatResolve(const float* a, const float* b, int dim) {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest);
+	return SP_DISTANCE_LOAD(spDistanceFloatFunc)(a, b, dim);
+}
+
+static void spDistanceBatchFloatResolve(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest);
+	SP_DISTANCE_LOAD(spDistanceBatchFloatFunc)(query, rows, stride, numOfRows, dim, distances);
+}
+
+static void spDistanceBatchCodeResolve(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest);
+	SP_DISTANCE_LOAD(spDistanceBatchCodeFunc)(query, scales, rows, stride, numOfRows, dim, distances);
+}
+
+SP_DISTANCE_KERNEL spDistanceInit() {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest); // a later first distance selects nothing again
+	SP_DISTANCE_KERNEL kernel = spDistanceBestKernel();
+	spDistanceAssign(kernel);
+	return kernel;
+}
+
+bool spDistanceIsSupported(SP_DISTANCE_KERNEL kernel) {
+	switch (kernel) {
+	case SP_DISTANCE_SCALAR:
+		return true;
+#ifdef SP_DISTANCE_X86
+	case SP_DISTANCE_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	case SP_DISTANCE_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	case SP_DISTANCE_AVX512:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return false;
+	}
+}
+
+bool spDistanceSetKernel(SP_DISTANCE_KERNEL kernel) {
+	if (!spDistanceIsSupported(kernel))
+		return false;
+	pthread_once(&spDistanceOnce, spDistanceSelectBest); // so the first distance doesn't override the selection
+	spDistanceAssign(kernel);
+	return true;
+}
+
+SP_DISTANCE_KERNEL spDistanceGetKernel() {
+	pthread_once(&spDistanceOnce, spDistanceSelectBest);
+	return SP_DISTANCE_LOAD(spDistanceKernel);
+}
+
+const char* spDistanceKernelName(SP_DISTANCE_KERNEL kernel) {
+	switch (kernel) {
+	case SP_DISTANCE_SSE2:
+		return "SSE2";
+	case SP_DISTANCE_AVX2:
+		return "AVX2";
+	case SP_DISTANCE_AVX512:
+		return "AVX-512";
+	default:
+		return "scalar";
+	}
+}
+
+int spDistancePaddedDim(int dim) {
+	return ((dim + SP_DISTANCE_PAD - 1) / SP_DISTANCE_PAD) * SP_DISTANCE_PAD;
+}
+
+double spDistanceL2Squared(const double* a, const double* b, int dim) {
+	assert(a != NULL && b != NULL && dim > 0);
+	return SP_DISTANCE_LOAD(spDistanceFunc)(a, b, dim);
+}
+
+void spDistanceL2SquaredBatch(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	assert(query != NULL && rows != NULL && distances != NULL);
+	assert(stride >= spDistancePaddedDim(dim));
+	SP_DISTANCE_LOAD(spDistanceBatchFunc)(query, rows, stride, numOfRows, dim, distances);
+}
+
+double spDistanceL2SquaredFloat(const float* a, const float* b, int dim) {
+	assert(a != NULL && b != NULL && dim > 0);
+	return SP_DISTANCE_LOAD(spDistanceFloatFunc)(a, b, dim);
+}
+
+void spDistanceL2SquaredBatchFloat(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	assert(query != NULL && rows != NULL && distances != NULL);
+	assert(stride >= spDistancePaddedDim(dim));
+	SP_DISTANCE_LOAD(spDistanceBatchFloatFunc)(query, rows, stride, numOfRows, dim, distances);
+}
+
+int spDistancePaddedCodeDim(int dim) {
+	return ((dim + SP_DISTANCE_CODE_PAD - 1) / SP_DISTANCE_CODE_PAD) * SP_DISTANCE_CODE_PAD;
+}
+
+void spDistanceL2SquaredBatchCode(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances) {
+	assert(query != NULL && scales != NULL && rows != NULL && distances != NULL);
+	assert(dim <= SP_DISTANCE_CODE_MAX_DIM && stride >= spDistancePaddedCodeDim(dim));
+	SP_DISTANCE_LOAD(spDistanceBatchCodeFunc)(query, scales, rows, stride, numOfRows, dim, distances);
+}
@@ -0,0 +1,201 @@
+#ifndef SPDISTANCE_H_
+#define SPDISTANCE_H_
+
+#include <stdbool.h>
+
+/**
+ * SPDistance Summary
+ * Squared L2 distance kernels over raw coordinate arrays.
+ * Several implementations (kernels) are available - a portable scalar one and SSE2, AVX2 and AVX-512
+ * ones on x86 processors. The best kernel supported by the processor is selected the first time a
+ * distance is calculated (or when spDistanceInit is called), and can be overridden by spDistanceSetKernel.
+ * The first selection happens once even if several threads calculate their first distances together, and
+ * a selection may change while other threads calculate distances - all the kernels return the same results.
+ *
+ * All the kernels sum the squared differences in the same order: coordinate i is added to
+ * partial sum i%8, and the eight partial sums are added pairwise. Therefore all the kernels,
+ * including the scalar one, return bit-exact results.
+ *
+ * Every kernel also has a float variant for float32 coordinates (SPFeatureStore rows of precision
+ * SP_FEATURE_STORE_FLOAT32). It keeps sixteen float partial sums - coordinate i is added to partial
+ * sum i%16 - which are added pairwise in float and returned as a double, so the float variants
+ * are bit-exact among themselves too. With at most a few terms per partial sum the float rounding
+ * error stays far below the differences between the distances of SIFT features.
+ *
+ * The code variant of every kernel is for scalar-quantized coordinates (SPQuantizedStore rows): the
+ * rows are unsigned bytes, every dimension has an integer scale (the width of its codes in query codes)
+ * and the query is 16-bit integers, so the squared differences between the query and the scaled rows are
+ * summed in integers (pmullw and pmaddwd, and vpdpwssd on processors with AVX-512 VNNI) and every kernel
+ * returns the exact sum. The scales must be at most SP_DISTANCE_CODE_SCALE_MAX and the query codes between
+ * SP_DISTANCE_CODE_QUERY_MIN and SP_DISTANCE_CODE_QUERY_MAX, which keeps the differences in 16 bits and
+ * the integer partial sums from overflowing for up to SP_DISTANCE_CODE_MAX_DIM coordinates.
+ *
+ * The arrays passed to the kernels must hold spDistancePaddedDim(dim) coordinates, where the
+ * coordinates after the first dim are zeros (this is the layout of SPFeatureStore rows).
+ *
+ * The following functions are supported:
+ *
+ * spDistanceInit             - Selects the best kernel supported by the processor.
+ * spDistanceIsSupported      - Checks if a kernel is supported by the processor.
+ * spDistanceSetKernel        - Selects a given kernel.
+ * spDistanceGetKernel        - A getter of the selected kernel.
+ * spDistanceKernelName       - A getter of the name of a kernel.
+ * spDistancePaddedDim        - Calculates the padded length of an array of a given dimension.
+ * spDistanceL2Squared        - Calculates the L2 squared distance between two arrays.
+ * spDistanceL2SquaredBatch   - Calculates the L2 squared distances between an array and consecutive rows.
+ * spDistanceL2SquaredFloat   - Calculates the L2 squared distance between two float arrays.
+ * spDistanceL2SquaredBatchFloat - Calculates the L2 squared distances between a float array and consecutive rows.
+ * spDistancePaddedCodeDim    - Calculates the padded length of an array of codes of a given dimension.
+ * spDistanceL2SquaredBatchCode - Calculates the L2 squared distances between a query code and consecutive scaled code rows.
+ *
+ */
+
+/** The arrays are padded to a multiple of this number of coordinates **/
+#define SP_DISTANCE_PAD 4
+/** The arrays of codes are padded to a multiple of this number of coordinates **/
+#define SP_DISTANCE_CODE_PAD 16
+/** The maximal scale of a dimension of the rows - a scaled row code is at most 255 * SP_DISTANCE_CODE_SCALE_MAX **/
+#define SP_DISTANCE_CODE_SCALE_MAX 8
+/** The range of the coordinates of a query code **/
+#define SP_DISTANCE_CODE_QUERY_MIN -2048
+#define SP_DISTANCE_CODE_QUERY_MAX 4095
+/** The maximal dimension of the codes **/
+#define SP_DISTANCE_CODE_MAX_DIM 512
+
+/** The available distance kernels **/
+typedef enum sp_distance_kernel_t {
+	SP_DISTANCE_SCALAR,
+	SP_DISTANCE_SSE2,
+	SP_DISTANCE_AVX2,
+	SP_DISTANCE_AVX512
+} SP_DISTANCE_KERNEL;
+
+/**
+ * Detects the instruction sets supported by the processor (cpuid) and selects
+ * the fastest supported kernel.
+ *
+ * @return The selected kernel
+ */
+SP_DISTANCE_KERNEL spDistanceInit();
+
+/**
+ * Checks if a kernel can run on this processor and was compiled in.
+ *
+ * @param kernel - the kernel to check
+ * @return true if the kernel is supported, false otherwise
+ */
+bool spDistanceIsSupported(SP_DISTANCE_KERNEL kernel);
+
+/**
+ * Selects the kernel used by spDistanceL2Squared and spDistanceL2SquaredBatch (and their float variants).
+ *
+ * @param kernel - the kernel to use
+ * @return false if the kernel is not supported (the selection is unchanged), true otherwise
+ */
+bool spDistanceSetKernel(SP_DISTANCE_KERNEL kernel);
+
+/**
+ * A getter of the selected kernel. Selects the best kernel if none was selected yet.
+ *
+ * @return The selected kernel
+ */
+SP_DISTANCE_KERNEL spDistanceGetKernel();
+
+/**
+ * A getter of a printable name of a kernel.
+ *
+ * @param kernel - the kernel
+ * @return The name of the kernel ("scalar", "SSE2", "AVX2" or "AVX-512")
+ */
+const char* spDistanceKernelName(SP_DISTANCE_KERNEL kernel);
+
+/**
+ * Calculates the padded length of an array of dim coordinates - dim rounded up
+ * to a multiple of SP_DISTANCE_PAD.
+ *
+ * @param dim - the dimension
+ * @return The padded length
+ */
+int spDistancePaddedDim(int dim);
+
+/**
+ * Calculates the L2-squared distance between a and b using the selected kernel.
+ *
+ * @param a - the first array
+ * @param b - the second array
+ * @param dim - the dimension of the arrays
+ * @assert a and b hold spDistancePaddedDim(dim) coordinates, zero padded
+ * @return The L2-squared distance between a and b
+ */
+double spDistanceL2Squared(const double* a, const double* b, int dim);
+
+/**
+ * Calculates the L2-squared distances between query and numOfRows consecutive rows,
+ * row i starting at rows + i*stride, using the selected kernel.
+ * The results are identical to calling spDistanceL2Squared on each row.
+ *
+ * @param query - the query array
+ * @param rows - the first row
+ * @param stride - the distance between consecutive rows (at least spDistancePaddedDim(dim))
+ * @param numOfRows - the number of rows
+ * @param dim - the dimension of the query and the rows
+ * @param distances - output array, distances[i] is set to the distance of row i
+ * @assert query and all rows hold spDistancePaddedDim(dim) coordinates, zero padded
+ */
+void spDistanceL2SquaredBatch(const double* query, const double* rows, int stride,
+		int numOfRows, int dim, double* distances);
+
+/**
+ * Calculates the L2-squared distance between the float arrays a and b using the float variant
+ * of the selected kernel.
+ *
+ * @param a - the first array
+ * @param b - the second array
+ * @param dim - the dimension of the arrays
+ * @assert a and b hold spDistancePaddedDim(dim) coordinates, zero padded
+ * @return The L2-squared distance between a and b, summed in float
+ */
+double spDistanceL2SquaredFloat(const float* a, const float* b, int dim);
+
+/**
+ * Calculates the L2-squared distances between the float query and numOfRows consecutive float rows,
+ * like spDistanceL2SquaredBatch. The results are identical to calling spDistanceL2SquaredFloat on each row.
+ *
+ * @param query - the query array
+ * @param rows - the first row
+ * @param stride - the distance between consecutive rows (at least spDistancePaddedDim(dim))
+ * @param numOfRows - the number of rows
+ * @param dim - the dimension of the query and the rows
+ * @param distances - output array, distances[i] is set to the distance of row i
+ * @assert query and all rows hold spDistancePaddedDim(dim) coordinates, zero padded
+ */
+void spDistanceL2SquaredBatchFloat(const float* query, const float* rows, int stride,
+		int numOfRows, int dim, double* distances);
+
+/**
+ * Calculates the padded length of an array of dim codes - dim rounded up to a multiple of SP_DISTANCE_CODE_PAD.
+ *
+ * @param dim - the dimension
+ * @return The padded length
+ */
+int spDistancePaddedCodeDim(int dim);
+
+/**
+ * Calculates the L2-squared distances between the query code and numOfRows consecutive rows of codes,
+ * row i starting at rows + i*stride, using the code variant of the selected kernel - the sum of
+ * (query[j] - scales[j]*row[j])^2. The squared differences are summed in integers, so the results are exact
+ * and identical in every kernel.
+ *
+ * @param query - the query code, every coordinate between SP_DISTANCE_CODE_QUERY_MIN and SP_DISTANCE_CODE_QUERY_MAX
+ * @param scales - the scale of every dimension, between 0 and SP_DISTANCE_CODE_SCALE_MAX
+ * @param rows - the first row
+ * @param stride - the distance between consecutive rows (at least spDistancePaddedCodeDim(dim))
+ * @param numOfRows - the number of rows
+ * @param dim - the dimension of the query and the rows, at most SP_DISTANCE_CODE_MAX_DIM
+ * @param distances - output array, distances[i] is set to the distance of row i
+ * @assert query, scales and all rows hold spDistancePaddedCodeDim(dim) coordinates, the query and the rows zero padded
+ */
+void spDistanceL2SquaredBatchCode(const short* query, const short* scales, const unsigned char* rows, int stride,
+		int numOfRows, int dim, double* distances);
+
+#endif /* SPDISTANCE_H_ */
@@ -0,0 +1,381 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdbool.h>
+#include "SPPoint.h"
+#include "SPFeatureStore.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+// Number of rows allocated when an empty store first grows
+#define SP_FEATURE_STORE_MIN_CAPACITY 64
+
+struct sp_feature_store_t {
+	void* block;	// The allocated block (data or floatData points into it, aligned)
+	double* data;	// The coordinates of a float64 store - row i starts at data + i*stride
+	float* floatData; // The coordinates of a float32 store - row i starts at floatData + i*stride
+	int* indices;	// indices[i] is the image index of row i
+	int dim;		// The dimension of each row
+	int stride;		// dim rounded up to a multiple of SP_FEATURE_STORE_ROW_PAD
+	int size;		// The number of rows in use
+	int capacity;	// The number of allocated rows
+	bool isView;	// True if data and indices are memory the store does not own (read-only)
+	SP_FEATURE_STORE_PRECISION precision; // The type of the coordinates
+};
+
+/*
+ * Allocates room for numOfValues coordinates of the precision aligned to SP_FEATURE_STORE_ALIGNMENT.
+ * The pointer to free is returned in block.
+ */
+static void* spFeatureStoreAlignedAlloc(size_t numOfValues, SP_FEATURE_STORE_PRECISION precision, void** block) {
+	size_t valueSize = precision == SP_FEATURE_STORE_FLOAT32 ? sizeof(float) : sizeof(double);
+	*block = malloc(numOfValues * valueSize + SP_FEATURE_STORE_ALIGNMENT);
+	if (*block == NULL)
+		return NULL;
+	uintptr_t addr = (uintptr_t) *block;
+	addr = (addr + SP_FEATURE_STORE_ALIGNMENT - 1) & ~((uintptr_t) SP_FEATURE_STORE_ALIGNMENT - 1);
+	return (void*) addr;
+}
+
+/*
+ * The size in bytes of a padded row of the store.
+ */
+static size_t spFeatureStoreRowSize(const SPFeatureStore* store) {
+	return (size_t) store->stride * (store->precision == SP_FEATURE_STORE_FLOAT32 ? sizeof(float) : sizeof(double));
+}
+
+/*
+ * A pointer to the first coordinate of a row, whatever the precision.
+ */
+static unsigned char* spFeatureStoreRowBytes(const SPFeatureStore* store, int row) {
+	unsigned char* rows = store->precision == SP_FEATURE_STORE_FLOAT32 ?
+			(unsigned char*) store->floatData : (unsigned char*) store->data;
+	return rows + (size_t) row * spFeatureStoreRowSize(store);
+}
+
+SPFeatureStore* spFeatureStoreCreate(int dim, int capacity) {
+	return spFeatureStoreCreateWithPrecision(dim, capacity, SP_FEATURE_STORE_FLOAT64);
+}
+
+SPFeatureStore* spFeatureStoreCreateWithPrecision(int dim, int capacity, SP_FEATURE_STORE_PRECISION precision) {
+	if (dim <= 0 || capacity < 0 ||
+			(precision != SP_FEATURE_STORE_FLOAT64 && precision != SP_FEATURE_STORE_FLOAT32)) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	SPFeatureStore* store = (SPFeatureStore*) malloc(sizeof(*store));
+	if (store == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	store->block = NULL;
+	store->data = NULL;
+	store->floatData = NULL;
+	store->indices = NULL;
+	store->dim = dim;
+	store->stride = spDistancePaddedDim(dim);
+	store->size = 0;
+	store->capacity = 0;
+	store->isView = false;
+	store->precision = precision;
+	if (capacity > 0 && spFeatureStoreReserve(store, capacity) == -1) {
+		spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	return store;
+}
+
+SPFeatureStore* spFeatureStoreCreateFromPoints(SPPoint*** mat, int numOfImages, int* numOfFeatures) {
+	int totalSize = 0, dim = 0;
+	if (mat != NULL && numOfFeatures != NULL) {
+		for (int i=0; i<numOfImages; i++) { // Count the features and find their dimension
+			totalSize += numOfFeatures[i];
+			if (dim == 0 && numOfFeatures[i] > 0 && mat[i] != NULL && mat[i][0] != NULL)
+				dim = spPointGetDimension(mat[i][0]);
+		}
+	}
+	if (totalSize < 1 || dim < 1) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+
+	SPFeatureStore* store = spFeatureStoreCreate(dim, totalSize);
+	if (store == NULL)
+		return NULL;
+	for (int i=0; i<numOfImages; i++) {
+		for (int j=0; j<numOfFeatures[i]; j++) {
+			if (mat[i] == NULL || spFeatureStoreAppendPoint(store, mat[i][j]) == -1) {
+				spFeatureStoreDestroy(store);
+				return NULL;
+			}
+		}
+	}
+	return store;
+}
+
+SPFeatureStore* spFeatureStoreCreateView(int dim, int size, const double* data, const int* indices) {
+	if (dim <= 0 || size < 0 || data == NULL || indices == NULL ||
+			(uintptr_t) data % SP_FEATURE_STORE_ALIGNMENT != 0) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	SPFeatureStore* store = spFeatureStoreCreate(dim, 0);
+	if (store == NULL)
+		return NULL;
+	store->data = (double*) data; // never written, all the functions writing rows fail on a view
+	store->indices = (int*) indices;
+	store->size = size;
+	store->capacity = size;
+	store->isView = true;
+	return store;
+}
+
+void spFeatureStoreDestroy(SPFeatureStore* store) {
+	if (store != NULL) {
+		if (!store->isView) {
+			free(store->block);
+			free(store->indices);
+		}
+		free(store);
+	}
+}
+
+int spFeatureStoreReserve(SPFeatureStore* store, int capacity) {
+	if (store == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (capacity <= store->capacity)
+		return 0;
+	if (store->isView || (store->block == NULL && store->size > 0)) { // a view, or released coordinates
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// allocate new block and copy the rows in use (padding included)
+	void* block = NULL;
+	void* data = spFeatureStoreAlignedAlloc((size_t) capacity * store->stride, store->precision, &block);
+	int* indices = (int*) malloc(capacity * sizeof(int));
+	if (data == NULL || indices == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(block);
+		free(indices);
+		return -1;
+	}
+	if (store->size > 0) {
+		memcpy(data, spFeatureStoreRowBytes(store, 0), (size_t) store->size * spFeatureStoreRowSize(store));
+		memcpy(indices, store->indices, store->size * sizeof(int));
+	}
+	free(store->block);
+	free(store->indices);
+	store->block = block;
+	if (store->precision == SP_FEATURE_STORE_FLOAT32)
+		store->floatData = (float*) data;
+	else
+		store->data = (double*) data;
+	store->indices = indices;
+	store->capacity = capacity;
+	return 0;
+}
+
+int spFeatureStoreAppend(SPFeatureStore* store, const double* data, int index) {
+	if (store == NULL || data == NULL || index < 0) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (store->size == store->capacity) { // grow geometrically
+		int capacity = store->capacity * 2;
+		if (capacity < SP_FEATURE_STORE_MIN_CAPACITY)
+			capacity = SP_FEATURE_STORE_MIN_CAPACITY;
+		if (spFeatureStoreReserve(store, capacity) == -1)
+			return -1;
+	}
+	if (store->precision == SP_FEATURE_STORE_FLOAT32) {
+		float* row = store->floatData + (size_t) store->size * store->stride;
+		for (int i=0; i<store->dim; i++)
+			row[i] = (float) data[i];
+		for (int i=store->dim; i<store->stride; i++)
+			row[i] = 0; // padding
+	}
+	else {
+		double* row = store->data + (size_t) store->size * store->stride;
+		for (int i=0; i<store->dim; i++)
+			row[i] = data[i];
+		for (int i=store->dim; i<store->stride; i++)
+			row[i] = 0; // padding
+	}
+	store->indices[store->size] = index;
+	return store->size++;
+}
+
+int spFeatureStoreAppendPoint(SPFeatureStore* store, SPPoint* point) {
+	if (store == NULL || point == NULL || spPointGetDimension(point) != store->dim) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	return spFeatureStoreAppend(store, spPointGetData(point), spPointGetIndex(point));
+}
+
+int spFeatureStoreGetDimension(SPFeatureStore* store) {
+	if (store == NULL)
+		return 0;
+	return store->dim;
+}
+
+int spFeatureStoreGetStride(SPFeatureStore* store) {
+	if (store == NULL)
+		return 0;
+	return store->stride;
+}
+
+int spFeatureStoreGetSize(SPFeatureStore* store) {
+	if (store == NULL)
+		return 0;
+	return store->size;
+}
+
+SP_FEATURE_STORE_PRECISION spFeatureStoreGetPrecision(SPFeatureStore* store) {
+	if (store == NULL)
+		return SP_FEATURE_STORE_FLOAT64;
+	return store->precision;
+}
+
+const double* spFeatureStoreGetRow(SPFeatureStore* store, int row) {
+	assert(store != NULL && store->precision == SP_FEATURE_STORE_FLOAT64);
+	assert(row >= 0 && row < store->size);
+	return store->data + (size_t) row * store->stride;
+}
+
+const double* spFeatureStoreGetData(SPFeatureStore* store) {
+	if (store == NULL)
+		return NULL;
+	return store->data;
+}
+
+const float* spFeatureStoreGetRowFloat(SPFeatureStore* store, int row) {
+	assert(store != NULL && store->precision == SP_FEATURE_STORE_FLOAT32);
+	assert(row >= 0 && row < store->size);
+	return store->floatData + (size_t) row * store->stride;
+}
+
+const float* spFeatureStoreGetDataFloat(SPFeatureStore* store) {
+	if (store == NULL)
+		return NULL;
+	return store->floatData;
+}
+
+void spFeatureStoreCopyRow(SPFeatureStore* store, int row, double* data) {
+	assert(store != NULL && data != NULL);
+	assert(row >= 0 && row < store->size);
+	for (int i=0; i<store->dim; i++)
+		data[i] = spFeatureStoreGetAxisCoor(store, row, i);
+}
+
+const int* spFeatureStoreGetIndices(SPFeatureStore* store) {
+	if (store == NULL)
+		return NULL;
+	return store->indices;
+}
+
+int spFeatureStoreGetIndex(SPFeatureStore* store, int row) {
+	assert(store != NULL);
+	assert(row >= 0 && row < store->size);
+	return store->indices[row];
+}
+
+double spFeatureStoreGetAxisCoor(SPFeatureStore* store, int row, int axis) {
+	assert(store != NULL);
+	assert(row >= 0 && row < store->size);
+	assert(axis >= 0 && axis < store->dim);
+	if (store->precision == SP_FEATURE_STORE_FLOAT32)
+		return store->floatData[(size_t) row * store->stride + axis];
+	return store->data[(size_t) row * store->stride + axis];
+}
+
+double spFeatureStoreL2SquaredDistance(SPFeatureStore* store, int row, const double* query) {
+	assert(store != NULL && query != NULL);
+	assert(row >= 0 && row < store->size);
+	if (store->precision == SP_FEATURE_STORE_FLOAT32) {
+		float floatQuery[store->stride]; // the query rounded like the rows
+		for (int i=0; i<store->stride; i++)
+			floatQuery[i] = (float) query[i];
+		return spDistanceL2SquaredFloat(floatQuery, store->floatData + (size_t) row * store->stride, store->dim);
+	}
+	return spDistanceL2Squared(query, store->data + (size_t) row * store->stride, store->dim);
+}
+
+void spFeatureStoreL2SquaredDistances(SPFeatureStore* store, int firstRow, int numOfRows,
+		const double* query, double* distances) {
+	assert(store != NULL && query != NULL && distances != NULL);
+	assert(firstRow >= 0 && numOfRows >= 0 && firstRow + numOfRows <= store->size);
+	if (store->precision == SP_FEATURE_STORE_FLOAT32) {
+		float floatQuery[store->stride]; // the query rounded like the rows
+		for (int i=0; i<store->stride; i++)
+			floatQuery[i] = (float) query[i];
+		spDistanceL2SquaredBatchFloat(floatQuery, store->floatData + (size_t) firstRow * store->stride, store->stride,
+				numOfRows, store->dim, distances);
+		return;
+	}
+	spDistanceL2SquaredBatch(query, store->data + (size_t) firstRow * store->stride, store->stride,
+			numOfRows, store->dim, distances);
+}
+
+int spFeatureStoreReorder(SPFeatureStore* store, int* order) {
+	if (store == NULL || order == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (store->isView || (store->block == NULL && store->size > 0)) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	size_t rowSize = spFeatureStoreRowSize(store);
+	void* saved = malloc(rowSize);
+	if (saved == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	for (int start=0; start<store->size; start++) {
+		if (order[start] == start)
+			continue;
+		// save the first row of the cycle, pull every row of the cycle from its source, and close the cycle
+		int savedIndex = store->indices[start];
+		memcpy(saved, spFeatureStoreRowBytes(store, start), rowSize);
+		int curr = start;
+		while (order[curr] != start) {
+			int src = order[curr];
+			assert(src >= 0 && src < store->size);
+			memcpy(spFeatureStoreRowBytes(store, curr), spFeatureStoreRowBytes(store, src), rowSize);
+			store->indices[curr] = store->indices[src];
+			order[curr] = curr;
+			curr = src;
+		}
+		memcpy(spFeatureStoreRowBytes(store, curr), saved, rowSize);
+		store->indices[curr] = savedIndex;
+		order[curr] = curr;
+	}
+	free(saved);
+	return 0;
+}
+
+int spFeatureStoreReleaseData(SPFeatureStore* store) {
+	if (store == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (store->isView) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	free(store->block);
+	store->block = NULL;
+	store->data = NULL;
+	store->floatData = NULL;
+	store->capacity = store->size; // rows can't be appended without the block
+	return 0;
+}
+
+bool spFeatureStoreIsReleased(SPFeatureStore* store) {
+	return store != NULL && !store->isView && store->block == NULL && store->size > 0;
+}
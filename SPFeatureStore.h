@@ -0,0 +1,330 @@
+#ifndef SPFEATURESTORE_H_
+#define SPFEATURESTORE_H_
+
+#include <stdbool.h>
+#include "SPPoint.h"
+#include "SPDistance.h"
+
+/**
+ * SPFeatureStore Summary
+ * Holds the features of all the database images in one contiguous block of doubles, or of floats
+ * for a store of precision SP_FEATURE_STORE_FLOAT32 (half the memory and bandwidth, the coordinates
+ * rounded to float and the distances calculated by the float SPDistance kernels).
+ * Each feature is a row of the block (row-major order). Rows are padded with zeros to a multiple
+ * of SP_FEATURE_STORE_ROW_PAD coordinates and the block is aligned to SP_FEATURE_STORE_ALIGNMENT
+ * bytes, so every row starts on an aligned address.
+ * A parallel array holds the index of the image each row belongs to.
+ * Rows are referred to by their row id, a number from 0 to size-1.
+ *
+ * The following functions are supported:
+ *
+ * spFeatureStoreCreate           - Creates a new empty feature store.
+ * spFeatureStoreCreateWithPrecision - Creates a new empty feature store of a given precision.
+ * spFeatureStoreCreateFromPoints - Creates a feature store holding copies of a matrix of points.
+ * spFeatureStoreCreateView       - Creates a read-only feature store over rows kept elsewhere (e.g. a mapped file).
+ * spFeatureStoreDestroy          - Frees all memory of a feature store.
+ * spFeatureStoreReserve          - Makes sure the store can hold a given number of rows.
+ * spFeatureStoreAppend           - Appends a new row to the store.
+ * spFeatureStoreAppendPoint      - Appends a copy of a point as a new row.
+ * spFeatureStoreGetDimension     - A getter of the dimension of the rows.
+ * spFeatureStoreGetStride        - A getter of the padded length of a row.
+ * spFeatureStoreGetSize          - A getter of the number of rows.
+ * spFeatureStoreGetPrecision     - A getter of the type of the coordinates.
+ * spFeatureStoreGetRow           - A getter of the coordinates of a row (float64 stores).
+ * spFeatureStoreGetData          - A getter of the coordinates block (float64 stores).
+ * spFeatureStoreGetRowFloat      - A getter of the coordinates of a row (float32 stores).
+ * spFeatureStoreGetDataFloat     - A getter of the coordinates block (float32 stores).
+ * spFeatureStoreCopyRow          - Copies the coordinates of a row as doubles.
+ * spFeatureStoreGetIndices       - A getter of the image indices of all rows.
+ * spFeatureStoreGetIndex         - A getter of the image index of a row.
+ * spFeatureStoreGetAxisCoor      - A getter of a given coordinate of a row.
+ * spFeatureStoreL2SquaredDistance - Calculates the L2 squared distance between a row and a query.
+ * spFeatureStoreL2SquaredDistances - Calculates the L2 squared distances between consecutive rows and a query.
+ * spFeatureStoreReorder          - Reorders the rows of the store in place.
+ * spFeatureStoreReleaseData      - Frees the coordinates of the rows, keeping their image indices.
+ * spFeatureStoreIsReleased       - Checks if the coordinates of the rows were freed.
+ *
+ */
+
+/** Alignment (in bytes) of the coordinates block **/
+#define SP_FEATURE_STORE_ALIGNMENT 64
+/** Rows are padded to a multiple of this number of coordinates **/
+#define SP_FEATURE_STORE_ROW_PAD SP_DISTANCE_PAD
+
+/** Type for defining the feature store **/
+typedef struct sp_feature_store_t SPFeatureStore;
+
+/** The type of the coordinates of a store **/
+typedef enum sp_feature_store_precision_t {
+	SP_FEATURE_STORE_FLOAT64,
+	SP_FEATURE_STORE_FLOAT32
+} SP_FEATURE_STORE_PRECISION;
+
+/**
+ * Allocates a new empty feature store of precision SP_FEATURE_STORE_FLOAT64.
+ *
+ * @param dim - the dimension of the features
+ * @param capacity - the number of rows to allocate in advance (may be 0)
+ *
+ * @return NULL in case of allocation failure OR dim <= 0 OR capacity < 0
+ * Otherwise, the new feature store is returned
+ */
+SPFeatureStore* spFeatureStoreCreate(int dim, int capacity);
+
+/**
+ * Allocates a new empty feature store whose coordinates are of the given precision.
+ * The coordinates of the rows appended to a SP_FEATURE_STORE_FLOAT32 store are rounded to float.
+ *
+ * @param dim - the dimension of the features
+ * @param capacity - the number of rows to allocate in advance (may be 0)
+ * @param precision - the type of the coordinates
+ *
+ * @return NULL in case of allocation failure OR dim <= 0 OR capacity < 0 OR precision is invalid
+ * Otherwise, the new feature store is returned
+ */
+SPFeatureStore* spFeatureStoreCreateWithPrecision(int dim, int capacity, SP_FEATURE_STORE_PRECISION precision);
+
+/**
+ * Allocates a new feature store holding copies of all the points in mat.
+ * There are numOfImages images, and the image with index i has numOfFeatures[i] points,
+ * mat[i][0] ... mat[i][numOfFeatures[i]-1]. The rows are ordered image after image.
+ * The points are not freed or kept by the store.
+ *
+ * @param mat - the array of the arrays of pointers of the features
+ * @param numOfImages - the number of images
+ * @param numOfFeatures - the array containing the number of features of each image
+ *
+ * @return NULL in case of allocation failure OR invalid input (missing points, different dimensions, no points)
+ * Otherwise, the new feature store is returned
+ */
+SPFeatureStore* spFeatureStoreCreateFromPoints(SPPoint*** mat, int numOfImages, int* numOfFeatures);
+
+/**
+ * Creates a read-only float64 feature store over size rows that are kept in memory the store does not own
+ * (for example a memory-mapped index file). data must be laid out like the block of a store of
+ * dimension dim - size rows of spDistancePaddedDim(dim) coordinates, aligned to SP_FEATURE_STORE_ALIGNMENT
+ * bytes - and indices must hold the size image indices. The memory must outlive the store, and is not
+ * freed by spFeatureStoreDestroy. Rows can't be appended to a view, and it can't be reordered.
+ *
+ * @param dim - the dimension of the rows
+ * @param size - the number of rows
+ * @param data - the padded coordinates of the rows
+ * @param indices - the image indices of the rows
+ *
+ * @return NULL in case of allocation failure OR dim <= 0 OR size < 0 OR data or indices are NULL
+ * OR data is not aligned. Otherwise, the new feature store is returned
+ */
+SPFeatureStore* spFeatureStoreCreateView(int dim, int size, const double* data, const int* indices);
+
+/**
+ * Frees all memory of the feature store. If store is NULL nothing happens.
+ *
+ * @param store - the feature store
+ */
+void spFeatureStoreDestroy(SPFeatureStore* store);
+
+/**
+ * Makes sure the store can hold at least capacity rows without further allocation.
+ *
+ * @param store - the feature store
+ * @param capacity - the requested number of rows
+ *
+ * @return -1 in case of allocation failure OR store is NULL, 0 otherwise
+ */
+int spFeatureStoreReserve(SPFeatureStore* store, int capacity);
+
+/**
+ * Appends a new row to the store, copying dim coordinates from data.
+ * The store grows as needed.
+ *
+ * @param store - the feature store
+ * @param data - the coordinates of the new row
+ * @param index - the index of the image the row belongs to
+ *
+ * @return -1 in case of allocation failure OR invalid arguments
+ * Otherwise, the row id of the new row
+ */
+int spFeatureStoreAppend(SPFeatureStore* store, const double* data, int index);
+
+/**
+ * Appends a copy of the point as a new row. The point is not kept by the store.
+ *
+ * @param store - the feature store
+ * @param point - the point to copy
+ *
+ * @return -1 in case of allocation failure OR invalid arguments (including a dimension mismatch)
+ * Otherwise, the row id of the new row
+ */
+int spFeatureStoreAppendPoint(SPFeatureStore* store, SPPoint* point);
+
+/**
+ * A getter for the dimension of the rows.
+ *
+ * @param store - the feature store
+ * @return The dimension, 0 if store is NULL
+ */
+int spFeatureStoreGetDimension(SPFeatureStore* store);
+
+/**
+ * A getter for the padded length of a row (the distance between two consecutive rows).
+ *
+ * @param store - the feature store
+ * @return The stride, 0 if store is NULL
+ */
+int spFeatureStoreGetStride(SPFeatureStore* store);
+
+/**
+ * A getter for the number of rows in the store.
+ *
+ * @param store - the feature store
+ * @return The number of rows, 0 if store is NULL
+ */
+int spFeatureStoreGetSize(SPFeatureStore* store);
+
+/**
+ * A getter for the type of the coordinates of the store.
+ *
+ * @param store - the feature store
+ * @return The precision, SP_FEATURE_STORE_FLOAT64 if store is NULL
+ */
+SP_FEATURE_STORE_PRECISION spFeatureStoreGetPrecision(SPFeatureStore* store);
+
+/**
+ * A getter for the coordinates of a row of a float64 store.
+ * The pointer stays valid until the store grows or is destroyed.
+ *
+ * @param store - the feature store
+ * @param row - the row id
+ * @assert store != NULL && 0 <= row < size && the precision is SP_FEATURE_STORE_FLOAT64
+ * @return A pointer to the stride coordinates of the row
+ */
+const double* spFeatureStoreGetRow(SPFeatureStore* store, int row);
+
+/**
+ * A getter for the coordinates block of a float64 store - row i starts at spFeatureStoreGetData(store) + i*stride.
+ * The pointer stays valid until the store grows or is destroyed.
+ *
+ * @param store - the feature store
+ * @return A pointer to the first row, NULL if store is NULL or its precision is SP_FEATURE_STORE_FLOAT32
+ */
+const double* spFeatureStoreGetData(SPFeatureStore* store);
+
+/**
+ * A getter for the coordinates of a row of a float32 store.
+ * The pointer stays valid until the store grows or is destroyed.
+ *
+ * @param store - the feature store
+ * @param row - the row id
+ * @assert store != NULL && 0 <= row < size && the precision is SP_FEATURE_STORE_FLOAT32
+ * @return A pointer to the stride coordinates of the row
+ */
+const float* spFeatureStoreGetRowFloat(SPFeatureStore* store, int row);
+
+/**
+ * A getter for the coordinates block of a float32 store - row i starts at spFeatureStoreGetDataFloat(store) + i*stride.
+ * The pointer stays valid until the store grows or is destroyed.
+ *
+ * @param store - the feature store
+ * @return A pointer to the first row, NULL if store is NULL or its precision is SP_FEATURE_STORE_FLOAT64
+ */
+const float* spFeatureStoreGetDataFloat(SPFeatureStore* store);
+
+/**
+ * Copies the dim coordinates of a row to data as doubles, whatever the precision of the store.
+ *
+ * @param store - the feature store
+ * @param row - the row id
+ * @param data - output array of dim doubles
+ * @assert store != NULL && data != NULL && 0 <= row < size
+ */
+void spFeatureStoreCopyRow(SPFeatureStore* store, int row, double* data);
+
+/**
+ * A getter for the image indices of all rows - element i is the image index of row i.
+ * The pointer stays valid until the store grows or is destroyed.
+ *
+ * @param store - the feature store
+ * @return A pointer to the size indices, NULL if store is NULL
+ */
+const int* spFeatureStoreGetIndices(SPFeatureStore* store);
+
+/**
+ * A getter for the index of the image a row belongs to.
+ *
+ * @param store - the feature store
+ * @param row - the row id
+ * @assert store != NULL && 0 <= row < size
+ * @return The image index of the row
+ */
+int spFeatureStoreGetIndex(SPFeatureStore* store, int row);
+
+/**
+ * A getter for a specific coordinate of a row.
+ *
+ * @param store - the feature store
+ * @param row - the row id
+ * @param axis - the coordinate to retrieve
+ * @assert store != NULL && 0 <= row < size && 0 <= axis < dim
+ * @return The value of the coordinate
+ */
+double spFeatureStoreGetAxisCoor(SPFeatureStore* store, int row, int axis);
+
+/**
+ * Calculates the L2-squared distance between a row and a query using the selected SPDistance kernel.
+ * The query must be laid out like a row of a float64 store - stride coordinates, where the coordinates
+ * after the first dim are zeros. A float32 store rounds the query to float and uses the float kernel.
+ *
+ * @param store - the feature store
+ * @param row - the row id
+ * @param query - the padded query coordinates
+ * @assert store != NULL && query != NULL && 0 <= row < size
+ * @return The L2-squared distance between the query and the row
+ */
+double spFeatureStoreL2SquaredDistance(SPFeatureStore* store, int row, const double* query);
+
+/**
+ * Calculates the L2-squared distances between a query and the rows firstRow ... firstRow+numOfRows-1
+ * using the selected SPDistance kernel. The query must be padded as in spFeatureStoreL2SquaredDistance.
+ *
+ * @param store - the feature store
+ * @param firstRow - the row id of the first row
+ * @param numOfRows - the number of rows
+ * @param query - the padded query coordinates
+ * @param distances - output array, distances[i] is set to the distance of row firstRow+i
+ * @assert store != NULL && query != NULL && distances != NULL && 0 <= firstRow <= firstRow+numOfRows <= size
+ */
+void spFeatureStoreL2SquaredDistances(SPFeatureStore* store, int firstRow, int numOfRows,
+		const double* query, double* distances);
+
+/**
+ * Reorders the rows of the store (coordinates and image indices) in place, so that the new row i
+ * is the old row order[i]. The rows are moved along the cycles of the permutation, so only one row
+ * of extra memory is allocated.
+ * order is used as scratch space - when the function returns, order[i] == i for every i.
+ *
+ * @param store - the feature store
+ * @param order - a permutation of 0 ... size-1
+ * @return -1 in case of allocation failure OR store or order are NULL, otherwise 0
+ */
+int spFeatureStoreReorder(SPFeatureStore* store, int* order);
+
+/**
+ * Frees the coordinates block of the store, keeping the dimension, the size and the image indices of the rows -
+ * for a store whose rows are only searched by a compressed copy (see spKDTreeInitPQ). Afterwards the getters of
+ * the coordinates return NULL, the functions reading coordinates must not be called, and rows can't be appended
+ * or reordered. A view is not changed.
+ *
+ * @param store - the feature store
+ * @return -1 in case store is NULL or a view, otherwise 0
+ */
+int spFeatureStoreReleaseData(SPFeatureStore* store);
+
+/**
+ * Checks if the coordinates of the rows of the store were freed (see spFeatureStoreReleaseData).
+ *
+ * @param store - the feature store
+ * @return true if store is not NULL, has rows and its coordinates were freed, otherwise false
+ */
+bool spFeatureStoreIsReleased(SPFeatureStore* store);
+
+#endif /* SPFEATURESTORE_H_ */
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "SPConfig.h"
+#include "SPLogger.h"
+#include "SPFeatureStore.h"
+#include "SPFeaturesFile.h"
+#include "SPConsts.h"
+
+/*
+ * Converts the features files of all the images (<prefix><i>.feats, text or binary)
+ * into one feature database (spFeaturesDBFilename), so SPCBIR can run with spFeaturesDB = true.
+ *
+ * Usage: SPFeaturesConvert [-c <config_filename>]
+ */
+int main(int argc, char* argv[]) {
+	// same arguments as SPCBIR
+	if ((argc != 1) && !(argc == 3 && strcmp(argv[1],"-c") == 0)) {
+		printf("%s\n", ERRORMSG_INIT_USAGE);
+		return -1;
+	}
+	const char* configFile = argc == 1 ? CONFIG_DEFAULT_FILE : argv[2];
+	SP_CONFIG_MSG configMsg;
+	SPConfig config = spConfigCreate(configFile, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		printf(argc == 1 ? ERRORMSG_CONFIG_DEFAULT "\n" : ERRORMSG_CONFIG_FILE "\n", configFile);
+		spConfigDestroy(config);
+		return -1;
+	}
+	SP_LOGGER_MSG loggerMsg;
+	if (spConfigInitLogger(config, &loggerMsg) != SP_CONFIG_SUCCESS || loggerMsg != SP_LOGGER_SUCCESS) {
+		printf("%s\n", ERRORMSG_INIT_LOGGER);
+		spConfigDestroy(config);
+		spLoggerDestroy();
+		return -1;
+	}
+
+	// load the features files of all the images
+	int numOfImages = spConfigGetNumOfImages(config, &configMsg);
+	SPFeatureStore* store = spFeatureStoreCreate(spConfigGetPCADim(config, &configMsg),
+			numOfImages * spConfigGetNumOfFeatures(config, &configMsg));
+	char path[STR_LEN];
+	char msg[2 * STR_LEN]; // room for a path and a message
+	int failed = store == NULL;
+	for (int i=0; !failed && i<numOfImages; i++) {
+		failed = spConfigGetFeaturesPath(path, config, i) != SP_CONFIG_SUCCESS ||
+				spFeaturesFileLoad(path, store, i) == -1;
+		if (failed) {
+			sprintf(msg, ERRORMSG_FEATS_GET, i);
+			spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		}
+	}
+
+	// write the feature database
+	if (!failed) {
+		spConfigGetFeaturesDBPath(path, config);
+		failed = spFeaturesFileSaveDB(path, store, numOfImages, SP_FEATURES_FLOAT64) == -1;
+		if (!failed) {
+			sprintf(msg, INFOMSG_FEATS_DB_SAVE_SUCCESS, spFeatureStoreGetSize(store), path);
+			spLoggerPrintInfo(msg);
+		}
+	}
+
+	spFeatureStoreDestroy(store);
+	spConfigDestroy(config);
+	spLoggerDestroy();
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "SPPoint.h"
+#include "SPFeatureStore.h"
+#include "SPFeaturesFile.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+#define SP_FEATURES_FILE_MAGIC "SPFEATS"
+#define SP_FEATURES_FILE_HEADER_SIZE 24 // magic[8], version, dtype, dim, count
+#define SP_FEATURES_DB_MAGIC "SPFTSDB"
+#define SP_FEATURES_DB_HEADER_SIZE 32 // magic[8], version, dtype, dim, numOfImages, numOfFeatures (64 bit)
+#define SP_FEATURES_DB_CHUNK_ROWS 4096 // the number of rows read or written at once
+
+/*
+ * Little-endian encoding and decoding, independent of the byte order of the machine.
+ * (On little-endian machines the compiler turns these into plain loads and stores.)
+ */
+static void spFeaturesFilePutU32(unsigned char* bytes, uint32_t value) {
+	for (int k=0; k<4; k++)
+		bytes[k] = (unsigned char) (value >> (8*k));
+}
+
+static uint32_t spFeaturesFileGetU32(const unsigned char* bytes) {
+	uint32_t value = 0;
+	for (int k=0; k<4; k++)
+		value |= (uint32_t) bytes[k] << (8*k);
+	return value;
+}
+
+static void spFeaturesFilePutU64(unsigned char* bytes, uint64_t value) {
+	for (int k=0; k<8; k++)
+		bytes[k] = (unsigned char) (value >> (8*k));
+}
+
+static uint64_t spFeaturesFileGetU64(const unsigned char* bytes) {
+	uint64_t value = 0;
+	for (int k=0; k<8; k++)
+		value |= (uint64_t) bytes[k] << (8*k);
+	return value;
+}
+
+/*
+ * The number of bytes of a coordinate of the data type (0 for an unknown type).
+ */
+static size_t spFeaturesFileElementSize(uint32_t dtype) {
+	switch (dtype) {
+	case SP_FEATURES_FLOAT64:
+		return sizeof(uint64_t);
+	case SP_FEATURES_FLOAT32:
+		return sizeof(uint32_t);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Encodes the dim coordinates of a row in the data type, and returns the position after them.
+ */
+static unsigned char* spFeaturesFileEncodeRow(unsigned char* curr, const double* data, int dim, uint32_t dtype) {
+	for (int j=0; j<dim; j++) {
+		if (dtype == SP_FEATURES_FLOAT64) {
+			uint64_t bits;
+			memcpy(&bits, data + j, sizeof(bits));
+			spFeaturesFilePutU64(curr, bits);
+			curr += sizeof(bits);
+		}
+		else {
+			float value = (float) data[j];
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			spFeaturesFilePutU32(curr, bits);
+			curr += sizeof(bits);
+		}
+	}
+	return curr;
+}
+
+/*
+ * Decodes the dim coordinates of a row from the data type, and returns the position after them.
+ */
+static const unsigned char* spFeaturesFileDecodeRow(double* row, const unsigned char* curr, int dim, uint32_t dtype) {
+	for (int j=0; j<dim; j++) {
+		if (dtype == SP_FEATURES_FLOAT64) {
+			uint64_t bits = spFeaturesFileGetU64(curr);
+			memcpy(row + j, &bits, sizeof(bits));
+			curr += sizeof(bits);
+		}
+		else {
+			uint32_t bits = spFeaturesFileGetU32(curr);
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			row[j] = value;
+			curr += sizeof(bits);
+		}
+	}
+	return curr;
+}
+
+int spFeaturesFileSave(const char* path, SPPoint** feats, int numOfFeatures, int dim, SP_FEATURES_DTYPE dtype) {
+	size_t elementSize = spFeaturesFileElementSize(dtype);
+	if (path == NULL || (feats == NULL && numOfFeatures > 0) || numOfFeatures < 0 || dim <= 0 || elementSize == 0) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	for (int i=0; i<numOfFeatures; i++) {
+		if (feats[i] == NULL || spPointGetDimension(feats[i]) != dim) {
+			spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+			return -1;
+		}
+	}
+
+	// encode the header and all the coordinates into one buffer
+	size_t size = SP_FEATURES_FILE_HEADER_SIZE + (size_t) numOfFeatures * dim * elementSize;
+	unsigned char* buffer = (unsigned char*) calloc(size, 1);
+	if (buffer == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	memcpy(buffer, SP_FEATURES_FILE_MAGIC, sizeof(SP_FEATURES_FILE_MAGIC));
+	spFeaturesFilePutU32(buffer + 8, SP_FEATURES_FILE_VERSION);
+	spFeaturesFilePutU32(buffer + 12, (uint32_t) dtype);
+	spFeaturesFilePutU32(buffer + 16, (uint32_t) dim);
+	spFeaturesFilePutU32(buffer + 20, (uint32_t) numOfFeatures);
+	unsigned char* curr = buffer + SP_FEATURES_FILE_HEADER_SIZE;
+	for (int i=0; i<numOfFeatures; i++)
+		curr = spFeaturesFileEncodeRow(curr, spPointGetData(feats[i]), dim, dtype);
+
+	// write it at once
+	char msg[STR_LEN];
+	FILE* featsFile = fopen(path, "wb");
+	if (featsFile == NULL) {
+		snprintf(msg, STR_LEN, ERRORMSG_FEATS_SAVE_OPEN, path);
+		spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+		free(buffer);
+		return -1;
+	}
+	int written = fwrite(buffer, 1, size, featsFile) == size;
+	written = (fclose(featsFile) == 0) && written;
+	free(buffer);
+	if (!written) {
+		snprintf(msg, STR_LEN, ERRORMSG_FEATS_SAVE_OPEN, path);
+		spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Reads the coordinates of a binary features file (after its header) with one read,
+ * and appends them to the store.
+ *
+ * @return the number of features read, -1 on failure
+ */
+static int spFeaturesFileLoadBinary(FILE* featsFile, const unsigned char* header, SPFeatureStore* store, int index) {
+	uint32_t version = spFeaturesFileGetU32(header + 8);
+	uint32_t dtype = spFeaturesFileGetU32(header + 12);
+	uint32_t dim = spFeaturesFileGetU32(header + 16);
+	uint32_t numOfFeatures = spFeaturesFileGetU32(header + 20);
+	size_t elementSize = spFeaturesFileElementSize(dtype);
+	if (version != SP_FEATURES_FILE_VERSION || elementSize == 0 ||
+			dim != (uint32_t) spFeatureStoreGetDimension(store) || numOfFeatures > (uint32_t) INT32_MAX) {
+		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	char msg[STR_LEN];
+	sprintf(msg, DEBUGMSG_FEATS_EXPECTED_NOF, (int) numOfFeatures);
+	spLoggerPrintDebug(msg, __FILE__, __func__, __LINE__);
+	if (spFeatureStoreReserve(store, spFeatureStoreGetSize(store) + (int) numOfFeatures) == -1)
+		return -1;
+
+	// read all the coordinates, and make sure nothing follows them
+	size_t size = (size_t) numOfFeatures * dim * elementSize;
+	unsigned char* buffer = (unsigned char*) malloc(size > 0 ? size : 1);
+	double* row = (double*) malloc(dim * sizeof(double));
+	if (buffer == NULL || row == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(buffer);
+		free(row);
+		return -1;
+	}
+	if (fread(buffer, 1, size, featsFile) != size || fgetc(featsFile) != EOF) {
+		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT, __FILE__, __func__, __LINE__);
+		free(buffer);
+		free(row);
+		return -1;
+	}
+
+	// decode into the store
+	const unsigned char* curr = buffer;
+	for (uint32_t i=0; i<numOfFeatures; i++) {
+		curr = spFeaturesFileDecodeRow(row, curr, (int) dim, dtype);
+		spFeatureStoreAppend(store, row, index); // room was reserved
+	}
+	free(buffer);
+	free(row);
+	return (int) numOfFeatures;
+}
+
+/*
+ * Reads the features of a text features file and appends them to the store.
+ *
+ * @return the number of features read, -1 on failure
+ */
+static int spFeaturesFileLoadText(FILE* featsFile, SPFeatureStore* store, int index) {
+	int numOfFeatures = 0;
+	if (fscanf(featsFile, "%d", &numOfFeatures) != 1 || numOfFeatures < 0) {
+		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	char msg[STR_LEN];
+	sprintf(msg, DEBUGMSG_FEATS_EXPECTED_NOF, numOfFeatures);
+	spLoggerPrintDebug(msg, __FILE__, __func__, __LINE__);
+	if (spFeatureStoreReserve(store, spFeatureStoreGetSize(store) + numOfFeatures) == -1)
+		return -1;
+
+	int dim = spFeatureStoreGetDimension(store);
+	double* row = (double*) malloc(dim * sizeof(double));
+	if (row == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// read exactly numOfFeatures rows of dim values
+	int loaded = 0;
+	bool valid = true;
+	while (valid && loaded < numOfFeatures) {
+		for (int j=0; valid && j<dim; j++)
+			valid = fscanf(featsFile, "%lf", row + j) == 1;
+		if (valid) {
+			spFeatureStoreAppend(store, row, index); // room was reserved
+			loaded++;
+		}
+	}
+	double extra;
+	valid = valid && fscanf(featsFile, "%lf", &extra) != 1;
+	free(row);
+
+	sprintf(msg, DEBUGMSG_FEATS_LOADED_NOF, loaded);
+	spLoggerPrintDebug(msg, __FILE__, __func__, __LINE__);
+	if (!valid) {
+		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	return numOfFeatures;
+}
+
+int spFeaturesFileLoad(const char* path, SPFeatureStore* store, int index) {
+	if (path == NULL || store == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	char msg[STR_LEN];
+	FILE* featsFile = fopen(path, "rb");
+	if (featsFile == NULL) {
+		snprintf(msg, STR_LEN, ERRORMSG_FEATS_LOAD_OPEN, path);
+		spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// a binary file starts with the magic string, anything else is read as text
+	unsigned char header[SP_FEATURES_FILE_HEADER_SIZE];
+	size_t headerSize = fread(header, 1, SP_FEATURES_FILE_HEADER_SIZE, featsFile);
+	int numOfFeatures;
+	if (headerSize == SP_FEATURES_FILE_HEADER_SIZE &&
+			memcmp(header, SP_FEATURES_FILE_MAGIC, sizeof(SP_FEATURES_FILE_MAGIC)) == 0)
+		numOfFeatures = spFeaturesFileLoadBinary(featsFile, header, store, index);
+	else {
+		rewind(featsFile);
+		numOfFeatures = spFeaturesFileLoadText(featsFile, store, index);
+	}
+	fclose(featsFile);
+	return numOfFeatures;
+}
+
+int spFeaturesFileSaveDB(const char* path, SPFeatureStore* store, int numOfImages, SP_FEATURES_DTYPE dtype) {
+	size_t elementSize = spFeaturesFileElementSize(dtype);
+	if (path == NULL || store == NULL || numOfImages <= 0 || elementSize == 0) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	int size = spFeatureStoreGetSize(store);
+	int dim = spFeatureStoreGetDimension(store);
+	size_t headerSize = SP_FEATURES_DB_HEADER_SIZE + ((size_t) numOfImages + 1) * sizeof(uint64_t);
+	size_t chunkSize = (size_t) SP_FEATURES_DB_CHUNK_ROWS * dim * elementSize;
+	uint64_t* offsets = (uint64_t*) calloc(numOfImages + 1, sizeof(uint64_t)); // offsets[i] is the first row of image i
+	uint64_t* next = (uint64_t*) malloc(numOfImages * sizeof(uint64_t));
+	int* order = (int*) malloc((size > 0 ? size : 1) * sizeof(int)); // the rows of the store grouped by image
+	unsigned char* buffer = (unsigned char*) malloc(headerSize > chunkSize ? headerSize : chunkSize);
+	char* tempPath = (char*) malloc(strlen(path) + sizeof(".tmp"));
+	double* row = (double*) malloc(dim * sizeof(double)); // the coordinates of a row of a float32 store
+	if (offsets == NULL || next == NULL || order == NULL || buffer == NULL || tempPath == NULL || row == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(offsets);
+		free(next);
+		free(order);
+		free(buffer);
+		free(tempPath);
+		free(row);
+		return -1;
+	}
+
+	// group the rows by image index, keeping their order within an image
+	bool valid = true;
+	for (int i=0; valid && i<size; i++) {
+		int index = spFeatureStoreGetIndex(store, i);
+		valid = index >= 0 && index < numOfImages;
+		if (valid)
+			offsets[index + 1]++;
+	}
+	if (!valid) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		free(offsets);
+		free(next);
+		free(order);
+		free(buffer);
+		free(tempPath);
+		free(row);
+		return -1;
+	}
+	for (int i=0; i<numOfImages; i++) {
+		offsets[i + 1] += offsets[i];
+		next[i] = offsets[i];
+	}
+	for (int i=0; i<size; i++)
+		order[next[spFeatureStoreGetIndex(store, i)]++] = i;
+
+	// the header and the offset table
+	memcpy(buffer, SP_FEATURES_DB_MAGIC, sizeof(SP_FEATURES_DB_MAGIC));
+	spFeaturesFilePutU32(buffer + 8, SP_FEATURES_FILE_VERSION);
+	spFeaturesFilePutU32(buffer + 12, (uint32_t) dtype);
+	spFeaturesFilePutU32(buffer + 16, (uint32_t) dim);
+	spFeaturesFilePutU32(buffer + 20, (uint32_t) numOfImages);
+	spFeaturesFilePutU64(buffer + 24, (uint64_t) size);
+	for (int i=0; i<=numOfImages; i++)
+		spFeaturesFilePutU64(buffer + SP_FEATURES_DB_HEADER_SIZE + i * sizeof(uint64_t), offsets[i]);
+
+	// write a temporary file and rename it, so readers never see a partial database
+	sprintf(tempPath, "%s.tmp", path);
+	char msg[STR_LEN];
+	FILE* dbFile = fopen(tempPath, "wb");
+	if (dbFile != NULL) {
+		valid = fwrite(buffer, 1, headerSize, dbFile) == headerSize;
+		for (int first=0; valid && first<size; first += SP_FEATURES_DB_CHUNK_ROWS) {
+			int last = first + SP_FEATURES_DB_CHUNK_ROWS < size ? first + SP_FEATURES_DB_CHUNK_ROWS : size;
+			unsigned char* curr = buffer;
+			for (int i=first; i<last; i++) {
+				const double* data = row;
+				if (spFeatureStoreGetPrecision(store) == SP_FEATURE_STORE_FLOAT32)
+					spFeatureStoreCopyRow(store, order[i], row);
+				else
+					data = spFeatureStoreGetRow(store, order[i]);
+				curr = spFeaturesFileEncodeRow(curr, data, dim, dtype);
+			}
+			valid = fwrite(buffer, 1, curr - buffer, dbFile) == (size_t) (curr - buffer);
+		}
+		valid = (fclose(dbFile) == 0) && valid && rename(tempPath, path) == 0;
+	}
+	if (dbFile == NULL || !valid) {
+		snprintf(msg, STR_LEN, ERRORMSG_FEATS_SAVE_OPEN, path);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		remove(tempPath);
+	}
+	free(offsets);
+	free(next);
+	free(order);
+	free(buffer);
+	free(tempPath);
+	free(row);
+	return dbFile != NULL && valid ? 0 : -1;
+}
+
+int spFeaturesFileLoadDB(const char* path, SPFeatureStore* store, int numOfImages) {
+	if (path == NULL || store == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	char msg[STR_LEN];
+	FILE* dbFile = fopen(path, "rb");
+	if (dbFile == NULL) {
+		snprintf(msg, STR_LEN, ERRORMSG_FEATS_LOAD_OPEN, path);
+		spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// the header must match the store and the number of images
+	int dim = spFeatureStoreGetDimension(store);
+	unsigned char header[SP_FEATURES_DB_HEADER_SIZE];
+	bool valid = numOfImages > 0 && fread(header, 1, SP_FEATURES_DB_HEADER_SIZE, dbFile) == SP_FEATURES_DB_HEADER_SIZE &&
+			memcmp(header, SP_FEATURES_DB_MAGIC, sizeof(SP_FEATURES_DB_MAGIC)) == 0 &&
+			spFeaturesFileGetU32(header + 8) == SP_FEATURES_FILE_VERSION &&
+			spFeaturesFileElementSize(spFeaturesFileGetU32(header + 12)) != 0 &&
+			spFeaturesFileGetU32(header + 16) == (uint32_t) dim &&
+			spFeaturesFileGetU32(header + 20) == (uint32_t) numOfImages &&
+			spFeaturesFileGetU64(header + 24) <= (uint64_t) (INT32_MAX - spFeatureStoreGetSize(store));
+	if (!valid) {
+		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT, __FILE__, __func__, __LINE__);
+		fclose(dbFile);
+		return -1;
+	}
+	uint32_t dtype = spFeaturesFileGetU32(header + 12);
+	size_t elementSize = spFeaturesFileElementSize(dtype);
+	int numOfFeatures = (int) spFeaturesFileGetU64(header + 24);
+	size_t tableSize = ((size_t) numOfImages + 1) * sizeof(uint64_t);
+	size_t chunkSize = (size_t) SP_FEATURES_DB_CHUNK_ROWS * dim * elementSize;
+	unsigned char* buffer = (unsigned char*) malloc(tableSize > chunkSize ? tableSize : chunkSize);
+	int* firstRows = (int*) malloc((numOfImages + 1) * sizeof(int)); // firstRows[i] is the first row of image i
+	double* row = (double*) malloc(dim * sizeof(double));
+	if (buffer == NULL || firstRows == NULL || row == NULL ||
+			spFeatureStoreReserve(store, spFeatureStoreGetSize(store) + numOfFeatures) == -1) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(buffer);
+		free(firstRows);
+		free(row);
+		fclose(dbFile);
+		return -1;
+	}
+
+	// the offset table must cover the rows in order
+	valid = fread(buffer, 1, tableSize, dbFile) == tableSize;
+	for (int i=0; valid && i<=numOfImages; i++) {
+		uint64_t offset = spFeaturesFileGetU64(buffer + i * sizeof(uint64_t));
+		valid = offset <= (uint64_t) numOfFeatures && (i == 0 ? offset == 0 : (int) offset >= firstRows[i - 1]);
+		firstRows[i] = (int) offset;
+	}
+	valid = valid && firstRows[numOfImages] == numOfFeatures;
+
+	// read the rows sequentially, chunk by chunk, tagging each with its image
+	int image = 0;
+	for (int first=0; valid && first<numOfFeatures; first += SP_FEATURES_DB_CHUNK_ROWS) {
+		int last = first + SP_FEATURES_DB_CHUNK_ROWS < numOfFeatures ? first + SP_FEATURES_DB_CHUNK_ROWS : numOfFeatures;
+		size_t bytes = (size_t) (last - first) * dim * elementSize;
+		valid = fread(buffer, 1, bytes, dbFile) == bytes;
+		const unsigned char* curr = buffer;
+		for (int i=first; valid && i<last; i++) {
+			while (firstRows[image + 1] <= i)
+				image++;
+			curr = spFeaturesFileDecodeRow(row, curr, dim, dtype);
+			spFeatureStoreAppend(store, row, image); // room was reserved
+		}
+	}
+	valid = valid && fgetc(dbFile) == EOF;
+	free(buffer);
+	free(firstRows);
+	free(row);
+	fclose(dbFile);
+	if (!valid) {
+		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	return numOfFeatures;
+}
@@ -0,0 +1,104 @@
+#ifndef SPFEATURESFILE_H_
+#define SPFEATURESFILE_H_
+
+#include "SPPoint.h"
+#include "SPFeatureStore.h"
+
+/**
+ * SPFeaturesFile Summary
+ * Reads and writes the features file (.feats) of an image, and the feature database holding
+ * the features of all the images in one file.
+ *
+ * Features files are written in a binary format: a header of 24 bytes - the magic string "SPFEATS",
+ * the format version, the data type of the coordinates, the dimension and the number of features,
+ * as little-endian 32 bit integers - followed by the coordinates of all the features, row after row,
+ * as little-endian IEEE float64 or float32 values. The coordinates are read with one read.
+ *
+ * The old text format - the number of features in the first line, and then a line of dim
+ * coordinates for every feature - is still read, so existing features files keep working.
+ *
+ * The feature database replaces the features files of all the images, so loading opens one file and
+ * reads it sequentially. It starts with a header of 32 bytes - the magic string "SPFTSDB", the format
+ * version, the data type, the dimension and the number of images as little-endian 32 bit integers, and
+ * the total number of features as a little-endian 64 bit integer - followed by an offset table of
+ * numOfImages+1 little-endian 64 bit integers (entry i is the first feature of image i, the last entry is
+ * the total number of features), and then the coordinates of all the features, grouped by image.
+ *
+ * The following functions are supported:
+ *
+ * spFeaturesFileSave      - Writes the features of an image to a binary features file.
+ * spFeaturesFileLoad      - Reads a binary or text features file, appending its features to a feature store.
+ * spFeaturesFileSaveDB    - Writes all the features of a feature store to a feature database.
+ * spFeaturesFileLoadDB    - Reads a feature database, appending all its features to a feature store.
+ *
+ */
+
+/** The version of the binary format, a binary file of any other version is not read **/
+#define SP_FEATURES_FILE_VERSION 1
+
+/** The data type of the coordinates in a binary features file **/
+typedef enum sp_features_dtype_t {
+	SP_FEATURES_FLOAT64,	// exact, 8 bytes per coordinate
+	SP_FEATURES_FLOAT32		// rounded to single precision, 4 bytes per coordinate
+} SP_FEATURES_DTYPE;
+
+/**
+ * Writes numOfFeatures features of dimension dim to a binary features file.
+ *
+ * @param path - the path of the features file
+ * @param feats - the features, all of dimension dim
+ * @param numOfFeatures - the number of features
+ * @param dim - the dimension of the features
+ * @param dtype - the data type to write the coordinates in
+ *
+ * @return -1 if path is NULL OR feats is NULL while numOfFeatures > 0 OR numOfFeatures < 0 OR dim <= 0
+ * OR a feature is not of dimension dim OR the file could not be written OR in case of allocation failure.
+ * Otherwise, 0 is returned
+ */
+int spFeaturesFileSave(const char* path, SPPoint** feats, int numOfFeatures, int dim, SP_FEATURES_DTYPE dtype);
+
+/**
+ * Reads a features file - binary, or else text - and appends its features to the store,
+ * with the given image index. The features must be of the dimension of the store.
+ * On failure, some of the features may have been appended already.
+ *
+ * @param path - the path of the features file
+ * @param store - the feature store to append the features to
+ * @param index - the image index of the features
+ *
+ * @return -1 if path or store are NULL OR the file could not be opened OR it is not a valid features file
+ * of the dimension of the store OR in case of allocation failure. Otherwise, the number of features read
+ */
+int spFeaturesFileLoad(const char* path, SPFeatureStore* store, int index);
+
+/**
+ * Writes all the rows of the store to a feature database, grouped by their image index
+ * (keeping their order within every image). The database is written to a temporary file
+ * next to path which is then renamed to path, so a failed save never leaves a partial database behind.
+ *
+ * @param path - the path of the feature database
+ * @param store - the feature store
+ * @param numOfImages - the number of images, all the image indices of the store must be in [0, numOfImages)
+ * @param dtype - the data type to write the coordinates in
+ *
+ * @return -1 if path or store are NULL OR numOfImages <= 0 OR an image index is out of range
+ * OR the file could not be written OR in case of allocation failure. Otherwise, 0 is returned
+ */
+int spFeaturesFileSaveDB(const char* path, SPFeatureStore* store, int numOfImages, SP_FEATURES_DTYPE dtype);
+
+/**
+ * Reads a feature database and appends all its features to the store, in the order of the images,
+ * each with the index of its image. The database must be of the dimension of the store and hold
+ * numOfImages images. On failure, some of the features may have been appended already.
+ *
+ * @param path - the path of the feature database
+ * @param store - the feature store to append the features to
+ * @param numOfImages - the expected number of images
+ *
+ * @return -1 if path or store are NULL OR the file could not be opened OR it is not a valid feature database
+ * of the dimension of the store and numOfImages images OR in case of allocation failure.
+ * Otherwise, the number of features read
+ */
+int spFeaturesFileLoadDB(const char* path, SPFeatureStore* store, int numOfImages);
+
+#endif /* SPFEATURESFILE_H_ */
@@ -10,6 +10,7 @@
 #include "SPImageProc.h"
 extern "C" {
 #include "SPLogger.h"
+#include "SPParallel.h"
 }
 
 using namespace cv;
@@ -20,6 +21,7 @@ using namespace std;
 #define PCA_EIGEN_VAL_STR "e_values"
 #define STRING_LENGTH 1024
 #define WARNING_MSG_LENGTH 2048
+#define IMAGES_PER_THREAD 4 // the images described in parallel per thread, before they are accumulated in order
 
 #define GENERAL_ERROR_MSG "An error occurred"
 #define PCA_DIM_ERROR_MSG "PCA dimension couldn't be resolved"
@@ -30,6 +32,7 @@ using namespace std;
 #define MINIMAL_GUI_ERROR "Minimal GUI mode couldn't be resolved"
 #define IMAGE_PATH_ERROR "Image path couldn't be resolved"
 #define IMAGE_NOT_EXIST_MSG ": Images doesn't exist"
+#define NO_DESCRIPTORS_ERROR "No SIFT descriptors were extracted from the images"
 #define MINIMAL_GUI_NOT_SET_WARNING "Cannot display images in non-Minimal-GUI mode"
 #define ALLOC_ERROR_MSG "Allocation error"
 #define INVALID_ARG_ERROR "Invalid arguments"
@@ -58,54 +61,118 @@ void sp::ImageProc::initFromConfig(const SPConfig config) {
 	}
 }
 
-void sp::ImageProc::getImagesMat(vector<Mat>& images, const SPConfig config) {
+namespace {
+// A batch of consecutive images, described on several threads
+struct DescribeBatch {
+	SPConfig config;
+	int numOfFeatures;
+	int first; // the index of the first image of the batch
+	vector<Mat>* descriptors; // the descriptors of image first+i
+	vector<char>* isRead; // image first+i was read and described
+	vector<char>* pathError; // the path of image first+i couldn't be resolved
+};
+
+// Reads and describes image first+task of the batch (a task of spParallelFor)
+void describeImageTask(void* arg, int task) {
+	DescribeBatch* batch = (DescribeBatch*) arg;
 	char warningMSG[WARNING_MSG_LENGTH] = { '\0' };
-	for (int i = 0; i < numOfImages; i++) {
-		char imagePath[STRING_LENGTH + 1] = { '\0' };
-		if (spConfigGetImagePath(imagePath, config, i) != SP_CONFIG_SUCCESS) {
-			spLoggerPrintError(IMAGE_PATH_ERROR, __FILE__, __func__, __LINE__);
-			throw Exception();
-		}
-		Mat img = imread(imagePath, IMREAD_GRAYSCALE);
-		if (img.empty()) {
-			sprintf(warningMSG, "%s %s", imagePath, IMAGE_NOT_EXIST_MSG);
-			spLoggerPrintWarning(warningMSG, __FILE__, __func__, __LINE__);
-			continue;
-		}
-		images.push_back(img);
+	char imagePath[STRING_LENGTH + 1] = { '\0' };
+	(*batch->descriptors)[task].release();
+	(*batch->isRead)[task] = false;
+	(*batch->pathError)[task] = false;
+	if (spConfigGetImagePath(imagePath, batch->config, batch->first + task) != SP_CONFIG_SUCCESS) {
+		(*batch->pathError)[task] = true;
+		return;
+	}
+	Mat img = imread(imagePath, IMREAD_GRAYSCALE);
+	if (img.empty()) {
+		sprintf(warningMSG, "%s %s", imagePath, IMAGE_NOT_EXIST_MSG);
+		spLoggerPrintWarning(warningMSG, __FILE__, __func__, __LINE__);
+		return;
 	}
+	//The SIFT feature extractor and descriptor (one per thread)
+	Ptr<xfeatures2d::SiftDescriptorExtractor> detector =
+			xfeatures2d::SIFT::create(batch->numOfFeatures);
+	vector<KeyPoint> keypoints;
+	detector->detect(img, keypoints);
+	detector->compute(img, keypoints, (*batch->descriptors)[task]);
+	(*batch->isRead)[task] = true;
+}
 }
 
-void sp::ImageProc::getFeatures(vector<Mat>& images, Mat& features) {
-	//To store the keypoints that will be extracted by SIFT
-	vector<KeyPoint> keypoints;
-	//To store the SIFT descriptor of current image
-	Mat descriptor;
-	//To store all the descriptors that are extracted from all the images.
+void sp::ImageProc::fitPCA(const SPConfig config) {
+	SP_CONFIG_MSG msg = SP_CONFIG_SUCCESS;
+	int numOfThreads = spParallelNumOfThreads(spConfigGetNumOfThreads(config, &msg));
+	int cacheSize = spConfigGetPCADescriptorCache(config, &msg);
+	int batchSize = numOfThreads * IMAGES_PER_THREAD;
+	vector<Mat> batchDescriptors(batchSize);
+	vector<char> isRead(batchSize, false), pathError(batchSize, false);
+	DescribeBatch batch = {config, numOfFeatures, 0, &batchDescriptors, &isRead, &pathError};
 
-	//The SIFT feature extractor and descriptor
-	Ptr<xfeatures2d::SiftDescriptorExtractor> detector =
-			xfeatures2d::SIFT::create(numOfFeatures);
+	//The sum of the descriptors and of their outer products, accumulated image by image,
+	//so only one batch of images is held at a time
+	Mat sum, products, rows, rowsSum;
+	double count = 0;
+	int cached = 0;
+	bool caching = cacheSize > 0;
+	isDescribed.assign(numOfImages, false);
+	descriptorRows.assign(numOfImages + 1, 0);
+	for (; batch.first < numOfImages; batch.first += batchSize) {
+		int size = min(batchSize, numOfImages - batch.first);
+		spParallelFor(size, numOfThreads, describeImageTask, &batch);
+		for (int i = 0; i < size; i++) {
+			int index = batch.first + i;
+			if (pathError[i]) {
+				spLoggerPrintError(IMAGE_PATH_ERROR, __FILE__, __func__, __LINE__);
+				throw Exception();
+			}
+			Mat& descriptor = batchDescriptors[i];
+			if (isRead[i] && descriptor.rows > 0) {
+				descriptor.convertTo(rows, CV_64F);
+				if (sum.empty()) {
+					sum = Mat::zeros(1, rows.cols, CV_64F);
+					products = Mat::zeros(rows.cols, rows.cols, CV_64F);
+				}
+				reduce(rows, rowsSum, 0, REDUCE_SUM, CV_64F);
+				sum += rowsSum;
+				products += rows.t() * rows;
+				count += rows.rows;
 
-	//feature descriptors and build the vocabulary
-	for (int i = 0; i < static_cast<int>(images.size()); i++) {
-		//detect feature points
-		detector->detect(images[i], keypoints);
-		//compute the descriptors for each keypoint
-		detector->compute(images[i], keypoints, descriptor);
-		//put the all feature descriptors in a single Mat object
-		features.push_back(descriptor);
+				//keep the descriptors for the extraction, while they fit in the cache
+				if (caching && descriptors.empty())
+					descriptors.create((int) min((long long) cacheSize, (long long) numOfImages * numOfFeatures),
+							descriptor.cols, descriptor.type());
+				caching = caching && cached + descriptor.rows <= descriptors.rows;
+				if (caching) {
+					descriptor.copyTo(descriptors.rowRange(cached, cached + descriptor.rows));
+					cached += descriptor.rows;
+					isDescribed[index] = true;
+				}
+			}
+			descriptorRows[index + 1] = cached;
+			descriptor.release();
+		}
+	}
+	if (count == 0) {
+		spLoggerPrintError(NO_DESCRIPTORS_ERROR, __FILE__, __func__, __LINE__);
+		throw Exception();
 	}
+	descriptors = descriptors.rowRange(0, cached);
+
+	//The principal components are the eigenvectors of the covariance matrix, as cv::PCA computes them
+	Mat mean = sum / count;
+	Mat covariance = products / count - mean.t() * mean;
+	Mat eigenvalues, eigenvectors;
+	eigen(covariance, eigenvalues, eigenvectors);
+	mean.convertTo(pca.mean, CV_32F);
+	eigenvalues.rowRange(0, pcaDim).convertTo(pca.eigenvalues, CV_32F);
+	eigenvectors.rowRange(0, pcaDim).convertTo(pca.eigenvectors, CV_32F);
 }
 
 void sp::ImageProc::preprocess(const SPConfig config) {
 	try {
-		vector<Mat> images;
-		Mat features;
 		char pcaPath[STRING_LENGTH + 1] = { '\0' };
-		getImagesMat(images, config);
-		getFeatures(images, features);
-		pca = PCA(features, Mat(), CV_PCA_DATA_AS_ROW, pcaDim);
+		fitPCA(config);
 		if (spConfigGetPCAPath(pcaPath, config) != SP_CONFIG_SUCCESS) {
 			spLoggerPrintError(PCA_FILE_NOT_RESOLVED, __FILE__, __func__,
 			__LINE__);
@@ -163,26 +230,10 @@ sp::ImageProc::ImageProc(const SPConfig config) {
 	}
 }
 
-SPPoint** sp::ImageProc::getImageFeatures(const char* imagePath, int index,
+SPPoint** sp::ImageProc::projectFeatures(const Mat& descriptor, int index,
 		int* numOfFeats) {
-	vector<KeyPoint> keypoints;
-	Mat descriptor, img, points;
+	Mat points;
 	double* pcaSift = NULL;
-	char errorMSG[STRING_LENGTH * 2];
-	Ptr<xfeatures2d::SiftDescriptorExtractor> detector;
-	if (!imagePath || !numOfFeats) {
-		spLoggerPrintError(INVALID_ARG_ERROR, __FILE__, __func__, __LINE__);
-		return NULL;
-	}
-	img = imread(imagePath, IMREAD_GRAYSCALE);
-	if (img.empty()) {
-		sprintf(errorMSG, "%s %s", imagePath, IMAGE_NOT_EXIST_MSG);
-		spLoggerPrintError(errorMSG, __FILE__, __func__, __LINE__);
-		return NULL;
-	}
-	detector = xfeatures2d::SIFT::create(numOfFeatures);
-	detector->detect(img, keypoints);
-	detector->compute(img, keypoints, descriptor);
 	points = pca.project(descriptor);
 	pcaSift = (double*) malloc(sizeof(double) * pcaDim);
 	if (!pcaSift) {
@@ -206,6 +257,46 @@ SPPoint** sp::ImageProc::getImageFeatures(const char* imagePath, int index,
 	return resPoints;
 }
 
+SPPoint** sp::ImageProc::getImageFeatures(const char* imagePath, int index,
+		int* numOfFeats) {
+	vector<KeyPoint> keypoints;
+	Mat descriptor, img;
+	char errorMSG[STRING_LENGTH * 2];
+	Ptr<xfeatures2d::SiftDescriptorExtractor> detector;
+	if (!imagePath || !numOfFeats) {
+		spLoggerPrintError(INVALID_ARG_ERROR, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	img = imread(imagePath, IMREAD_GRAYSCALE);
+	if (img.empty()) {
+		sprintf(errorMSG, "%s %s", imagePath, IMAGE_NOT_EXIST_MSG);
+		spLoggerPrintError(errorMSG, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	detector = xfeatures2d::SIFT::create(numOfFeatures);
+	detector->detect(img, keypoints);
+	detector->compute(img, keypoints, descriptor);
+	return projectFeatures(descriptor, index, numOfFeats);
+}
+
+SPPoint** sp::ImageProc::getCachedImageFeatures(int index, int* numOfFeats) {
+	if (!numOfFeats) {
+		spLoggerPrintError(INVALID_ARG_ERROR, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	if (index < 0 || index >= static_cast<int>(isDescribed.size()) || !isDescribed[index]
+			|| descriptors.empty())
+		return NULL;
+	return projectFeatures(descriptors.rowRange(descriptorRows[index], descriptorRows[index + 1]),
+			index, numOfFeats);
+}
+
+void sp::ImageProc::releaseCachedFeatures() {
+	descriptors.release();
+	descriptorRows.clear();
+	isDescribed.clear();
+}
+
 void sp::ImageProc::showImage(const char* imgPath) {
 	if (minimalGui) {
 		Mat img = imread(imgPath, cv::IMREAD_COLOR);
@@ -22,12 +22,14 @@ private:
 	int numOfFeatures;
 	cv::PCA pca;
 	bool minimalGui;
+	cv::Mat descriptors; // extraction mode: SIFT descriptors kept from fitting the PCA (at most spPCADescriptorCache)
+	std::vector<int> descriptorRows; // the descriptors of image i are rows descriptorRows[i] to descriptorRows[i+1]-1
+	std::vector<char> isDescribed; // isDescribed[i] - the descriptors of image i are kept
 	void initFromConfig(const SPConfig);
-	void getImagesMat(std::vector<cv::Mat>&, const SPConfig);
-	void getFeatures(std::vector<cv::Mat>&,
-			cv::Mat&);
+	void fitPCA(const SPConfig);
 	void preprocess(const SPConfig config);
 	void initPCAFromFile(const SPConfig config);
+	SPPoint** projectFeatures(const cv::Mat& descriptor, int index, int* numOfFeats);
 public:
 
 	/**
@@ -52,6 +54,28 @@ public:
 	 */
 	SPPoint** getImageFeatures(const char* imagePath,int index,int* numOfFeats);
 
+	/**
+	 * Returns an array of features for the image of the database with the given index,
+	 * projecting the SIFT descriptors kept from fitting the PCA (in extraction mode), so the
+	 * image is not read and described again. Returns the same features as getImageFeatures
+	 * for the image path of index. The actual number of features will be stored in the
+	 * pointer given by numOfFeats. Safe to call from several threads.
+	 *
+	 * @param index - the index of the image in the database
+	 * @param numOfFeats - a pointer in which the actual number of feats will be stored
+	 * @return
+	 * An array of the features. NULL is returned if the descriptors of the image are not kept
+	 * (not in extraction mode, the image could not be read, or releaseCachedFeatures was called)
+	 * or in case of an error.
+	 */
+	SPPoint** getCachedImageFeatures(int index, int* numOfFeats);
+
+	/**
+	 * Frees the SIFT descriptors kept from fitting the PCA. getCachedImageFeatures returns
+	 * NULL afterwards.
+	 */
+	void releaseCachedFeatures();
+
 	/**
 	 *	Displays the image given by imagePath. Notice that this function works
 	 *	only in MinimalGUI mode (otherwise a warnning message is printed).
@@ -1,25 +1,30 @@
 #include <malloc.h>
 #include <assert.h>
-#include "SPPoint.h"
+#include "SPFeatureStore.h"
 #include "SPKDArray.h"
+#include "SPParallel.h"
 #include "SPLogger.h"
 #include "SPConsts.h"
 
 /**
  * SPKDArray Summary
  * Encapsulates an array of points, each having the same dimension.
+ * The points are rows of a feature store, and the KD array holds their row ids.
  * The points are ordered differently by each dimension, and each
  * possible order is saved in the KD Array as an array.
  *
  * The following functions are supported:
  *
- * spKDArrayInit            	- Initializes a KD array based on an array of points.
+ * spKDArrayInit            	- Initializes a KD array based on an array of row ids.
+ * spKDArrayInitParallel       	- Initializes a KD array, sorting the dimensions on several threads.
  * spKDArraySplit 		    	- Splits the KD array into 2 based on the ordering by a given dimension.
- * spCopyPointArray		    	- Create a new copy of a given point array.
+ * spKDArraySplitParallel     	- Splits the KD array, filling the dimensions on several threads.
+ * spCopyRowArray		    	- Create a new copy of a given row ids array.
  * spSortPointArrayByDimension	- Orders an array of indices by a given dimension.
  * spKDArrayGetDimension		- A getter of the dimension of all the points in the KD array.
  * spKDArrayGetSize     		- A getter of the number of points in the KD array.
- * spKDArrayGetArray    		- A getter of the array of points.
+ * spKDArrayGetStore    		- A getter of the feature store holding the points.
+ * spKDArrayGetRows    		    - A getter of the array of row ids.
  * spKDArrayGetIndicesByDim 	- A getter of an array of indices as sorted by a given dimension.
  * spKDArrayDestroy     		- Frees all allocated memory in the KD Array.
  *
@@ -27,99 +32,181 @@
 
 /** Type for defining the array **/
 struct kd_array_t {
-	SPPoint** arr; /* The array of pointers to the points  */
+	SPFeatureStore* store; /* The feature store holding the points (not owned by the KD array) */
+	int* rows; /* The array of row ids of the points in the store */
 	int** arrIndices; /* Each row contains the sorted indices for the dimension with that row number */
 	int dim; /* The number of dimensions each point has */
 	int size; /* The number of points */
 };
 
+/** The arguments of the tasks sorting the dimensions of a new KD array (spKDArrayInitParallel) **/
+typedef struct kd_array_sort_t {
+	SPFeatureStore* store;
+	int* rows; /* The row ids of the new KD array */
+	int** a; /* The matrix of indices to sort, row k is sorted by task k */
+	int* sorted; /* sorted[k] is set to 1 if row k was sorted, -1 otherwise */
+	int size;
+} SPKDArraySort;
+
+/** The arguments of the tasks filling the dimensions of the two halves of a KD array (spKDArraySplitParallel) **/
+typedef struct kd_array_split_t {
+	SPKDArray* kdArr; /* The KD array to split */
+	int* tempSplitArray; /* tempSplitArray[i] is the index of point i in the order of the split dimension */
+	int* tempNewIndex; /* tempNewIndex[i] is the index of point i in the new left or right array */
+	int** aLeft; /* The matrix of indices of the left array, row k is filled by task k */
+	int** aRight; /* The matrix of indices of the right array, row k is filled by task k */
+	int n1; /* The number of points of the left array */
+} SPKDArraySplitTask;
+
+/**
+ * Sorts row k of the matrix of a new KD array, with its own temporary array (a task of spParallelFor).
+ *
+ * @param arg - the SPKDArraySort of the KD array
+ * @param k - the index of the row to sort
+ */
+static void spKDArraySortDimension(void* arg, int k){
+    SPKDArraySort* sort = (SPKDArraySort*) arg;
+    int* tempArray = (int*) malloc(sort->size*sizeof(int)); // tempArray will help in sort
+    if(tempArray == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        sort->sorted[k] = -1;
+        return;
+    }
+    for(int j = 0; j<sort->size; j++)
+        sort->a[k][j] = j; // The initial index order before sort is 0,1,...,size-1 in each row
+    sort->sorted[k] = spSortPointArrayByDimension(sort->a, sort->store, sort->rows, sort->size, k, tempArray); // Merge sort of row k
+    free(tempArray);
+}
+
+/**
+ * Fills row k of the matrices of the left and right arrays of a split (a task of spParallelFor).
+ * The points keep the order they have in row k of the split KD array.
+ *
+ * @param arg - the SPKDArraySplitTask of the split
+ * @param k - the index of the row to fill
+ */
+static void spKDArraySplitDimension(void* arg, int k){
+    SPKDArraySplitTask* split = (SPKDArraySplitTask*) arg;
+    int* indices = split->kdArr->arrIndices[k];
+    int j1 = 0; /* Index for left array */
+    int j2 = 0; /* Index for right array */
+    for(int i = 0; i< split->kdArr->size ; i++){
+        if(split->tempSplitArray[indices[i]]<split->n1){
+            split->aLeft[k][j1] = split->tempNewIndex[indices[i]]; /* Filling the matrix in correct order */
+            j1++;
+        }
+        else{
+            split->aRight[k][j2] = split->tempNewIndex[indices[i]]; /* Filling the matrix in correct order */
+            j2++;
+        }
+    }
+}
+
 /**
- * Initializes a new KD array based on inputed point array and size of array.
- * If d is the dimension of each point, and there are n points,
+ * Initializes a new KD array based on inputed row ids array and size of array.
+ * If d is the dimension of the store, and there are n row ids,
  * a matrix of d rows and n columns is created, each cell holding
- * an index of an SPPoint in the array.
+ * an index of a row id in the array.
  * Each row is sorted by the coordinates of the points in the row number dimension.
+ * The row ids array is copied, the store is referenced (not copied) and must outlive the KD array.
  *
- * @param arr - the array of pointers to points
- * @param size - the number of pointers to points
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids, if NULL all the rows of the store are used (size must then be the store size)
+ * @param size - the number of row ids
  *
- * @return NULL in case allocation failure occurred OR arr is NULL OR not all the dimensions are the same
+ * @return NULL in case allocation failure occurred OR store is NULL OR some row id is out of range
  * Otherwise, the new KD Array is returned
  */
-SPKDArray* spKDArrayInit(SPPoint** arr, int size){
+SPKDArray* spKDArrayInit(SPFeatureStore* store, int* rows, int size){
+    return spKDArrayInitParallel(store, rows, size, 1);
+}
+
+/**
+ * Initializes a new KD array exactly like spKDArrayInit, where the d rows of the matrix
+ * are sorted on up to numOfThreads threads (each row is sorted by one thread).
+ *
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids, if NULL all the rows of the store are used (size must then be the store size)
+ * @param size - the number of row ids
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case allocation failure occurred OR store is NULL OR some row id is out of range
+ * Otherwise, the new KD Array is returned
+ */
+SPKDArray* spKDArrayInitParallel(SPFeatureStore* store, int* rows, int size, int numOfThreads){
     int iError = -1; // Allocation error checker
-    int d = 0; // Number of dimensions of each point
-    if(size>0 && arr != NULL){
-        for(int i = 0; i<size && iError == -1 ; i++){ // Check that all points exist and have the same dimension
-            if(arr[i] == NULL){
-                d = 0;
-                iError = 0;
-            }
-            else if(i == 0)
-                d = spPointGetDimension((arr[i]));
-            else if(d != spPointGetDimension((arr[i]))){
-                d = -1;
-                iError = 0;
-            }
+    int d = spFeatureStoreGetDimension(store); // Number of dimensions of each point
+    if(size>0 && d>0 && (rows != NULL || size == spFeatureStoreGetSize(store))){
+        int* rowsCopy = NULL; // The row ids of the new KD array
+        if(rows != NULL)
+            rowsCopy = spCopyRowArray(rows, size);
+        else if((rowsCopy = (int*) malloc(size*sizeof(int))) != NULL){
+            for(int i = 0; i<size; i++)
+                rowsCopy[i] = i; // All the rows of the store, by order
         }
-        if(d > 0){
-            int **a = (int**) malloc(d*sizeof(*a)); // a is the sorted matrix of indexes
-            iError = -1;
-            if(a == NULL) {
-            	spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        else
+            spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        if(rowsCopy == NULL)
+            return NULL;
+        for(int i = 0; i<size ; i++){ // Check that all row ids exist in the store
+            if(rowsCopy[i] < 0 || rowsCopy[i] >= spFeatureStoreGetSize(store)){
+                spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+                free(rowsCopy);
                 return NULL;
             }
-            int* tempArray = (int*) malloc(size*sizeof(int)); // tempArray will help in sort
-            if(tempArray == NULL){
-                spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
-                free(a);
-                return NULL;
+        }
+        int **a = (int**) malloc(d*sizeof(*a)); // a is the sorted matrix of indexes
+        if(a == NULL) {
+            spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+            free(rowsCopy);
+            return NULL;
+        }
+        int* sorted = (int*) malloc(d*sizeof(int)); // sorted[i] is the result of sorting row i
+        if(sorted == NULL){
+            spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+            free(a);
+            free(rowsCopy);
+            return NULL;
+        }
+        for(int i = 0; i<d ; i++){
+            a[i] = (int*) malloc(size*sizeof(int));
+            if(a[i] == NULL){
+                iError = i;
+                i = d;
             }
+        }
+        if(iError == -1){ // Merge sort of all the rows, each by its own dimension
+            SPKDArraySort sort = {store, rowsCopy, a, sorted, size};
+            spParallelFor(d, numOfThreads, spKDArraySortDimension, &sort);
             for(int i = 0; i<d ; i++){
-                a[i] = (int*) malloc(size*sizeof(int));
-                if(a[i] == NULL){
-                    d = -1;
-                    iError = i;
-                }
-                else{
-                    for(int j = 0; j<size; j++)
-                        a[i][j] = j; // The initial index order before sort is 0,1,...,size-1 in each row
-                    spSortPointArrayByDimension(a , arr , size, i, tempArray); // Merge sort of row i
-                }
+                if(sorted[i] != 1)
+                    iError = d;
             }
-            free(tempArray);
-            if(d == -1){
-                spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
-                for(int i = 0; i < iError ; i++){
-                    free(a[i]);
-                }
-                free(a);
-                return NULL;
-            }
-            SPPoint** dataCopy = spCopyPointArray(arr , size);
-            if(dataCopy == NULL){
-                spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
-                for(int i = 0; i<d ; i++){
-                    free(a[i]);
-                }
-                free(a);
-                return NULL;
-            }
-            SPKDArray* res = spKDArrayInitPreSorted(dataCopy, a, size , d);
-            if(res == NULL)
-            {
-                spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
-                for(int i = 0; i<d ; i++)
-                    free(a[i]);
-                free(a);
-                free(dataCopy);
-                return NULL;
+        }
+        free(sorted);
+        if(iError != -1){
+            spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+            for(int i = 0; i < iError ; i++){
+                free(a[i]);
             }
-            return res;
+            free(a);
+            free(rowsCopy);
+            return NULL;
+        }
+        SPKDArray* res = spKDArrayInitPreSorted(store, rowsCopy, a, size , d);
+        if(res == NULL)
+        {
+            spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+            for(int i = 0; i<d ; i++)
+                free(a[i]);
+            free(a);
+            free(rowsCopy);
+            return NULL;
         }
+        return res;
     }
 
-    // (NULL array or some points have different dimensions than others)
+    // (NULL store or rows, or no points)
     spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
     return NULL;
 }
@@ -128,19 +215,21 @@ SPKDArray* spKDArrayInit(SPPoint** arr, int size){
  * Initializes a new KD array using the sorted matrix given as input.
  * Requires the matrix to be sorted correctly in each row.
  *
- * @param data - the array of pointers to points
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids
  * @param a - the sorted matrix of indices
- * @param size - the number of pointers to points
+ * @param size - the number of row ids
  * @param d - the dimensions of each point
  *
  * @return The new KD Array is returned (NULL in case of allocation error)
  */
-SPKDArray* spKDArrayInitPreSorted(SPPoint** data, int** a, int size , int d){
+SPKDArray* spKDArrayInitPreSorted(SPFeatureStore* store, int* rows, int** a, int size , int d){
     SPKDArray *res = (SPKDArray*) malloc(sizeof(*res));
     if(res != NULL){
         res->dim = d;
         res->size = size;
-        res->arr = data;
+        res->store = store;
+        res->rows = rows;
         res->arrIndices = a;
         return res;
     }
@@ -161,6 +250,21 @@ SPKDArray* spKDArrayInitPreSorted(SPPoint** data, int** a, int size , int d){
  * NULL is returned in case of allocation error.
  */
 SPKDArray** spKDArraySplit(SPKDArray* kdArr, int coor){
+    return spKDArraySplitParallel(kdArr, coor, 1);
+}
+
+/**
+ * Splits an inputed KD array in half exactly like spKDArraySplit, where the d rows of the matrices
+ * of the two new KD arrays are filled on up to numOfThreads threads (each row is filled by one thread).
+ *
+ * @param kdArr - the kd array to split
+ * @param coor - the dimension to split by (a number from 1 to d, not the index from 0 to d-1)
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return The output is an array of 2 KD Array pointers, the first being kdLeft and the second kdRight.
+ * NULL is returned in case of allocation error.
+ */
+SPKDArray** spKDArraySplitParallel(SPKDArray* kdArr, int coor, int numOfThreads){
     if(kdArr == NULL){
         spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
         return NULL;
@@ -180,8 +284,8 @@ SPKDArray** spKDArraySplit(SPKDArray* kdArr, int coor){
     SPKDArray** res = (SPKDArray**) malloc(2*(sizeof(kdArr))); /* res[0] is the pointer to the left array, and res[1] is the pointer to the right array */
     int* tempSplitArray = (int*) malloc((kdArr->size)*sizeof(int)); /* tempSplitArray[i] is the index of point i in row kdArr->arrIndices[coor-1] */
     int* tempNewIndex = (int*) malloc((kdArr->size)*sizeof(int)); /* tempNewIndex[i] is the index of point i in the new left or right array */
-    SPPoint **dataLeft = (SPPoint**) malloc(n1*sizeof(*dataLeft)); /* The points of the left array */
-    SPPoint **dataRight = (SPPoint**) malloc(n2*sizeof(*dataRight)); /* The points of the right array */
+    int *dataLeft = (int*) malloc(n1*sizeof(*dataLeft)); /* The row ids of the left array */
+    int *dataRight = (int*) malloc(n2*sizeof(*dataRight)); /* The row ids of the right array */
     int **aLeft = (int**) malloc((kdArr->dim)*sizeof(*aLeft)); /* The matrix of indices of the left array */
     int **aRight = (int**) malloc((kdArr->dim)*sizeof(*aRight)); /* The matrix of indices of the right array */
     if(aRight != NULL && aLeft != NULL){
@@ -230,64 +334,39 @@ SPKDArray** spKDArraySplit(SPKDArray* kdArr, int coor){
     }
     for(int i = 0; i< kdArr->size ; i++){
         if(tempSplitArray[i]<n1){
-            dataLeft[j1] = kdArr->arr[i]; /* Filling the point array */
+            dataLeft[j1] = kdArr->rows[i]; /* Filling the row ids array */
             tempNewIndex[i] = j1; /* Setting the correct tempNewIndex values */
             j1++;
         }
         else{
-            dataRight[j2] = kdArr->arr[i]; /* Filling the point array */
+            dataRight[j2] = kdArr->rows[i]; /* Filling the row ids array */
             tempNewIndex[i] = j2; /* Setting the correct tempNewIndex values */
             j2++;
         }
     }
-    for(int k = 0; k< kdArr->dim ; k++){
-        j1 = 0;
-        j2 = 0;
-        for(int i = 0; i< kdArr->size ; i++){
-            if(tempSplitArray[kdArr->arrIndices[k][i]]<n1){
-                aLeft[k][j1] = tempNewIndex[kdArr->arrIndices[k][i]]; /* Filling the matrix in correct order */
-                j1++;
-            }
-            else{
-                aRight[k][j2] = tempNewIndex[kdArr->arrIndices[k][i]]; /* Filling the matrix in correct order */
-                j2++;
-            }
-        }
-    }
+    SPKDArraySplitTask split = {kdArr, tempSplitArray, tempNewIndex, aLeft, aRight, n1};
+    spParallelFor(kdArr->dim, numOfThreads, spKDArraySplitDimension, &split); /* Filling the matrixes, row by row */
     free(tempSplitArray);
     free(tempNewIndex);
-    res[0] = spKDArrayInitPreSorted(dataLeft, aLeft, n1 , kdArr->dim);
-    res[1] = spKDArrayInitPreSorted(dataRight, aRight, n2 , kdArr->dim);
+    res[0] = spKDArrayInitPreSorted(kdArr->store, dataLeft, aLeft, n1 , kdArr->dim);
+    res[1] = spKDArrayInitPreSorted(kdArr->store, dataRight, aRight, n2 , kdArr->dim);
     return res;
 }
 
 /**
- * Makes a new copy of an SPPoint pointers array, base, with size elements.
+ * Makes a new copy of a row ids array, base, with size elements.
  *
- * @param base - the array of pointers to points to copy
- * @param size - the number of pointers to points
+ * @param base - the array of row ids to copy
+ * @param size - the number of row ids
  *
  * @return The copy is returned (NULL in case of allocation error)
  */
-SPPoint** spCopyPointArray(SPPoint** base, int size ){
-    int iChecker=size;
+int* spCopyRowArray(int* base, int size ){
     if(size>0 && base != NULL){
-        SPPoint **res = (SPPoint**) malloc(size*(sizeof(*res)));
+        int *res = (int*) malloc(size*(sizeof(*res)));
         if(res != NULL){
-            for(int i = 0; i < size; i++){
-                res[i] = NULL;
-                if(base[i] != NULL)
-                    res[i] = base[i];
-                if(res[i] == NULL){
-                    i = size+1;
-                    iChecker = size+1;
-                }
-            }
-            if(iChecker != size){
-				spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
-                free(res);
-                return NULL;
-            }
+            for(int i = 0; i < size; i++)
+                res[i] = base[i];
             return res;
         }
         spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
@@ -303,32 +382,22 @@ SPPoint** spCopyPointArray(SPPoint** base, int size ){
  * for temporary sorting purposes, since it would be less efficient to reallocate memory to one each time sort is called.
  *
  * @param a - the matrix of indices
- * @param data - the array of pointers to points
- * @param size - the number of pointers to points (number of columns in a)
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids
+ * @param size - the number of row ids (number of columns in a)
  * @param d - the index of the row to sort in a
  * @param tempArray - a temporary array with the same size as the row in a
  *
  * @return 1 if sort succeeded (-1 in case of error)
  */
-int spSortPointArrayByDimension(int** a , SPPoint** data, int size, int d , int* tempArray){
+int spSortPointArrayByDimension(int** a , SPFeatureStore* store, int* rows, int size, int d , int* tempArray){
     int i3 = 0; /* Counter for first group to merge */
     int i4 = 0; /* Counter for second group to merge */
     int i5 = 0; /* Counter for the result of the merge */
-    int dim = 0; /* The number of dimensions in each point */
-    if((size>0 && d>-1) && (a != NULL && data != NULL)){
-        for(int i = 0; i < size; i++){
-            if(data[i] != NULL){
-                if(i == 0)
-                    dim = spPointGetDimension((data[i]));
-                if(spPointGetDimension((data[i])) != dim){
-					spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
-                    return -1;
-                }
-            }
-            else{
-                spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
-                return -1;
-            }
+    if((size>0 && d>-1) && (a != NULL && rows != NULL && store != NULL)){
+        if(d >= spFeatureStoreGetDimension(store)){
+            spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+            return -1;
         }
         if(a[d] == NULL){
             spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
@@ -340,7 +409,7 @@ int spSortPointArrayByDimension(int** a , SPPoint** data, int size, int d , int*
                     i3 = i2;
                     i4 = i2+i;
                     for(i5 = i2;(i3 < size && i4 < size) && (i3 < i2+i && i4<i2 + i*2) ; i5++){
-                        if(spPointGetAxisCoor(data[a[d][i4]],d) < spPointGetAxisCoor(data[a[d][i3]],d)){
+                        if(spFeatureStoreGetAxisCoor(store, rows[a[d][i4]],d) < spFeatureStoreGetAxisCoor(store, rows[a[d][i3]],d)){
                             tempArray[i5] = a[d][i4]; /* Point a[d][i4] comes before point a[d][i3] in dimension d */
                             i4 = i4+1;
                         }
@@ -394,16 +463,29 @@ int spKDArrayGetSize(SPKDArray* kdA){
 }
 
 /**
- * Returns the array of points in the KD array.
+ * Returns the feature store holding the points of the KD array.
+ *
+ * @param kdA - the kd array
+ *
+ * @return The output is store.
+ */
+SPFeatureStore* spKDArrayGetStore(SPKDArray* kdA){
+    if(kdA == NULL)
+        return NULL;
+    return kdA->store;
+}
+
+/**
+ * Returns the array of row ids in the KD array.
  *
  * @param kdA - the kd array
  *
- * @return The output is arr.
+ * @return The output is rows.
  */
-SPPoint** spKDArrayGetArray(SPKDArray* kdA){
+int* spKDArrayGetRows(SPKDArray* kdA){
     if(kdA == NULL)
         return NULL;
-    return kdA->arr;
+    return kdA->rows;
 }
 
 /**
@@ -432,7 +514,7 @@ void spKDArrayDestroy(SPKDArray* kdA){
     if(kdA != NULL){
         for(int i = 0; i< kdA->dim; i++)
             free(kdA->arrIndices[i]);
-        free(kdA->arr);
+        free(kdA->rows);
         free(kdA->arrIndices);
         free(kdA);
     }
@@ -1,21 +1,27 @@
 #ifndef SPKDARRAY_H_INCLUDED
 #define SPKDARRAY_H_INCLUDED
 
+#include "SPFeatureStore.h"
+
 /**
  * SPKDArray Summary
  * Encapsulates an array of points, each having the same dimension.
+ * The points are rows of a feature store, and the KD array holds their row ids.
  * The points are ordered differently by each dimension, and each
  * possible order is saved in the KD Array as an array.
  *
  * The following functions are supported:
  *
- * spKDArrayInit            	- Initializes a KD array based on an array of points.
+ * spKDArrayInit            	- Initializes a KD array based on an array of row ids.
+ * spKDArrayInitParallel       	- Initializes a KD array, sorting the dimensions on several threads.
  * spKDArraySplit 		    	- Splits the KD array into 2 based on the ordering by a given dimension.
- * spCopyPointArray		    	- Create a new copy of the pointers in a given point array.
+ * spKDArraySplitParallel     	- Splits the KD array, filling the dimensions on several threads.
+ * spCopyRowArray		    	- Create a new copy of a given row ids array.
  * spSortPointArrayByDimension	- Orders an array of indices by a given dimension.
  * spKDArrayGetDimension		- A getter of the dimension of all the points in the KD array.
  * spKDArrayGetSize     		- A getter of the number of points in the KD array.
- * spKDArrayGetArray    		- A getter of the array of points.
+ * spKDArrayGetStore    		- A getter of the feature store holding the points.
+ * spKDArrayGetRows    		    - A getter of the array of row ids.
  * spKDArrayGetIndicesByDim 	- A getter of an array of indices as sorted by a given dimension.
  * spKDArrayDestroy     		- Frees all allocated memory in the KD Array.
  *
@@ -25,32 +31,49 @@
 typedef struct kd_array_t SPKDArray;
 
 /**
- * Initializes a new KD array based on inputed point array and size of array.
- * If d is the dimension of each point, and there are n points,
+ * Initializes a new KD array based on inputed row ids array and size of array.
+ * If d is the dimension of the store, and there are n row ids,
  * a matrix of d rows and n columns is created, each cell holding
- * an index of an SPPoint in the array.
+ * an index of a row id in the array.
  * Each row is sorted by the coordinates of the points in the row number dimension.
+ * The row ids array is copied, the store is referenced (not copied) and must outlive the KD array.
  *
- * @param arr - the array of pointers to points
- * @param size - the number of pointers to points
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids, if NULL all the rows of the store are used (size must then be the store size)
+ * @param size - the number of row ids
  *
- * @return NULL in case allocation failure occurred OR arr is NULL OR not all the dimensions are the same
+ * @return NULL in case allocation failure occurred OR store is NULL OR some row id is out of range
  * Otherwise, the new KD Array is returned
  */
-SPKDArray* spKDArrayInit(SPPoint** arr, int size);
+SPKDArray* spKDArrayInit(SPFeatureStore* store, int* rows, int size);
+
+/**
+ * Initializes a new KD array exactly like spKDArrayInit, where the d rows of the matrix
+ * are sorted on up to numOfThreads threads (each row is sorted by one thread).
+ *
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids, if NULL all the rows of the store are used (size must then be the store size)
+ * @param size - the number of row ids
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case allocation failure occurred OR store is NULL OR some row id is out of range
+ * Otherwise, the new KD Array is returned
+ */
+SPKDArray* spKDArrayInitParallel(SPFeatureStore* store, int* rows, int size, int numOfThreads);
 
 /**
  * Initializes a new KD array using the sorted matrix given as input.
  * Requires the matrix to be sorted correctly in each row.
  *
- * @param data - the array of pointers to points
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids
  * @param a - the sorted matrix of indices
- * @param size - the number of pointers to points
+ * @param size - the number of row ids
  * @param d - the dimensions of each point
  *
  * @return The new KD Array is returned (NULL in case of allocation error)
  */
-SPKDArray* spKDArrayInitPreSorted(SPPoint** data, int** a, int size , int d);
+SPKDArray* spKDArrayInitPreSorted(SPFeatureStore* store, int* rows, int** a, int size , int d);
 
 /**
  * Splits an inputed KD array in half, into 2 KD arrays.
@@ -67,14 +90,27 @@ SPKDArray* spKDArrayInitPreSorted(SPPoint** data, int** a, int size , int d);
 SPKDArray** spKDArraySplit(SPKDArray* kdArr, int coor);
 
 /**
- * Makes a new copy of an SPPoint pointers array, base, with size elements.
+ * Splits an inputed KD array in half exactly like spKDArraySplit, where the d rows of the matrices
+ * of the two new KD arrays are filled on up to numOfThreads threads (each row is filled by one thread).
+ *
+ * @param kdArr - the kd array to split
+ * @param coor - the dimension to split by (a number from 1 to d, not the index from 0 to d-1)
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return The output is an array of 2 KD Array pointers, the first being kdLeft and the second kdRight.
+ * NULL is returned in case of allocation error.
+ */
+SPKDArray** spKDArraySplitParallel(SPKDArray* kdArr, int coor, int numOfThreads);
+
+/**
+ * Makes a new copy of a row ids array, base, with size elements.
  *
- * @param base - the array of pointers to points to copy
- * @param size - the number of pointers to points
+ * @param base - the array of row ids to copy
+ * @param size - the number of row ids
  *
  * @return The copy is returned (NULL in case of allocation error)
  */
-SPPoint** spCopyPointArray(SPPoint** base, int size );
+int* spCopyRowArray(int* base, int size );
 
 /**
  * Merge sorts row number d of the inputed matrix a by the coordinates of the points in the inputed dimension.
@@ -82,14 +118,15 @@ SPPoint** spCopyPointArray(SPPoint** base, int size );
  * for temporary sorting purposes, since it would be less efficient to reallocate memory to one each time sort is called.
  *
  * @param a - the matrix of indices
- * @param data - the array of pointers to points
- * @param size - the number of pointers to points (number of columns in a)
+ * @param store - the feature store holding the points
+ * @param rows - the array of row ids
+ * @param size - the number of row ids (number of columns in a)
  * @param d - the index of the row to sort in a
  * @param tempArray - a temporary array with the same size as the row in a
  *
  * @return 1 if sort succeeded (-1 in case of error)
  */
-int spSortPointArrayByDimension(int** a , SPPoint** data, int size, int d , int* tempArray);
+int spSortPointArrayByDimension(int** a , SPFeatureStore* store, int* rows, int size, int d , int* tempArray);
 
 /**
  * Returns the dimension of the points in the KD array.
@@ -110,13 +147,22 @@ int spKDArrayGetDimension(SPKDArray* kdA);
 int spKDArrayGetSize(SPKDArray* kdA);
 
 /**
- * Returns the array of points in the KD array.
+ * Returns the feature store holding the points of the KD array.
+ *
+ * @param kdA - the kd array
+ *
+ * @return The output is store.
+ */
+SPFeatureStore* spKDArrayGetStore(SPKDArray* kdA);
+
+/**
+ * Returns the array of row ids in the KD array.
  *
  * @param kdA - the kd array
  *
- * @return The output is arr.
+ * @return The output is rows.
  */
-SPPoint** spKDArrayGetArray(SPKDArray* kdA);
+int* spKDArrayGetRows(SPKDArray* kdA);
 
 /**
  * Returns the indices of the array of points, a sorted by their dim coordinate.
@@ -2,9 +2,17 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
+#include <sys/mman.h>
 #include "SPPoint.h"
+#include "SPFeatureStore.h"
+#include "SPPQIndex.h"
+#include "SPQuantizedStore.h"
 #include "SPKDArray.h"
 #include "SPKDTree.h"
+#include "SPKDTreeInternal.h"
+#include "SPDistance.h"
+#include "SPParallel.h"
 #include "SPBPriorityQueue.h"
 #include "SPConfig.h"
 #include "SPLogger.h"
@@ -16,7 +24,7 @@
  * Each non-leaf node represents a group of points, and splits the group in half around the median coordinate
  * in a dimension chosen by one of 3 methods. The left child represents the half with the lower values in that dimension,
  * while the right child represents the group with the higher values.
- * The root node represents the full array of points. The leaves contain the points themselves.
+ * The root node represents the full array of points. The leaves contain the row ids of the points in the feature store.
  * The different splitting methods are:
  * INCREMENTAL, meaning the dimension increases by 1 for each level.
  * RANDOM, meaning the dimension is randomly selected.
@@ -24,59 +32,751 @@
  *
  * The purpose of the kd tree in this project is to easily find points that are close, in terms of distance,
  * to a target point.
+ * An SPKDTree holds the root node of the tree and the feature store the tree is built over.
+ * Alternatively (spKDTreeInitFlat), the tree is kept in a flat layout: one array of small nodes in breadth-first
+ * order, where children are found by their position in the array and the leaves are buckets of up to leafSize points,
+ * kept in consecutive rows of the feature store (the store is reordered when the tree is built).
  * The points are ordered differently by each dimension, and each
  * possible order is saved in the KD Array as an array.
  *
  * The following functions are supported:
  *
- * spKDTreeInit            	    - Initializes a KD tree based on an array of points, and splitting method.
+ * spKDTreeInit            	    - Initializes a KD tree based on a feature store, and splitting method.
  * spKDTreeInitRecursion 		- The recursion function used in spKDTreeInit.
+ * spKDTreeInitFlat        	    - Initializes a KD tree in the flat layout, with leaf buckets.
+ * spKDTreeInitFlatParallel	    - Initializes a KD tree in the flat layout, splitting on several threads.
+ * spKDTreeInitFlatInPlace	    - Initializes a KD tree in the flat layout, selecting medians in place of kd arrays.
+ * spKDTreeInitForest           - Initializes a forest of randomized KD trees in the flat layout, over one feature store.
+ * spKDTreeInitPQ               - Initializes a KD tree without nodes, searched by a product quantization index.
  * kNearestNeighboursTree		- Fills a bounded priority queue with the closest points to a target point.
  * kNearestNeighboursRecursion	- The recursion function used in kNearestNeighboursTree.
  * minDistanceSquared		    - Calculates the minimal distance from a target point to an area within defined limits.
  * spKDTreeDestroy     		    - Frees all allocated memory in a KD tree.
+ * spKDTreeNodeDestroy     		- Frees all allocated memory in a KD subtree.
+ * spKDTreeGetStore     		- A getter of the feature store of a KD tree.
+ * spKDTreeSetSearch    		- Sets the search function used by closestImagesSearch.
  * fullKDTreeCreator    		- Initializes a KD tree containing the features of all the images. Uses spKDTreeInit.
  * closestImagesSearch 	        - Finds the closest points to all features of a target image, and returns the indices
- *                                of the images with the highest number of similar features. Uses kNearestNeighboursTree.
+ *                                of the images with the highest number of similar features. Uses the search function
+ *                                of the tree (kNearestNeighboursTree unless set by spKDTreeSetSearch).
  *
  * kNearestNeighbours     		- Unused in main project, used for checking
  *
  */
 
-/** Type for defining the tree node **/
-struct kd_tree_node_t {
-	SPPoint* data; /* If the node is a leaf, data is the pointer to the point it represents */
-	SPKDTreeNode* left; /* The left child node */
-	SPKDTreeNode* right; /* The right child node */
-	int dim; /* The dimension which the kd array was split by at this node */
-	double val; /* The median value around which the kd array was split by at this node */
-};
+/**
+ * Chooses the dimension to split a kd array by, using splitMethod.
+ * INCREMENTAL adds 1 to the previous split dimension, RANDOM chooses a random dimension and
+ * MAX_SPREAD chooses the dimension with the largest range of points.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param kdA - the kd array to split (of at least 2 points)
+ * @param coorSplit - the previous split dimension (used in the INCREMENTAL method)
+ *
+ * @return The split dimension, between 1 and the dimension of kdA
+ */
+static int spKDTreeSplitDimension(KD_METHOD splitMethod, SPKDArray* kdA, int coorSplit){
+	int n = spKDArrayGetSize(kdA);
+	int d = spKDArrayGetDimension(kdA);
+	SPFeatureStore* store = spKDArrayGetStore(kdA);
+	int* rows = spKDArrayGetRows(kdA);
+	if(splitMethod == INCREMENTAL) /* INCREMENTAL method (adds 1 to previous coorSplit) */
+	{
+		coorSplit = coorSplit+1;
+		if(coorSplit > d)
+			coorSplit = 1;
+	}
+	if(splitMethod == RANDOM) /* RANDOM method (random coorSplit) */
+	{
+		coorSplit = (rand() % d) + 1;
+	}
+	if(splitMethod == MAX_SPREAD) /* MAX_SPREAD method (coorSplit will be the dimension with the largest range of points) */
+	{
+        double maxSpread = 0;
+        double currentSpread = 0;
+		coorSplit = 1;
+		for(int i = 0; i<d; i++){
+			currentSpread = spFeatureStoreGetAxisCoor(store, rows[(spKDArrayGetIndicesByDim(kdA, i+1))[n-1]],i) - spFeatureStoreGetAxisCoor(store, rows[(spKDArrayGetIndicesByDim(kdA, i+1))[0]],i);
+			if(maxSpread < currentSpread){
+				maxSpread = currentSpread;
+				coorSplit = i+1;
+			}
+		}
+	}
+	return coorSplit;
+}
+
+/**
+ * Returns the median value a kd array is split around in dimension coorSplit:
+ * the coordinate of the middle point (index medianIndex in the order of dimension coorSplit).
+ *
+ * @param kdA - the kd array to split (of at least 2 points)
+ * @param coorSplit - the split dimension
+ *
+ * @return The median value
+ */
+static double spKDTreeSplitValue(SPKDArray* kdA, int coorSplit){
+	int n = spKDArrayGetSize(kdA);
+	int medianIndex = n;
+	if(n % 2 == 1)
+		medianIndex = medianIndex-1;
+	medianIndex = (int)(medianIndex/2);
+	return spFeatureStoreGetAxisCoor(spKDArrayGetStore(kdA), spKDArrayGetRows(kdA)[(spKDArrayGetIndicesByDim(kdA, coorSplit))[medianIndex]], coorSplit-1);
+}
+
+SPKDTree* spKDTreeAlloc(SPFeatureStore* store, int leafSize){
+	SPKDTree* tree = (SPKDTree*) calloc(1, sizeof(*tree));
+	if(tree == NULL)
+		return NULL;
+	tree->store = store;
+	tree->numOfTrees = 1;
+	tree->leafSize = leafSize;
+	tree->search = kNearestNeighboursTree;
+	return tree;
+}
 
 /**
- * Initializes a new KD tree based on inputed point array and size of array.
- * First, a kd array is created, then it is split recursively using splitMethod to determine next split dimension.
+ * Initializes a new KD tree based on inputed feature store.
+ * First, a kd array of all the rows of the store is created, then it is split recursively using splitMethod to
+ * determine next split dimension.
  * A new tree node is created with each split, saving the split dimension and the median value in that dimension,
  * which the array split around. The left child of the node is the node created with the left kd array after the split,
  * and the right child of the node is the node created with the right kd array after the split.
  * When the recursive function is called for a kd array of 1 point, it is a leaf and
- * saves the pointer to the point.
+ * saves the row id of the point.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param store - the feature store holding the points
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInit(KD_METHOD splitMethod , SPFeatureStore* store){
+	if(store == NULL || spFeatureStoreGetSize(store) < 1){
+        spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	SPKDTree* tree = spKDTreeAlloc(store, 1);
+	if(tree == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	SPKDArray* kdA = spKDArrayInit(store, NULL, spFeatureStoreGetSize(store));
+	if(kdA != NULL)
+		tree->root = spKDTreeInitRecursion(splitMethod, kdA, 0);
+	if(tree->root == NULL){
+		spKDTreeDestroy(tree);
+		return NULL;
+	}
+    return tree;
+}
+
+/**
+ * Returns the number of nodes of a flat subtree of n points, where subtrees of at most leafSize points are leaves.
+ * The left subtree gets the larger half of the points, as in spKDArraySplit.
+ *
+ * @param n - the number of points
+ * @param leafSize - the maximal number of points in a leaf
+ *
+ * @return The number of nodes
+ */
+static int spKDTreeFlatNumOfNodes(int n, int leafSize){
+	if(n <= leafSize)
+		return 1;
+	return 1 + spKDTreeFlatNumOfNodes(n - n/2, leafSize) + spKDTreeFlatNumOfNodes(n/2, leafSize);
+}
+
+/**
+ * The arguments of the tasks splitting the kd arrays of one level of a flat tree (spKDTreeInitFlatParallel).
+ * The children of the nodes split in the level are positions first ... first+2*numOfTasks-1 of pending,
+ * and task j splits the kd array of the parent of the pair first+2j, first+2j+1.
+ */
+typedef struct kd_tree_flat_level_t {
+	SPKDArray** pending; /* pending[c] is the kd array of the parent of c until it is split, then the kd array of c */
+	int* pendingSplit; /* pendingSplit[c] is the split dimension of the parent of c */
+	int first; /* The position of the first child of the level */
+	int numOfThreads; /* The number of threads each split may use */
+} SPKDTreeFlatLevel;
+
+/**
+ * Splits the kd array of the j-th node split in a level of a flat tree, and puts the halves in the
+ * positions of its children in pending (NULL on failure). The kd array of the node is freed.
+ * A task of spParallelFor.
+ *
+ * @param arg - the SPKDTreeFlatLevel of the level
+ * @param j - the number of the split in the level
+ */
+static void spKDTreeFlatSplitTask(void* arg, int j){
+	SPKDTreeFlatLevel* level = (SPKDTreeFlatLevel*) arg;
+	int child = level->first + 2*j;
+	SPKDArray* kdA = level->pending[child];
+	SPKDArray** kdASplit = spKDArraySplitParallel(kdA, level->pendingSplit[child], level->numOfThreads);
+	level->pending[child] = kdASplit != NULL ? kdASplit[0] : NULL;
+	level->pending[child+1] = kdASplit != NULL ? kdASplit[1] : NULL;
+	free(kdASplit);
+	spKDArrayDestroy(kdA);
+}
+
+/**
+ * Initializes a new KD tree in the flat layout based on inputed feature store.
+ * Same as spKDTreeInitFlatParallel with one thread.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitFlat(KD_METHOD splitMethod, SPFeatureStore* store, int leafSize){
+	return spKDTreeInitFlatParallel(splitMethod, store, leafSize, 1);
+}
+
+/**
+ * Initializes a new KD tree in the flat layout based on inputed feature store.
+ * The kd array of all the rows of the store is split as in spKDTreeInit, but breadth-first, level by level:
+ * the kd arrays waiting to be split are kept in a queue, in the order of their nodes in the node array.
+ * The children of a node are added to the end of the queue together, so they are adjacent in the array,
+ * and the node saves the position of the left child.
+ * A kd array of at most leafSize points is not split, it becomes a leaf holding a bucket of its points.
+ * The nodes of a level are first visited in order on the calling thread, choosing their split dimensions
+ * and median values (so the RANDOM method draws the same dimensions with any number of threads), and then
+ * their kd arrays are split on up to numOfThreads threads. When a level has fewer nodes than threads,
+ * the dimensions of each kd array are split on several threads too.
+ * When the tree is built, the rows of the store are reordered in the order of the leaves, so the points of
+ * every bucket are consecutive rows and a leaf only saves the first row of its bucket.
+ * All the nodes are allocated in one block, which spKDTreeDestroy frees at once.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitFlatParallel(KD_METHOD splitMethod, SPFeatureStore* store, int leafSize, int numOfThreads){
+	if(store == NULL || spFeatureStoreGetSize(store) < 1 || leafSize < 1){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	if(numOfThreads < 1)
+		numOfThreads = 1;
+	int n = spFeatureStoreGetSize(store);
+	int numOfNodes = spKDTreeFlatNumOfNodes(n, leafSize);
+	SPKDTree* tree = spKDTreeAlloc(store, leafSize);
+	SPKDArray** pending = (SPKDArray**) calloc(numOfNodes, sizeof(*pending)); /* pending[i] is the kd array of node i, until it is split */
+	int* pendingSplit = (int*) malloc(numOfNodes * sizeof(int)); /* pendingSplit[i] is the split dimension of the parent of node i */
+	int* order = (int*) malloc(n * sizeof(int)); /* order[i] is the row id of the i-th point in the leaves */
+	SPKDTreeFlatNode* nodes = (SPKDTreeFlatNode*) malloc(numOfNodes * sizeof(SPKDTreeFlatNode));
+	if(tree == NULL || pending == NULL || pendingSplit == NULL || order == NULL || nodes == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(tree);
+        free(pending);
+        free(pendingSplit);
+        free(order);
+        free(nodes);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	tree->nodes = nodes;
+	tree->numOfNodes = numOfNodes;
+
+	int head = 0, tail = 1, numOfIds = 0;
+	pending[0] = spKDArrayInitParallel(store, NULL, n, numOfThreads);
+	pendingSplit[0] = 0;
+	bool success = (pending[0] != NULL);
+	while(success && head < tail){ /* One level of the tree - nodes head ... levelEnd-1 */
+		int levelEnd = tail;
+		for(; head < levelEnd; head++){
+			SPKDArray* kdA = pending[head];
+			SPKDTreeFlatNode* node = tree->nodes + head;
+			int size = spKDArrayGetSize(kdA);
+			if(size <= leafSize){ /* Leaf initialisation - the bucket will be rows numOfIds ... numOfIds+size-1 */
+				int* rows = spKDArrayGetRows(kdA);
+				node->val = 0;
+				node->dim = -size;
+				node->child = numOfIds;
+				for(int i = 0; i < size; i++)
+					order[numOfIds++] = rows[i];
+				spKDArrayDestroy(kdA);
+			}
+			else{
+				int coorSplit = spKDTreeSplitDimension(splitMethod, kdA, pendingSplit[head]);
+				node->val = spKDTreeSplitValue(kdA, coorSplit);
+				node->dim = coorSplit;
+				node->child = tail;
+				pending[tail] = kdA; /* The children are added to the queue together, and wait for the split of kdA */
+				pendingSplit[tail] = coorSplit;
+				pendingSplit[tail+1] = coorSplit;
+				tail = tail+2;
+			}
+			pending[head] = NULL;
+		}
+		int numOfSplits = (tail - levelEnd)/2; /* Split the kd arrays of the level, sharing the threads between them */
+		int threadsPerSplit = (numOfSplits > 0 && numOfSplits < numOfThreads) ? numOfThreads/numOfSplits : 1;
+		SPKDTreeFlatLevel level = {pending, pendingSplit, levelEnd, threadsPerSplit};
+		spParallelFor(numOfSplits, numOfThreads, spKDTreeFlatSplitTask, &level);
+		for(int i = levelEnd; i < tail; i++)
+			success = success && pending[i] != NULL;
+	}
+	success = success && head == numOfNodes && numOfIds == n;
+	for(int i = 0; i < tail; i++) /* Release the kd arrays left after a failure */
+		spKDArrayDestroy(pending[i]);
+	free(pending);
+	free(pendingSplit);
+	if(success && spFeatureStoreReorder(store, order) == -1) /* Make the buckets consecutive rows */
+		success = false;
+	free(order);
+	if(!success){
+		spKDTreeDestroy(tree);
+		return NULL;
+	}
+    return tree;
+}
+
+/** The arguments of the tasks splitting the nodes of one level of an in-place flat tree (spKDTreeInitFlatInPlace) **/
+typedef struct kd_tree_in_place_level_t {
+	SPFeatureStore* store; /* The feature store the tree is built over */
+	SPKDTreeFlatNode* nodes; /* The node array of the tree being built */
+	int* perm; /* The permutation of the row ids, the points of node i are perm[first[i]] ... perm[first[i]+size[i]-1] */
+	int* first; /* first[i] is the position of the first point of node i in perm */
+	int* size; /* size[i] is the number of points of node i */
+	int* splits; /* splits[j] is the position of the j-th node split in the level */
+	int* draws; /* draws[j] is the random draw of the j-th node split in the level (randomized trees) */
+	KD_METHOD splitMethod;
+	bool randomized; /* The split dimension is drawn from the dimensions of highest variance (see spKDTreeInitForest) */
+} SPKDTreeInPlaceLevel;
+
+/**
+ * The coordinates block of the store of an in-place build, of either precision (exactly one of data and floatData is set).
+ */
+typedef struct sp_kd_tree_coordinates_t {
+	const double* data; /* The block of a float64 store */
+	const float* floatData; /* The block of a float32 store */
+	int stride; /* The padded length of a row */
+} SPKDTreeCoordinates;
+
+/**
+ * A getter of coordinate axis of row row of the block. The precision is the same for the whole build,
+ * so the branch is always predicted.
+ */
+static inline double spKDTreeCoor(const SPKDTreeCoordinates* coords, int row, int axis){
+	size_t i = (size_t) row * coords->stride + axis;
+	return coords->data != NULL ? coords->data[i] : coords->floatData[i];
+}
+
+/**
+ * Compares two points of the store by coordinate axis, and by row id if the coordinates are equal.
+ * This is the order of the rows of a kd array (sorted by a stable merge sort of ascending row ids).
+ *
+ * @return true if row a comes before row b
+ */
+static bool spKDTreePointLess(const SPKDTreeCoordinates* coords, int axis, int a, int b){
+	double va = spKDTreeCoor(coords, a, axis), vb = spKDTreeCoor(coords, b, axis);
+	return va < vb || (va == vb && a < b);
+}
+
+/**
+ * Sifts perm[p] down the heap perm[0] ... perm[end-1] (ordered by spKDTreePointLess, largest first).
+ */
+static void spKDTreeSiftDown(int* perm, int p, int end, const SPKDTreeCoordinates* coords, int axis){
+	for(int c = 2*p+1; c < end; p = c, c = 2*c+1){
+		if(c+1 < end && spKDTreePointLess(coords, axis, perm[c], perm[c+1]))
+			c++;
+		if(!spKDTreePointLess(coords, axis, perm[p], perm[c]))
+			return;
+		int tmp = perm[p]; perm[p] = perm[c]; perm[c] = tmp;
+	}
+}
+
+/**
+ * Sorts perm[0] ... perm[size-1] by spKDTreePointLess (heap sort). The fallback of spKDTreeSelect.
+ */
+static void spKDTreeHeapSort(int* perm, int size, const SPKDTreeCoordinates* coords, int axis){
+	for(int i = size/2 - 1; i >= 0; i--)
+		spKDTreeSiftDown(perm, i, size, coords, axis);
+	for(int end = size-1; end > 0; end--){ /* Move the largest point to the end */
+		int tmp = perm[0]; perm[0] = perm[end]; perm[end] = tmp;
+		spKDTreeSiftDown(perm, 0, end, coords, axis);
+	}
+}
+
+/**
+ * Reorders perm[0] ... perm[size-1] so that perm[k] is the point that would be in position k if they were sorted
+ * by spKDTreePointLess, the points before it come before it and the points after it come after it (introselect:
+ * quickselect with a median of 3 pivot, which falls back to heap sort after 2*log2(size) partitions).
+ */
+static void spKDTreeSelect(int* perm, int size, int k, const SPKDTreeCoordinates* coords, int axis){
+	int lo = 0, hi = size-1, depthLimit = 0;
+	for(int i = size; i > 1; i = i/2)
+		depthLimit = depthLimit+2;
+	while(hi > lo){
+		if(depthLimit-- == 0){
+			spKDTreeHeapSort(perm + lo, hi-lo+1, coords, axis);
+			return;
+		}
+		int a = perm[lo], b = perm[lo + (hi-lo)/2], c = perm[hi], pivot = b; /* Median of 3 */
+		if(spKDTreePointLess(coords, axis, a, b) != spKDTreePointLess(coords, axis, a, c))
+			pivot = a;
+		else if(spKDTreePointLess(coords, axis, c, a) != spKDTreePointLess(coords, axis, c, b))
+			pivot = c;
+		int i = lo, j = hi;
+		while(i <= j){ /* Partition around the pivot - all the keys are distinct */
+			while(spKDTreePointLess(coords, axis, perm[i], pivot))
+				i++;
+			while(spKDTreePointLess(coords, axis, pivot, perm[j]))
+				j--;
+			if(i <= j){
+				int tmp = perm[i]; perm[i] = perm[j]; perm[j] = tmp;
+				i++;
+				j--;
+			}
+		}
+		if(k <= j)
+			hi = j;
+		else if(k >= i)
+			lo = i;
+		else
+			return;
+	}
+}
+
+/**
+ * Compares two row ids (for qsort).
+ */
+static int spKDTreeCompareRows(const void* a, const void* b){
+	return (*(const int*) a > *(const int*) b) - (*(const int*) a < *(const int*) b);
+}
+
+/**
+ * Chooses the split dimension of the points perm[0] ... perm[n-1] of a node of a randomized tree: the dimensions
+ * are ranked by the variance of the points, and the dimension ranked draw % SP_KDTREE_FOREST_SPLIT_DIMENSIONS
+ * (among the dimensions of highest variance) is chosen.
+ *
+ * @return The split dimension, between 1 and the dimension of the store
+ */
+static int spKDTreeRandomizedDimension(const SPKDTreeCoordinates* coords, int d, const int* perm, int n, int draw){
+	int top[SP_KDTREE_FOREST_SPLIT_DIMENSIONS]; /* The dimensions of highest variance, highest first */
+	double topVariance[SP_KDTREE_FOREST_SPLIT_DIMENSIONS];
+	int numOfTop = 0;
+	for(int i = 0; i < d; i++){
+		double mean = 0, variance = 0;
+		for(int p = 0; p < n; p++)
+			mean = mean + spKDTreeCoor(coords, perm[p], i);
+		mean = mean / n;
+		for(int p = 0; p < n; p++)
+			variance = variance + (spKDTreeCoor(coords, perm[p], i) - mean)*(spKDTreeCoor(coords, perm[p], i) - mean);
+		int k = numOfTop < SP_KDTREE_FOREST_SPLIT_DIMENSIONS ? numOfTop++ : SP_KDTREE_FOREST_SPLIT_DIMENSIONS;
+		for(; k > 0 && topVariance[k-1] < variance; k--){ /* Insert dimension i in its place in top */
+			if(k < SP_KDTREE_FOREST_SPLIT_DIMENSIONS){
+				top[k] = top[k-1];
+				topVariance[k] = topVariance[k-1];
+			}
+		}
+		if(k < SP_KDTREE_FOREST_SPLIT_DIMENSIONS){
+			top[k] = i+1;
+			topVariance[k] = variance;
+		}
+	}
+	return top[draw % numOfTop];
+}
+
+/**
+ * Splits the j-th node split in a level of an in-place flat tree (a task of spParallelFor).
+ * The MAX_SPREAD split dimension is chosen by the range of the points of the node in every dimension,
+ * and the split dimension of a randomized tree by spKDTreeRandomizedDimension,
+ * then the points are selected around the median, so the first half of the range of the node holds the
+ * points of the left child. The node saves the split dimension and the median value, like spKDTreeSplitValue.
+ *
+ * @param arg - the SPKDTreeInPlaceLevel of the level
+ * @param j - the number of the split in the level
+ */
+static void spKDTreeInPlaceSplitTask(void* arg, int j){
+	SPKDTreeInPlaceLevel* level = (SPKDTreeInPlaceLevel*) arg;
+	SPKDTreeFlatNode* node = level->nodes + level->splits[j];
+	SPKDTreeCoordinates coords = {spFeatureStoreGetData(level->store), spFeatureStoreGetDataFloat(level->store),
+			spFeatureStoreGetStride(level->store)};
+	int* perm = level->perm + level->first[level->splits[j]];
+	int n = level->size[level->splits[j]];
+	if(level->randomized)
+		node->dim = spKDTreeRandomizedDimension(&coords, spFeatureStoreGetDimension(level->store), perm, n, level->draws[j]);
+	else if(level->splitMethod == MAX_SPREAD){ /* coorSplit is the dimension with the largest range of points */
+		double maxSpread = 0;
+		node->dim = 1;
+		for(int i = 0; i < spFeatureStoreGetDimension(level->store); i++){
+			double low = spKDTreeCoor(&coords, perm[0], i), high = low;
+			for(int p = 1; p < n; p++){
+				double coor = spKDTreeCoor(&coords, perm[p], i);
+				low = coor < low ? coor : low;
+				high = coor > high ? coor : high;
+			}
+			if(maxSpread < high - low){
+				maxSpread = high - low;
+				node->dim = i+1;
+			}
+		}
+	}
+	int medianIndex = (n % 2 == 1 ? n-1 : n)/2; /* As in spKDTreeSplitValue */
+	spKDTreeSelect(perm, n, medianIndex, &coords, node->dim - 1);
+	node->val = spKDTreeCoor(&coords, perm[medianIndex], node->dim - 1);
+}
+
+/**
+ * Builds the nodes of one in-place flat tree (see spKDTreeInitFlatInPlace) over the rows perm[0] ... perm[n-1]
+ * of store. perm is reordered so the points of every leaf bucket are a range of it, by ascending row id, and every
+ * leaf saves the position of its range in perm. The positions of the children and of the buckets start at 0.
+ * The split dimensions of a randomized tree are drawn by spKDTreeRandomizedDimension, with the random numbers
+ * drawn on the calling thread in the order of the nodes, like the RANDOM dimensions.
+ *
+ * @param store - the feature store holding the points
+ * @param nodes - an array of spKDTreeFlatNumOfNodes(n, leafSize) nodes
+ * @param perm - the row ids of the points, n of them
+ * @param splitMethod - the method used to determine the split dimension (unless randomized)
+ * @param randomized - true to draw the split dimensions from the dimensions of highest variance
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return false in case of allocation failure occurred, true otherwise
+ */
+static bool spKDTreeInPlaceBuild(SPFeatureStore* store, SPKDTreeFlatNode* nodes, int* perm, KD_METHOD splitMethod, bool randomized, int leafSize, int numOfThreads){
+	int n = spFeatureStoreGetSize(store);
+	int d = spFeatureStoreGetDimension(store);
+	int numOfNodes = spKDTreeFlatNumOfNodes(n, leafSize);
+	int* first = (int*) malloc(numOfNodes * sizeof(int));
+	int* size = (int*) malloc(numOfNodes * sizeof(int));
+	int* splits = (int*) malloc((numOfNodes/2 + 1) * sizeof(int));
+	int* draws = (int*) malloc((numOfNodes/2 + 1) * sizeof(int));
+	if(first == NULL || size == NULL || splits == NULL || draws == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(first);
+        free(size);
+        free(splits);
+        free(draws);
+		return false;
+	}
+	first[0] = 0;
+	size[0] = n;
+	nodes[0].dim = 0; /* Until a node is visited, dim is the split dimension of its parent */
+	int head = 0, tail = 1;
+	while(head < tail){ /* One level of the tree - nodes head ... levelEnd-1 */
+		int levelEnd = tail, numOfSplits = 0;
+		for(; head < levelEnd; head++){
+			SPKDTreeFlatNode* node = nodes + head;
+			if(size[head] <= leafSize){ /* Leaf - the bucket is its range of the permutation, by ascending row id */
+				qsort(perm + first[head], size[head], sizeof(int), spKDTreeCompareRows);
+				node->val = 0;
+				node->dim = -size[head];
+				node->child = first[head];
+				continue;
+			}
+			if(randomized)
+				draws[numOfSplits] = rand();
+			else if(splitMethod == INCREMENTAL) /* The split dimensions as in spKDTreeSplitDimension, MAX_SPREAD is chosen by the task */
+				node->dim = node->dim % d + 1;
+			else if(splitMethod == RANDOM)
+				node->dim = (rand() % d) + 1;
+			node->child = tail; /* The left child gets the larger half, as in spKDArraySplit */
+			first[tail] = first[head];
+			size[tail] = size[head] - size[head]/2;
+			first[tail+1] = first[head] + size[tail];
+			size[tail+1] = size[head]/2;
+			nodes[tail].dim = node->dim;
+			nodes[tail+1].dim = node->dim;
+			tail = tail+2;
+			splits[numOfSplits++] = head;
+		}
+		SPKDTreeInPlaceLevel level = {store, nodes, perm, first, size, splits, draws, splitMethod, randomized};
+		spParallelFor(numOfSplits, numOfThreads, spKDTreeInPlaceSplitTask, &level);
+	}
+	free(first);
+	free(size);
+	free(splits);
+	free(draws);
+	return true;
+}
+
+/**
+ * Initializes a new KD tree in the flat layout based on inputed feature store, without kd arrays.
+ * The tree is the same tree spKDTreeInitFlatParallel builds (the same nodes, and the same points in every leaf bucket),
+ * but the points are kept in one permutation of the row ids instead of a sorted matrix of indices for every node.
+ * The points of a node are a range of the permutation. A node is split by selecting its median point in the split
+ * dimension (introselect, O(size) on average), so that the points of the left child are the first half of the range
+ * and the points of the right child are the second half - the points are ordered by their coordinate and then
+ * by their row id, which is the order of the points in a kd array.
+ * MAX_SPREAD finds the range of the points in every dimension by scanning them.
+ * The extra memory is the permutation and a few integers for every node, instead of d+1 integers for every
+ * point in every level of the tree.
+ * The tree is built level by level, and the nodes of a level are split on up to numOfThreads threads (the RANDOM
+ * dimensions are drawn on the calling thread in the order of the nodes).
+ * When the tree is built, the rows of the store are reordered in the order of the permutation, so the points
+ * of every leaf bucket are consecutive rows (by ascending original row id).
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
  *
  * @param splitMethod - the method used to determine the split dimension
- * @param pointsArray - the array of pointers to points
- * @param pointsArraySize - the number of pointers to points
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitFlatInPlace(KD_METHOD splitMethod, SPFeatureStore* store, int leafSize, int numOfThreads){
+	if(store == NULL || spFeatureStoreGetSize(store) < 1 || leafSize < 1){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	int n = spFeatureStoreGetSize(store);
+	int numOfNodes = spKDTreeFlatNumOfNodes(n, leafSize);
+	SPKDTree* tree = spKDTreeAlloc(store, leafSize);
+	int* perm = (int*) malloc(n * sizeof(int));
+	SPKDTreeFlatNode* nodes = (SPKDTreeFlatNode*) malloc(numOfNodes * sizeof(SPKDTreeFlatNode));
+	if(tree == NULL || perm == NULL || nodes == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(tree);
+        free(perm);
+        free(nodes);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	tree->nodes = nodes;
+	tree->numOfNodes = numOfNodes;
+
+	for(int i = 0; i < n; i++)
+		perm[i] = i;
+	if(!spKDTreeInPlaceBuild(store, nodes, perm, splitMethod, false, leafSize, numOfThreads) ||
+			spFeatureStoreReorder(store, perm) == -1){ /* Make the buckets consecutive rows */
+		free(perm);
+		spKDTreeDestroy(tree);
+		return NULL;
+	}
+	free(perm);
+    return tree;
+}
+
+/**
+ * Initializes a new forest of numOfTrees randomized KD trees in the flat layout, over one feature store.
+ * Every tree is built like spKDTreeInitFlatInPlace, but the split dimension of every node is drawn at random
+ * from the SP_KDTREE_FOREST_SPLIT_DIMENSIONS dimensions in which its points have the highest variance, so the
+ * trees split the points differently. The points are split around the median, as in the other layouts.
+ * The nodes of all the trees are kept in one array, tree t in positions t*numOfNodes ... (t+1)*numOfNodes-1.
+ * The store is reordered by the leaves of the first tree, so the first tree is an ordinary flat tree, searched
+ * like one by the exact searches. The leaf buckets of the other trees are ranges of an array of row ids.
+ * The best-bin-first search (see spKDTreeSetMaxLeafChecks) searches all the trees together.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfTrees - the number of trees
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1 OR numOfTrees < 1
+ * Otherwise, the new forest is returned
+ */
+SPKDTree* spKDTreeInitForest(SPFeatureStore* store, int leafSize, int numOfTrees, int numOfThreads){
+	if(store == NULL || spFeatureStoreGetSize(store) < 1 || leafSize < 1 || numOfTrees < 1){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	int n = spFeatureStoreGetSize(store);
+	int numOfNodes = spKDTreeFlatNumOfNodes(n, leafSize);
+	SPKDTree* tree = spKDTreeAlloc(store, leafSize);
+	int* rows = (int*) malloc((size_t) numOfTrees * n * sizeof(int)); /* The permutation of every tree */
+	int* newRows = (int*) malloc(n * sizeof(int)); /* newRows[i] is the row of row i after the store is reordered */
+	SPKDTreeFlatNode* nodes = (SPKDTreeFlatNode*) malloc((size_t) numOfTrees * numOfNodes * sizeof(SPKDTreeFlatNode));
+	if(tree == NULL || rows == NULL || newRows == NULL || nodes == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(tree);
+        free(rows);
+        free(newRows);
+        free(nodes);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	tree->nodes = nodes;
+	tree->numOfNodes = numOfNodes;
+	tree->numOfTrees = numOfTrees;
+	tree->rows = rows;
+
+	bool success = true;
+	for(int t = 0; success && t < numOfTrees; t++){
+		int* perm = rows + (size_t) t * n;
+		for(int i = 0; i < n; i++)
+			perm[i] = i;
+		success = spKDTreeInPlaceBuild(store, nodes + (size_t) t * numOfNodes, perm, MAX_SPREAD, true, leafSize, numOfThreads);
+	}
+	for(int i = 0; success && i < n; i++)
+		newRows[rows[i]] = i;
+	if(!success || spFeatureStoreReorder(store, rows) == -1){ /* Make the buckets of the first tree consecutive rows */
+		free(newRows);
+		spKDTreeDestroy(tree);
+		return NULL;
+	}
+	for(int t = 1; t < numOfTrees; t++){ /* The positions of the other trees, in the arrays of the forest */
+		int* perm = rows + (size_t) t * n;
+		for(int i = 0; i < n; i++)
+			perm[i] = newRows[perm[i]];
+		for(int i = 0; i < numOfNodes; i++){
+			SPKDTreeFlatNode* node = nodes + (size_t) t * numOfNodes + i;
+			if(node->dim < 0) /* Leaf - its bucket by ascending row id, as in the first tree */
+				qsort(perm + node->child, -node->dim, sizeof(int), spKDTreeCompareRows);
+			node->child = node->child + (node->dim < 0 ? t * n : t * numOfNodes);
+		}
+	}
+	free(newRows);
+    return tree;
+}
+
+/**
+ * Initializes a new KD tree without nodes, searched only by a product quantization index of the inputed feature
+ * store (see spKDTreeSetPQIndex) - no tree is built, and its search contexts and search function (kNearestNeighboursPQ)
+ * scan the codes of the index. The index has numOfSubspaces bytes for every point, and is trained on up to
+ * SP_PQ_INDEX_TRAINING_ROWS points on up to numOfThreads threads.
+ * If numOfCandidates is positive, the numOfCandidates closest points by the index are re-ranked by their exact
+ * distances, so the coordinates are kept. Otherwise the coordinates are freed once the points are encoded
+ * (see spFeatureStoreReleaseData), and only the codes and the image indices of the points stay in memory.
+ * The exact and best-bin-first searches, the quantized codes and the index file need nodes, so they fail on the tree,
+ * and its index can't be replaced.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param store - the feature store holding the points
+ * @param numOfSubspaces - the number of subspaces, between 1 and the dimension of the store
+ * @param numOfCandidates - the number of candidates re-ranked by their exact distances, 0 (or less) to keep the
+ * approximate distances and free the coordinates
+ * @param numOfThreads - the maximal number of threads building the index
  *
- * @return NULL in case of allocation failure occurred OR pointsArray is NULL
- * Otherwise, the root node of the new tree is returned
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR numOfSubspaces is out of range
+ * Otherwise, the new tree is returned
  */
-SPKDTreeNode* spKDTreeInit(KD_METHOD splitMethod , SPPoint** pointsArray, int pointsArraySize){
-	if(pointsArray == NULL || pointsArraySize < 1){
+SPKDTree* spKDTreeInitPQ(SPFeatureStore* store, int numOfSubspaces, int numOfCandidates, int numOfThreads){
+	if(store == NULL || spFeatureStoreGetSize(store) < 1){
         spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
+        spFeatureStoreDestroy(store);
+		return NULL;
+	}
+	SPKDTree* tree = spKDTreeAlloc(store, 1);
+	if(tree == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        spFeatureStoreDestroy(store);
 		return NULL;
 	}
-	SPKDArray* kdA = spKDArrayInit(pointsArray, pointsArraySize);
-	if(kdA == NULL)
+	if(numOfSubspaces < 1 || spKDTreeSetPQIndex(tree, numOfSubspaces, numOfCandidates, numOfThreads) == -1){
+        if(numOfSubspaces < 1)
+            spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		spKDTreeDestroy(tree);
 		return NULL;
-    return spKDTreeInitRecursion (splitMethod, kdA, 0);
+	}
+	tree->search = kNearestNeighboursPQ;
+	if(tree->pqCandidates == 0) /* Only the codes are read by the search */
+		spFeatureStoreReleaseData(store);
+    return tree;
 }
 
 /**
@@ -95,6 +795,7 @@ SPKDTreeNode* spKDTreeInitRecursion(KD_METHOD splitMethod , SPKDArray* kdA, int
 	SPKDTreeNode* newNode = (SPKDTreeNode*) malloc(sizeof(*newNode));
 	if(newNode == NULL){
         spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        spKDArrayDestroy(kdA);
 		return NULL;
 	}
 	if(spKDArrayGetSize(kdA) == 1){ /* Leaf initialisation */
@@ -102,96 +803,223 @@ SPKDTreeNode* spKDTreeInitRecursion(KD_METHOD splitMethod , SPKDArray* kdA, int
 		newNode->right = NULL;
 		newNode->dim = -1;
 		newNode->val = 0;
-		newNode->data = (spKDArrayGetArray(kdA))[0];
+		newNode->row = (spKDArrayGetRows(kdA))[0];
 		spKDArrayDestroy(kdA);
 	}
 	else{
-		int n = spKDArrayGetSize(kdA);
-		int d = spKDArrayGetDimension(kdA);
-		if(splitMethod == INCREMENTAL) /* INCREMENTAL method (adds 1 to previous coorSplit) */
-		{
-			coorSplit = coorSplit+1;
-			if(coorSplit > d)
-				coorSplit = 1;
-		}
-		if(splitMethod == RANDOM) /* RANDOM method (random coorSplit) */
-		{
-			coorSplit = (rand() % d) + 1;
-		}
-		if(splitMethod == MAX_SPREAD) /* MAX_SPREAD method (coorSplit will be the dimension with the largest range of points) */
-		{
-            double maxSpread = 0;
-            double currentSpread = 0;
-			coorSplit = 1;
-			for(int i = 0; i<d; i++){
-				currentSpread = spPointGetAxisCoor((spKDArrayGetArray(kdA))[(spKDArrayGetIndicesByDim(kdA, i+1))[n-1]],i) - spPointGetAxisCoor((spKDArrayGetArray(kdA))[(spKDArrayGetIndicesByDim(kdA, i+1))[0]],i);
-				if(maxSpread < currentSpread){
-					maxSpread = currentSpread;
-					coorSplit = i+1;
-				}
-			}
-		}
+		coorSplit = spKDTreeSplitDimension(splitMethod, kdA, coorSplit);
 		SPKDArray** kdASplit = spKDArraySplit(kdA, coorSplit); /* Split the array by dimension coorSplit */
+		if(kdASplit == NULL){
+			free(newNode);
+			spKDArrayDestroy(kdA);
+			return NULL;
+		}
 		newNode->dim = coorSplit;
-		int medianIndex = n;
-		if(n % 2 == 1)
-			medianIndex = medianIndex-1;
-		medianIndex = (int)(medianIndex/2); /* newNode->val is set as the coordinate of the middle point (index medianIndex) in dimension coorSplit */
-		newNode->val = spPointGetAxisCoor((spKDArrayGetArray(kdA))[(spKDArrayGetIndicesByDim(kdA, coorSplit))[medianIndex]],coorSplit-1);
-		newNode->data = NULL; /* NULL data marks node, non-leaf */
+		newNode->val = spKDTreeSplitValue(kdA, coorSplit);
+		newNode->row = -1; /* -1 row marks node, non-leaf */
+		spKDArrayDestroy(kdA);
 		newNode->left = spKDTreeInitRecursion(splitMethod, kdASplit[0], coorSplit); /* Left child recursion, with left kd array */
-		newNode->right = spKDTreeInitRecursion(splitMethod, kdASplit[1], coorSplit); /* Right child recursion, with right kd array */
+		newNode->right = NULL;
+		if(newNode->left != NULL)
+			newNode->right = spKDTreeInitRecursion(splitMethod, kdASplit[1], coorSplit); /* Right child recursion, with right kd array */
+		else
+			spKDArrayDestroy(kdASplit[1]);
 		free(kdASplit);
-		spKDArrayDestroy(kdA);
+		if(newNode->right == NULL){ /* Allocation failure in one of the subtrees */
+			spKDTreeNodeDestroy(newNode);
+			return NULL;
+		}
 	}
     return newNode;
 }
 
+/**
+ * Returns the squared distance from a coordinate of the target point to the limits of one dimension,
+ * the contribution of that dimension to minDistanceSquared.
+ *
+ * @param coor - the coordinate of the target point
+ * @param high - the maximum value of the dimension, used if highUse is 1
+ * @param low - the minimum value of the dimension, used if lowUse is 1
+ * @param highUse - 1 if the dimension has a maximum value
+ * @param lowUse - 1 if the dimension has a minimum value
+ *
+ * @return 0 if coor is within the limits, otherwise the squared distance from coor to the closest limit
+ */
+static double axisDistanceSquared(double coor, double high, double low, int highUse, int lowUse){
+    if(lowUse == 1 && coor < low)
+        return (low - coor)*(low - coor);
+    if(highUse == 1 && coor > high)
+        return (coor - high)*(coor - high);
+    return 0;
+}
+
+/**
+ * Checks if a subtree can be skipped by the exact kNN search, when the queue is full.
+ * The recursions keep the minimal squared distance to the limits of the subtree (bound) incrementally,
+ * so it is rounded differently than minDistanceSquared, by far less than SP_KDTREE_BOUND_TOLERANCE.
+ * Only when bound is that close to the maximal squared distance in the queue could the rounding change
+ * the decision, and minDistanceSquared decides instead - so exactly the same subtrees are skipped.
+ *
+ * @param bpq - the full queue
+ * @param bound - the minimal squared distance to the limits of the subtree, kept by the recursion
+ * @param targetPoint - the point, or feature, that is being searched for
+ * @param highLimit - the limits of the subtree (see minDistanceSquared)
+ * @param lowLimit
+ * @param highLimitUse
+ * @param lowLimitUse
+ *
+ * @return true if no point of the subtree is closer to targetPoint than the furthest point in the queue
+ */
+static bool kNearestNeighboursSkip(SPBPQueue* bpq, double bound, SPPoint* targetPoint, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse){
+    double maxValue = spBPQueueMaxValue(bpq);
+    if(fabs(bound - maxValue) <= SP_KDTREE_BOUND_TOLERANCE * maxValue)
+        bound = minDistanceSquared(targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse);
+    return bound >= maxValue;
+}
+
+/**
+ * The recursion function of kNearestNeighboursTree for trees in the flat layout.
+ * It travels the tree exactly like kNearestNeighboursRecursion, where the children of node i are
+ * nodes[i].child and nodes[i].child+1. At a leaf, the distances of all the consecutive rows of the bucket
+ * are calculated in one batch, and every point of the bucket is sent to be added to the priority queue.
+ * If codeQuery is not NULL, the distances of a bucket are calculated from the quantized codes of the tree
+ * instead (see spKDTreeSetQuantized), and the row ids of the points are added rather than their image indices.
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree, in the flat layout
+ * @param curr - the position of the current node in the node array, the root of the current subtree
+ * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - the coordinates of targetPoint, zero padded to the stride of the feature store
+ * @param codeQuery - targetPoint quantized by the quantized store of the tree, NULL to use the exact distances
+ * @param distances - an array of leafSize doubles, for the distances of the points of a bucket
+ * @param highLimit - the array that contains the maximum value for each dimension of the points in the subtree
+ * @param lowLimit - the array that contains the minimum value for each dimension of the points in the subtree
+ * @param highLimitUse - the array that marks if there is a maximum value for each dimension of the points in the subtree
+ * @param lowLimitUse - the array that marks if there is a minimum value for each dimension of the points in the subtree
+ * @param bound - the minimal squared distance from the target point to the limits of the subtree
+ */
+static void kNearestNeighboursFlatRecursion(SPBPQueue* bpq, SPKDTree* tree, int curr, SPPoint* targetPoint, const double* query, const short* codeQuery, double* distances, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse, double bound){
+    const SPKDTreeFlatNode* node = tree->nodes + curr;
+    if(node->dim < 0 && codeQuery != NULL){ /* Leaf of the quantized search - the candidates are row ids */
+        spQuantizedStoreL2SquaredDistances(tree->quantized, node->child, -node->dim, codeQuery, distances);
+        for(int i = 0; i < -node->dim; i++)
+            spBPQueueEnqueue(bpq, node->child + i, distances[i]);
+        return;
+    }
+    if(node->dim < 0){ /* Leaf - try to add all the points of the bucket */
+        spFeatureStoreL2SquaredDistances(tree->store, node->child, -node->dim, query, distances);
+        for(int i = 0; i < -node->dim; i++)
+            spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(tree->store, node->child + i), distances[i]);
+        return;
+    }
+    int currentDimIndex = node->dim -1;
+    double coor = query[currentDimIndex];
+    double axis = axisDistanceSquared(coor, highLimit[currentDimIndex], lowLimit[currentDimIndex], /* Only the split dimension changes */
+            highLimitUse[currentDimIndex], lowLimitUse[currentDimIndex]);
+    double currentLimit = highLimit[currentDimIndex]; /* The limits of the left subtree */
+    int currentLimitUse = highLimitUse[currentDimIndex];
+    highLimit[currentDimIndex] = node->val;
+    highLimitUse[currentDimIndex] = 1;
+    double childBound = bound + (axisDistanceSquared(coor, node->val, lowLimit[currentDimIndex], 1, lowLimitUse[currentDimIndex]) - axis);
+    if(spBPQueueIsFull(bpq) == false || !kNearestNeighboursSkip(bpq, childBound, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse))
+        kNearestNeighboursFlatRecursion(bpq, tree, node->child, targetPoint, query, codeQuery, distances, highLimit, lowLimit, highLimitUse, lowLimitUse, childBound);
+    highLimit[currentDimIndex] = currentLimit;
+    highLimitUse[currentDimIndex] = currentLimitUse;
+
+    currentLimit = lowLimit[currentDimIndex]; /* The limits of the right subtree */
+    currentLimitUse = lowLimitUse[currentDimIndex];
+    lowLimit[currentDimIndex] = node->val;
+    lowLimitUse[currentDimIndex] = 1;
+    childBound = bound + (axisDistanceSquared(coor, highLimit[currentDimIndex], node->val, highLimitUse[currentDimIndex], 1) - axis);
+    if(spBPQueueIsFull(bpq) == false || !kNearestNeighboursSkip(bpq, childBound, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse))
+        kNearestNeighboursFlatRecursion(bpq, tree, node->child + 1, targetPoint, query, codeQuery, distances, highLimit, lowLimit, highLimitUse, lowLimitUse, childBound);
+    lowLimit[currentDimIndex] = currentLimit;
+    lowLimitUse[currentDimIndex] = currentLimitUse;
+}
+
+/**
+ * Fills bpq with the closest points to targetPoint, using the scratch arrays of one search.
+ * The limits are reset, the target point is padded into query, and the recursion function of the
+ * layout of the tree is called. The arguments are assumed to be valid (see kNearestNeighboursTree).
+ * If codeQuery is not NULL, the target point is quantized into it, and the flat tree is searched by the
+ * quantized codes - bpq is filled with row ids (see kNearestNeighboursQuantizedFill).
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - an array of stride doubles (the stride of the feature store of the tree)
+ * @param codeQuery - an array of stride shorts (the stride of the quantized store of the tree), NULL for the exact search
+ * @param distances - an array of leafSize doubles (the leaf size of the tree)
+ * @param highLimit - an array of d doubles (the dimension of the tree)
+ * @param lowLimit - an array of d doubles
+ * @param highLimitUse - an array of d integers
+ * @param lowLimitUse - an array of d integers
+ */
+static void kNearestNeighboursFill(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint, double* query, short* codeQuery, double* distances, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse){
+    for(int i = 0; i<spPointGetDimension(targetPoint) ; i++){
+        highLimit[i] = 0; /* highLimit[i] is the highest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
+        lowLimit[i] = 0; /* lowLimit[i] is the lowest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
+        highLimitUse[i] = 0; /* highLimitUse[i] is 0 if there is no limit on the highest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
+        lowLimitUse[i] = 0; /* lowLimitUse[i] is 0 if there is no limit on the lowest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
+    }
+    for(int i = 0; i<spFeatureStoreGetStride(tree->store) ; i++){
+        query[i] = i < spPointGetDimension(targetPoint) ? spPointGetAxisCoor(targetPoint, i) : 0;
+    }
+    if(codeQuery != NULL)
+        spQuantizedStoreQuantizeQuery(tree->quantized, query, codeQuery);
+    if(tree->nodes != NULL) /* Recursion function of the layout of the tree */
+        kNearestNeighboursFlatRecursion(bpq, tree, 0, targetPoint, query, codeQuery, distances, highLimit, lowLimit, highLimitUse, lowLimitUse, 0);
+    else
+        kNearestNeighboursRecursion(bpq, tree->store, tree->root, targetPoint, query, highLimit, lowLimit, highLimitUse, lowLimitUse, 0);
+}
+
 /**
  * This function searches the inputed kd tree for the closest points to an inputed target point.
  * Each point found is a feature in an image with an index, and that index as well as the distance squared is entered
  * into the bounded minimum priority queue bpq, where the priority is the distance squared and the lower it is the better.
  * Arrays to hold the limits covered by the kd subtrees are defined here, and their addresses are
  * sent into the recursive function kNearestNeighboursTree as well as the address of the tree and the queue.
+ * The arrays are allocated on every call - kNearestNeighboursContext searches with the arrays of a search context instead.
  *
  * @param bpq - the bounded priority queue to fill
- * @param root - the root node of the tree to search
+ * @param tree - the tree to search
  * @param targetPoint - the point, or feature, that is being searched for in the other images
  *
- * @return -2 in case of allocation failure occurred. -1 in case bpq, root or targetNode are NULL.
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * the tree has no nodes (see spKDTreeInitPQ) or coordinates (see spKDTreeReleaseFeatures), or the dimension of
+ * targetPoint differs from the dimension of the tree.
  * Otherwise, 1 is returned.
  */
-int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTreeNode* root, SPPoint* targetPoint){
-	if(root == NULL || targetPoint == NULL || bpq == NULL){
+int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTree* tree, SPPoint* targetPoint){
+	if(tree == NULL || targetPoint == NULL || bpq == NULL){
 		spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
 		return -1;
 	}
+	if((tree->root == NULL && tree->nodes == NULL) || spFeatureStoreIsReleased(tree->store) ||
+			spPointGetDimension(targetPoint) != spFeatureStoreGetDimension(tree->store)){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
     double* lowLimit = (double*) malloc(spPointGetDimension(targetPoint) * sizeof(double)); /* These arrays are used in the recursion to mark limits */
     double* highLimit = (double*) malloc(spPointGetDimension(targetPoint) * sizeof(double));
     int* lowLimitUse = (int*) malloc(spPointGetDimension(targetPoint) * sizeof(int));
     int* highLimitUse = (int*) malloc(spPointGetDimension(targetPoint) * sizeof(int));
-	if(highLimit == NULL || lowLimit == NULL || highLimitUse == NULL || lowLimitUse == NULL){
+    double* query = (double*) malloc(spFeatureStoreGetStride(tree->store) * sizeof(double)); /* targetPoint padded like a store row */
+    double* distances = (double*) malloc(tree->leafSize * sizeof(double)); /* The distances of the points of a leaf bucket */
+	if(highLimit == NULL || lowLimit == NULL || highLimitUse == NULL || lowLimitUse == NULL || query == NULL || distances == NULL){
         spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
-        if(bpq != NULL)
-            spBPQueueDestroy(bpq);
-        if(highLimit != NULL)
-            free(highLimit);
-        if(lowLimit != NULL)
-            free(lowLimit);
-        if(highLimitUse != NULL)
-            free(highLimitUse);
-        if(lowLimitUse != NULL)
-            free(lowLimitUse);
+        free(highLimit); /* The queue belongs to the caller, it is not freed */
+        free(lowLimit);
+        free(highLimitUse);
+        free(lowLimitUse);
+        free(query);
+        free(distances);
         return -2;
 	}
-    for(int i = 0; i<spPointGetDimension(targetPoint) ; i++){
-        highLimit[i] = 0; /* highLimit[i] is the highest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
-        lowLimit[i] = 0; /* lowLimit[i] is the lowest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
-        highLimitUse[i] = 0; /* highLimitUse[i] is 0 if there is no limit on the highest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
-        lowLimitUse[i] = 0; /* lowLimitUse[i] is 0 if there is no limit on the lowest possible value of coordinate i in the current kd subtree in kNearestNeighboursRecursion */
-    }
-    kNearestNeighboursRecursion(bpq, root, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse); /* Recursion function */
-    free(highLimit); /* Freeing the allocated memory */
+    kNearestNeighboursFill(bpq, tree, targetPoint, query, NULL, distances, highLimit, lowLimit, highLimitUse, lowLimitUse);
+    free(query); /* Freeing the allocated memory */
+    free(distances);
+    free(highLimit);
     free(lowLimit);
     free(highLimitUse);
     free(lowLimitUse);
@@ -205,12 +1033,17 @@ int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTreeNode* root, SPPoint* targetP
  *
  * If the current node is split by dimension with index currentDimIndex, the current limits of that dimension
  * are saved.
+ * The minimal squared distance from the target point to the limits (bound) is kept along the way: only the limits
+ * of currentDimIndex change between a subtree and its children, so the bound of a child is the bound of the subtree,
+ * with the contribution of currentDimIndex replaced. This costs the same in any dimension, unlike minDistanceSquared,
+ * which is only called when the bound is too close to the furthest distance in the queue to be trusted
+ * (see kNearestNeighboursSkip), so the same subtrees are skipped.
  * Next, the limits are set to match the limits of the left child subtree:
  * highLimitUse[currentDimIndex] is set to 1, meaning there is a top value.
  * highLimit[currentDimIndex] is set to the median value saved in the node,
  * meaning all points in the left subtree have a coordinate that is lower than the limit in the currentDimIndex dimension.
- * Next, if the queue is full, the minimal squared distance from those limits to the target point is calculated,
- * and if that squared distance is bigger than the maximal squared distance in the queue, that subtree is skipped.
+ * Next, if the queue is full, and the bound of the left subtree is bigger than the maximal squared distance in
+ * the queue, that subtree is skipped.
  * If it is not skipped, the functoin is called on the left chid.
  *
  * After this, highLimitUse[currentDimIndex] highLimit[currentDimIndex] are restored to their previous values.
@@ -218,23 +1051,26 @@ int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTreeNode* root, SPPoint* targetP
  * lowLimitUse[currentDimIndex] is set to 1, meaning there is a bottom value.
  * lowLimit[currentDimIndex] is set to the median value saved in the node,
  * meaning all points in the right subtree have a coordinate that is higher than the limit in the currentDimIndex dimension.
- * Next, if the queue is full, the minimal squared distance from those limits to the target point is calculated,
- * and if that squared distance is bigger than the maximal squared distance in the queue, that subtree is skipped.
+ * Next, if the queue is full, and the bound of the right subtree is bigger than the maximal squared distance in
+ * the queue, that subtree is skipped.
  * If it is not skipped, the function is called on the right chid.
  *
  * @param bpq - the bounded priority queue to fill
+ * @param store - the feature store holding the points of the tree
  * @param curr - the current node of the tree, the root of the current subtree
  * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - the coordinates of targetPoint, zero padded to the stride of the feature store
  * @param highLimit - the array that contains the maximum value for each dimension of the points in the subtree
  * @param lowLimit - the array that contains the minimum value for each dimension of the points in the subtree
  * @param highLimitUse - the array that marks if there is a maximum value for each dimension of the points in the subtree
  * @param lowLimitUse - the array that marks if there is a minimum value for each dimension of the points in the subtree
+ * @param bound - the minimal squared distance from the target point to the limits of the subtree (0 at the root)
  *
  */
-void kNearestNeighboursRecursion(SPBPQueue* bpq, SPKDTreeNode* curr, SPPoint* targetPoint, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse){
+void kNearestNeighboursRecursion(SPBPQueue* bpq, SPFeatureStore* store, SPKDTreeNode* curr, SPPoint* targetPoint, const double* query, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse, double bound){
     if(curr != NULL){
-        if(curr->data != NULL){ /* If root is a leaf, try to add the index of the point and its distance from targetPoint to the queue */
-            spBPQueueEnqueue(bpq, spPointGetIndex(curr->data), spPointL2SquaredDistance(targetPoint, curr->data));
+        if(curr->row != -1){ /* If root is a leaf, try to add the index of the point and its distance from targetPoint to the queue */
+            spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(store, curr->row), spFeatureStoreL2SquaredDistance(store, curr->row, query));
         }
         else{
             bool cont = true; /* If cont becomes false, the next subtree will be skipped */
@@ -243,15 +1079,18 @@ void kNearestNeighboursRecursion(SPBPQueue* bpq, SPKDTreeNode* curr, SPPoint* ta
             double currentHighLimit = highLimit[currentDimIndex];
             int currentLowLimitUse = lowLimitUse[currentDimIndex];
             int currentHighLimitUse = highLimitUse[currentDimIndex];
+            double coor = query[currentDimIndex];
+            double axis = axisDistanceSquared(coor, currentHighLimit, currentLowLimit, currentHighLimitUse, currentLowLimitUse);
 
             highLimit[currentDimIndex] = curr->val; /* The limits are changed to those of the left subtree */
             highLimitUse[currentDimIndex] = 1;
+            double childBound = bound + (axisDistanceSquared(coor, curr->val, currentLowLimit, 1, currentLowLimitUse) - axis);
             if(spBPQueueIsFull(bpq) == true){
-                if(minDistanceSquared(targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse) >= spBPQueueMaxValue(bpq))
+                if(kNearestNeighboursSkip(bpq, childBound, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse))
                     cont = false; /* The left subtree is skipped only if the distance between the target point and the closest  */
             } /* point within the limits, is bigger than the distance between the target point and the furthest point in the full queue. */
             if(cont == true){ /* Recursion on the left subtree */
-                kNearestNeighboursRecursion(bpq, curr->left, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse);
+                kNearestNeighboursRecursion(bpq, store, curr->left, targetPoint, query, highLimit, lowLimit, highLimitUse, lowLimitUse, childBound);
             }
             highLimit[currentDimIndex] = currentHighLimit; /* The limits of the splitting dimension are restored */
             highLimitUse[currentDimIndex] = currentHighLimitUse;
@@ -259,12 +1098,13 @@ void kNearestNeighboursRecursion(SPBPQueue* bpq, SPKDTreeNode* curr, SPPoint* ta
 
             lowLimit[currentDimIndex] = curr->val; /* The limits are changed to those of the right subtree */
             lowLimitUse[currentDimIndex] = 1;
+            childBound = bound + (axisDistanceSquared(coor, currentHighLimit, curr->val, currentHighLimitUse, 1) - axis);
             if(spBPQueueIsFull(bpq) == true){
-                if(minDistanceSquared(targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse) >= spBPQueueMaxValue(bpq))
+                if(kNearestNeighboursSkip(bpq, childBound, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse))
                     cont = false; /* The right subtree is skipped only if the distance between the target point and the closest  */
             } /* point within the limits, is bigger than the distance between the target point and the furthest point in the full queue. */
             if(cont == true){ /* Recursion on the right subtree */
-                kNearestNeighboursRecursion(bpq, curr->right, targetPoint, highLimit, lowLimit, highLimitUse, lowLimitUse);
+                kNearestNeighboursRecursion(bpq, store, curr->right, targetPoint, query, highLimit, lowLimit, highLimitUse, lowLimitUse, childBound);
             }
             lowLimit[currentDimIndex] = currentLowLimit; /* The limits of the splitting dimension are restored */
             lowLimitUse[currentDimIndex] = currentLowLimitUse;
@@ -307,126 +1147,854 @@ double minDistanceSquared(SPPoint* targetPoint, double* highLimit, double* lowLi
 }
 
 /**
- * Frees all allocated memory of kd tree. It is used recursively on each child.
+ * Returns the number of branches the heap of a best-bin-first search of tree may hold.
+ * The trees are split at the median, so a path from the root to a leaf crosses at most ceil(log2(size))
+ * nodes, and every leaf checked adds at most one branch per node on its path to the roots of the trees.
+ * A node is never added twice, so there are never more branches than nodes.
  *
- * @param curr - the tree node to free
+ * @param tree - the tree (or forest) to search
+ * @param maxLeafChecks - the maximal number of leaves checked by a search
+ *
+ * @return The size of the heap of a search
  */
-void spKDTreeDestroy(SPKDTreeNode* curr){
-    if (curr != NULL) {
-        spPointDestroy(curr->data);
-        spKDTreeDestroy(curr->left);
-        spKDTreeDestroy(curr->right);
-        free(curr);
-    }
+static int kNearestNeighboursMaxBranches(SPKDTree* tree, int maxLeafChecks){
+    int size = spFeatureStoreGetSize(tree->store);
+    int depth = 0;
+    for(int n = size - 1; n > 0; n = n/2)
+        depth++;
+    long long maxBranches = (long long) maxLeafChecks * depth + tree->numOfTrees;
+    long long numOfNodes = 2LL * size * tree->numOfTrees;
+    return (int) (maxBranches < numOfNodes ? maxBranches : numOfNodes);
 }
 
 /**
- * Initializes a new KD tree based on inputed point matrix.
- * There are numOfImages images, and the image with index i has numOfFeatures[i] features, or points.
- * The pointer to the point with index j of that image is in mat[i][j]. The index saved in that point is i.
- * In this function, all the pointers are saved in one long array of type SPPoint*.
- * Finally, spKDTreeInit is called with that array, to create a big kd tree.
+ * Returns the size of the set of the rows visited by a best-bin-first search of a forest (see spKDTreeVisitRow) -
+ * the power of 2 that is at least twice the number of points in maxLeafChecks leaves (or in the store).
+ * A tree of one tree does not visit rows twice, so it needs no set.
  *
- * @param mat - the array of the arrays of pointers of the features
- * @param numOfImages - the number of images
- * @param numOfFeatures - the array containing the number of features of each image
- * @param splitMethod - the method used to determine the split dimension during the tree creation
+ * @param tree - the tree (or forest) to search
+ * @param maxLeafChecks - the maximal number of leaves checked by a search
  *
- * @return NULL in case of allocation failure occurred OR a missing point in mat OR another error in the input
- * Otherwise, the root node of the new tree is returned
+ * @return The size of the set of a search, 0 if the tree is not a forest
  */
-SPKDTreeNode* fullKDTreeCreator(SPPoint*** mat , int numOfImages, int* numOfFeatures, KD_METHOD splitMethod){
-    int totalSize = 0;
-    if(numOfFeatures != NULL){
-        for(int i=0; i<numOfImages; i++) /* Loop to count the total number of features */
-            totalSize = totalSize + numOfFeatures[i];
-    }
-    if(totalSize <1 || mat == NULL){
-        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
-        return NULL;
-    }
-    SPPoint** allPoints = (SPPoint**) malloc(totalSize * sizeof(*allPoints));
-    if(allPoints == NULL){
-        spLoggerPrintError(ERRORMSG_ALLOCATION,__FILE__,__func__,__LINE__);
-        return NULL;
+static int kNearestNeighboursMaxVisited(SPKDTree* tree, int maxLeafChecks){
+    if(tree->numOfTrees == 1)
+        return 0;
+    long long maxPoints = (long long) maxLeafChecks * tree->leafSize;
+    if(maxPoints > spFeatureStoreGetSize(tree->store))
+        maxPoints = spFeatureStoreGetSize(tree->store);
+    int maxVisited = 1;
+    while(maxVisited < 2 * maxPoints)
+        maxVisited = 2 * maxVisited;
+    return maxVisited;
+}
+
+/**
+ * Adds a row to a set of visited rows - an open addressing hash table, whose empty entries are -1.
+ *
+ * @param visited - the set, of a power of 2 entries
+ * @param maxVisited - the number of entries of the set
+ * @param row - the row to add
+ *
+ * @return true if the row was added, false if it was already in the set
+ */
+static bool spKDTreeVisitRow(int* visited, int maxVisited, int row){
+    int i = (int) (((uint32_t) row * 2654435761u) & (uint32_t) (maxVisited - 1)); /* Multiplicative hash */
+    for(; visited[i] != -1; i = (i + 1) & (maxVisited - 1)){
+        if(visited[i] == row)
+            return false;
+    }
+    visited[i] = row;
+    return true;
+}
+
+/**
+ * Adds a branch to a heap of branches, where the branch with the lowest bound is first.
+ *
+ * @param branches - the heap
+ * @param numOfBranches - the number of branches in the heap, it goes up by one
+ * @param branch - the branch to add
+ */
+static void spKDTreeBranchPush(SPKDTreeBranch* branches, int* numOfBranches, SPKDTreeBranch branch){
+    int i = (*numOfBranches)++;
+    while(i > 0 && branches[(i-1)/2].bound > branch.bound){ /* Move the parents with higher bounds down */
+        branches[i] = branches[(i-1)/2];
+        i = (i-1)/2;
+    }
+    branches[i] = branch;
+}
+
+/**
+ * Removes the branch with the lowest bound from a heap of branches, and returns it.
+ * The heap is assumed not to be empty.
+ *
+ * @param branches - the heap
+ * @param numOfBranches - the number of branches in the heap, it goes down by one
+ *
+ * @return The branch with the lowest bound
+ */
+static SPKDTreeBranch spKDTreeBranchPop(SPKDTreeBranch* branches, int* numOfBranches){
+    SPKDTreeBranch top = branches[0];
+    SPKDTreeBranch last = branches[--(*numOfBranches)];
+    int i = 0;
+    for(int child = 1; child < *numOfBranches; child = 2*i + 1){ /* Move the children with lower bounds up */
+        if(child + 1 < *numOfBranches && branches[child + 1].bound < branches[child].bound)
+            child++;
+        if(branches[child].bound >= last.bound)
+            break;
+        branches[i] = branches[child];
+        i = child;
+    }
+    branches[i] = last;
+    return top;
+}
+
+/**
+ * Fills bpq with points close to targetPoint by a best-bin-first search, using the scratch arrays of one search.
+ * The search goes down from a root to the leaf whose limits contain the target point, always choosing the child
+ * on the side of the split value the target point is on. Every child not chosen is added to a heap of unexplored
+ * branches, with a bound - the bound of its parent plus the squared distance from the target point to the split value.
+ * The points of the leaf are sent to be added to the queue, and the search goes down again from the branch with
+ * the lowest bound, until maxLeafChecks leaves are checked, or until the queue is full and no branch has a lower
+ * bound than the maximal squared distance in the queue.
+ * The bound is a cheap estimate of the minimal squared distance from the target point to the subtree (it is exact
+ * unless the same dimension is crossed twice), so the closest points may be missed - the more leaves are checked,
+ * the more of the closest points are found.
+ * The roots of all the trees of a forest start in the heap, so the trees are searched together, and a point found
+ * in more than one tree is only sent to the queue once (the rows found are kept in the set visited).
+ * The arguments are assumed to be valid (see kNearestNeighboursTree).
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - an array of stride doubles (the stride of the feature store of the tree)
+ * @param distances - an array of leafSize doubles (the leaf size of the tree)
+ * @param branches - an array of maxBranches branches (see kNearestNeighboursMaxBranches)
+ * @param maxBranches - the size of branches
+ * @param visited - an array of maxVisited integers (see kNearestNeighboursMaxVisited), NULL if the tree is not a forest
+ * @param maxVisited - the size of visited
+ * @param maxLeafChecks - the maximal number of leaves checked
+ */
+static void kNearestNeighboursBestBinFirstFill(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint, double* query, double* distances, SPKDTreeBranch* branches, int maxBranches, int* visited, int maxVisited, int maxLeafChecks){
+    for(int i = 0; i<spFeatureStoreGetStride(tree->store) ; i++){
+        query[i] = i < spPointGetDimension(targetPoint) ? spPointGetAxisCoor(targetPoint, i) : 0;
     }
-    int k = 0;
-    for(int i = 0; i<numOfImages; i++){
-        for(int j = 0; j < numOfFeatures[i]; j++){
-            allPoints[k] = mat[i][j]; /* Adds all the features into one array */
-            k = k+1;
+    for(int i = 0; i < maxVisited; i++)
+        visited[i] = -1; /* No row was visited yet */
+    int numOfBranches = 0;
+    for(int t = 0; t < tree->numOfTrees; t++){ /* The search starts at the roots */
+        SPKDTreeBranch root = {0, t * tree->numOfNodes, tree->root};
+        spKDTreeBranchPush(branches, &numOfBranches, root);
+    }
+    SPKDTreeBranch branch;
+    for(int leafChecks = 0; leafChecks < maxLeafChecks && numOfBranches > 0; leafChecks++){
+        branch = spKDTreeBranchPop(branches, &numOfBranches);
+        if(spBPQueueIsFull(bpq) == true && branch.bound >= spBPQueueMaxValue(bpq))
+            break; /* The other branches have higher bounds */
+        SPKDTreeBranch other = branch; /* The child not chosen at every node on the way to the leaf */
+        if(tree->nodes != NULL){
+            const SPKDTreeFlatNode* node = tree->nodes + branch.node;
+            while(node->dim >= 0){
+                double diff = query[node->dim -1] - node->val;
+                other.bound = branch.bound + diff*diff;
+                other.node = diff <= 0 ? node->child + 1 : node->child;
+                if(numOfBranches < maxBranches && (spBPQueueIsFull(bpq) == false || other.bound < spBPQueueMaxValue(bpq)))
+                    spKDTreeBranchPush(branches, &numOfBranches, other);
+                node = tree->nodes + (diff <= 0 ? node->child : node->child + 1);
+            }
+            if(tree->rows == NULL){ /* The leaf bucket is consecutive rows */
+                spFeatureStoreL2SquaredDistances(tree->store, node->child, -node->dim, query, distances);
+                for(int i = 0; i < -node->dim; i++)
+                    spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(tree->store, node->child + i), distances[i]);
+            }
+            else{ /* A bucket of a forest, its points may have been found in other trees */
+                for(int i = 0; i < -node->dim; i++){
+                    int row = tree->rows[node->child + i];
+                    if(spKDTreeVisitRow(visited, maxVisited, row) == true)
+                        spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(tree->store, row), spFeatureStoreL2SquaredDistance(tree->store, row, query));
+                }
+            }
+        }
+        else{
+            SPKDTreeNode* curr = branch.ptr;
+            while(curr->row == -1){
+                double diff = query[curr->dim -1] - curr->val;
+                other.bound = branch.bound + diff*diff;
+                other.ptr = diff <= 0 ? curr->right : curr->left;
+                if(numOfBranches < maxBranches && (spBPQueueIsFull(bpq) == false || other.bound < spBPQueueMaxValue(bpq)))
+                    spKDTreeBranchPush(branches, &numOfBranches, other);
+                curr = diff <= 0 ? curr->left : curr->right;
+            }
+            spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(tree->store, curr->row), spFeatureStoreL2SquaredDistance(tree->store, curr->row, query));
         }
     }
-    SPKDTreeNode* root = spKDTreeInit(splitMethod , allPoints, totalSize); /* Makes array into kd tree */
-    free(allPoints);
-    return root;
 }
 
 /**
- * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
- * Pointers to the features of the target image are in the targetFeatures array. The root of the kd tree containing
- * all the features of all the images to search is root.
+ * This function searches the inputed kd tree for points close to an inputed target point, checking at most
+ * maxLeafChecks leaves (see kNearestNeighboursBestBinFirstFill). The index of the image of every point found and its
+ * squared distance are entered into bpq, like in kNearestNeighboursTree. The more leaves are checked, the closer the
+ * results are to the results of kNearestNeighboursTree, and the longer the search takes.
+ * The arrays of the search are allocated on every call - kNearestNeighboursContext searches with the arrays of a
+ * search context instead (see spKDTreeSetMaxLeafChecks).
  *
- * A bounded priority queue, bpQueue, of size kNN is defined. For each target feature with index i:
- * bpQueue is filled with the kNN indices of the images that contain features that are closest to the target feature,
- * using the function kNearestNeighboursTree(bpQueue , root, targetFeatures[i]).
- * For each image index j in the queue, a counter for that image, imageResults[j], goes up by one.
- * If the same index appears more than once, imageResults[j] only goes up by one. The queue is then emptied.
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ * @param maxLeafChecks - the maximal number of leaves checked
  *
- * The spNumOfSimilarImages image indices with the highest values in imageResults are placed in a
- * sorted array, closestImages, and this array is returned.
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * maxLeafChecks < 1, the tree has no nodes (see spKDTreeInitPQ) or coordinates (see spKDTreeReleaseFeatures), or the
+ * dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursBestBinFirst(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint, int maxLeafChecks){
+	if(tree == NULL || targetPoint == NULL || bpq == NULL){
+		spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+	if(maxLeafChecks < 1 || (tree->root == NULL && tree->nodes == NULL) || spFeatureStoreIsReleased(tree->store) ||
+			spPointGetDimension(targetPoint) != spFeatureStoreGetDimension(tree->store)){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+    int maxBranches = kNearestNeighboursMaxBranches(tree, maxLeafChecks);
+    int maxVisited = kNearestNeighboursMaxVisited(tree, maxLeafChecks);
+    SPKDTreeBranch* branches = (SPKDTreeBranch*) malloc(maxBranches * sizeof(SPKDTreeBranch)); /* The heap of unexplored branches */
+    int* visited = maxVisited > 0 ? (int*) malloc(maxVisited * sizeof(int)) : NULL; /* The rows found in the trees of a forest */
+    double* query = (double*) malloc(spFeatureStoreGetStride(tree->store) * sizeof(double)); /* targetPoint padded like a store row */
+    double* distances = (double*) malloc(tree->leafSize * sizeof(double)); /* The distances of the points of a leaf bucket */
+	if(branches == NULL || (maxVisited > 0 && visited == NULL) || query == NULL || distances == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(branches);
+        free(visited);
+        free(query);
+        free(distances);
+        return -2;
+	}
+    kNearestNeighboursBestBinFirstFill(bpq, tree, targetPoint, query, distances, branches, maxBranches, visited, maxVisited, maxLeafChecks);
+    free(branches);
+    free(visited);
+    free(query);
+    free(distances);
+	return 1;
+}
+
+/**
+ * The size of the candidate queue of an approximate search (by the product quantization index or by the
+ * quantized codes) of a queue of size kNN: the number of candidates re-ranked, and at least kNN.
+ */
+static int kNearestNeighboursCandidates(int numOfCandidates, int kNN){
+    return numOfCandidates > kNN ? numOfCandidates : kNN;
+}
+
+/**
+ * Empties candidates, a queue of row ids and their approximate distances, into bpq. Every candidate is entered
+ * with the image index of its row and, if rerank is true, its exact squared distance read from the feature store
+ * (otherwise its approximate distance is kept).
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree that was searched
+ * @param candidates - the queue of the candidates, emptied
+ * @param query - the coordinates of the target point, zero padded to the stride of the feature store
+ * @param rerank - true to enter the exact distances
+ */
+static void kNearestNeighboursMoveCandidates(SPBPQueue* bpq, SPKDTree* tree, SPBPQueue* candidates, const double* query, bool rerank){
+    BPQueueElement candidate;
+    while(spBPQueueIsEmpty(candidates) == false){
+        spBPQueuePeek(candidates, &candidate);
+        spBPQueueDequeue(candidates);
+        double distance = rerank ? spFeatureStoreL2SquaredDistance(tree->store, candidate.index, query) : candidate.value;
+        spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(tree->store, candidate.index), distance);
+    }
+}
+
+/**
+ * Fills bpq with the closest points to targetPoint by the product quantization index of the tree.
+ * The distance table of the target point is calculated, and the codes of all the rows are scanned into candidates.
+ * If the tree re-ranks the candidates, the exact squared distance of every candidate is read from the feature store
+ * and entered into bpq, otherwise the candidates are entered with their approximate distances.
+ * The arguments are assumed to be valid (see kNearestNeighboursPQ).
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search, with a product quantization index
+ * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - an array of stride doubles (the stride of the feature store of the tree)
+ * @param table - an array of spPQIndexGetTableSize floats (the distance table)
+ * @param candidates - an empty queue of kNearestNeighboursCandidates(pqCandidates, kNN) elements
+ */
+static void kNearestNeighboursPQFill(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint, double* query, float* table, SPBPQueue* candidates){
+    for(int i = 0; i<spFeatureStoreGetStride(tree->store) ; i++){
+        query[i] = i < spPointGetDimension(targetPoint) ? spPointGetAxisCoor(targetPoint, i) : 0;
+    }
+    spPQIndexDistanceTable(tree->pq, query, table);
+    spPQIndexSearch(tree->pq, table, candidates); /* The candidates are row ids */
+    kNearestNeighboursMoveCandidates(bpq, tree, candidates, query, tree->pqCandidates > 0);
+}
+
+/**
+ * This function searches the product quantization index of the inputed kd tree (see spKDTreeSetPQIndex) for points
+ * close to an inputed target point. The index of the image of every point found and its squared distance are entered
+ * into bpq, like in kNearestNeighboursTree. The distances are approximate, unless the tree re-ranks the candidates
+ * of the index by their exact distances.
+ * The arrays of the search are allocated on every call - kNearestNeighboursContext searches with the arrays of a
+ * search context instead.
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ *
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * the tree has no product quantization index, or the dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursPQ(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint){
+	if(tree == NULL || targetPoint == NULL || bpq == NULL){
+		spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+	if(tree->pq == NULL || spPointGetDimension(targetPoint) != spFeatureStoreGetDimension(tree->store)){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+    double* query = (double*) malloc(spFeatureStoreGetStride(tree->store) * sizeof(double)); /* targetPoint padded like a store row */
+    float* table = (float*) malloc(spPQIndexGetTableSize(tree->pq) * sizeof(float)); /* The distance table of targetPoint */
+    SPBPQueue* candidates = spBPQueueCreate(kNearestNeighboursCandidates(tree->pqCandidates, spBPQueueGetMaxSize(bpq)));
+	if(query == NULL || table == NULL || candidates == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(query);
+        free(table);
+        spBPQueueDestroy(candidates);
+        return -2;
+	}
+    kNearestNeighboursPQFill(bpq, tree, targetPoint, query, table, candidates);
+    free(query);
+    free(table);
+    spBPQueueDestroy(candidates);
+	return 1;
+}
+
+/**
+ * Fills bpq with the closest points to targetPoint by the quantized codes of the tree, using the scratch arrays
+ * of one search. The flat tree is travelled like in kNearestNeighboursTree, but the distances of the points of the
+ * leaves are calculated from their codes, and the closest points are gathered into candidates. If the tree re-ranks
+ * the candidates, they are entered into bpq with their exact squared distances, read from the feature store,
+ * otherwise with their approximate distances. The arguments are assumed to be valid (see kNearestNeighboursQuantized).
+ * The subtrees are skipped by the approximate distances of the candidates, so with at least as many candidates as
+ * the points of the tree nothing is skipped and the re-ranked search is exact.
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search, with quantized codes
+ * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - an array of stride doubles (the stride of the feature store of the tree)
+ * @param codeQuery - an array of stride shorts (the stride of the quantized store of the tree)
+ * @param distances - an array of leafSize doubles (the leaf size of the tree)
+ * @param highLimit - an array of d doubles (the dimension of the tree)
+ * @param lowLimit - an array of d doubles
+ * @param highLimitUse - an array of d integers
+ * @param lowLimitUse - an array of d integers
+ * @param candidates - an empty queue of kNearestNeighboursCandidates(quantizedCandidates, kNN) elements
+ */
+static void kNearestNeighboursQuantizedFill(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint, double* query, short* codeQuery, double* distances, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse, SPBPQueue* candidates){
+    kNearestNeighboursFill(candidates, tree, targetPoint, query, codeQuery, distances, highLimit, lowLimit, highLimitUse, lowLimitUse);
+    kNearestNeighboursMoveCandidates(bpq, tree, candidates, query, tree->quantizedCandidates > 0);
+}
+
+/**
+ * This function searches the inputed kd tree by its quantized codes (see spKDTreeSetQuantized) for points close to an
+ * inputed target point. The index of the image of every point found and its squared distance are entered into bpq,
+ * like in kNearestNeighboursTree. The distances are approximate, unless the tree re-ranks the candidates by their
+ * exact distances.
+ * The arrays of the search are allocated on every call - kNearestNeighboursContext searches with the arrays of a
+ * search context instead.
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ *
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * the tree has no quantized codes, or the dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursQuantized(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint){
+	if(tree == NULL || targetPoint == NULL || bpq == NULL){
+		spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+	if(tree->quantized == NULL || spPointGetDimension(targetPoint) != spFeatureStoreGetDimension(tree->store)){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+    int dim = spPointGetDimension(targetPoint);
+    double* lowLimit = (double*) malloc(dim * sizeof(double)); /* These arrays are used in the recursion to mark limits */
+    double* highLimit = (double*) malloc(dim * sizeof(double));
+    int* lowLimitUse = (int*) malloc(dim * sizeof(int));
+    int* highLimitUse = (int*) malloc(dim * sizeof(int));
+    double* query = (double*) malloc(spFeatureStoreGetStride(tree->store) * sizeof(double)); /* targetPoint padded like a store row */
+    short* codeQuery = (short*) malloc(spQuantizedStoreGetStride(tree->quantized) * sizeof(short)); /* targetPoint quantized */
+    double* distances = (double*) malloc(tree->leafSize * sizeof(double)); /* The distances of the points of a leaf bucket */
+    SPBPQueue* candidates = spBPQueueCreate(kNearestNeighboursCandidates(tree->quantizedCandidates, spBPQueueGetMaxSize(bpq)));
+	if(highLimit == NULL || lowLimit == NULL || highLimitUse == NULL || lowLimitUse == NULL || query == NULL ||
+            codeQuery == NULL || distances == NULL || candidates == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        free(highLimit); /* The queue belongs to the caller, it is not freed */
+        free(lowLimit);
+        free(highLimitUse);
+        free(lowLimitUse);
+        free(query);
+        free(codeQuery);
+        free(distances);
+        spBPQueueDestroy(candidates);
+        return -2;
+	}
+    kNearestNeighboursQuantizedFill(bpq, tree, targetPoint, query, codeQuery, distances, highLimit, lowLimit, highLimitUse, lowLimitUse, candidates);
+    free(query); /* Freeing the allocated memory */
+    free(codeQuery);
+    free(distances);
+    free(highLimit);
+    free(lowLimit);
+    free(highLimitUse);
+    free(lowLimitUse);
+    spBPQueueDestroy(candidates);
+	return 1;
+}
+
+/**
+ * Frees all allocated memory of kd tree, including its feature store.
+ * A tree loaded from an index file (see spKDTreeIndexLoad) is unmapped instead.
+ *
+ * @param tree - the tree to free
+ */
+void spKDTreeDestroy(SPKDTree* tree){
+    if (tree != NULL) {
+        spKDTreeNodeDestroy(tree->root);
+        if (tree->mapping != NULL) /* The nodes are in the mapped index file */
+            munmap(tree->mapping, tree->mappingSize);
+        else
+            free(tree->nodes); /* The flat layout is one block */
+        free(tree->rows);
+        spPQIndexDestroy(tree->pq);
+        spQuantizedStoreDestroy(tree->quantized);
+        spFeatureStoreDestroy(tree->store);
+        free(tree);
+    }
+}
+
+/**
+ * Frees all allocated memory of kd subtree. It is used recursively on each child.
+ *
+ * @param curr - the tree node to free
+ */
+void spKDTreeNodeDestroy(SPKDTreeNode* curr){
+    if (curr != NULL) {
+        spKDTreeNodeDestroy(curr->left);
+        spKDTreeNodeDestroy(curr->right);
+        free(curr);
+    }
+}
+
+/**
+ * Returns the feature store the kd tree is built over.
+ *
+ * @param tree - the tree
+ *
+ * @return The feature store (NULL if tree is NULL)
+ */
+SPFeatureStore* spKDTreeGetStore(SPKDTree* tree){
+    if (tree == NULL)
+        return NULL;
+    return tree->store;
+}
+
+/**
+ * Sets the search function closestImagesSearch uses to fill the queue for each target feature.
+ * A new tree uses kNearestNeighboursTree. The function must give the same results as kNearestNeighboursTree,
+ * for example a version specialized to the dimension of the tree (see SPKDTreeSearch.h).
+ *
+ * @param tree - the tree
+ * @param search - the search function, if NULL kNearestNeighboursTree is set
+ */
+void spKDTreeSetSearch(SPKDTree* tree, SPKDTreeSearchFunc search){
+    if (tree != NULL)
+        tree->search = search != NULL ? search : kNearestNeighboursTree;
+}
+
+/**
+ * Sets the maximal number of leaves checked by the searches of the search contexts of a tree created after this call.
+ * If it is positive, kNearestNeighboursContext searches best-bin-first (see kNearestNeighboursBestBinFirst)
+ * instead of calling the search function of the tree. A new tree searches exactly (0).
+ *
+ * @param tree - the tree
+ * @param maxLeafChecks - the maximal number of leaves checked by a search, 0 (or less) for the exact search
+ */
+void spKDTreeSetMaxLeafChecks(SPKDTree* tree, int maxLeafChecks){
+    if (tree != NULL)
+        tree->maxLeafChecks = maxLeafChecks > 0 ? maxLeafChecks : 0;
+}
+
+/**
+ * Builds a product quantization index of the feature store of the tree (see SPPQIndex.h), with numOfSubspaces bytes
+ * for every point, trained on up to SP_PQ_INDEX_TRAINING_ROWS points on up to numOfThreads threads. The search
+ * contexts of the tree created after this call search the index instead of the tree (see kNearestNeighboursPQ).
+ * If numOfCandidates is positive, the numOfCandidates closest points by the index (at least the size of the queue)
+ * are re-ranked by their exact distances, read from the feature store. Otherwise the approximate distances are kept.
+ * The index is built after the tree, which may reorder the store, and replaces the previous index of the tree.
+ *
+ * @param tree - the tree
+ * @param numOfSubspaces - the number of subspaces, between 1 and the dimension of the tree, or 0 to remove the index
+ * @param numOfCandidates - the number of candidates re-ranked by their exact distances, 0 (or less) to keep the
+ * approximate distances
+ * @param numOfThreads - the maximal number of threads building the index
+ *
+ * @return -1 in case tree is NULL, numOfSubspaces is out of range, the tree has no nodes (its index is kept - see
+ * spKDTreeInitPQ) or coordinates (see spKDTreeReleaseFeatures), or allocation failure occurred (the tree keeps
+ * its previous index). Otherwise, 1 is returned.
+ */
+int spKDTreeSetPQIndex(SPKDTree* tree, int numOfSubspaces, int numOfCandidates, int numOfThreads){
+    if(tree == NULL || numOfSubspaces < 0 || (tree->pq != NULL && tree->root == NULL && tree->nodes == NULL) ||
+            spFeatureStoreIsReleased(tree->store)){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        return -1;
+    }
+    SPPQIndex* pq = NULL;
+    if(numOfSubspaces > 0){
+        pq = spPQIndexCreate(tree->store, numOfSubspaces, SP_PQ_INDEX_TRAINING_ROWS, numOfThreads);
+        if(pq == NULL)
+            return -1;
+    }
+    spPQIndexDestroy(tree->pq);
+    tree->pq = pq;
+    tree->pqCandidates = numOfCandidates > 0 ? numOfCandidates : 0;
+    return 1;
+}
+
+/**
+ * Quantizes the points of the tree into one byte per coordinate (see SPQuantizedStore.h), calibrated on all the
+ * points, or removes the codes. The search contexts of the tree created after this call scan the leaves by the codes
+ * instead of the coordinates (see kNearestNeighboursQuantized). If numOfCandidates is positive, the numOfCandidates
+ * closest points by the codes (at least the size of the queue) are re-ranked by their exact distances, read from
+ * the feature store. Otherwise the approximate distances are kept.
+ * The codes follow the rows of the leaf buckets, so only a single tree in the flat layout can be quantized, and the
+ * codes are built after the tree, which may reorder the store.
+ *
+ * @param tree - the tree, a single tree in the flat layout
+ * @param quantized - true to quantize the points, false to remove the codes
+ * @param numOfCandidates - the number of candidates re-ranked by their exact distances, 0 (or less) to keep the
+ * approximate distances
+ *
+ * @return -1 in case tree is NULL, is not a single tree in the flat layout, has no coordinates (see
+ * spKDTreeReleaseFeatures), or allocation failure occurred (the tree keeps its previous codes). Otherwise, 1 is returned.
+ */
+int spKDTreeSetQuantized(SPKDTree* tree, bool quantized, int numOfCandidates){
+    if(tree == NULL || spFeatureStoreIsReleased(tree->store)){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        return -1;
+    }
+    if(quantized && (tree->nodes == NULL || tree->numOfTrees != 1)){
+        spLoggerPrintError(ERRORMSG_QUANTIZED_LAYOUT,__FILE__,__func__,__LINE__);
+        return -1;
+    }
+    SPQuantizedStore* codes = NULL;
+    if(quantized){
+        codes = spQuantizedStoreCreate(tree->store);
+        if(codes == NULL)
+            return -1;
+    }
+    spQuantizedStoreDestroy(tree->quantized);
+    tree->quantized = codes;
+    tree->quantizedCandidates = numOfCandidates > 0 ? numOfCandidates : 0;
+    return 1;
+}
+
+/**
+ * Frees the coordinates of the points of a quantized tree that keeps the approximate distances (see
+ * spKDTreeSetQuantized and spFeatureStoreReleaseData) - only its nodes, its codes and the image indices of the points
+ * stay in memory, and the tree is searched by its codes (kNearestNeighboursQuantized). The exact and best-bin-first
+ * searches, the product quantization index and the index file read the coordinates, so they fail on the tree
+ * afterwards, and its codes can't be replaced or removed.
+ * The coordinates of a tree loaded from an index file are mapped, not allocated, so they are kept.
+ *
+ * @param tree - the tree, quantized without re-ranking and without a product quantization index
+ *
+ * @return -1 in case tree is NULL, has no quantized codes, re-ranks them or has a product quantization index.
+ * 0 if the coordinates are mapped and kept. Otherwise, 1 is returned.
+ */
+int spKDTreeReleaseFeatures(SPKDTree* tree){
+    if(tree == NULL || tree->quantized == NULL || tree->quantizedCandidates > 0 || tree->pq != NULL){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        return -1;
+    }
+    tree->search = kNearestNeighboursQuantized;
+    if(tree->mapping != NULL) /* The rows are in the mapped index file */
+        return 0;
+    return spFeatureStoreReleaseData(tree->store) == 0 ? 1 : -1;
+}
+
+/**
+ * Initializes a new KD tree based on inputed point matrix.
+ * There are numOfImages images, and the image with index i has numOfFeatures[i] features, or points.
+ * The pointer to the point with index j of that image is in mat[i][j]. The index saved in that point is i.
+ * In this function, all the points are copied into one feature store (the points themselves are not kept,
+ * and are still owned by the caller).
+ * Finally, spKDTreeInit is called with that store, to create a big kd tree.
+ *
+ * @param mat - the array of the arrays of pointers of the features
+ * @param numOfImages - the number of images
+ * @param numOfFeatures - the array containing the number of features of each image
+ * @param splitMethod - the method used to determine the split dimension during the tree creation
+ *
+ * @return NULL in case of allocation failure occurred OR a missing point in mat OR another error in the input
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* fullKDTreeCreator(SPPoint*** mat , int numOfImages, int* numOfFeatures, KD_METHOD splitMethod){
+    SPFeatureStore* store = spFeatureStoreCreateFromPoints(mat, numOfImages, numOfFeatures); /* Copies all the features into one store */
+    if(store == NULL){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        return NULL;
+    }
+    return spKDTreeInit(splitMethod , store); /* Makes store into kd tree */
+}
+
+/**
+ * Creates a search context for tree: the queue of size kNN, the scratch arrays of kNearestNeighboursTree
+ * and the vote arrays of closestImagesSearch for numOfImages images, allocated once (and the heap of the
+ * best-bin-first search, if the tree has a maximal number of leaf checks - see spKDTreeSetMaxLeafChecks).
+ * The distance kernel is selected here (see SPDistance.h), so the searches only read shared state.
+ *
+ * @param tree - the tree the context searches
+ * @param kNN - the size of the bounded priority queue
+ * @param numOfImages - the number of images of the tree. All image indices will be between 0 and numOfImages-1
+ *
+ * @return NULL in case of allocation failure occurred OR tree is NULL OR kNN < 1 OR numOfImages < 1
+ * Otherwise, the new context is returned
+ */
+SPKDTreeSearchContext* spKDTreeSearchContextCreate(SPKDTree* tree, int kNN, int numOfImages){
+    if(tree == NULL || kNN < 1 || numOfImages < 1){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        return NULL;
+    }
+    SPKDTreeSearchContext* context = (SPKDTreeSearchContext*) calloc(1, sizeof(*context));
+    if(context == NULL){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        return NULL;
+    }
+    int dim = spFeatureStoreGetDimension(tree->store);
+    context->tree = tree;
+    context->numOfImages = numOfImages;
+    context->bpq = spBPQueueCreate(kNN);
+    context->query = (double*) malloc(spFeatureStoreGetStride(tree->store) * sizeof(double));
+    context->distances = (double*) malloc(tree->leafSize * sizeof(double));
+    context->highLimit = (double*) malloc(dim * sizeof(double));
+    context->lowLimit = (double*) malloc(dim * sizeof(double));
+    context->highLimitUse = (int*) malloc(dim * sizeof(int));
+    context->lowLimitUse = (int*) malloc(dim * sizeof(int));
+    context->imageResults = (int*) malloc(numOfImages * sizeof(int));
+    context->imageCheck = (int*) malloc(numOfImages * sizeof(int));
+    context->maxLeafChecks = tree->maxLeafChecks;
+    if(tree->pq != NULL){ /* The scratch memory of the product quantization search */
+        context->pqTable = (float*) malloc(spPQIndexGetTableSize(tree->pq) * sizeof(float));
+        context->candidates = spBPQueueCreate(kNearestNeighboursCandidates(tree->pqCandidates, kNN));
+    }
+    else if(tree->quantized != NULL){ /* The scratch memory of the quantized search */
+        context->codeQuery = (short*) malloc(spQuantizedStoreGetStride(tree->quantized) * sizeof(short));
+        context->candidates = spBPQueueCreate(kNearestNeighboursCandidates(tree->quantizedCandidates, kNN));
+    }
+    if(context->maxLeafChecks > 0){ /* The heap of the best-bin-first search */
+        context->maxBranches = kNearestNeighboursMaxBranches(tree, context->maxLeafChecks);
+        context->branches = (SPKDTreeBranch*) malloc(context->maxBranches * sizeof(SPKDTreeBranch));
+        context->maxVisited = kNearestNeighboursMaxVisited(tree, context->maxLeafChecks);
+        if(context->maxVisited > 0)
+            context->visited = (int*) malloc(context->maxVisited * sizeof(int));
+    }
+    if(context->bpq == NULL || context->query == NULL || context->distances == NULL || context->highLimit == NULL ||
+            context->lowLimit == NULL || context->highLimitUse == NULL || context->lowLimitUse == NULL ||
+            context->imageResults == NULL || context->imageCheck == NULL || (context->maxLeafChecks > 0 && context->branches == NULL) ||
+            (context->maxVisited > 0 && context->visited == NULL) ||
+            (tree->pq != NULL && (context->pqTable == NULL || context->candidates == NULL)) ||
+            (tree->pq == NULL && tree->quantized != NULL && (context->codeQuery == NULL || context->candidates == NULL))){
+        spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ );
+        spKDTreeSearchContextDestroy(context);
+        return NULL;
+    }
+    spDistanceGetKernel();
+    return context;
+}
+
+/**
+ * Frees all allocated memory of a search context. The tree is not destroyed.
+ *
+ * @param context - the context to free
+ */
+void spKDTreeSearchContextDestroy(SPKDTreeSearchContext* context){
+    if (context != NULL) {
+        spBPQueueDestroy(context->bpq);
+        free(context->query);
+        free(context->distances);
+        free(context->highLimit);
+        free(context->lowLimit);
+        free(context->highLimitUse);
+        free(context->lowLimitUse);
+        free(context->imageResults);
+        free(context->imageCheck);
+        free(context->branches);
+        free(context->visited);
+        free(context->pqTable);
+        free(context->codeQuery);
+        spBPQueueDestroy(context->candidates);
+        free(context);
+    }
+}
+
+/**
+ * Returns the queue of a search context, filled by kNearestNeighboursContext.
+ *
+ * @param context - the context
+ *
+ * @return The queue (NULL if context is NULL)
+ */
+SPBPQueue* spKDTreeSearchContextGetQueue(SPKDTreeSearchContext* context){
+    if (context == NULL)
+        return NULL;
+    return context->bpq;
+}
+
+/**
+ * Empties the queue of the context, and fills it with the closest points to targetPoint, like the search function
+ * of the tree of the context. kNearestNeighboursTree is run with the scratch arrays of the context, and the
+ * specialized search functions (see SPKDTreeSearch.h) keep their state on the stack, so nothing is allocated.
+ * If the tree had a maximal number of leaf checks when the context was created (see spKDTreeSetMaxLeafChecks),
+ * the queue is filled by a best-bin-first search instead, with the heap of the context.
+ * If the tree had a product quantization index when the context was created (see spKDTreeSetPQIndex), the queue
+ * is filled from the index instead (see kNearestNeighboursPQ), with the distance table of the context.
+ * Otherwise, if the tree had quantized codes (see spKDTreeSetQuantized), the leaves are scanned by the codes
+ * (see kNearestNeighboursQuantized) - the quantized search is not combined with the best-bin-first search.
+ *
+ * @param context - the search context
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ *
+ * @return -1 in case context or targetPoint are NULL, or the dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursContext(SPKDTreeSearchContext* context, SPPoint* targetPoint){
+    if(context == NULL || targetPoint == NULL){
+        spLoggerPrintError(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
+        return -1;
+    }
+    SPKDTree* tree = context->tree;
+    if(spPointGetDimension(targetPoint) != spFeatureStoreGetDimension(tree->store)){
+        spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+        return -1;
+    }
+    spBPQueueClear(context->bpq);
+    if(context->pqTable != NULL){ /* Product quantization search */
+        spBPQueueClear(context->candidates);
+        kNearestNeighboursPQFill(context->bpq, tree, targetPoint, context->query, context->pqTable, context->candidates);
+        return 1;
+    }
+    if(context->codeQuery != NULL){ /* Quantized search */
+        spBPQueueClear(context->candidates);
+        kNearestNeighboursQuantizedFill(context->bpq, tree, targetPoint, context->query, context->codeQuery, context->distances,
+                context->highLimit, context->lowLimit, context->highLimitUse, context->lowLimitUse, context->candidates);
+        return 1;
+    }
+    if(context->maxLeafChecks > 0){ /* Approximate search */
+        kNearestNeighboursBestBinFirstFill(context->bpq, tree, targetPoint, context->query, context->distances,
+                context->branches, context->maxBranches, context->visited, context->maxVisited, context->maxLeafChecks);
+        return 1;
+    }
+    if(tree->search != kNearestNeighboursTree)
+        return tree->search(context->bpq, tree, targetPoint);
+    kNearestNeighboursFill(context->bpq, tree, targetPoint, context->query, NULL, context->distances,
+            context->highLimit, context->lowLimit, context->highLimitUse, context->lowLimitUse);
+    return 1;
+}
+
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
+ * Same as closestImagesSearchContext, with a search context created for this call.
  *
  * @param kNN - the size of the bounded priority queue
  * @param closestImages - return parameter - array containing indices of similar images found
  * @param spNumOfSimilarImages - the number of similar images to find
  * @param targetFeatures - the array containing pointers to the features of the target image
  * @param numOfTargetFeatures - the number of features the target image has
- * @param root - the root node of the kd tree containing all the features of the images to search
+ * @param tree - the kd tree containing all the features of the images to search
  * @param numOfImages - the number of images to search. All image indices will be between 0 and numOfImages-1
  *
  * @return -1 in case of allocation failure occurred OR an error in the inputed variables
- * Otherwise, 0
+ * Otherwise, 1
  */
-int closestImagesSearch(int kNN, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures, SPKDTreeNode* root, int numOfImages){
-	if(closestImages == NULL || targetFeatures == NULL || root == NULL || numOfTargetFeatures < 1 || numOfImages < 1 || kNN < 1|| spNumOfSimilarImages < 1|| spNumOfSimilarImages > numOfImages){
+int closestImagesSearch(int kNN, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures, SPKDTree* tree, int numOfImages){
+	if(closestImages == NULL || targetFeatures == NULL || tree == NULL || numOfTargetFeatures < 1 || numOfImages < 1 || kNN < 1|| spNumOfSimilarImages < 1|| spNumOfSimilarImages > numOfImages){
 		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
 		return -1;
 	}
-	int* imageResults = (int*) malloc(numOfImages * sizeof(int)); /* imageResults[i] is the number of features image i has that are close to features in targetFeatures. */
-	int* imageCheck = (int*) malloc(numOfImages * sizeof(int)); /* targetFeatures[imageCheck[i]] is the last feature that was close to a feature in image i. */
-	BPQueueElement* peekElementPointer = (BPQueueElement*) malloc(sizeof(*peekElementPointer)); /* Element required to check the queues */
-    SPBPQueue* bpQueue = spBPQueueCreate(kNN); /* This queue will be filled with similar features, and emptied, for each feature in targetFeatures */
-
-    if(imageResults == NULL || imageCheck == NULL || peekElementPointer == NULL || bpQueue == NULL){
-        if(imageResults != NULL) free(imageResults);
-        if(imageCheck != NULL) free(imageCheck);
-        if(peekElementPointer != NULL) free(peekElementPointer);
-        if(bpQueue != NULL) spBPQueueDestroy(bpQueue);
+    SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(tree, kNN, numOfImages);
+    if(context == NULL)
         return -1;
-	}
+    int res = closestImagesSearchContext(context, closestImages, spNumOfSimilarImages, targetFeatures, numOfTargetFeatures);
+    spKDTreeSearchContextDestroy(context);
+    return res;
+}
+
+/**
+ * Resets the vote arrays of a search context before the votes of a target image.
+ *
+ * @param context - the search context
+ */
+static void closestImagesClear(SPKDTreeSearchContext* context){
+    for(int i = 0; i < context->numOfImages; i++){
+        context->imageResults[i] = 0; // Initialisation of imageResults
+        context->imageCheck[i] = -1; // Initialisation of imageCheck
+    }
+}
+
+/**
+ * Adds the votes of the target features first to last-1 to the vote arrays of a search context.
+ * For each target feature with index i: the queue of the context is filled with the kNN indices of the images
+ * that contain features that are closest to the target feature, using kNearestNeighboursContext.
+ * For each image index j in the queue, a counter for that image, imageResults[j], goes up by one.
+ * If the same index appears more than once, imageResults[j] only goes up by one. The queue is then emptied.
+ * Every target feature must be voted for once, by any context, in any order.
+ *
+ * @param context - the search context
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param first - the index of the first target feature
+ * @param last - the index after the last target feature
+ */
+static void closestImagesVote(SPKDTreeSearchContext* context, SPPoint** targetFeatures, int first, int last){
+	int* imageResults = context->imageResults; /* imageResults[i] is the number of features image i has that are close to features in targetFeatures. */
+	int* imageCheck = context->imageCheck; /* targetFeatures[imageCheck[i]] is the last feature that was close to a feature in image i. */
+	BPQueueElement peekElement; /* Element required to check the queues */
+    SPBPQueue* bpQueue = context->bpq; /* This queue will be filled with similar features, and emptied, for each feature in targetFeatures */
+    for(int i = first; i < last; i++){ // The main loop
+        kNearestNeighboursContext(context, targetFeatures[i]); // Fill bpQueue with close features
+        while(spBPQueueIsEmpty(bpQueue) == false){
+            spBPQueuePeek(bpQueue, &peekElement);
+            if(imageCheck[peekElement.index] != i){ // This is true only if a feature in image peekElement.index has not previously been found in the queue for feature targetFeatures[i]
+                imageResults[peekElement.index] = imageResults[peekElement.index]+1;
+                imageCheck[peekElement.index] = i; // This is to avoid counting the same image twice for one feature
+            }
+            spBPQueueDequeue(bpQueue);
+        }
+    }
+}
 
+/**
+ * Places the spNumOfSimilarImages image indices with the highest values in imageResults in a sorted array,
+ * closestImages. Of images with the same value, the lower index comes first.
+ *
+ * @param imageResults - the votes of every image
+ * @param numOfImages - the number of images
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ */
+static void closestImagesRank(const int* imageResults, int numOfImages, int* closestImages, int spNumOfSimilarImages){
     // Initialisation of closestImages
     for(int i = 1; i < spNumOfSimilarImages; i++){
         closestImages[i] = -1;
     }
     closestImages[0] = 0; // There is at least 1 image to compare, so there must be a closest image by default
-    for(int i = 0; i < numOfImages; i++){
-        imageResults[i] = 0; // Initialisation of imageResults
-        imageCheck[i] = -1; // Initialisation of imageCheck
-    }
-    for(int i = 0; i < numOfTargetFeatures; i++){ // The main loop
-        kNearestNeighboursTree(bpQueue , root, targetFeatures[i]); // Fill bpQueue with close features
-        if(bpQueue != NULL){
-            while(spBPQueueIsEmpty(bpQueue) == false){
-                spBPQueuePeek(bpQueue, peekElementPointer);
-                if(imageCheck[peekElementPointer->index] < i){ // This is true only if a feature in image peekElementPointer->index has not previously been found in the queue for feature targetFeatures[i]
-                    imageResults[peekElementPointer->index] = imageResults[peekElementPointer->index]+1;
-                    imageCheck[peekElementPointer->index] = i; // This is to avoid counting the same image twice for one feature
-                }
-                spBPQueueDequeue(bpQueue);
-            }
-        }
-    }
     int numOfClosestImages = 1; // The number of closest images found, out of a possible spNumOfSimilarImages
     int nextIndex = 0;
     for(int i = 1; i < numOfImages; i++){ // During this loop, the indices of the spNumOfSimilarImages closest images will be placed in closestImages
@@ -439,12 +2007,138 @@ int closestImagesSearch(int kNN, int* closestImages, int spNumOfSimilarImages, S
             closestImages[nextIndex] = i;
         }
     }
+}
 
-    // Release allocated memory
-    spBPQueueDestroy(bpQueue);
-    free(peekElementPointer);
-    free(imageResults);
-    free(imageCheck);
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
+ * Pointers to the features of the target image are in the targetFeatures array. The kd tree containing
+ * all the features of all the images to search is the tree of the context.
+ *
+ * For each target feature with index i: the queue of the context, of size kNN,
+ * is filled with the kNN indices of the images that contain features that are closest to the target feature,
+ * using kNearestNeighboursContext (the search function of the tree, kNearestNeighboursTree by default).
+ * For each image index j in the queue, a counter for that image, imageResults[j], goes up by one.
+ * If the same index appears more than once, imageResults[j] only goes up by one. The queue is then emptied.
+ *
+ * The spNumOfSimilarImages image indices with the highest values in imageResults are placed in a
+ * sorted array, closestImages, and this array is returned.
+ * All the memory used is in the context, so nothing is allocated, and any number of threads may search
+ * the same tree at once, each with its own context.
+ *
+ * @param context - the search context, holding the tree, the queue and the vote arrays
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param numOfTargetFeatures - the number of features the target image has
+ *
+ * @return -1 in case of an error in the inputed variables
+ * Otherwise, 1
+ */
+int closestImagesSearchContext(SPKDTreeSearchContext* context, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures){
+	if(context == NULL || closestImages == NULL || targetFeatures == NULL || numOfTargetFeatures < 1 || spNumOfSimilarImages < 1|| spNumOfSimilarImages > context->numOfImages){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+    closestImagesClear(context);
+    closestImagesVote(context, targetFeatures, 0, numOfTargetFeatures);
+    closestImagesRank(context->imageResults, context->numOfImages, closestImages, spNumOfSimilarImages);
+    return 1;
+}
+
+/** The target features of closestImagesSearchContexts, voted for by tasks of spParallelForThreads **/
+typedef struct kd_tree_vote_t {
+	SPKDTreeSearchContext** contexts; /* contexts[t] holds the votes of thread t */
+	SPPoint** targetFeatures;
+	int numOfTargetFeatures;
+} SPKDTreeVote;
+
+/**
+ * Votes for the target features of task into the context of thread (a task of spParallelForThreads)
+ */
+static void closestImagesVoteTask(void* arg, int task, int thread){
+    SPKDTreeVote* vote = (SPKDTreeVote*) arg;
+    int first = task * SP_SEARCH_FEATURES_PER_TASK;
+    int last = first + SP_SEARCH_FEATURES_PER_TASK < vote->numOfTargetFeatures ? first + SP_SEARCH_FEATURES_PER_TASK : vote->numOfTargetFeatures;
+    closestImagesVote(vote->contexts[thread], vote->targetFeatures, first, last);
+}
 
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image,
+ * searching for the target features on up to numOfContexts threads.
+ * The target features are split into tasks of SP_SEARCH_FEATURES_PER_TASK consecutive features, and every thread
+ * votes for the features of the tasks it takes into the vote arrays of its own context (see closestImagesSearchContext).
+ * The votes of a feature don't depend on the other features, so when all the tasks are done, the votes of the
+ * contexts are summed into the first context, and the images are ranked exactly as closestImagesSearchContext ranks
+ * them - the results, ties included, are the same with any number of threads.
+ *
+ * @param contexts - the search contexts, one for every thread, of the same tree, kNN, number of images and leaf checks
+ * @param numOfContexts - the number of contexts, the maximal number of threads
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param numOfTargetFeatures - the number of features the target image has
+ *
+ * @return -1 in case of an error in the inputed variables (including contexts that don't match)
+ * Otherwise, 1
+ */
+int closestImagesSearchContexts(SPKDTreeSearchContext** contexts, int numOfContexts, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures){
+	if(contexts == NULL || numOfContexts < 1 || contexts[0] == NULL || closestImages == NULL || targetFeatures == NULL || numOfTargetFeatures < 1 || spNumOfSimilarImages < 1|| spNumOfSimilarImages > contexts[0]->numOfImages){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+    int numOfTasks = (numOfTargetFeatures + SP_SEARCH_FEATURES_PER_TASK - 1) / SP_SEARCH_FEATURES_PER_TASK;
+    int numOfThreads = numOfContexts < numOfTasks ? numOfContexts : numOfTasks;
+    for(int t = 0; t < numOfThreads; t++){
+        if(contexts[t] == NULL || contexts[t]->tree != contexts[0]->tree || contexts[t]->numOfImages != contexts[0]->numOfImages ||
+                spBPQueueGetMaxSize(contexts[t]->bpq) != spBPQueueGetMaxSize(contexts[0]->bpq) ||
+                contexts[t]->maxLeafChecks != contexts[0]->maxLeafChecks){
+            spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+            return -1;
+        }
+        closestImagesClear(contexts[t]);
+    }
+    SPKDTreeVote vote = {contexts, targetFeatures, numOfTargetFeatures};
+    spParallelForThreads(numOfTasks, numOfThreads, closestImagesVoteTask, &vote);
+    int* imageResults = contexts[0]->imageResults;
+    for(int t = 1; t < numOfThreads; t++){ // Reduction of the votes of the threads
+        for(int i = 0; i < contexts[0]->numOfImages; i++)
+            imageResults[i] += contexts[t]->imageResults[i];
+    }
+    closestImagesRank(imageResults, contexts[0]->numOfImages, closestImages, spNumOfSimilarImages);
     return 1;
 }
+
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
+ * Same as closestImagesSearchContexts, with numOfThreads search contexts created for this call.
+ *
+ * @param kNN - the size of the bounded priority queue
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param numOfTargetFeatures - the number of features the target image has
+ * @param tree - the kd tree containing all the features of the images to search
+ * @param numOfImages - the number of images to search. All image indices will be between 0 and numOfImages-1
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return -1 in case of allocation failure occurred OR an error in the inputed variables
+ * Otherwise, 1
+ */
+int closestImagesSearchParallel(int kNN, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures, SPKDTree* tree, int numOfImages, int numOfThreads){
+	if(closestImages == NULL || targetFeatures == NULL || tree == NULL || numOfTargetFeatures < 1 || numOfImages < 1 || kNN < 1|| spNumOfSimilarImages < 1|| spNumOfSimilarImages > numOfImages || numOfThreads < 1){
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS,__FILE__,__func__,__LINE__);
+		return -1;
+	}
+    int numOfTasks = (numOfTargetFeatures + SP_SEARCH_FEATURES_PER_TASK - 1) / SP_SEARCH_FEATURES_PER_TASK;
+    if(numOfThreads > numOfTasks) /* No more contexts than threads that can be used */
+        numOfThreads = numOfTasks;
+    SPKDTreeSearchContext** contexts = (SPKDTreeSearchContext**) calloc(numOfThreads, sizeof(*contexts));
+    bool allocated = contexts != NULL;
+    for(int t = 0; allocated && t < numOfThreads; t++)
+        allocated = (contexts[t] = spKDTreeSearchContextCreate(tree, kNN, numOfImages)) != NULL;
+    int res = allocated ? closestImagesSearchContexts(contexts, numOfThreads, closestImages, spNumOfSimilarImages, targetFeatures, numOfTargetFeatures) : -1;
+    for(int t = 0; contexts != NULL && t < numOfThreads; t++)
+        spKDTreeSearchContextDestroy(contexts[t]);
+    free(contexts);
+    return res;
+}
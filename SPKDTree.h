@@ -1,5 +1,6 @@
 #ifndef SPKDTREE_H_INCLUDED
 #define SPKDTREE_H_INCLUDED
+#include "SPFeatureStore.h"
 #include "SPKDArray.h"
 #include "SPConfig.h"
 #include "SPBPriorityQueue.h"
@@ -10,7 +11,7 @@
  * Each non-leaf node represents a group of points, and splits the group in half around the median coordinate
  * in a dimension chosen by one of 3 methods. The left child represents the half with the lower values in that dimension,
  * while the right child represents the group with the higher values.
- * The root node represents the full array of points. The leaves contain the points themselves.
+ * The root node represents the full array of points. The leaves contain the row ids of the points in the feature store.
  * The different splitting methods are:
  * INCREMENTAL, meaning the dimension increases by 1 for each level.
  * RANDOM, meaning the dimension is randomly selected.
@@ -18,43 +19,199 @@
  *
  * The purpose of the kd tree in this project is to easily find points that are close, in terms of distance,
  * to a target point.
+ * An SPKDTree holds the root node of the tree and the feature store the tree is built over.
+ * Alternatively (spKDTreeInitFlat), the tree is kept in a flat layout: one array of small nodes in breadth-first
+ * order, where children are found by their position in the array and the leaves are buckets of up to leafSize points,
+ * kept in consecutive rows of the feature store (the store is reordered when the tree is built).
+ * A forest (spKDTreeInitForest) is a number of randomized trees in the flat layout over the same store, searched
+ * together by the best-bin-first search.
+ * A tree without nodes (spKDTreeInitPQ) only holds a product quantization index of the store, scanned by every search.
  * The points are ordered differently by each dimension, and each
  * possible order is saved in the KD Array as an array.
  *
  * The following functions are supported:
  *
- * spKDTreeInit            	    - Initializes a KD tree based on an array of points, and splitting method.
+ * spKDTreeInit            	    - Initializes a KD tree based on a feature store, and splitting method.
  * spKDTreeInitRecursion 		- The recursion function used in spKDTreeInit.
+ * spKDTreeInitFlat        	    - Initializes a KD tree in the flat layout, with leaf buckets.
+ * spKDTreeInitFlatParallel	    - Initializes a KD tree in the flat layout, splitting on several threads.
+ * spKDTreeInitFlatInPlace	    - Initializes a KD tree in the flat layout, selecting medians in place of kd arrays.
+ * spKDTreeInitForest           - Initializes a forest of randomized KD trees in the flat layout, over one feature store.
+ * spKDTreeInitPQ               - Initializes a KD tree without nodes, searched by a product quantization index.
  * kNearestNeighboursTree		- Fills a bounded priority queue with the closest points to a target point.
  * kNearestNeighboursRecursion	- The recursion function used in kNearestNeighboursTree.
  * minDistanceSquared		    - Calculates the minimal distance from a target point to an area within defined limits.
+ * kNearestNeighboursBestBinFirst - Fills a bounded priority queue with close points, checking a limited number of leaves.
+ * kNearestNeighboursPQ         - Fills a bounded priority queue with close points, by the product quantization index of a tree.
+ * kNearestNeighboursQuantized  - Fills a bounded priority queue with close points, by the quantized codes of a tree.
  * spKDTreeDestroy     		    - Frees all allocated memory in a KD tree.
+ * spKDTreeNodeDestroy     		- Frees all allocated memory in a KD subtree.
+ * spKDTreeGetStore     		- A getter of the feature store of a KD tree.
+ * spKDTreeSetSearch    		- Sets the search function used by closestImagesSearch.
+ * spKDTreeSetMaxLeafChecks     - Sets the number of leaves checked by the approximate searches of search contexts.
+ * spKDTreeSetPQIndex           - Builds a product quantization index, searched by search contexts instead of the tree.
+ * spKDTreeSetQuantized         - Quantizes the points of a tree, scanned at the leaves by search contexts instead of the coordinates.
+ * spKDTreeReleaseFeatures      - Frees the coordinates of a quantized tree, keeping only its codes.
  * fullKDTreeCreator    		- Initializes a KD tree containing the features of all the images. Uses spKDTreeInit.
  * closestImagesSearch 	        - Finds the closest points to all features of a target image, and returns the indices
- *                                of the images with the highest number of similar features. Uses kNearestNeighboursTree.
+ *                                of the images with the highest number of similar features. Uses the search function
+ *                                of the tree (kNearestNeighboursTree unless set by spKDTreeSetSearch).
+ * spKDTreeSearchContextCreate  - Allocates the memory of the searches of one thread.
+ * spKDTreeSearchContextDestroy - Frees all allocated memory in a search context.
+ * spKDTreeSearchContextGetQueue - A getter of the queue of a search context.
+ * kNearestNeighboursContext    - Fills the queue of a search context with the closest points to a target point.
+ * closestImagesSearchContext   - closestImagesSearch with a search context, without allocating memory.
+ * closestImagesSearchContexts  - closestImagesSearchContext on several threads, each with its own search context.
+ * closestImagesSearchParallel  - closestImagesSearch on several threads.
+ *
+ * A tree is never changed by a search, so any number of threads may search it at once. The search context
+ * variants keep all the memory of a search in a context the caller owns, one for each thread, so searching
+ * does not allocate memory and the threads share no mutable state.
  *
  */
 
 /** Type for defining the tree node **/
 typedef struct kd_tree_node_t SPKDTreeNode;
 
+/** Type for defining the tree (the root node and the feature store it is built over) **/
+typedef struct kd_tree_t SPKDTree;
+
+/** Type for defining a search context - the queue and the scratch memory of the searches of one thread **/
+typedef struct kd_tree_search_context_t SPKDTreeSearchContext;
+
+/** Type of a function filling a bounded priority queue with the closest points to a target point (see kNearestNeighboursTree) **/
+typedef int (*SPKDTreeSearchFunc)(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint);
+
 /**
- * Initializes a new KD tree based on inputed point array and size of array.
- * First, a kd array is created, then it is split recursively using splitMethod to determine next split dimension.
+ * Initializes a new KD tree based on inputed feature store.
+ * First, a kd array of all the rows of the store is created, then it is split recursively using splitMethod to
+ * determine next split dimension.
  * A new tree node is created with each split, saving the split dimension and the median value in that dimension,
  * which the array split around. The left child of the node is the node created with the left kd array after the split,
  * and the right child of the node is the node created with the right kd array after the split.
  * When the recursive function is called for a kd array of 1 point, it is a leaf and
- * saves the pointer to the point.
+ * saves the row id of the point.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param store - the feature store holding the points
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInit(KD_METHOD splitMethod , SPFeatureStore* store);
+
+/**
+ * Initializes a new KD tree in the flat layout based on inputed feature store.
+ * Same as spKDTreeInitFlatParallel with one thread.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitFlat(KD_METHOD splitMethod, SPFeatureStore* store, int leafSize);
+
+/**
+ * Initializes a new KD tree in the flat layout based on inputed feature store.
+ * The kd array of all the rows of the store is split as in spKDTreeInit, but breadth-first, level by level:
+ * the kd arrays waiting to be split are kept in a queue, in the order of their nodes in the node array.
+ * The children of a node are added to the end of the queue together, so they are adjacent in the array,
+ * and the node saves the position of the left child.
+ * A kd array of at most leafSize points is not split, it becomes a leaf holding a bucket of its points.
+ * The nodes of a level are first visited in order on the calling thread, choosing their split dimensions
+ * and median values (so the RANDOM method draws the same dimensions with any number of threads), and then
+ * their kd arrays are split on up to numOfThreads threads. When a level has fewer nodes than threads,
+ * the dimensions of each kd array are split on several threads too.
+ * When the tree is built, the rows of the store are reordered in the order of the leaves, so the points of
+ * every bucket are consecutive rows and a leaf only saves the first row of its bucket.
+ * All the nodes are allocated in one block, which spKDTreeDestroy frees at once.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param splitMethod - the method used to determine the split dimension
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitFlatParallel(KD_METHOD splitMethod, SPFeatureStore* store, int leafSize, int numOfThreads);
+
+/**
+ * Initializes a new KD tree in the flat layout based on inputed feature store, without kd arrays.
+ * The tree is the same tree spKDTreeInitFlatParallel builds (the same nodes, and the same points in every leaf bucket),
+ * but the points are kept in one permutation of the row ids instead of a sorted matrix of indices for every node.
+ * The points of a node are a range of the permutation. A node is split by selecting its median point in the split
+ * dimension (introselect, O(size) on average), so that the points of the left child are the first half of the range
+ * and the points of the right child are the second half - the points are ordered by their coordinate and then
+ * by their row id, which is the order of the points in a kd array.
+ * MAX_SPREAD finds the range of the points in every dimension by scanning them.
+ * The extra memory is the permutation and a few integers for every node, instead of d+1 integers for every
+ * point in every level of the tree.
+ * The tree is built level by level, and the nodes of a level are split on up to numOfThreads threads (the RANDOM
+ * dimensions are drawn on the calling thread in the order of the nodes).
+ * When the tree is built, the rows of the store are reordered in the order of the permutation, so the points
+ * of every leaf bucket are consecutive rows (by ascending original row id).
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
  *
  * @param splitMethod - the method used to determine the split dimension
- * @param pointsArray - the array of pointers to points
- * @param pointsArraySize - the number of pointers to points
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitFlatInPlace(KD_METHOD splitMethod, SPFeatureStore* store, int leafSize, int numOfThreads);
+
+/**
+ * Initializes a new forest of numOfTrees randomized KD trees in the flat layout, over one feature store.
+ * Every tree is built like spKDTreeInitFlatInPlace, but the split dimension of every node is drawn at random
+ * from the SP_KDTREE_FOREST_SPLIT_DIMENSIONS dimensions in which its points have the highest variance, so the
+ * trees split the points differently. The points are split around the median, as in the other layouts.
+ * The store is reordered by the leaves of the first tree, so the first tree is an ordinary flat tree, searched
+ * like one by the exact searches. The leaf buckets of the other trees are ranges of an array of row ids, so the
+ * extra memory of every tree is its nodes and one integer for every point.
+ * The best-bin-first search (see spKDTreeSetMaxLeafChecks) searches all the trees together, with one heap of
+ * branches and one budget of leaf checks, which finds more of the closest points than one tree does with the
+ * same number of leaf checks.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf bucket
+ * @param numOfTrees - the number of trees
+ * @param numOfThreads - the maximal number of threads to use
  *
- * @return NULL in case of allocation failure occurred OR pointsArray is NULL
- * Otherwise, the root node of the new tree is returned
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR leafSize < 1 OR numOfTrees < 1
+ * Otherwise, the new forest is returned
  */
-SPKDTreeNode* spKDTreeInit(KD_METHOD splitMethod , SPPoint** pointsArray, int pointsArraySize);
+SPKDTree* spKDTreeInitForest(SPFeatureStore* store, int leafSize, int numOfTrees, int numOfThreads);
+
+/**
+ * Initializes a new KD tree without nodes, searched only by a product quantization index of the inputed feature
+ * store (see spKDTreeSetPQIndex) - no tree is built, and its search contexts and search function (kNearestNeighboursPQ)
+ * scan the codes of the index. The index has numOfSubspaces bytes for every point, and is trained on up to
+ * SP_PQ_INDEX_TRAINING_ROWS points on up to numOfThreads threads.
+ * If numOfCandidates is positive, the numOfCandidates closest points by the index are re-ranked by their exact
+ * distances, so the coordinates are kept. Otherwise the coordinates are freed once the points are encoded
+ * (see spFeatureStoreReleaseData), and only the codes and the image indices of the points stay in memory.
+ * The exact and best-bin-first searches, the quantized codes and the index file need nodes, so they fail on the tree,
+ * and its index can't be replaced.
+ * The tree takes ownership of the store (also on failure), it is freed by spKDTreeDestroy.
+ *
+ * @param store - the feature store holding the points
+ * @param numOfSubspaces - the number of subspaces, between 1 and the dimension of the store
+ * @param numOfCandidates - the number of candidates re-ranked by their exact distances, 0 (or less) to keep the
+ * approximate distances and free the coordinates
+ * @param numOfThreads - the maximal number of threads building the index
+ *
+ * @return NULL in case of allocation failure occurred OR store is NULL or empty OR numOfSubspaces is out of range
+ * Otherwise, the new tree is returned
+ */
+SPKDTree* spKDTreeInitPQ(SPFeatureStore* store, int numOfSubspaces, int numOfCandidates, int numOfThreads);
 
 /**
  * The recursion function used to create the kd tree.
@@ -78,13 +235,15 @@ SPKDTreeNode* spKDTreeInitRecursion(KD_METHOD splitMethod , SPKDArray* kdA, int
  * sent into the recursive function kNearestNeighboursTree as well as the address of the tree and the queue.
  *
  * @param bpq - the bounded priority queue to fill
- * @param root - the root node of the tree to search
+ * @param tree - the tree to search
  * @param targetPoint - the point, or feature, that is being searched for in the other images
  *
- * @return -2 in case of allocation failure occurred. -1 in case bpq, root or targetNode are NULL.
+ * @return -2 in case of allocation failure occurred. -1 in case bpq, tree or targetNode are NULL,
+ * the tree has no nodes (see spKDTreeInitPQ) or coordinates (see spKDTreeReleaseFeatures), or the dimension of
+ * targetPoint differs from the dimension of the tree.
  * Otherwise, 1 is returned.
  */
-int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTreeNode* root, SPPoint* targetPoint);
+int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTree* tree, SPPoint* targetPoint);
 
 /**
  * This function recursively travels along the kd tree and marks the limits defined by each subtree.
@@ -93,12 +252,16 @@ int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTreeNode* root, SPPoint* targetP
  *
  * If the current node is split by dimension with index currentDimIndex, the current limits of that dimension
  * are saved.
+ * The minimal squared distance from the target point to the limits (bound) is kept along the way: only the limits
+ * of currentDimIndex change between a subtree and its children, so the bound of a child is the bound of the subtree,
+ * with the contribution of currentDimIndex replaced. minDistanceSquared is only called when the bound is too close
+ * to the furthest distance in the queue to tell them apart despite rounding, so the same subtrees are skipped.
  * Next, the limits are set to match the limits of the left child subtree:
  * highLimitUse[currentDimIndex] is set to 1, meaning there is a top value.
  * highLimit[currentDimIndex] is set to the median value saved in the node,
  * meaning all points in the left subtree have a coordinate that is lower than the limit in the currentDimIndex dimension.
- * Next, if the queue is full, the minimal squared distance from those limits to the target point is calculated,
- * and if that squared distance is bigger than the maximal squared distance in the queue, that subtree is skipped.
+ * Next, if the queue is full, and the bound of the left subtree is bigger than the maximal squared distance in
+ * the queue, that subtree is skipped.
  * If it is not skipped, the functoin is called on the left chid.
  *
  * After this, highLimitUse[currentDimIndex] highLimit[currentDimIndex] are restored to their previous values.
@@ -106,20 +269,23 @@ int kNearestNeighboursTree(SPBPQueue* bpq , SPKDTreeNode* root, SPPoint* targetP
  * lowLimitUse[currentDimIndex] is set to 1, meaning there is a bottom value.
  * lowLimit[currentDimIndex] is set to the median value saved in the node,
  * meaning all points in the right subtree have a coordinate that is higher than the limit in the currentDimIndex dimension.
- * Next, if the queue is full, the minimal squared distance from those limits to the target point is calculated,
- * and if that squared distance is bigger than the maximal squared distance in the queue, that subtree is skipped.
+ * Next, if the queue is full, and the bound of the right subtree is bigger than the maximal squared distance in
+ * the queue, that subtree is skipped.
  * If it is not skipped, the function is called on the right chid.
  *
  * @param bpq - the bounded priority queue to fill
+ * @param store - the feature store holding the points of the tree
  * @param curr - the current node of the tree, the root of the current subtree
  * @param targetPoint - the point, or feature, that is being searched for
+ * @param query - the coordinates of targetPoint, zero padded to the stride of the feature store
  * @param highLimit - the array that contains the maximum value for each dimension of the points in the subtree
  * @param lowLimit - the array that contains the minimum value for each dimension of the points in the subtree
  * @param highLimitUse - the array that marks if there is a maximum value for each dimension of the points in the subtree
  * @param lowLimitUse - the array that marks if there is a minimum value for each dimension of the points in the subtree
+ * @param bound - the minimal squared distance from the target point to the limits of the subtree (0 at the root)
  *
  */
-void kNearestNeighboursRecursion(SPBPQueue* bpq, SPKDTreeNode* curr, SPPoint* targetPoint, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse);
+void kNearestNeighboursRecursion(SPBPQueue* bpq, SPFeatureStore* store, SPKDTreeNode* curr, SPPoint* targetPoint, const double* query, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse, double bound);
 
 /**
  * This function calculates the distance squared from the target point to the closest point in the limits.
@@ -137,18 +303,185 @@ void kNearestNeighboursRecursion(SPBPQueue* bpq, SPKDTreeNode* curr, SPPoint* ta
 double minDistanceSquared(SPPoint* targetPoint, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse);
 
 /**
- * Frees all allocated memory of kd tree. It is used recursively on each child.
+ * This function searches the inputed kd tree for points close to an inputed target point, checking at most
+ * maxLeafChecks leaves. The index of the image of every point found and its squared distance are entered into bpq,
+ * like in kNearestNeighboursTree.
+ * The search is best-bin-first: it goes down from the root to the leaf whose limits contain the target point, and
+ * every child not chosen on the way is added to a heap of unexplored branches, with a bound - the bound of its parent
+ * plus the squared distance from the target point to the split value. The search then goes down again from the
+ * branch with the lowest bound, until maxLeafChecks leaves are checked, or until the queue is full and no branch
+ * has a lower bound than the maximal squared distance in the queue.
+ * The closest points may be missed - the more leaves are checked, the closer the results are to the results of
+ * kNearestNeighboursTree, and the longer the search takes. A leaf is a bucket of points in the flat layout.
+ * The arrays of the search are allocated on every call - kNearestNeighboursContext searches with the arrays of a
+ * search context instead (see spKDTreeSetMaxLeafChecks).
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ * @param maxLeafChecks - the maximal number of leaves checked
+ *
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * maxLeafChecks < 1, the tree has no nodes (see spKDTreeInitPQ) or coordinates (see spKDTreeReleaseFeatures), or the
+ * dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursBestBinFirst(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint, int maxLeafChecks);
+
+/**
+ * This function searches the product quantization index of the inputed kd tree (see spKDTreeSetPQIndex) for points
+ * close to an inputed target point. The index of the image of every point found and its squared distance are entered
+ * into bpq, like in kNearestNeighboursTree.
+ * The distance table of the target point is calculated, and the codes of all the points are scanned for the closest
+ * candidates by the approximate distances (see SPPQIndex.h). If the tree re-ranks the candidates, their exact
+ * squared distances are read from the feature store (which may be the mapped index file of a loaded tree),
+ * otherwise the candidates are entered with their approximate distances.
+ * The arrays of the search are allocated on every call - kNearestNeighboursContext searches with the arrays of a
+ * search context instead.
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ *
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * the tree has no product quantization index, or the dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursPQ(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint);
+
+/**
+ * This function searches the inputed kd tree by its quantized codes (see spKDTreeSetQuantized) for points close to an
+ * inputed target point. The index of the image of every point found and its squared distance are entered into bpq,
+ * like in kNearestNeighboursTree.
+ * The target point is quantized, and the tree is travelled like in kNearestNeighboursTree, but the distances of the
+ * points of the leaves are calculated from their codes by the integer kernels (see SPQuantizedStore.h) - one byte per
+ * coordinate instead of eight - and the closest candidates are gathered by these approximate distances. If the tree
+ * re-ranks the candidates, their exact squared distances are read from the feature store, otherwise the candidates
+ * are entered with their approximate distances. The subtrees are skipped by the approximate distances of the
+ * candidates, so with at least as many candidates as the points of the tree the re-ranked search is exact.
+ * The arrays of the search are allocated on every call - kNearestNeighboursContext searches with the arrays of a
+ * search context instead.
+ *
+ * @param bpq - the bounded priority queue to fill
+ * @param tree - the tree to search
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ *
+ * @return -2 in case of allocation failure occurred (bpq is left as it is). -1 in case bpq, tree or targetNode are NULL,
+ * the tree has no quantized codes, or the dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursQuantized(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint);
+
+/**
+ * Frees all allocated memory of kd tree, including its feature store.
+ * A tree loaded from an index file (see spKDTreeIndexLoad) is unmapped instead.
+ *
+ * @param tree - the tree to free
+ */
+void spKDTreeDestroy(SPKDTree* tree);
+
+/**
+ * Frees all allocated memory of kd subtree. It is used recursively on each child.
  *
  * @param curr - the tree node to free
  */
-void spKDTreeDestroy(SPKDTreeNode* curr);
+void spKDTreeNodeDestroy(SPKDTreeNode* curr);
+
+/**
+ * Returns the feature store the kd tree is built over.
+ *
+ * @param tree - the tree
+ *
+ * @return The feature store (NULL if tree is NULL)
+ */
+SPFeatureStore* spKDTreeGetStore(SPKDTree* tree);
+
+/**
+ * Sets the search function closestImagesSearch uses to fill the queue for each target feature.
+ * A new tree uses kNearestNeighboursTree. The function must give the same results as kNearestNeighboursTree,
+ * for example a version specialized to the dimension of the tree (see SPKDTreeSearch.h).
+ *
+ * @param tree - the tree
+ * @param search - the search function, if NULL kNearestNeighboursTree is set
+ */
+void spKDTreeSetSearch(SPKDTree* tree, SPKDTreeSearchFunc search);
+
+/**
+ * Sets the maximal number of leaves checked by the searches of the search contexts of a tree created after this call.
+ * If it is positive, kNearestNeighboursContext (and so closestImagesSearch) searches best-bin-first
+ * (see kNearestNeighboursBestBinFirst) instead of calling the search function of the tree - fewer leaf checks
+ * make the search faster, and miss more of the closest points. A new tree searches exactly (0).
+ *
+ * @param tree - the tree
+ * @param maxLeafChecks - the maximal number of leaves checked by a search, 0 (or less) for the exact search
+ */
+void spKDTreeSetMaxLeafChecks(SPKDTree* tree, int maxLeafChecks);
+
+/**
+ * Builds a product quantization index of the feature store of the tree (see SPPQIndex.h), with numOfSubspaces bytes
+ * for every point, trained on up to SP_PQ_INDEX_TRAINING_ROWS points on up to numOfThreads threads.
+ * The search contexts of the tree created after this call search the index instead of the tree
+ * (see kNearestNeighboursPQ), so closestImagesSearch does too. If numOfCandidates is positive, the numOfCandidates
+ * closest points by the index (at least the size of the queue) are re-ranked by their exact distances, read from
+ * the feature store. Otherwise the approximate distances are kept.
+ * The index refers to the rows of the store, so it is built after the tree. It replaces the previous index of the tree,
+ * and is freed by spKDTreeDestroy.
+ *
+ * @param tree - the tree
+ * @param numOfSubspaces - the number of subspaces, between 1 and the dimension of the tree, or 0 to remove the index
+ * @param numOfCandidates - the number of candidates re-ranked by their exact distances, 0 (or less) to keep the
+ * approximate distances
+ * @param numOfThreads - the maximal number of threads building the index
+ *
+ * @return -1 in case tree is NULL, numOfSubspaces is out of range, the tree has no nodes (its index is kept - see
+ * spKDTreeInitPQ) or coordinates (see spKDTreeReleaseFeatures), or allocation failure occurred (the tree keeps
+ * its previous index). Otherwise, 1 is returned.
+ */
+int spKDTreeSetPQIndex(SPKDTree* tree, int numOfSubspaces, int numOfCandidates, int numOfThreads);
+
+/**
+ * Quantizes the points of the tree into one byte per coordinate (see SPQuantizedStore.h), calibrated on the range of
+ * every dimension over all the points, or removes the codes. The search contexts of the tree created after this call
+ * scan the leaves by the codes instead of the coordinates (see kNearestNeighboursQuantized), so closestImagesSearch
+ * does too, unless the tree has a product quantization index, which is searched first. If numOfCandidates is positive,
+ * the numOfCandidates closest points by the codes (at least the size of the queue) are re-ranked by their exact
+ * distances, read from the feature store. Otherwise the approximate distances are kept, and the coordinates may be
+ * freed (see spKDTreeReleaseFeatures).
+ * The codes follow the rows of the leaf buckets, so only a single tree in the flat layout can be quantized, and the
+ * codes are built after the tree. They replace the previous codes of the tree, and are freed by spKDTreeDestroy.
+ *
+ * @param tree - the tree, a single tree in the flat layout
+ * @param quantized - true to quantize the points, false to remove the codes
+ * @param numOfCandidates - the number of candidates re-ranked by their exact distances, 0 (or less) to keep the
+ * approximate distances
+ *
+ * @return -1 in case tree is NULL, is not a single tree in the flat layout, has no coordinates (see
+ * spKDTreeReleaseFeatures), or allocation failure occurred (the tree keeps its previous codes). Otherwise, 1 is returned.
+ */
+int spKDTreeSetQuantized(SPKDTree* tree, bool quantized, int numOfCandidates);
+
+/**
+ * Frees the coordinates of the points of a quantized tree that keeps the approximate distances (see
+ * spKDTreeSetQuantized and spFeatureStoreReleaseData) - only its nodes, its codes and the image indices of the points
+ * stay in memory, and the tree is searched by its codes (kNearestNeighboursQuantized). The exact and best-bin-first
+ * searches, the product quantization index and the index file read the coordinates, so they fail on the tree
+ * afterwards, and its codes can't be replaced or removed.
+ * The coordinates of a tree loaded from an index file are mapped, not allocated, so they are kept.
+ *
+ * @param tree - the tree, quantized without re-ranking and without a product quantization index
+ *
+ * @return -1 in case tree is NULL, has no quantized codes, re-ranks them or has a product quantization index.
+ * 0 if the coordinates are mapped and kept. Otherwise, 1 is returned.
+ */
+int spKDTreeReleaseFeatures(SPKDTree* tree);
 
 /**
  * Initializes a new KD tree based on inputed point matrix.
  * There are numOfImages images, and the image with index i has numOfFeatures[i] features, or points.
  * The pointer to the point with index j of that image is in mat[i][j]. The index saved in that point is i.
- * In this function, all the pointers are saved in one long array of type SPPoint*.
- * Finally, spKDTreeInit is called with that array, to create a big kd tree.
+ * In this function, all the points are copied into one feature store (the points themselves are not kept,
+ * and are still owned by the caller).
+ * Finally, spKDTreeInit is called with that store, to create a big kd tree.
  *
  * @param mat - the array of the arrays of pointers of the features
  * @param numOfImages - the number of images
@@ -156,35 +489,146 @@ void spKDTreeDestroy(SPKDTreeNode* curr);
  * @param splitMethod - the method used to determine the split dimension during the tree creation
  *
  * @return NULL in case of allocation failure occurred OR a missing point in mat OR another error in the input
- * Otherwise, the root node of the new tree is returned
+ * Otherwise, the new tree is returned
  */
-SPKDTreeNode* fullKDTreeCreator(SPPoint*** mat , int numOfImages, int* numOfFeatures, KD_METHOD splitMethod);
+SPKDTree* fullKDTreeCreator(SPPoint*** mat , int numOfImages, int* numOfFeatures, KD_METHOD splitMethod);
 
 /**
  * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
- * Pointers to the features of the target image are in the targetFeatures array. The root of the kd tree containing
- * all the features of all the images to search is root.
+ * Same as closestImagesSearchContext, with a search context created for this call (see spKDTreeSearchContextCreate).
+ *
+ * @param kNN - the size of the bounded priority queue
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param numOfTargetFeatures - the number of features the target image has
+ * @param tree - the kd tree containing all the features of the images to search
+ * @param numOfImages - the number of images to search. All image indices will be between 0 and numOfImages-1
+ *
+ * @return -1 in case of allocation failure occurred OR an error in the inputed variables
+ * Otherwise, 1
+ */
+int closestImagesSearch(int kNN, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures, SPKDTree* tree, int numOfImages);
+
+/**
+ * Creates a search context for tree: the queue of size kNN, the scratch arrays of kNearestNeighboursTree
+ * and the vote arrays of closestImagesSearch for numOfImages images, allocated once (and the heap of the
+ * best-bin-first search, if the tree has a maximal number of leaf checks - see spKDTreeSetMaxLeafChecks).
+ * A context is used by one thread at a time, and must be destroyed before its tree.
+ * The distance kernel is selected here (see SPDistance.h), so the searches only read shared state.
  *
- * A bounded priority queue, bpQueue, of size kNN is defined. For each target feature with index i:
- * bpQueue is filled with the kNN indices of the images that contain features that are closest to the target feature,
- * using the function kNearestNeighboursTree(bpQueue , root, targetFeatures[i]).
+ * @param tree - the tree the context searches
+ * @param kNN - the size of the bounded priority queue
+ * @param numOfImages - the number of images of the tree. All image indices will be between 0 and numOfImages-1
+ *
+ * @return NULL in case of allocation failure occurred OR tree is NULL OR kNN < 1 OR numOfImages < 1
+ * Otherwise, the new context is returned
+ */
+SPKDTreeSearchContext* spKDTreeSearchContextCreate(SPKDTree* tree, int kNN, int numOfImages);
+
+/**
+ * Frees all allocated memory of a search context. The tree is not destroyed.
+ * If context is NULL nothing happens.
+ *
+ * @param context - the context to free
+ */
+void spKDTreeSearchContextDestroy(SPKDTreeSearchContext* context);
+
+/**
+ * Returns the queue of a search context, filled by kNearestNeighboursContext.
+ *
+ * @param context - the context
+ *
+ * @return The queue (NULL if context is NULL)
+ */
+SPBPQueue* spKDTreeSearchContextGetQueue(SPKDTreeSearchContext* context);
+
+/**
+ * Empties the queue of the context, and fills it with the closest points to targetPoint, like the search function
+ * of the tree of the context. kNearestNeighboursTree is run with the scratch arrays of the context, and the
+ * specialized search functions (see SPKDTreeSearch.h) keep their state on the stack, so nothing is allocated.
+ * If the tree had a maximal number of leaf checks when the context was created (see spKDTreeSetMaxLeafChecks),
+ * the queue is filled by a best-bin-first search instead, with the heap of the context.
+ * If the tree had a product quantization index when the context was created (see spKDTreeSetPQIndex), the queue
+ * is filled from the index instead (see kNearestNeighboursPQ), with the distance table of the context.
+ * Otherwise, if the tree had quantized codes (see spKDTreeSetQuantized), the leaves are scanned by the codes
+ * (see kNearestNeighboursQuantized) with the quantized query of the context. The quantized search visits the
+ * leaves like the exact search - it is not combined with the best-bin-first search.
+ *
+ * @param context - the search context
+ * @param targetPoint - the point, or feature, that is being searched for in the other images
+ *
+ * @return -1 in case context or targetPoint are NULL, or the dimension of targetPoint differs from the dimension of the tree.
+ * Otherwise, 1 is returned.
+ */
+int kNearestNeighboursContext(SPKDTreeSearchContext* context, SPPoint* targetPoint);
+
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
+ * Pointers to the features of the target image are in the targetFeatures array. The kd tree containing
+ * all the features of all the images to search is the tree of the context.
+ *
+ * For each target feature with index i: the queue of the context, of size kNN,
+ * is filled with the kNN indices of the images that contain features that are closest to the target feature,
+ * using kNearestNeighboursContext (the search function of the tree, kNearestNeighboursTree by default).
  * For each image index j in the queue, a counter for that image, imageResults[j], goes up by one.
  * If the same index appears more than once, imageResults[j] only goes up by one. The queue is then emptied.
  *
  * The spNumOfSimilarImages image indices with the highest values in imageResults are placed in a
  * sorted array, closestImages, and this array is returned.
+ * All the memory used is in the context, so nothing is allocated, and any number of threads may search
+ * the same tree at once, each with its own context.
+ *
+ * @param context - the search context, holding the tree, the queue and the vote arrays
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param numOfTargetFeatures - the number of features the target image has
+ *
+ * @return -1 in case of an error in the inputed variables
+ * Otherwise, 1
+ */
+int closestImagesSearchContext(SPKDTreeSearchContext* context, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures);
+
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image,
+ * searching for the target features on up to numOfContexts threads.
+ * The target features are split into tasks of SP_SEARCH_FEATURES_PER_TASK consecutive features, and every thread
+ * votes for the features of the tasks it takes into the vote arrays of its own context (see closestImagesSearchContext).
+ * The votes of a feature don't depend on the other features, so when all the tasks are done, the votes of the
+ * contexts are summed into the first context, and the images are ranked exactly as closestImagesSearchContext ranks
+ * them - the results, ties included, are the same with any number of threads.
+ * Only the threads are created, no memory is allocated for the search.
+ *
+ * @param contexts - the search contexts, one for every thread, of the same tree, kNN, number of images and leaf checks
+ * @param numOfContexts - the number of contexts, the maximal number of threads
+ * @param closestImages - return parameter - array containing indices of similar images found
+ * @param spNumOfSimilarImages - the number of similar images to find
+ * @param targetFeatures - the array containing pointers to the features of the target image
+ * @param numOfTargetFeatures - the number of features the target image has
+ *
+ * @return -1 in case of an error in the inputed variables (including contexts that don't match)
+ * Otherwise, 1
+ */
+int closestImagesSearchContexts(SPKDTreeSearchContext** contexts, int numOfContexts, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures);
+
+/**
+ * Returns an array containing the indices of the spNumOfSimilarImages most similar images to the target image.
+ * Same as closestImagesSearchContexts, with up to numOfThreads search contexts created for this call.
+ * The results are the same as the results of closestImagesSearch.
  *
  * @param kNN - the size of the bounded priority queue
  * @param closestImages - return parameter - array containing indices of similar images found
  * @param spNumOfSimilarImages - the number of similar images to find
  * @param targetFeatures - the array containing pointers to the features of the target image
  * @param numOfTargetFeatures - the number of features the target image has
- * @param root - the root node of the kd tree containing all the features of the images to search
+ * @param tree - the kd tree containing all the features of the images to search
  * @param numOfImages - the number of images to search. All image indices will be between 0 and numOfImages-1
+ * @param numOfThreads - the maximal number of threads to use
  *
  * @return -1 in case of allocation failure occurred OR an error in the inputed variables
- * Otherwise, 0
+ * Otherwise, 1
  */
-int closestImagesSearch(int kNN, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures, SPKDTreeNode* root, int numOfImages);
+int closestImagesSearchParallel(int kNN, int* closestImages, int spNumOfSimilarImages, SPPoint** targetFeatures, int numOfTargetFeatures, SPKDTree* tree, int numOfImages, int numOfThreads);
 
 #endif // SPKDTREE_H_INCLUDED
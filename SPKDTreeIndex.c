@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "SPFeatureStore.h"
+#include "SPDistance.h"
+#include "SPKDTree.h"
+#include "SPKDTreeInternal.h"
+#include "SPKDTreeIndex.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+#define SP_KDTREE_INDEX_MAGIC "SPKDIDX"
+#define SP_KDTREE_INDEX_BYTE_ORDER 0x01020304u
+
+// The header at the start of an index file. The sections follow it at aligned offsets.
+typedef struct sp_kd_tree_index_header_t {
+	char magic[8];			// SP_KDTREE_INDEX_MAGIC
+	uint32_t version;		// SP_KDTREE_INDEX_VERSION
+	uint32_t byteOrder;		// SP_KDTREE_INDEX_BYTE_ORDER as written by the saving machine
+	int32_t dim;			// The dimension of the features
+	int32_t stride;			// The padded length of a row
+	int32_t size;			// The number of rows
+	int32_t numOfNodes;		// The number of nodes
+	int32_t leafSize;		// The maximal number of points in a leaf
+	int32_t splitMethod;	// The KD_METHOD the tree was built with
+	int32_t numOfImages;	// The number of images the features belong to
+	int32_t nodeSize;		// sizeof(SPKDTreeFlatNode)
+	uint64_t nodesOffset;	// The offset of the node array
+	uint64_t dataOffset;	// The offset of the coordinates (size rows of stride doubles)
+	uint64_t indicesOffset;	// The offset of the image indices (size ints)
+	uint64_t fileSize;		// The size of the whole file
+} SPKDTreeIndexHeader;
+
+/*
+ * Rounds offset up to a multiple of SP_FEATURE_STORE_ALIGNMENT.
+ */
+static uint64_t spKDTreeIndexAlign(uint64_t offset) {
+	return (offset + SP_FEATURE_STORE_ALIGNMENT - 1) & ~((uint64_t) SP_FEATURE_STORE_ALIGNMENT - 1);
+}
+
+/*
+ * Pads the file with zeros up to offset, and writes a section of bytes bytes there.
+ *
+ * @return false if the file could not be written, true otherwise
+ */
+static bool spKDTreeIndexWriteSection(FILE* file, uint64_t* position, uint64_t offset, const void* section, size_t bytes) {
+	static const char zeros[SP_FEATURE_STORE_ALIGNMENT] = {0};
+	if (offset - *position > 0 && fwrite(zeros, 1, offset - *position, file) != offset - *position)
+		return false;
+	if (bytes > 0 && fwrite(section, 1, bytes, file) != bytes)
+		return false;
+	*position = offset + bytes;
+	return true;
+}
+
+/*
+ * Checks that the node array is a tree whose leaves hold rows of the store: every internal node splits by
+ * one of the dim dimensions and its children come after it, and every bucket is within the rows.
+ * So the search can neither read outside the mapping nor recurse forever.
+ */
+static bool spKDTreeIndexValidNodes(const SPKDTreeFlatNode* nodes, int numOfNodes, int dim, int size, int leafSize) {
+	for (int i=0; i<numOfNodes; i++) {
+		const SPKDTreeFlatNode* node = nodes + i;
+		if (node->dim < 0) {
+			if (-node->dim > leafSize || node->child < 0 || node->child > size + node->dim)
+				return false;
+		}
+		else if (node->dim < 1 || node->dim > dim || node->child <= i || node->child >= numOfNodes - 1)
+			return false;
+	}
+	return true;
+}
+
+int spKDTreeIndexSave(SPKDTree* tree, const char* path, KD_METHOD splitMethod, int numOfImages) {
+	if (tree == NULL || path == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (tree->nodes == NULL || tree->numOfTrees != 1 || // only the flat layout of one tree of doubles is saved
+			spFeatureStoreGetPrecision(tree->store) != SP_FEATURE_STORE_FLOAT64 || spFeatureStoreIsReleased(tree->store)) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	SPKDTreeIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, SP_KDTREE_INDEX_MAGIC);
+	header.version = SP_KDTREE_INDEX_VERSION;
+	header.byteOrder = SP_KDTREE_INDEX_BYTE_ORDER;
+	header.dim = spFeatureStoreGetDimension(tree->store);
+	header.stride = spFeatureStoreGetStride(tree->store);
+	header.size = spFeatureStoreGetSize(tree->store);
+	header.numOfNodes = tree->numOfNodes;
+	header.leafSize = tree->leafSize;
+	header.splitMethod = (int32_t) splitMethod;
+	header.numOfImages = numOfImages;
+	header.nodeSize = (int32_t) sizeof(SPKDTreeFlatNode);
+	size_t nodesBytes = (size_t) header.numOfNodes * sizeof(SPKDTreeFlatNode);
+	size_t dataBytes = (size_t) header.size * header.stride * sizeof(double);
+	size_t indicesBytes = (size_t) header.size * sizeof(int);
+	header.nodesOffset = spKDTreeIndexAlign(sizeof(header));
+	header.dataOffset = spKDTreeIndexAlign(header.nodesOffset + nodesBytes);
+	header.indicesOffset = spKDTreeIndexAlign(header.dataOffset + dataBytes);
+	header.fileSize = header.indicesOffset + indicesBytes;
+
+	// write a temporary file and rename it, so readers never see a partial index
+	char* tempPath = (char*) malloc(strlen(path) + sizeof(".tmp"));
+	if (tempPath == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	sprintf(tempPath, "%s.tmp", path);
+	char msg[STR_LEN];
+	FILE* file = fopen(tempPath, "wb");
+	if (file == NULL) {
+		snprintf(msg, STR_LEN, ERRORMSG_KDTREE_INDEX_SAVE_OPEN, tempPath);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		free(tempPath);
+		return -1;
+	}
+	uint64_t position = 0;
+	bool written = spKDTreeIndexWriteSection(file, &position, 0, &header, sizeof(header)) &&
+			spKDTreeIndexWriteSection(file, &position, header.nodesOffset, tree->nodes, nodesBytes) &&
+			spKDTreeIndexWriteSection(file, &position, header.dataOffset, spFeatureStoreGetData(tree->store), dataBytes) &&
+			spKDTreeIndexWriteSection(file, &position, header.indicesOffset, spFeatureStoreGetIndices(tree->store), indicesBytes);
+	written = (fclose(file) == 0) && written;
+	if (!written || rename(tempPath, path) != 0) {
+		snprintf(msg, STR_LEN, ERRORMSG_KDTREE_INDEX_SAVE_OPEN, path);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		remove(tempPath);
+		free(tempPath);
+		return -1;
+	}
+	free(tempPath);
+	return 0;
+}
+
+SPKDTree* spKDTreeIndexLoad(const char* path, int dim, KD_METHOD splitMethod, int leafSize, int numOfImages) {
+	if (path == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+
+	// map the whole file
+	char msg[STR_LEN];
+	int fd = open(path, O_RDONLY);
+	struct stat fileStat;
+	if (fd == -1 || fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < sizeof(SPKDTreeIndexHeader)) {
+		snprintf(msg, STR_LEN, ERRORMSG_KDTREE_INDEX_LOAD_OPEN, path);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		if (fd != -1)
+			close(fd);
+		return NULL;
+	}
+	size_t mappingSize = (size_t) fileStat.st_size;
+	void* mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping stays valid
+	if (mapping == MAP_FAILED) {
+		snprintf(msg, STR_LEN, ERRORMSG_KDTREE_INDEX_LOAD_OPEN, path);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+
+	// check the header matches this machine and the configuration, and the sections are within the file
+	const SPKDTreeIndexHeader* header = (const SPKDTreeIndexHeader*) mapping;
+	bool valid = memcmp(header->magic, SP_KDTREE_INDEX_MAGIC, sizeof(SP_KDTREE_INDEX_MAGIC)) == 0 &&
+			header->version == SP_KDTREE_INDEX_VERSION && header->byteOrder == SP_KDTREE_INDEX_BYTE_ORDER &&
+			header->nodeSize == (int32_t) sizeof(SPKDTreeFlatNode) &&
+			header->dim == dim && header->stride == spDistancePaddedDim(dim) &&
+			header->splitMethod == (int32_t) splitMethod && header->leafSize == leafSize &&
+			header->numOfImages == numOfImages && header->size > 0 && header->numOfNodes > 0 &&
+			header->fileSize == mappingSize &&
+			header->nodesOffset % SP_FEATURE_STORE_ALIGNMENT == 0 &&
+			header->dataOffset % SP_FEATURE_STORE_ALIGNMENT == 0 &&
+			header->indicesOffset % SP_FEATURE_STORE_ALIGNMENT == 0 &&
+			header->nodesOffset >= sizeof(SPKDTreeIndexHeader) &&
+			header->nodesOffset + (uint64_t) header->numOfNodes * sizeof(SPKDTreeFlatNode) <= header->fileSize &&
+			header->dataOffset + (uint64_t) header->size * header->stride * sizeof(double) <= header->fileSize &&
+			header->indicesOffset + (uint64_t) header->size * sizeof(int) <= header->fileSize;
+	const SPKDTreeFlatNode* nodes = NULL;
+	const double* data = NULL;
+	const int* indices = NULL;
+	if (valid) {
+		nodes = (const SPKDTreeFlatNode*) ((const char*) mapping + header->nodesOffset);
+		data = (const double*) ((const char*) mapping + header->dataOffset);
+		indices = (const int*) ((const char*) mapping + header->indicesOffset);
+		valid = spKDTreeIndexValidNodes(nodes, header->numOfNodes, dim, header->size, leafSize);
+		for (int i=0; valid && i<header->size; i++)
+			valid = indices[i] >= 0 && indices[i] < numOfImages;
+	}
+	if (!valid) {
+		snprintf(msg, STR_LEN, ERRORMSG_KDTREE_INDEX_LOAD_FRMT, path);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		munmap(mapping, mappingSize);
+		return NULL;
+	}
+
+	// the tree and its store point into the mapping
+	SPFeatureStore* store = spFeatureStoreCreateView(dim, header->size, data, indices);
+	SPKDTree* tree = spKDTreeAlloc(store, leafSize);
+	if (tree == NULL || store == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(tree);
+		spFeatureStoreDestroy(store);
+		munmap(mapping, mappingSize);
+		return NULL;
+	}
+	tree->nodes = (SPKDTreeFlatNode*) nodes; // never written, the mapping is read-only
+	tree->numOfNodes = header->numOfNodes;
+	tree->mapping = mapping;
+	tree->mappingSize = mappingSize;
+	return tree;
+}
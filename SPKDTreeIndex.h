@@ -0,0 +1,65 @@
+#ifndef SPKDTREEINDEX_H_
+#define SPKDTREEINDEX_H_
+
+#include "SPKDTree.h"
+#include "SPConfig.h"
+
+/**
+ * SPKDTreeIndex Summary
+ * Saves a kd tree in the flat layout to a binary index file, and loads it back without building it again.
+ * The index file holds the node array and the rows of the feature store (coordinates and image indices)
+ * exactly as they are kept in memory, so loading maps the file read-only and uses it in place:
+ * the pages are read from the disk when the search first touches them, and processes loading the same
+ * index share them in the page cache.
+ *
+ * The file starts with a header - a magic string, the format version, a byte order marker, and the
+ * parameters the tree was built with (PCA dimension, split method, leaf size and number of images) -
+ * followed by the node array, the coordinates and the image indices, each at an offset aligned to
+ * SP_FEATURE_STORE_ALIGNMENT bytes. An index is only loaded if its header matches the current
+ * configuration and the machine, otherwise the tree should be built again.
+ *
+ * The following functions are supported:
+ *
+ * spKDTreeIndexSave      - Saves a kd tree in the flat layout to an index file.
+ * spKDTreeIndexLoad      - Loads a kd tree from an index file, mapping the file read-only.
+ *
+ */
+
+/** The version of the index file format, a file of any other version is not loaded **/
+#define SP_KDTREE_INDEX_VERSION 1
+
+/**
+ * Saves a kd tree in the flat layout to an index file.
+ * The index is written to a temporary file next to path which is then renamed to path,
+ * so a failed save never leaves a partial index behind.
+ *
+ * @param tree - the tree, in the flat layout (not a forest - see spKDTreeInitForest), over a float64 store
+ * @param path - the path of the index file
+ * @param splitMethod - the method the tree was built with
+ * @param numOfImages - the number of images the features of the tree belong to
+ *
+ * @return -1 if tree or path is NULL OR the tree is not in the flat layout OR is a forest OR its store is float32
+ * OR its coordinates were freed (see spKDTreeReleaseFeatures) OR the file could not be written, 0 otherwise
+ */
+int spKDTreeIndexSave(SPKDTree* tree, const char* path, KD_METHOD splitMethod, int numOfImages);
+
+/**
+ * Loads a kd tree from an index file saved by spKDTreeIndexSave. The file is mapped read-only and
+ * the nodes and the feature store of the tree (a view, see spFeatureStoreCreateView) point into it;
+ * spKDTreeDestroy unmaps it. The header must match the arguments, and the node array and the image
+ * indices are checked to be consistent, so a stale or damaged index is never searched.
+ * The search function of the loaded tree is kNearestNeighboursTree.
+ *
+ * @param path - the path of the index file
+ * @param dim - the expected dimension of the features (the PCA dimension)
+ * @param splitMethod - the expected split method
+ * @param leafSize - the expected leaf size
+ * @param numOfImages - the expected number of images
+ *
+ * @return NULL if path is NULL OR the file could not be opened or mapped OR it is not an index file of
+ * this version and byte order OR its header does not match the arguments OR it is damaged OR in case of
+ * allocation failure. Otherwise, the loaded tree is returned
+ */
+SPKDTree* spKDTreeIndexLoad(const char* path, int dim, KD_METHOD splitMethod, int leafSize, int numOfImages);
+
+#endif /* SPKDTREEINDEX_H_ */
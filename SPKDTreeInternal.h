@@ -0,0 +1,102 @@
+#ifndef SPKDTREEINTERNAL_H_
+#define SPKDTREEINTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SPFeatureStore.h"
+#include "SPPQIndex.h"
+#include "SPQuantizedStore.h"
+#include "SPKDTree.h"
+
+/**
+ * The layout of the kd tree types. This header is not part of the SPKDTree interface,
+ * it is shared by the modules implementing the tree (SPKDTree.c and the specialized
+ * search core in SPKDTreeSearch.cpp).
+ */
+
+/** Type for defining the tree node **/
+struct kd_tree_node_t {
+	int row; /* If the node is a leaf, row is the row id in the feature store of the point it represents (-1 otherwise) */
+	SPKDTreeNode* left; /* The left child node */
+	SPKDTreeNode* right; /* The right child node */
+	int dim; /* The dimension which the kd array was split by at this node */
+	double val; /* The median value around which the kd array was split by at this node */
+};
+
+/**
+ * Type for defining a node of the flat tree layout (16 bytes, 4 nodes per cache line).
+ * The nodes are kept in one array in breadth-first order, and the two children of a node are adjacent.
+ * A leaf is a bucket of consecutive rows of the feature store.
+ */
+typedef struct kd_tree_flat_node_t {
+	double val; /* Internal node: the median value around which the kd array was split */
+	int32_t dim; /* Internal node: the split dimension (1 to d). Leaf: minus the number of points in the bucket */
+	int32_t child; /* Internal node: the position of the left child (the right child follows it). Leaf: the first row of the bucket */
+} SPKDTreeFlatNode;
+
+/**
+ * Type for defining a branch of the best-bin-first search (see kNearestNeighboursBestBinFirst) - a subtree
+ * that was not explored yet, and the estimate of its squared distance from the target point.
+ */
+typedef struct kd_tree_branch_t {
+	double bound; /* The sum of the squared distances to the split values crossed on the way to the subtree */
+	int node; /* The flat layout: the position of the root of the subtree in the node array */
+	SPKDTreeNode* ptr; /* The pointer layout: the root of the subtree */
+} SPKDTreeBranch;
+
+/** Type for defining the tree **/
+struct kd_tree_t {
+	SPFeatureStore* store; /* The feature store holding all the points of the tree */
+	SPKDTreeNode* root; /* The root node of the tree (NULL in the flat layout) */
+	SPKDTreeFlatNode* nodes; /* The flat layout: the node array, root first (NULL in the pointer layout) */
+	int numOfNodes; /* The flat layout: the number of nodes (of every tree of a forest) */
+	int numOfTrees; /* The number of trees - more than 1 in a forest, whose tree t is nodes t*numOfNodes ... */
+	int* rows; /* A forest: the buckets of tree t are ranges of rows t*size ... (the rows of tree 0 are 0 ... size-1), NULL otherwise */
+	int leafSize; /* The maximal number of points in a leaf (1 in the pointer layout) */
+	void* mapping; /* A tree loaded from an index file (see SPKDTreeIndex): the mapped file holding the nodes and the rows, NULL otherwise */
+	size_t mappingSize; /* The size of the mapped file */
+	SPKDTreeSearchFunc search; /* The search function used by closestImagesSearch */
+	int maxLeafChecks; /* The leaves checked by the best-bin-first search of new search contexts, 0 for the exact search */
+	SPPQIndex* pq; /* The product quantization index searched instead of the tree (see spKDTreeSetPQIndex), NULL otherwise */
+	int pqCandidates; /* The candidates of the index re-ranked by their exact distances, 0 to keep the approximate distances */
+	SPQuantizedStore* quantized; /* The codes of the points, scanned at the leaves instead of the coordinates (see spKDTreeSetQuantized), NULL otherwise */
+	int quantizedCandidates; /* The candidates of the codes re-ranked by their exact distances, 0 to keep the approximate distances */
+};
+
+/** Type for defining a search context - the scratch memory of the searches of one thread **/
+struct kd_tree_search_context_t {
+	SPKDTree* tree; /* The tree the context searches */
+	int numOfImages; /* The number of images of the tree */
+	SPBPQueue* bpq; /* The queue of the closest points to the current target point */
+	double* query; /* The current target point, zero padded to the stride of the feature store */
+	double* distances; /* The distances of the points of a leaf bucket (leafSize) */
+	double* highLimit; /* The limits of the current subtree (see kNearestNeighboursRecursion) */
+	double* lowLimit;
+	int* highLimitUse;
+	int* lowLimitUse;
+	int maxLeafChecks; /* The leaves checked by the best-bin-first search, 0 for the exact search */
+	SPKDTreeBranch* branches; /* The heap of the best-bin-first search (maxBranches, NULL for the exact search) */
+	int maxBranches;
+	int* visited; /* The set of the rows found by the best-bin-first search of a forest (maxVisited, NULL otherwise) */
+	int maxVisited;
+	float* pqTable; /* The distance table of the product quantization search (see kNearestNeighboursPQ), NULL otherwise */
+	short* codeQuery; /* The quantized target point of the quantized search (see kNearestNeighboursQuantized), NULL otherwise */
+	SPBPQueue* candidates; /* The candidates of the product quantization or the quantized search, NULL otherwise */
+	int* imageResults; /* The vote histogram of closestImagesSearch (numOfImages) */
+	int* imageCheck; /* The last target feature that voted for every image (numOfImages) */
+};
+
+/**
+ * Allocates a tree of store with the defaults of every constructor: no nodes, a single tree, the exact
+ * search (kNearestNeighboursTree), no product quantization index or quantized codes and no mapping.
+ * A constructor sets only the fields of its layout.
+ * The store is not freed on failure, nothing is logged.
+ *
+ * @param store - the feature store holding the points
+ * @param leafSize - the maximal number of points in a leaf (1 in the pointer layout)
+ *
+ * @return NULL in case of allocation failure, otherwise the new tree
+ */
+SPKDTree* spKDTreeAlloc(SPFeatureStore* store, int leafSize);
+
+#endif /* SPKDTREEINTERNAL_H_ */
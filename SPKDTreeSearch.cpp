@@ -0,0 +1,250 @@
+#include <cmath>
+#include <cstddef>
+#include <limits>
+extern "C" {
+#include "SPKDTreeSearch.h"
+#include "SPKDTreeInternal.h"
+#include "SPDistance.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+}
+
+// The distances must be rounded exactly like in SPKDTree.c and the SPDistance kernels, so a multiplication
+// followed by an addition must not be fused into one instruction (FMA)
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+namespace {
+
+/**
+ * The rows of a feature store of coordinates of type T (double or float) and their distances.
+ */
+template <typename T>
+struct StoreRows;
+
+template <>
+struct StoreRows<double> {
+	static const double* data(SPFeatureStore* store) {
+		return spFeatureStoreGetData(store);
+	}
+
+	// Same partial sums and reduction as the SPDistance kernels, so the result is bit-exact
+	template <int D>
+	static double distanceSquared(const double* query, const double* point) {
+		double lanes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+		for (int i=0; i<D; i++)
+			lanes[i % 8] += (query[i] - point[i])*(query[i] - point[i]);
+		return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+				((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+	}
+};
+
+template <>
+struct StoreRows<float> {
+	static const float* data(SPFeatureStore* store) {
+		return spFeatureStoreGetDataFloat(store);
+	}
+
+	// Same float partial sums and reduction as the float SPDistance kernels, so the result is bit-exact
+	template <int D>
+	static double distanceSquared(const float* query, const float* point) {
+		float lanes[16] = {0};
+		for (int i=0; i<D; i++)
+			lanes[i % 16] += (query[i] - point[i])*(query[i] - point[i]);
+		return (((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]))) +
+				(((lanes[8] + lanes[9]) + (lanes[10] + lanes[11])) + ((lanes[12] + lanes[13]) + (lanes[14] + lanes[15])));
+	}
+};
+
+/**
+ * The kNN search of kNearestNeighboursTree for trees of dimension D over a store of coordinates of type T.
+ * An object holds the state of one search: the queue, the padded target point and
+ * the limits of the current subtree. An unlimited side of a dimension is kept as an
+ * infinite limit, which never adds to the minimal distance. The minimal distance to the
+ * limits of a subtree is passed down the recursion and updated for the split dimension only.
+ * The limits are compared to the target point in double, like in SPKDTree.c, and the distances
+ * to the rows are calculated from the target point rounded to T, like in SPFeatureStore.
+ */
+template <int D, typename T>
+class KDTreeSearch {
+public:
+	static int search(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint);
+
+private:
+	static const int STRIDE = (D + SP_DISTANCE_PAD - 1) / SP_DISTANCE_PAD * SP_DISTANCE_PAD;
+
+	SPBPQueue* bpq;
+	const SPKDTreeFlatNode* nodes;
+	const T* data;
+	const int* indices;
+	double query[STRIDE];
+	T rowQuery[STRIDE];
+	double highLimit[D];
+	double lowLimit[D];
+
+	KDTreeSearch(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint);
+	void recursion(const SPKDTreeNode* curr, double bound);
+	void flatRecursion(int curr, double bound);
+	double axisDistanceSquared(int i) const;
+	bool skip(double bound) const;
+	double minDistanceSquared() const;
+	double leafDistanceSquared(int row) const;
+};
+
+template <int D, typename T>
+KDTreeSearch<D, T>::KDTreeSearch(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint) :
+		bpq(bpq), nodes(tree->nodes), data(StoreRows<T>::data(tree->store)),
+		indices(spFeatureStoreGetIndices(tree->store)) {
+	for (int i=0; i<STRIDE; i++) {
+		query[i] = i < D ? spPointGetAxisCoor(targetPoint, i) : 0;
+		rowQuery[i] = (T) query[i];
+	}
+	for (int i=0; i<D; i++) {
+		highLimit[i] = std::numeric_limits<double>::infinity();
+		lowLimit[i] = -std::numeric_limits<double>::infinity();
+	}
+}
+
+template <int D, typename T>
+int KDTreeSearch<D, T>::search(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint) {
+	if (!bpq || !tree || !targetPoint) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if ((!tree->root && !tree->nodes) || spFeatureStoreIsReleased(tree->store) || spPointGetDimension(targetPoint) != D || spFeatureStoreGetDimension(tree->store) != D) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	KDTreeSearch<D, T> state(bpq, tree, targetPoint);
+	if (tree->nodes)
+		state.flatRecursion(0, 0);
+	else
+		state.recursion(tree->root, 0);
+	return 1;
+}
+
+// Same traversal and pruning as kNearestNeighboursRecursion
+template <int D, typename T>
+void KDTreeSearch<D, T>::recursion(const SPKDTreeNode* curr, double bound) {
+	if (!curr)
+		return;
+	if (curr->row != -1) { // leaf
+		spBPQueueEnqueue(bpq, indices[curr->row], leafDistanceSquared(curr->row));
+		return;
+	}
+	int dimIndex = curr->dim - 1;
+	double axis = axisDistanceSquared(dimIndex);
+
+	// left subtree
+	double savedLimit = highLimit[dimIndex];
+	highLimit[dimIndex] = curr->val;
+	double childBound = bound + (axisDistanceSquared(dimIndex) - axis);
+	if (!spBPQueueIsFull(bpq) || !skip(childBound))
+		recursion(curr->left, childBound);
+	highLimit[dimIndex] = savedLimit;
+
+	// right subtree
+	savedLimit = lowLimit[dimIndex];
+	lowLimit[dimIndex] = curr->val;
+	childBound = bound + (axisDistanceSquared(dimIndex) - axis);
+	if (!spBPQueueIsFull(bpq) || !skip(childBound))
+		recursion(curr->right, childBound);
+	lowLimit[dimIndex] = savedLimit;
+}
+
+// Same traversal and pruning as kNearestNeighboursFlatRecursion
+template <int D, typename T>
+void KDTreeSearch<D, T>::flatRecursion(int curr, double bound) {
+	const SPKDTreeFlatNode* node = nodes + curr;
+	if (node->dim < 0) { // leaf bucket of consecutive rows
+		for (int row=node->child; row<node->child - node->dim; row++)
+			spBPQueueEnqueue(bpq, indices[row], leafDistanceSquared(row));
+		return;
+	}
+	int dimIndex = node->dim - 1;
+	double axis = axisDistanceSquared(dimIndex);
+
+	// left subtree
+	double savedLimit = highLimit[dimIndex];
+	highLimit[dimIndex] = node->val;
+	double childBound = bound + (axisDistanceSquared(dimIndex) - axis);
+	if (!spBPQueueIsFull(bpq) || !skip(childBound))
+		flatRecursion(node->child, childBound);
+	highLimit[dimIndex] = savedLimit;
+
+	// right subtree
+	savedLimit = lowLimit[dimIndex];
+	lowLimit[dimIndex] = node->val;
+	childBound = bound + (axisDistanceSquared(dimIndex) - axis);
+	if (!spBPQueueIsFull(bpq) || !skip(childBound))
+		flatRecursion(node->child + 1, childBound);
+	lowLimit[dimIndex] = savedLimit;
+}
+
+// Same as axisDistanceSquared in SPKDTree.c, the contribution of dimension i to minDistanceSquared
+template <int D, typename T>
+double KDTreeSearch<D, T>::axisDistanceSquared(int i) const {
+	if (query[i] < lowLimit[i])
+		return (lowLimit[i] - query[i])*(lowLimit[i] - query[i]);
+	if (query[i] > highLimit[i])
+		return (query[i] - highLimit[i])*(query[i] - highLimit[i]);
+	return 0;
+}
+
+// Same decision as kNearestNeighboursSkip: the full sum decides when the kept bound is too close to call
+template <int D, typename T>
+bool KDTreeSearch<D, T>::skip(double bound) const {
+	double maxValue = spBPQueueMaxValue(bpq);
+	if (std::fabs(bound - maxValue) <= SP_KDTREE_BOUND_TOLERANCE * maxValue)
+		bound = minDistanceSquared();
+	return bound >= maxValue;
+}
+
+// Same sum, in the same order, as minDistanceSquared
+template <int D, typename T>
+double KDTreeSearch<D, T>::minDistanceSquared() const {
+	double res = 0;
+	for (int i=0; i<D; i++) {
+		if (query[i] < lowLimit[i])
+			res = res + (lowLimit[i] - query[i])*(lowLimit[i] - query[i]);
+		if (query[i] > highLimit[i])
+			res = res + (query[i] - highLimit[i])*(query[i] - highLimit[i]);
+	}
+	return res;
+}
+
+template <int D, typename T>
+double KDTreeSearch<D, T>::leafDistanceSquared(int row) const {
+	return StoreRows<T>::template distanceSquared<D>(rowQuery, data + (size_t) row * STRIDE);
+}
+
+// The search of dimension D for the precision of the store of the tree
+template <int D>
+int search(SPBPQueue* bpq, SPKDTree* tree, SPPoint* targetPoint) {
+	if (tree && spFeatureStoreGetPrecision(tree->store) == SP_FEATURE_STORE_FLOAT32)
+		return KDTreeSearch<D, float>::search(bpq, tree, targetPoint);
+	return KDTreeSearch<D, double>::search(bpq, tree, targetPoint);
+}
+
+// The specialized search functions, element i is for dimension SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN + i
+const SPKDTreeSearchFunc searchFuncs[] = {
+		search<10>, search<11>, search<12>, search<13>, search<14>, search<15>, search<16>,
+		search<17>, search<18>, search<19>, search<20>, search<21>, search<22>, search<23>,
+		search<24>, search<25>, search<26>, search<27>, search<28>
+};
+
+static_assert(SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN == 10 &&
+		sizeof(searchFuncs) / sizeof(searchFuncs[0]) ==
+		SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX - SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN + 1,
+		"searchFuncs must cover the allowed PCA dimensions");
+
+}
+
+SPKDTreeSearchFunc spKDTreeSearchForDim(int dim) {
+	if (dim < SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN || dim > SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX)
+		return kNearestNeighboursTree;
+	return searchFuncs[dim - SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN];
+}
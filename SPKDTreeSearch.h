@@ -0,0 +1,35 @@
+#ifndef SPKDTREESEARCH_H_
+#define SPKDTREESEARCH_H_
+
+#include "SPKDTree.h"
+
+/**
+ * SPKDTreeSearch Summary
+ * A kNN search core specialized at compile time for every PCA dimension the configuration allows
+ * (SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN to SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX).
+ * The core is a C++ template instantiated once per dimension. The limits of the current subtree
+ * and the padded target point are kept on the stack, and the loops of the minimal distance and
+ * of the leaf distance have a constant length, so the compiler can unroll them.
+ *
+ * The specialized search gives exactly the same results as kNearestNeighboursTree - it visits the
+ * nodes in the same order, and calculates the distances with the same operations in the same order.
+ * It is set on a tree with spKDTreeSetSearch, after the dimension is read from the configuration.
+ *
+ * The following functions are supported:
+ *
+ * spKDTreeSearchForDim - Returns the search function specialized to a given dimension.
+ *
+ */
+
+/**
+ * Returns the search function specialized to dimension dim. If there is no specialization
+ * for dim, the generic kNearestNeighboursTree is returned.
+ * The returned function has the interface of kNearestNeighboursTree, and also returns -1
+ * when the dimension of the target point or of the tree differ from dim.
+ *
+ * @param dim - the dimension of the tree
+ * @return The search function for trees of dimension dim
+ */
+SPKDTreeSearchFunc spKDTreeSearchForDim(int dim);
+
+#endif /* SPKDTREESEARCH_H_ */
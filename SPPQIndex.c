@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <float.h>
+#include "SPFeatureStore.h"
+#include "SPPQIndex.h"
+#include "SPBPriorityQueue.h"
+#include "SPParallel.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+// Number of rows encoded by one task of spParallelFor
+#define SP_PQ_INDEX_ENCODE_ROWS 4096
+
+struct sp_pq_index_t {
+	int dim;				// The dimension of the rows
+	int numOfSubspaces;		// The number of subspaces (the bytes of a code)
+	int numOfCentroids;		// The number of centroids of every subspace (at most SP_PQ_INDEX_CENTROIDS)
+	int* first;				// Subspace m covers the dimensions first[m] ... first[m+1]-1 (numOfSubspaces+1)
+	double* centroids;		// Centroid c of every subspace is in the dimensions of the subspace of row c (numOfCentroids*dim)
+	unsigned char* codes;	// The code of row i starts at codes + i*numOfSubspaces
+	int size;				// The number of encoded rows
+};
+
+/** The training of the codebooks, shared by the tasks of spParallelFor (one per subspace) **/
+typedef struct sp_pq_index_training_t {
+	SPPQIndex* pq;
+	const double* sample;	// The training rows (numOfSamples*dim)
+	int numOfSamples;
+	int* assignment;		// The centroid of every training row of every subspace (numOfSubspaces*numOfSamples)
+	bool failed;			// Set by a task that failed to allocate
+} SPPQIndexTraining;
+
+/** The encoding of the rows, shared by the tasks of spParallelFor (one per SP_PQ_INDEX_ENCODE_ROWS rows) **/
+typedef struct sp_pq_index_encoding_t {
+	SPPQIndex* pq;
+	SPFeatureStore* store;
+	bool failed;
+} SPPQIndexEncoding;
+
+/*
+ * The squared distance between the sub-vector of point in subspace m and centroid c.
+ */
+static double spPQIndexSubDistance(const SPPQIndex* pq, int m, int c, const double* point) {
+	const double* centroid = pq->centroids + (size_t) c * pq->dim;
+	double sum = 0;
+	for (int j = pq->first[m]; j < pq->first[m + 1]; j++) {
+		double diff = point[j] - centroid[j];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+/*
+ * The closest centroid of subspace m to the sub-vector of point.
+ */
+static int spPQIndexClosest(const SPPQIndex* pq, int m, const double* point) {
+	int best = 0;
+	double bestDistance = DBL_MAX;
+	for (int c = 0; c < pq->numOfCentroids; c++) {
+		double distance = spPQIndexSubDistance(pq, m, c, point);
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			best = c;
+		}
+	}
+	return best;
+}
+
+/*
+ * Trains the codebook of subspace m by Lloyd's k-means (a task of spParallelFor).
+ * The centroids start at training rows spread evenly over the sample, and the iterations stop
+ * early once no training row moves to another centroid. A centroid left without rows keeps its place.
+ */
+static void spPQIndexTrainTask(void* arg, int m) {
+	SPPQIndexTraining* training = (SPPQIndexTraining*) arg;
+	SPPQIndex* pq = training->pq;
+	int dim = pq->dim, k = pq->numOfCentroids, n = training->numOfSamples;
+	int first = pq->first[m], len = pq->first[m + 1] - first;
+	int* assignment = training->assignment + (size_t) m * n;
+	double* sums = (double*) malloc((size_t) k * len * sizeof(double));
+	int* counts = (int*) malloc(k * sizeof(int));
+	if (sums == NULL || counts == NULL) {
+		free(sums);
+		free(counts);
+		training->failed = true;
+		return;
+	}
+	for (int c = 0; c < k; c++)
+		memcpy(pq->centroids + (size_t) c * dim + first,
+				training->sample + (size_t) (((long long) c * n) / k) * dim + first, len * sizeof(double));
+	for (int i = 0; i < n; i++)
+		assignment[i] = -1;
+	for (int iteration = 0; iteration < SP_PQ_INDEX_ITERATIONS; iteration++) {
+		bool changed = false;
+		for (int i = 0; i < n; i++) {
+			int c = spPQIndexClosest(pq, m, training->sample + (size_t) i * dim);
+			if (c != assignment[i]) {
+				assignment[i] = c;
+				changed = true;
+			}
+		}
+		if (!changed)
+			break;
+		memset(sums, 0, (size_t) k * len * sizeof(double));
+		memset(counts, 0, k * sizeof(int));
+		for (int i = 0; i < n; i++) {
+			const double* point = training->sample + (size_t) i * dim + first;
+			double* sum = sums + (size_t) assignment[i] * len;
+			for (int j = 0; j < len; j++)
+				sum[j] += point[j];
+			counts[assignment[i]]++;
+		}
+		for (int c = 0; c < k; c++) {
+			if (counts[c] == 0)
+				continue;
+			double* centroid = pq->centroids + (size_t) c * dim + first;
+			for (int j = 0; j < len; j++)
+				centroid[j] = sums[(size_t) c * len + j] / counts[c];
+		}
+	}
+	free(sums);
+	free(counts);
+}
+
+/*
+ * Encodes the j-th range of SP_PQ_INDEX_ENCODE_ROWS rows (a task of spParallelFor).
+ */
+static void spPQIndexEncodeTask(void* arg, int j) {
+	SPPQIndexEncoding* encoding = (SPPQIndexEncoding*) arg;
+	SPPQIndex* pq = encoding->pq;
+	double* row = (double*) malloc(pq->dim * sizeof(double));
+	if (row == NULL) {
+		encoding->failed = true;
+		return;
+	}
+	int end = (j + 1) * SP_PQ_INDEX_ENCODE_ROWS < pq->size ? (j + 1) * SP_PQ_INDEX_ENCODE_ROWS : pq->size;
+	for (int i = j * SP_PQ_INDEX_ENCODE_ROWS; i < end; i++) {
+		spFeatureStoreCopyRow(encoding->store, i, row);
+		unsigned char* code = pq->codes + (size_t) i * pq->numOfSubspaces;
+		for (int m = 0; m < pq->numOfSubspaces; m++)
+			code[m] = (unsigned char) spPQIndexClosest(pq, m, row);
+	}
+	free(row);
+}
+
+SPPQIndex* spPQIndexCreate(SPFeatureStore* store, int numOfSubspaces, int numOfTrainingRows, int numOfThreads) {
+	if (store == NULL || spFeatureStoreGetSize(store) == 0 || numOfSubspaces < 1 ||
+			numOfSubspaces > spFeatureStoreGetDimension(store) || numOfTrainingRows < 1) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	int dim = spFeatureStoreGetDimension(store), size = spFeatureStoreGetSize(store);
+	int numOfSamples = numOfTrainingRows < size ? numOfTrainingRows : size;
+	SPPQIndex* pq = (SPPQIndex*) malloc(sizeof(*pq));
+	if (pq == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	pq->dim = dim;
+	pq->numOfSubspaces = numOfSubspaces;
+	pq->numOfCentroids = numOfSamples < SP_PQ_INDEX_CENTROIDS ? numOfSamples : SP_PQ_INDEX_CENTROIDS;
+	pq->size = size;
+	pq->first = (int*) malloc((numOfSubspaces + 1) * sizeof(int));
+	pq->centroids = (double*) malloc((size_t) pq->numOfCentroids * dim * sizeof(double));
+	pq->codes = (unsigned char*) malloc((size_t) size * numOfSubspaces);
+	double* sample = (double*) malloc((size_t) numOfSamples * dim * sizeof(double));
+	int* assignment = (int*) malloc((size_t) numOfSubspaces * numOfSamples * sizeof(int));
+	if (pq->first == NULL || pq->centroids == NULL || pq->codes == NULL || sample == NULL || assignment == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(sample);
+		free(assignment);
+		spPQIndexDestroy(pq);
+		return NULL;
+	}
+	for (int m = 0; m <= numOfSubspaces; m++)
+		pq->first[m] = (int) (((long long) m * dim) / numOfSubspaces);
+	for (int i = 0; i < numOfSamples; i++)
+		spFeatureStoreCopyRow(store, (int) (((long long) i * size) / numOfSamples), sample + (size_t) i * dim);
+
+	SPPQIndexTraining training = { pq, sample, numOfSamples, assignment, false };
+	spParallelFor(numOfSubspaces, numOfThreads, spPQIndexTrainTask, &training);
+	free(sample);
+	free(assignment);
+	SPPQIndexEncoding encoding = { pq, store, false };
+	if (!training.failed)
+		spParallelFor((size + SP_PQ_INDEX_ENCODE_ROWS - 1) / SP_PQ_INDEX_ENCODE_ROWS, numOfThreads,
+				spPQIndexEncodeTask, &encoding);
+	if (training.failed || encoding.failed) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		spPQIndexDestroy(pq);
+		return NULL;
+	}
+	return pq;
+}
+
+void spPQIndexDestroy(SPPQIndex* pq) {
+	if (pq == NULL)
+		return;
+	free(pq->first);
+	free(pq->centroids);
+	free(pq->codes);
+	free(pq);
+}
+
+int spPQIndexGetNumOfSubspaces(SPPQIndex* pq) {
+	return pq == NULL ? 0 : pq->numOfSubspaces;
+}
+
+int spPQIndexGetSize(SPPQIndex* pq) {
+	return pq == NULL ? 0 : pq->size;
+}
+
+int spPQIndexGetTableSize(SPPQIndex* pq) {
+	return pq == NULL ? 0 : pq->numOfSubspaces * SP_PQ_INDEX_CENTROIDS;
+}
+
+const unsigned char* spPQIndexGetCode(SPPQIndex* pq, int row) {
+	assert(pq != NULL && row >= 0 && row < pq->size);
+	return pq->codes + (size_t) row * pq->numOfSubspaces;
+}
+
+void spPQIndexDistanceTable(SPPQIndex* pq, const double* query, float* table) {
+	assert(pq != NULL && query != NULL && table != NULL);
+	for (int m = 0; m < pq->numOfSubspaces; m++) {
+		float* entries = table + m * SP_PQ_INDEX_CENTROIDS;
+		for (int c = 0; c < pq->numOfCentroids; c++)
+			entries[c] = (float) spPQIndexSubDistance(pq, m, c, query);
+		for (int c = pq->numOfCentroids; c < SP_PQ_INDEX_CENTROIDS; c++)
+			entries[c] = FLT_MAX;
+	}
+}
+
+double spPQIndexDistance(SPPQIndex* pq, const float* table, int row) {
+	assert(pq != NULL && table != NULL && row >= 0 && row < pq->size);
+	const unsigned char* code = pq->codes + (size_t) row * pq->numOfSubspaces;
+	float sum = 0;
+	for (int m = 0; m < pq->numOfSubspaces; m++)
+		sum += table[m * SP_PQ_INDEX_CENTROIDS + code[m]];
+	return sum;
+}
+
+void spPQIndexSearch(SPPQIndex* pq, const float* table, SPBPQueue* bpq) {
+	assert(pq != NULL && table != NULL && bpq != NULL);
+	int numOfSubspaces = pq->numOfSubspaces;
+	const unsigned char* code = pq->codes;
+	// A row only enters a full queue if it is not farther than the last element, so the queue is
+	// only called for the few rows that are
+	double bound = spBPQueueIsFull(bpq) ? spBPQueueMaxValue(bpq) : DBL_MAX;
+	for (int i = 0; i < pq->size; i++, code += numOfSubspaces) {
+		float sum = 0;
+		for (int m = 0; m < numOfSubspaces; m++)
+			sum += table[m * SP_PQ_INDEX_CENTROIDS + code[m]];
+		if (sum > bound)
+			continue;
+		spBPQueueEnqueue(bpq, i, sum);
+		if (spBPQueueIsFull(bpq))
+			bound = spBPQueueMaxValue(bpq);
+	}
+}
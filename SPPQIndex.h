@@ -0,0 +1,138 @@
+#ifndef SPPQINDEX_H_
+#define SPPQINDEX_H_
+
+#include "SPFeatureStore.h"
+#include "SPBPriorityQueue.h"
+
+/**
+ * SPPQIndex Summary
+ * A product quantization (PQ) index of the rows of a feature store - a compressed copy of the features,
+ * one byte per subspace for every row, that is searched instead of the kd tree (see spKDTreeSetPQIndex).
+ *
+ * The dim dimensions are split into numOfSubspaces ranges of consecutive dimensions (subspaces), whose lengths
+ * differ by at most 1. Every subspace has a codebook of up to SP_PQ_INDEX_CENTROIDS centroids, trained by k-means
+ * on a sample of the rows, and a row is kept as the codes of the closest centroid to each of its sub-vectors.
+ * A search calculates the table of the squared distances between the sub-vectors of the query and all the
+ * centroids once (spPQIndexDistanceTable). The approximate (asymmetric) distance to a row is then the sum of
+ * the entries of its codes, so the coordinates of the rows are not read.
+ *
+ * The index refers to the rows of the store by their row id, so the store must not be reordered after the
+ * index is created. The store is not kept by the index.
+ *
+ * The following functions are supported:
+ *
+ * spPQIndexCreate             - Trains the codebooks on a sample of the rows of a store, and encodes all its rows.
+ * spPQIndexDestroy            - Frees all memory of an index.
+ * spPQIndexGetNumOfSubspaces  - A getter of the number of subspaces (the bytes of the code of a row).
+ * spPQIndexGetSize            - A getter of the number of encoded rows.
+ * spPQIndexGetTableSize       - A getter of the length of a distance table.
+ * spPQIndexGetCode            - A getter of the code of a row.
+ * spPQIndexDistanceTable      - Calculates the distance table of a query.
+ * spPQIndexDistance           - Calculates the approximate distance between a query and a row.
+ * spPQIndexSearch             - Fills a bounded priority queue with the rows of the smallest approximate distances.
+ *
+ */
+
+/** The maximal number of centroids of a subspace (the codes are bytes) **/
+#define SP_PQ_INDEX_CENTROIDS 256
+/** The maximal number of k-means iterations training a codebook **/
+#define SP_PQ_INDEX_ITERATIONS 16
+/** The number of rows the codebooks are trained on by default **/
+#define SP_PQ_INDEX_TRAINING_ROWS 16384
+
+/** Type for defining the PQ index **/
+typedef struct sp_pq_index_t SPPQIndex;
+
+/**
+ * Creates a PQ index of all the rows of store. The codebooks are trained on numOfTrainingRows rows spread
+ * evenly over the store (all the rows if there are fewer), with SP_PQ_INDEX_CENTROIDS centroids per subspace
+ * (or one per training row if there are fewer). The subspaces are trained, and the rows encoded, on up to
+ * numOfThreads threads (see SPParallel.h).
+ *
+ * @param store - the feature store, with at least one row
+ * @param numOfSubspaces - the number of subspaces, between 1 and the dimension of the store
+ * @param numOfTrainingRows - the number of rows the codebooks are trained on, at least 1
+ * @param numOfThreads - the maximal number of threads to use
+ *
+ * @return NULL in case of allocation failure OR store is NULL or empty OR numOfSubspaces or numOfTrainingRows
+ * are out of range. Otherwise, the new index is returned
+ */
+SPPQIndex* spPQIndexCreate(SPFeatureStore* store, int numOfSubspaces, int numOfTrainingRows, int numOfThreads);
+
+/**
+ * Frees all memory of the index. If pq is NULL nothing happens.
+ *
+ * @param pq - the index
+ */
+void spPQIndexDestroy(SPPQIndex* pq);
+
+/**
+ * A getter of the number of subspaces - the number of bytes of the code of a row.
+ *
+ * @param pq - the index
+ * @return The number of subspaces, 0 if pq is NULL
+ */
+int spPQIndexGetNumOfSubspaces(SPPQIndex* pq);
+
+/**
+ * A getter of the number of encoded rows (the size of the store when the index was created).
+ *
+ * @param pq - the index
+ * @return The number of rows, 0 if pq is NULL
+ */
+int spPQIndexGetSize(SPPQIndex* pq);
+
+/**
+ * A getter of the number of entries of a distance table - numOfSubspaces * SP_PQ_INDEX_CENTROIDS.
+ *
+ * @param pq - the index
+ * @return The length of a distance table, 0 if pq is NULL
+ */
+int spPQIndexGetTableSize(SPPQIndex* pq);
+
+/**
+ * A getter of the code of a row - the centroid of every subspace closest to the sub-vector of the row.
+ *
+ * @param pq - the index
+ * @param row - the row id
+ * @assert pq != NULL && 0 <= row < size
+ * @return A pointer to the numOfSubspaces bytes of the code
+ */
+const unsigned char* spPQIndexGetCode(SPPQIndex* pq, int row);
+
+/**
+ * Calculates the distance table of a query: entry m*SP_PQ_INDEX_CENTROIDS + c is the squared distance between
+ * the sub-vector of the query in subspace m and centroid c of the subspace.
+ *
+ * @param pq - the index
+ * @param query - the dim coordinates of the query
+ * @param table - output array of spPQIndexGetTableSize(pq) entries
+ * @assert pq != NULL && query != NULL && table != NULL
+ */
+void spPQIndexDistanceTable(SPPQIndex* pq, const double* query, float* table);
+
+/**
+ * Calculates the approximate squared distance between the query of a distance table and a row - the sum of
+ * the table entries of the code of the row.
+ *
+ * @param pq - the index
+ * @param table - the distance table of the query
+ * @param row - the row id
+ * @assert pq != NULL && table != NULL && 0 <= row < size
+ * @return The approximate L2-squared distance
+ */
+double spPQIndexDistance(SPPQIndex* pq, const float* table, int row);
+
+/**
+ * Fills bpq with the rows of the smallest approximate distances to the query of a distance table, by a scan of
+ * the codes of all the rows. The index of every element of the queue is a row id (not an image index).
+ * The rows are enqueued in ascending row id order, on top of the elements already in the queue.
+ *
+ * @param pq - the index
+ * @param table - the distance table of the query
+ * @param bpq - the queue to fill
+ * @assert pq != NULL && table != NULL && bpq != NULL
+ */
+void spPQIndexSearch(SPPQIndex* pq, const float* table, SPBPQueue* bpq);
+
+#endif /* SPPQINDEX_H_ */
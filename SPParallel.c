@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "SPParallel.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+// The state shared by the threads of one spParallelFor call
+typedef struct sp_parallel_for_t {
+	pthread_mutex_t lock;	// Guards next
+	int next;				// The next task to take
+	int numOfTasks;
+	SPParallelTask task;			// The task function of spParallelFor, or NULL
+	SPParallelThreadTask threadTask;	// The task function of spParallelForThreads, or NULL
+	void* arg;
+} SPParallelFor;
+
+// A thread of one spParallelFor call
+typedef struct sp_parallel_thread_t {
+	SPParallelFor* loop;
+	int thread;				// The number of the thread, 0 is the calling thread
+} SPParallelThread;
+
+/*
+ * Takes tasks until there are none left. This is the body of every thread.
+ */
+static void* spParallelWorker(void* state) {
+	SPParallelThread* self = (SPParallelThread*) state;
+	SPParallelFor* loop = self->loop;
+	while (1) {
+		pthread_mutex_lock(&loop->lock);
+		int task = loop->next++;
+		pthread_mutex_unlock(&loop->lock);
+		if (task >= loop->numOfTasks)
+			return NULL;
+		if (loop->task != NULL)
+			loop->task(loop->arg, task);
+		else
+			loop->threadTask(loop->arg, task, self->thread);
+	}
+}
+
+/*
+ * Runs the tasks of a loop on up to numOfThreads threads, the calling thread included
+ */
+static void spParallelRun(SPParallelFor* loop, int numOfThreads) {
+	pthread_mutex_init(&loop->lock, NULL);
+	loop->next = 0;
+	pthread_t* threads = (pthread_t*) malloc((numOfThreads - 1) * sizeof(pthread_t));
+	SPParallelThread* selves = (SPParallelThread*) malloc(numOfThreads * sizeof(SPParallelThread));
+	int numOfCreated = 0;
+	if (threads != NULL && selves != NULL) {
+		for (int i=0; i<numOfThreads; i++) {
+			selves[i].loop = loop;
+			selves[i].thread = i;
+		}
+		while (numOfCreated < numOfThreads - 1 &&
+				pthread_create(&threads[numOfCreated], NULL, spParallelWorker, &selves[numOfCreated + 1]) == 0)
+			numOfCreated++;
+	}
+	if (numOfCreated < numOfThreads - 1)
+		spLoggerPrintWarning(WARNINGMSG_THREAD_CREATE, __FILE__, __func__, __LINE__);
+	SPParallelThread caller = {loop, 0};
+	spParallelWorker(&caller);
+	for (int i=0; i<numOfCreated; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(selves);
+	pthread_mutex_destroy(&loop->lock);
+}
+
+int spParallelNumOfCores() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores < 1 ? 1 : (int) cores;
+}
+
+int spParallelNumOfThreads(int numOfThreads) {
+	return numOfThreads > 0 ? numOfThreads : spParallelNumOfCores();
+}
+
+int spParallelFor(int numOfTasks, int numOfThreads, SPParallelTask task, void* arg) {
+	if (task == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (numOfThreads > numOfTasks)
+		numOfThreads = numOfTasks;
+	if (numOfThreads <= 1) { // nothing to share, run on the calling thread
+		for (int i=0; i<numOfTasks; i++)
+			task(arg, i);
+		return 0;
+	}
+
+	SPParallelFor loop;
+	loop.numOfTasks = numOfTasks;
+	loop.task = task;
+	loop.threadTask = NULL;
+	loop.arg = arg;
+	spParallelRun(&loop, numOfThreads);
+	return 0;
+}
+
+int spParallelForThreads(int numOfTasks, int numOfThreads, SPParallelThreadTask task, void* arg) {
+	if (task == NULL) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	if (numOfThreads > numOfTasks)
+		numOfThreads = numOfTasks;
+	if (numOfThreads <= 1) { // nothing to share, run on the calling thread
+		for (int i=0; i<numOfTasks; i++)
+			task(arg, i, 0);
+		return 0;
+	}
+
+	SPParallelFor loop;
+	loop.numOfTasks = numOfTasks;
+	loop.task = NULL;
+	loop.threadTask = task;
+	loop.arg = arg;
+	spParallelRun(&loop, numOfThreads);
+	return 0;
+}
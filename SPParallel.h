@@ -0,0 +1,71 @@
+#ifndef SPPARALLEL_H_
+#define SPPARALLEL_H_
+
+/**
+ * SPParallel Summary
+ * Runs a number of independent tasks on several threads (POSIX threads).
+ * The tasks are numbered 0 to numOfTasks-1. Every thread repeatedly takes the next task that was
+ * not taken yet, so a thread that finishes its tasks early keeps taking tasks instead of waiting,
+ * and tasks of different lengths are balanced between the threads.
+ * The calling thread runs tasks too, so numOfThreads-1 threads are created.
+ *
+ * The following functions are supported:
+ *
+ * spParallelNumOfCores      - A getter of the number of online processors.
+ * spParallelNumOfThreads    - Resolves a configured number of threads (0 meaning all the processors).
+ * spParallelFor             - Runs tasks on several threads, and waits for all of them to finish.
+ * spParallelForThreads      - spParallelFor, telling every task which thread runs it.
+ *
+ */
+
+/** Type of a task - called with the argument passed to spParallelFor and the number of the task **/
+typedef void (*SPParallelTask)(void* arg, int task);
+
+/** Type of a task that is also told the number of the thread running it (see spParallelForThreads) **/
+typedef void (*SPParallelThreadTask)(void* arg, int task, int thread);
+
+/**
+ * Returns the number of online processors.
+ *
+ * @return The number of online processors (1 if it can't be determined)
+ */
+int spParallelNumOfCores();
+
+/**
+ * Resolves a configured number of threads: a positive number is used as is,
+ * and 0 (or a negative number) means one thread per online processor.
+ *
+ * @param numOfThreads - the configured number of threads
+ * @return The number of threads to use (at least 1)
+ */
+int spParallelNumOfThreads(int numOfThreads);
+
+/**
+ * Runs task(arg, i) for every i from 0 to numOfTasks-1, on up to numOfThreads threads
+ * (the calling thread included), and returns when all the tasks are done.
+ * The order in which the tasks run is not defined, so they must not depend on each other.
+ * If a thread can't be created, its share of the tasks is run by the other threads.
+ *
+ * @param numOfTasks - the number of tasks
+ * @param numOfThreads - the maximal number of threads
+ * @param task - the task function
+ * @param arg - the argument passed to every task
+ * @return -1 if task is NULL, otherwise 0
+ */
+int spParallelFor(int numOfTasks, int numOfThreads, SPParallelTask task, void* arg);
+
+/**
+ * Same as spParallelFor, but runs task(arg, i, thread), where thread is the number of the thread
+ * running task i, from 0 (the calling thread) to numOfThreads-1. A thread runs one task at a time,
+ * so the tasks can use memory allocated for their thread - for example a search context for every
+ * thread (see spKDTreeSearchContextCreate) - without locking it.
+ *
+ * @param numOfTasks - the number of tasks
+ * @param numOfThreads - the maximal number of threads
+ * @param task - the task function
+ * @param arg - the argument passed to every task
+ * @return -1 if task is NULL, otherwise 0
+ */
+int spParallelForThreads(int numOfTasks, int numOfThreads, SPParallelThreadTask task, void* arg);
+
+#endif /* SPPARALLEL_H_ */
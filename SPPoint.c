@@ -16,6 +16,7 @@
  * spPointGetDimension		- A getter of the dimension of a point
  * spPointGetIndex			- A getter of the index of a point
  * spPointGetAxisCoor		- A getter of a given coordinate of the point
+ * spPointGetData			- A getter of the coordinates array of the point
  * spPointL2SquaredDistance	- Calculates the L2 squared distance between two points
  *
  */
@@ -136,6 +137,20 @@ double spPointGetAxisCoor(SPPoint* point, int axis){
     return point->coor[axis];
 }
 
+/**
+ * A getter for the coordinates array of the point.
+ * The array holds dim(point) values and must not be freed or changed.
+ *
+ * @param point - The source point
+ * @assert point != NULL
+ * @return
+ * A pointer to the coordinates of the point (p_0,...,p_{dim-1})
+ */
+const double* spPointGetData(SPPoint* point){
+    assert (point != NULL);
+    return point->coor;
+}
+
 /**
  * Calculates the L2-squared distance between p and q.
  * The L2-squared distance is defined as:
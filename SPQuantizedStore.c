@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "SPFeatureStore.h"
+#include "SPQuantizedStore.h"
+#include "SPDistance.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+// The largest code of a row
+#define SP_QUANTIZED_STORE_MAX_CODE 255
+
+struct sp_quantized_store_t {
+	int dim;				// The dimension of the rows
+	int stride;				// dim rounded up to a multiple of SP_DISTANCE_CODE_PAD
+	int size;				// The number of rows
+	double step;			// The width of a query code
+	short* scales;			// A row code of dimension j is scales[j] steps wide (stride, zero padded)
+	double* min;			// min[j] is the coordinate of code 0 in dimension j (dim)
+	unsigned char* codes;	// The codes of row i start at codes + i*stride, zero padded
+};
+
+/*
+ * The code of coordinate x of dimension axis, of codes width steps wide, rounded and clamped to low ... high.
+ */
+static int spQuantizedStoreCode(const SPQuantizedStore* quantized, int axis, double x, double width, int low, int high) {
+	double code = (x - quantized->min[axis]) / width;
+	if (code <= low)
+		return low;
+	if (code >= high)
+		return high;
+	return code < 0 ? -(int) (0.5 - code) : (int) (code + 0.5);
+}
+
+SPQuantizedStore* spQuantizedStoreCreate(SPFeatureStore* store) {
+	if (store == NULL || spFeatureStoreGetSize(store) == 0 ||
+			spFeatureStoreGetDimension(store) > SP_DISTANCE_CODE_MAX_DIM) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	int dim = spFeatureStoreGetDimension(store), size = spFeatureStoreGetSize(store);
+	SPQuantizedStore* quantized = (SPQuantizedStore*) malloc(sizeof(*quantized));
+	if (quantized == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	quantized->dim = dim;
+	quantized->stride = spDistancePaddedCodeDim(dim);
+	quantized->size = size;
+	quantized->scales = (short*) calloc(quantized->stride, sizeof(short));
+	quantized->min = (double*) malloc(dim * sizeof(double));
+	quantized->codes = (unsigned char*) calloc((size_t) size * quantized->stride, 1);
+	double* max = (double*) malloc(dim * sizeof(double));
+	double* row = (double*) malloc(dim * sizeof(double));
+	if (quantized->scales == NULL || quantized->min == NULL || quantized->codes == NULL || max == NULL || row == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(max);
+		free(row);
+		spQuantizedStoreDestroy(quantized);
+		return NULL;
+	}
+
+	// Calibration - the range of every dimension over all the rows
+	spFeatureStoreCopyRow(store, 0, quantized->min);
+	memcpy(max, quantized->min, dim * sizeof(double));
+	for (int i = 1; i < size; i++) {
+		spFeatureStoreCopyRow(store, i, row);
+		for (int j = 0; j < dim; j++) {
+			if (row[j] < quantized->min[j])
+				quantized->min[j] = row[j];
+			if (row[j] > max[j])
+				max[j] = row[j];
+		}
+	}
+	double range = 0;
+	for (int j = 0; j < dim; j++)
+		if (max[j] - quantized->min[j] > range)
+			range = max[j] - quantized->min[j];
+	quantized->step = range > 0 ? range / (SP_QUANTIZED_STORE_MAX_CODE * SP_DISTANCE_CODE_SCALE_MAX) : 1;
+	for (int j = 0; j < dim; j++) { // the fewest steps whose codes cover the range of the dimension
+		double steps = (max[j] - quantized->min[j]) / (SP_QUANTIZED_STORE_MAX_CODE * quantized->step);
+		int scale = steps < SP_DISTANCE_CODE_SCALE_MAX ? (int) steps : SP_DISTANCE_CODE_SCALE_MAX;
+		scale += scale < steps && scale < SP_DISTANCE_CODE_SCALE_MAX;
+		quantized->scales[j] = (short) (scale < 1 ? 1 : scale);
+	}
+
+	for (int i = 0; i < size; i++) {
+		unsigned char* code = quantized->codes + (size_t) i * quantized->stride;
+		spFeatureStoreCopyRow(store, i, row);
+		for (int j = 0; j < dim; j++)
+			code[j] = (unsigned char) spQuantizedStoreCode(quantized, j, row[j], quantized->scales[j] * quantized->step,
+					0, SP_QUANTIZED_STORE_MAX_CODE);
+	}
+	free(max);
+	free(row);
+	return quantized;
+}
+
+void spQuantizedStoreDestroy(SPQuantizedStore* quantized) {
+	if (quantized == NULL)
+		return;
+	free(quantized->scales);
+	free(quantized->min);
+	free(quantized->codes);
+	free(quantized);
+}
+
+int spQuantizedStoreGetDimension(SPQuantizedStore* quantized) {
+	return quantized == NULL ? -1 : quantized->dim;
+}
+
+int spQuantizedStoreGetStride(SPQuantizedStore* quantized) {
+	return quantized == NULL ? -1 : quantized->stride;
+}
+
+int spQuantizedStoreGetSize(SPQuantizedStore* quantized) {
+	return quantized == NULL ? 0 : quantized->size;
+}
+
+double spQuantizedStoreGetStep(SPQuantizedStore* quantized) {
+	assert(quantized != NULL);
+	return quantized->step;
+}
+
+int spQuantizedStoreGetScale(SPQuantizedStore* quantized, int axis) {
+	assert(quantized != NULL && axis >= 0 && axis < quantized->dim);
+	return quantized->scales[axis];
+}
+
+double spQuantizedStoreGetMin(SPQuantizedStore* quantized, int axis) {
+	assert(quantized != NULL && axis >= 0 && axis < quantized->dim);
+	return quantized->min[axis];
+}
+
+const unsigned char* spQuantizedStoreGetRow(SPQuantizedStore* quantized, int row) {
+	assert(quantized != NULL && row >= 0 && row < quantized->size);
+	return quantized->codes + (size_t) row * quantized->stride;
+}
+
+void spQuantizedStoreQuantizeQuery(SPQuantizedStore* quantized, const double* query, short* code) {
+	assert(quantized != NULL && query != NULL && code != NULL);
+	for (int j = 0; j < quantized->dim; j++)
+		code[j] = (short) spQuantizedStoreCode(quantized, j, query[j], quantized->step,
+				SP_DISTANCE_CODE_QUERY_MIN, SP_DISTANCE_CODE_QUERY_MAX);
+	for (int j = quantized->dim; j < quantized->stride; j++)
+		code[j] = 0;
+}
+
+void spQuantizedStoreL2SquaredDistances(SPQuantizedStore* quantized, int firstRow, int numOfRows,
+		const short* code, double* distances) {
+	assert(quantized != NULL && code != NULL && distances != NULL);
+	assert(firstRow >= 0 && numOfRows >= 0 && firstRow + numOfRows <= quantized->size);
+	spDistanceL2SquaredBatchCode(code, quantized->scales, quantized->codes + (size_t) firstRow * quantized->stride,
+			quantized->stride, numOfRows, quantized->dim, distances);
+	double scale = quantized->step * quantized->step;
+	for (int i = 0; i < numOfRows; i++)
+		distances[i] *= scale;
+}
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "SPPoint.h"
+#include "SPFeatureStore.h"
+#include "SPFeaturesFile.h"
+#include "SPQueryServer.h"
+#include "SPConsts.h"
+
+#define CLIENT_USAGE "Usage: SPQueryClient <socket_filename> [-d <PCA_dimension>] [<query>...]"
+#define CLIENT_MAX_SIMILAR_IMAGES 1024
+
+/*
+ * Sends the features of the features file (.feats, text or binary) at path to the server
+ * returns the number of similar images stored, -1 on failure
+ */
+static int searchFeaturesFile(int fd, const char* path, int dim, int* similarImages) {
+	SPFeatureStore* store = spFeatureStoreCreate(dim, 0);
+	if (!store || spFeaturesFileLoad(path, store, 0) < 1) {
+		spFeatureStoreDestroy(store);
+		return -1;
+	}
+	int numOfFeatures = spFeatureStoreGetSize(store);
+	SPPoint** feats = (SPPoint**) calloc(numOfFeatures, sizeof(SPPoint*));
+	int count = feats ? 0 : -1;
+	for (int i=0; count == 0 && i<numOfFeatures; i++) {
+		feats[i] = spPointCreate((double*) spFeatureStoreGetRow(store, i), dim, 0);
+		count = feats[i] ? 0 : -1;
+	}
+	if (count == 0)
+		count = spQueryClientSearchFeatures(fd, feats, numOfFeatures, dim, similarImages, CLIENT_MAX_SIMILAR_IMAGES);
+	for (int i=0; feats && i<numOfFeatures; i++)
+		spPointDestroy(feats[i]);
+	free(feats);
+	spFeatureStoreDestroy(store);
+	return count;
+}
+
+/*
+ * Sends a query to the server and prints its line - the query and the indices of its similar images,
+ * tab separated (as in batch mode)
+ * returns 0 if the query was answered, -1 otherwise
+ */
+static int query(int fd, const char* path, int dim, int* similarImages) {
+	int count = dim > 0 ? searchFeaturesFile(fd, path, dim, similarImages) :
+			spQueryClientSearchPath(fd, path, similarImages, CLIENT_MAX_SIMILAR_IMAGES);
+	printf("%s", path);
+	for (int i=0; i<count; i++)
+		printf("\t%d", similarImages[i]);
+	if (count == -1)
+		printf("\t%s", OUTPUTMSG_BATCH_FAILED);
+	printf("\n");
+	fflush(stdout);
+	return count == -1 ? -1 : 0;
+}
+
+/*
+ * Sends queries to a SPCBIR query server (SPCBIR -s <socket_filename>), and prints their results.
+ * The queries are the query image paths given on the command line, or else read from the standard
+ * input, one per line. With -d, the queries are features files of the given PCA dimension instead,
+ * whose features are sent to the server.
+ *
+ * Usage: SPQueryClient <socket_filename> [-d <PCA_dimension>] [<query>...]
+ */
+int main(int argc, char* argv[]) {
+	int dim = 0, first = 2;
+	if (argc >= 4 && strcmp(argv[2], "-d") == 0) {
+		dim = atoi(argv[3]);
+		first = 4;
+	}
+	if (argc < 2 || (first == 4 && dim < 1)) {
+		printf("%s\n", CLIENT_USAGE);
+		return -1;
+	}
+	int fd = spQueryClientConnect(argv[1]);
+	if (fd == -1) {
+		printf(ERRORMSG_QUERY_CLIENT_CONNECT "\n", argv[1]);
+		return -1;
+	}
+
+	int* similarImages = (int*) malloc(CLIENT_MAX_SIMILAR_IMAGES * sizeof(int));
+	if (!similarImages) {
+		printf("%s\n", ERRORMSG_ALLOCATION);
+		close(fd);
+		return -1;
+	}
+
+	// a failed query is printed as failed, and the next queries are still sent
+	int failed = 0;
+	char path[STR_LEN];
+	if (first < argc) {
+		for (int i=first; i<argc; i++)
+			failed |= query(fd, argv[i], dim, similarImages) == -1;
+	}
+	else {
+		while (fgets(path, STR_LEN, stdin)) {
+			path[strcspn(path, "\r\n")] = '\0';
+			if (path[0] != '\0')
+				failed |= query(fd, path, dim, similarImages) == -1;
+		}
+	}
+	free(similarImages);
+	close(fd);
+	return failed ? -1 : 0;
+}
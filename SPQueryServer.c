@@ -0,0 +1,524 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "SPPoint.h"
+#include "SPFeatureStore.h"
+#include "SPKDTree.h"
+#include "SPQueryServer.h"
+#include "SPLogger.h"
+#include "SPConsts.h"
+
+#define SP_QUERY_FRAME_HEADER_SIZE 4 // the length of the payload
+#define SP_QUERY_RESPONSE_HEADER_SIZE 8 // status, number of images
+#define SP_QUERY_FEATURES_HEADER_SIZE 9 // type, number of features, dimension
+#define SP_QUERY_SERVER_TIMEOUT_SEC 1 // how often a worker waiting for a request checks if the server stops
+#define SP_QUERY_SERVER_IDLE_SEC 2 // how long a connection may wait for a request while other connections wait
+#define SP_QUERY_SERVER_SEND_TIMEOUT_SEC 5 // how long a response may wait for the client to read it
+#define SP_QUERY_SERVER_ACCEPT_RETRY_MS 100 // the pause after a failed accept, so a persistent failure doesn't spin
+
+typedef struct sp_query_worker_t SPQueryWorker;
+
+struct sp_query_server_t {
+	int listenFd;
+	char* socketPath;
+	SPKDTree* tree;
+	int dim;
+	int kNN;
+	int numOfSimilarImages;
+	int numOfImages;
+	SPQueryExtractFunc extract;
+	void* extractArg;
+	SPQueryWorker* workers;
+	int numOfWorkers;
+	pthread_mutex_t lock;	// Guards stopping
+	bool stopping;
+};
+
+// A worker thread, searching the tree with its own search context
+struct sp_query_worker_t {
+	pthread_t thread;
+	SPQueryServer* server;
+	SPKDTreeSearchContext* context;
+};
+
+/*
+ * Little-endian encoding and decoding, independent of the byte order of the machine.
+ */
+static void spQueryPutU32(unsigned char* bytes, uint32_t value) {
+	for (int k=0; k<4; k++)
+		bytes[k] = (unsigned char) (value >> (8*k));
+}
+
+static uint32_t spQueryGetU32(const unsigned char* bytes) {
+	uint32_t value = 0;
+	for (int k=0; k<4; k++)
+		value |= (uint32_t) bytes[k] << (8*k);
+	return value;
+}
+
+static bool spQueryServerIsStopping(SPQueryServer* server) {
+	pthread_mutex_lock(&server->lock);
+	bool stopping = server->stopping;
+	pthread_mutex_unlock(&server->lock);
+	return stopping;
+}
+
+/*
+ * Sends all the bytes of a frame whose payload is after its header, filling the header.
+ *
+ * @return false if the connection failed
+ */
+static bool spQuerySendFrame(int fd, unsigned char* frame, size_t payloadSize) {
+	spQueryPutU32(frame, (uint32_t) payloadSize);
+	size_t size = SP_QUERY_FRAME_HEADER_SIZE + payloadSize;
+	for (size_t sent = 0; sent < size; ) {
+		ssize_t bytes = send(fd, frame + sent, size - sent, MSG_NOSIGNAL);
+		if (bytes == -1 && errno == EINTR)
+			continue;
+		if (bytes <= 0)
+			return false;
+		sent += (size_t) bytes;
+	}
+	return true;
+}
+
+/*
+ * @return true if a connection waits to be accepted by the server
+ */
+static bool spQueryServerHasPending(SPQueryServer* server) {
+	struct pollfd listening = {server->listenFd, POLLIN, 0};
+	return poll(&listening, 1, 0) == 1 && (listening.revents & POLLIN);
+}
+
+/*
+ * @return the seconds since start, on the monotonic clock
+ */
+static double spQueryElapsedSec(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Receives exactly size bytes. On the server, a receive timing out is retried unless the server stops,
+ * or the frame started at start has waited SP_QUERY_SERVER_IDLE_SEC and other connections wait for a
+ * worker - then the connection is dropped, so idle (or slow) clients don't keep the workers from them.
+ *
+ * @return false if the connection was closed, failed or was dropped
+ */
+static bool spQueryReceiveAll(int fd, unsigned char* buffer, size_t size, SPQueryServer* server,
+		const struct timespec* start) {
+	for (size_t received = 0; received < size; ) {
+		ssize_t bytes = recv(fd, buffer + received, size - received, 0);
+		if (bytes == -1 && errno != EINTR && (!server || (errno != EAGAIN && errno != EWOULDBLOCK)))
+			return false;
+		if (bytes == 0 || (bytes == -1 && server && spQueryServerIsStopping(server)))
+			return false;
+		if (bytes > 0)
+			received += (size_t) bytes;
+		if (server && received < size &&
+				spQueryElapsedSec(start) >= SP_QUERY_SERVER_IDLE_SEC && spQueryServerHasPending(server))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Receives a frame.
+ *
+ * @return the payload (freed by the caller) and its size in size, NULL if the connection was closed
+ * or failed OR the frame is larger than SP_QUERY_MAX_PAYLOAD OR in case of allocation failure
+ */
+static unsigned char* spQueryReceiveFrame(int fd, uint32_t* size, SPQueryServer* server) {
+	unsigned char header[SP_QUERY_FRAME_HEADER_SIZE];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!spQueryReceiveAll(fd, header, SP_QUERY_FRAME_HEADER_SIZE, server, &start))
+		return NULL;
+	*size = spQueryGetU32(header);
+	if (*size > SP_QUERY_MAX_PAYLOAD) {
+		spLoggerPrintError(ERRORMSG_QUERY_FRAME, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	unsigned char* payload = (unsigned char*) malloc(*size > 0 ? *size : 1);
+	if (payload == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	if (!spQueryReceiveAll(fd, payload, *size, server, &start)) {
+		free(payload);
+		return NULL;
+	}
+	return payload;
+}
+
+/*
+ * Decodes the features of a SP_QUERY_FEATURES request, which must be of the dimension of the tree.
+ *
+ * @return the features (numOfFeatures of them), NULL if the request is not valid OR in case of allocation failure
+ */
+static SPPoint** spQueryServerDecodeFeatures(SPQueryServer* server, const unsigned char* payload, uint32_t size,
+		int* numOfFeatures) {
+	if (size < SP_QUERY_FEATURES_HEADER_SIZE)
+		return NULL;
+	uint32_t count = spQueryGetU32(payload + 1);
+	uint32_t dim = spQueryGetU32(payload + 5);
+	if (count == 0 || dim != (uint32_t) server->dim ||
+			(uint64_t) size != SP_QUERY_FEATURES_HEADER_SIZE + (uint64_t) count * dim * sizeof(uint64_t))
+		return NULL;
+	SPPoint** feats = (SPPoint**) calloc(count, sizeof(SPPoint*));
+	double* row = (double*) malloc(dim * sizeof(double));
+	bool valid = feats != NULL && row != NULL;
+	const unsigned char* curr = payload + SP_QUERY_FEATURES_HEADER_SIZE;
+	for (uint32_t i=0; valid && i<count; i++) {
+		for (uint32_t j=0; j<dim; j++) {
+			uint64_t bits = (uint64_t) spQueryGetU32(curr) | (uint64_t) spQueryGetU32(curr + 4) << 32;
+			memcpy(row + j, &bits, sizeof(bits));
+			curr += sizeof(bits);
+		}
+		feats[i] = spPointCreate(row, (int) dim, 0);
+		valid = feats[i] != NULL;
+	}
+	free(row);
+	if (!valid) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		for (uint32_t i=0; feats != NULL && i<count; i++)
+			spPointDestroy(feats[i]);
+		free(feats);
+		return NULL;
+	}
+	*numOfFeatures = (int) count;
+	return feats;
+}
+
+/*
+ * Answers a request - finds the similar images of the query image of the request.
+ *
+ * @return false if the request is not valid or could not be answered
+ */
+static bool spQueryServerSearch(SPQueryWorker* worker, const unsigned char* payload, uint32_t size,
+		int* similarImages) {
+	SPQueryServer* server = worker->server;
+	SPPoint** feats = NULL;
+	int numOfFeatures = 0;
+	if (size > 0 && payload[0] == SP_QUERY_PATH && size - 1 < STR_LEN && server->extract != NULL &&
+			memchr(payload + 1, '\0', size - 1) == NULL) {
+		char path[STR_LEN];
+		memcpy(path, payload + 1, size - 1);
+		path[size - 1] = '\0';
+		feats = server->extract(server->extractArg, path, &numOfFeatures);
+	}
+	else if (size > 0 && payload[0] == SP_QUERY_FEATURES)
+		feats = spQueryServerDecodeFeatures(server, payload, size, &numOfFeatures);
+	if (feats == NULL)
+		return false;
+	bool found = closestImagesSearchContext(worker->context, similarImages, server->numOfSimilarImages,
+			feats, numOfFeatures) != -1;
+	for (int i=0; i<numOfFeatures; i++)
+		spPointDestroy(feats[i]);
+	free(feats);
+	return found;
+}
+
+/*
+ * Answers the requests of a connection, in order, until the client closes it or the server stops.
+ */
+static void spQueryServerAnswer(SPQueryWorker* worker, int fd) {
+	SPQueryServer* server = worker->server;
+	size_t responseSize = SP_QUERY_RESPONSE_HEADER_SIZE + (size_t) server->numOfSimilarImages * sizeof(uint32_t);
+	unsigned char* response = (unsigned char*) malloc(SP_QUERY_FRAME_HEADER_SIZE + responseSize);
+	int* similarImages = (int*) malloc(server->numOfSimilarImages * sizeof(int));
+	if (response == NULL || similarImages == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(response);
+		free(similarImages);
+		return;
+	}
+	unsigned char* curr = response + SP_QUERY_FRAME_HEADER_SIZE;
+	uint32_t size;
+	unsigned char* payload;
+	bool connected = true;
+	while (connected && (payload = spQueryReceiveFrame(fd, &size, server)) != NULL) {
+		bool found = spQueryServerSearch(worker, payload, size, similarImages);
+		free(payload);
+		spQueryPutU32(curr, found ? SP_QUERY_SUCCESS : SP_QUERY_FAILURE);
+		spQueryPutU32(curr + 4, found ? (uint32_t) server->numOfSimilarImages : 0);
+		for (int i=0; found && i<server->numOfSimilarImages; i++)
+			spQueryPutU32(curr + SP_QUERY_RESPONSE_HEADER_SIZE + i * sizeof(uint32_t), (uint32_t) similarImages[i]);
+		connected = spQuerySendFrame(fd, response,
+				found ? responseSize : SP_QUERY_RESPONSE_HEADER_SIZE);
+	}
+	free(response);
+	free(similarImages);
+}
+
+/*
+ * Accepts connections and answers them until the server stops. This is the body of every worker.
+ */
+static void* spQueryServerWorker(void* arg) {
+	SPQueryWorker* worker = (SPQueryWorker*) arg;
+	SPQueryServer* server = worker->server;
+	struct timeval timeout = {SP_QUERY_SERVER_TIMEOUT_SEC, 0};
+	struct timeval sendTimeout = {SP_QUERY_SERVER_SEND_TIMEOUT_SEC, 0};
+	struct timespec retry = {0, SP_QUERY_SERVER_ACCEPT_RETRY_MS * 1000000L};
+	while (!spQueryServerIsStopping(server)) {
+		int fd = accept(server->listenFd, NULL, NULL);
+		if (fd == -1) {
+			// interrupted and aborted connections are retried at once, other failures (such as running
+			// out of descriptors) after a pause
+			if (errno != EINTR && errno != ECONNABORTED && !spQueryServerIsStopping(server)) {
+				spLoggerPrintWarning(WARNINGMSG_QUERY_SERVER_ACCEPT, __FILE__, __func__, __LINE__);
+				nanosleep(&retry, NULL);
+			}
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+		spQueryServerAnswer(worker, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+/*
+ * Fills the address of the socket at socketPath.
+ *
+ * @return false if the path is too long
+ */
+static bool spQuerySocketAddress(struct sockaddr_un* address, const char* socketPath) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address->sun_path))
+		return false;
+	strcpy(address->sun_path, socketPath);
+	return true;
+}
+
+/*
+ * Creates the listening socket of the server at server->socketPath, replacing a stale socket.
+ *
+ * @return false if the socket could not be created
+ */
+static bool spQueryServerListen(SPQueryServer* server) {
+	struct sockaddr_un address;
+	struct stat fileStat;
+	if (!spQuerySocketAddress(&address, server->socketPath))
+		return false;
+	if (lstat(server->socketPath, &fileStat) == 0 && S_ISSOCK(fileStat.st_mode))
+		unlink(server->socketPath);
+	server->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server->listenFd == -1)
+		return false;
+	if (bind(server->listenFd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+			listen(server->listenFd, SOMAXCONN) != 0) {
+		close(server->listenFd);
+		server->listenFd = -1;
+		return false;
+	}
+	return true;
+}
+
+SPQueryServer* spQueryServerCreate(const char* socketPath, SPKDTree* tree, int kNN, int numOfSimilarImages,
+		int numOfImages, int numOfThreads, SPQueryExtractFunc extract, void* extractArg) {
+	if (socketPath == NULL || tree == NULL || kNN < 1 || numOfSimilarImages < 1 || numOfImages < numOfSimilarImages ||
+			numOfThreads < 1) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	SPQueryServer* server = (SPQueryServer*) malloc(sizeof(*server));
+	char* path = (char*) malloc(strlen(socketPath) + 1);
+	SPQueryWorker* workers = (SPQueryWorker*) calloc(numOfThreads, sizeof(SPQueryWorker));
+	bool allocated = server != NULL && path != NULL && workers != NULL;
+	for (int i=0; allocated && i<numOfThreads; i++) { // the search context of every worker
+		workers[i].server = server;
+		allocated = (workers[i].context = spKDTreeSearchContextCreate(tree, kNN, numOfImages)) != NULL;
+	}
+	if (!allocated) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		for (int i=0; workers != NULL && i<numOfThreads; i++)
+			spKDTreeSearchContextDestroy(workers[i].context);
+		free(server);
+		free(path);
+		free(workers);
+		return NULL;
+	}
+	strcpy(path, socketPath);
+	server->socketPath = path;
+	server->tree = tree;
+	server->dim = spFeatureStoreGetDimension(spKDTreeGetStore(tree));
+	server->kNN = kNN;
+	server->numOfSimilarImages = numOfSimilarImages;
+	server->numOfImages = numOfImages;
+	server->extract = extract;
+	server->extractArg = extractArg;
+	server->workers = workers;
+	server->numOfWorkers = 0;
+	server->stopping = false;
+	pthread_mutex_init(&server->lock, NULL);
+
+	char msg[2 * STR_LEN];
+	if (!spQueryServerListen(server)) {
+		sprintf(msg, ERRORMSG_QUERY_SERVER_LISTEN, socketPath);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		pthread_mutex_destroy(&server->lock);
+		for (int i=0; i<numOfThreads; i++)
+			spKDTreeSearchContextDestroy(workers[i].context);
+		free(workers);
+		free(path);
+		free(server);
+		return NULL;
+	}
+
+	// start the workers
+	int numOfStarted = 0;
+	while (numOfStarted < numOfThreads &&
+			pthread_create(&workers[numOfStarted].thread, NULL, spQueryServerWorker, workers + numOfStarted) == 0)
+		numOfStarted++;
+	for (int i=numOfStarted; i<numOfThreads; i++) // contexts of workers that were not started
+		spKDTreeSearchContextDestroy(workers[i].context);
+	server->numOfWorkers = numOfStarted;
+	if (server->numOfWorkers < numOfThreads)
+		spLoggerPrintWarning(WARNINGMSG_THREAD_CREATE, __FILE__, __func__, __LINE__);
+	if (server->numOfWorkers == 0) {
+		spQueryServerDestroy(server);
+		return NULL;
+	}
+	return server;
+}
+
+void spQueryServerDestroy(SPQueryServer* server) {
+	if (server == NULL)
+		return;
+	pthread_mutex_lock(&server->lock);
+	server->stopping = true;
+	pthread_mutex_unlock(&server->lock);
+	shutdown(server->listenFd, SHUT_RDWR); // wakes the workers waiting in accept
+	for (int i=0; i<server->numOfWorkers; i++) {
+		pthread_join(server->workers[i].thread, NULL);
+		spKDTreeSearchContextDestroy(server->workers[i].context);
+	}
+	close(server->listenFd);
+	unlink(server->socketPath);
+	pthread_mutex_destroy(&server->lock);
+	free(server->workers);
+	free(server->socketPath);
+	free(server);
+}
+
+int spQueryClientConnect(const char* socketPath) {
+	struct sockaddr_un address;
+	if (socketPath == NULL || !spQuerySocketAddress(&address, socketPath)) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd != -1 && connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd == -1) {
+		char msg[2 * STR_LEN];
+		sprintf(msg, ERRORMSG_QUERY_CLIENT_CONNECT, socketPath);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+	}
+	return fd;
+}
+
+/*
+ * Sends a request frame, and receives the similar images of the response.
+ *
+ * @return -1 if the connection failed OR the server could not answer, otherwise the number of similar images stored
+ */
+static int spQueryClientExchange(int fd, unsigned char* request, size_t payloadSize,
+		int* similarImages, int maxSimilarImages) {
+	if (!spQuerySendFrame(fd, request, payloadSize))
+		return -1;
+	uint32_t size;
+	unsigned char* response = spQueryReceiveFrame(fd, &size, NULL);
+	if (response == NULL)
+		return -1;
+	int count = -1;
+	if (size >= SP_QUERY_RESPONSE_HEADER_SIZE && spQueryGetU32(response) == SP_QUERY_SUCCESS) {
+		uint32_t numOfImages = spQueryGetU32(response + 4);
+		if ((uint64_t) size == SP_QUERY_RESPONSE_HEADER_SIZE + (uint64_t) numOfImages * sizeof(uint32_t)) {
+			count = numOfImages < (uint32_t) maxSimilarImages ? (int) numOfImages : maxSimilarImages;
+			for (int i=0; i<count; i++)
+				similarImages[i] = (int) spQueryGetU32(response + SP_QUERY_RESPONSE_HEADER_SIZE + i * sizeof(uint32_t));
+		}
+	}
+	free(response);
+	return count;
+}
+
+int spQueryClientSearchPath(int fd, const char* path, int* similarImages, int maxSimilarImages) {
+	if (fd < 0 || path == NULL || similarImages == NULL || maxSimilarImages < 1) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	size_t length = strlen(path);
+	unsigned char* request = (unsigned char*) malloc(SP_QUERY_FRAME_HEADER_SIZE + 1 + length);
+	if (request == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	request[SP_QUERY_FRAME_HEADER_SIZE] = SP_QUERY_PATH;
+	memcpy(request + SP_QUERY_FRAME_HEADER_SIZE + 1, path, length);
+	int count = spQueryClientExchange(fd, request, 1 + length, similarImages, maxSimilarImages);
+	free(request);
+	return count;
+}
+
+int spQueryClientSearchFeatures(int fd, SPPoint** feats, int numOfFeatures, int dim,
+		int* similarImages, int maxSimilarImages) {
+	if (fd < 0 || feats == NULL || numOfFeatures < 1 || dim < 1 || similarImages == NULL || maxSimilarImages < 1) {
+		spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	for (int i=0; i<numOfFeatures; i++) {
+		if (feats[i] == NULL || spPointGetDimension(feats[i]) != dim) {
+			spLoggerPrintError(ERRORMSG_INVALID_ARGS, __FILE__, __func__, __LINE__);
+			return -1;
+		}
+	}
+	size_t payloadSize = SP_QUERY_FEATURES_HEADER_SIZE + (size_t) numOfFeatures * dim * sizeof(uint64_t);
+	if (payloadSize > SP_QUERY_MAX_PAYLOAD) {
+		spLoggerPrintError(ERRORMSG_QUERY_FRAME, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	unsigned char* request = (unsigned char*) malloc(SP_QUERY_FRAME_HEADER_SIZE + payloadSize);
+	if (request == NULL) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	unsigned char* curr = request + SP_QUERY_FRAME_HEADER_SIZE;
+	curr[0] = SP_QUERY_FEATURES;
+	spQueryPutU32(curr + 1, (uint32_t) numOfFeatures);
+	spQueryPutU32(curr + 5, (uint32_t) dim);
+	curr += SP_QUERY_FEATURES_HEADER_SIZE;
+	for (int i=0; i<numOfFeatures; i++) {
+		const double* data = spPointGetData(feats[i]);
+		for (int j=0; j<dim; j++) {
+			uint64_t bits;
+			memcpy(&bits, data + j, sizeof(bits));
+			spQueryPutU32(curr, (uint32_t) bits);
+			spQueryPutU32(curr + 4, (uint32_t) (bits >> 32));
+			curr += sizeof(bits);
+		}
+	}
+	int count = spQueryClientExchange(fd, request, payloadSize, similarImages, maxSimilarImages);
+	free(request);
+	return count;
+}
@@ -0,0 +1,127 @@
+#ifndef SPQUERYSERVER_H_
+#define SPQUERYSERVER_H_
+
+#include "SPPoint.h"
+#include "SPKDTree.h"
+
+/**
+ * SPQueryServer Summary
+ * A query server answering similar image queries over a Unix domain socket, so the kd tree is
+ * built (or loaded) once and searched by many clients. The server accepts connections on a pool of
+ * worker threads sharing the read-only tree; every worker answers the requests of one connection at
+ * a time, in order, until the client closes it. A connection that waits a couple of seconds for its
+ * next request while other connections wait for a worker is closed, and a response the client does not
+ * read within a few seconds closes its connection, so idle clients don't keep the workers from the
+ * others - a client of a busy server should connect when it has queries to send. Every worker searches
+ * with its own search context (see spKDTreeSearchContextCreate), so answering a query allocates no
+ * search memory.
+ *
+ * Every message - request or response - is a frame: its length as a little-endian 32 bit integer,
+ * followed by that many bytes of payload. A request payload starts with its type:
+ * - SP_QUERY_PATH - followed by the path of a query image (not NUL terminated). The server
+ *   extracts its features with the extraction function it was created with.
+ * - SP_QUERY_FEATURES - followed by the number of features and their dimension as little-endian
+ *   32 bit integers, and the coordinates of all the features, row after row, as little-endian
+ *   IEEE float64 values. The features are the PCA-projected features the tree holds, so the
+ *   dimension must be the dimension of the tree.
+ * A response payload is a status (SP_QUERY_SUCCESS or SP_QUERY_FAILURE) and a number of image
+ * indices as little-endian 32 bit integers, followed by the indices of the similar images,
+ * most similar first, as little-endian 32 bit integers.
+ *
+ * The following functions are supported:
+ *
+ * spQueryServerCreate      - Starts a server listening on a socket.
+ * spQueryServerDestroy     - Stops a server and frees it.
+ * spQueryClientConnect     - Connects to a server.
+ * spQueryClientSearchPath  - Sends a query image path and receives its similar images.
+ * spQueryClientSearchFeatures - Sends query features and receives their similar images.
+ *
+ */
+
+/** Request types **/
+#define SP_QUERY_PATH 'P'
+#define SP_QUERY_FEATURES 'F'
+
+/** Response statuses **/
+#define SP_QUERY_SUCCESS 0
+#define SP_QUERY_FAILURE 1
+
+/** The maximal payload of a frame, larger frames are rejected **/
+#define SP_QUERY_MAX_PAYLOAD (64u << 20)
+
+/** Type of the function extracting the features of a query image - may be called from several threads at once **/
+typedef SPPoint** (*SPQueryExtractFunc)(void* arg, const char* path, int* numOfFeatures);
+
+/** Type for defining the server **/
+typedef struct sp_query_server_t SPQueryServer;
+
+/**
+ * Creates a server listening on a Unix domain socket at socketPath, and starts numOfThreads worker
+ * threads answering its connections. A stale socket at socketPath is replaced.
+ * The tree is shared by the workers and must not change (or be destroyed) before the server is destroyed.
+ * Signals the caller wants to wait for (with sigwait) should be blocked before calling this function,
+ * so the workers inherit the mask.
+ *
+ * @param socketPath - the path of the socket
+ * @param tree - the kd tree of the features of all the images
+ * @param kNN - the number of nearest features searched for every query feature
+ * @param numOfSimilarImages - the number of similar images returned for a query
+ * @param numOfImages - the number of images of the tree
+ * @param numOfThreads - the number of worker threads
+ * @param extract - the function extracting the features of a query image (NULL to answer only feature requests)
+ * @param extractArg - the argument passed to extract
+ *
+ * @return NULL if socketPath or tree are NULL OR socketPath is too long for a socket OR an argument is
+ * not positive OR numOfSimilarImages > numOfImages OR the socket could not be created OR no worker could
+ * be started OR in case of allocation failure. Otherwise, the server.
+ */
+SPQueryServer* spQueryServerCreate(const char* socketPath, SPKDTree* tree, int kNN, int numOfSimilarImages,
+		int numOfImages, int numOfThreads, SPQueryExtractFunc extract, void* extractArg);
+
+/**
+ * Stops accepting connections, waits for the workers to finish the requests they are answering,
+ * removes the socket and frees the server. The tree is not destroyed.
+ * If server is NULL nothing happens.
+ *
+ * @param server - the server
+ */
+void spQueryServerDestroy(SPQueryServer* server);
+
+/**
+ * Connects to the server listening at socketPath.
+ *
+ * @param socketPath - the path of the socket
+ * @return the socket descriptor of the connection (closed with close), -1 on failure
+ */
+int spQueryClientConnect(const char* socketPath);
+
+/**
+ * Sends a query image path to the server, and receives the indices of its similar images.
+ *
+ * @param fd - a connection to the server
+ * @param path - the path of the query image
+ * @param similarImages - the indices of the similar images are stored here, most similar first
+ * @param maxSimilarImages - the size of similarImages
+ *
+ * @return -1 if the arguments are invalid OR the connection failed OR the server could not answer the query.
+ * Otherwise, the number of similar images stored
+ */
+int spQueryClientSearchPath(int fd, const char* path, int* similarImages, int maxSimilarImages);
+
+/**
+ * Sends the features of a query image to the server, and receives the indices of its similar images.
+ *
+ * @param fd - a connection to the server
+ * @param feats - the features of the query image, all of dimension dim (the dimension of the tree of the server)
+ * @param numOfFeatures - the number of features
+ * @param dim - the dimension of the features
+ * @param similarImages - the indices of the similar images are stored here, most similar first
+ * @param maxSimilarImages - the size of similarImages
+ *
+ * @return -1 if the arguments are invalid OR the connection failed OR the server could not answer the query.
+ * Otherwise, the number of similar images stored
+ */
+int spQueryClientSearchFeatures(int fd, SPPoint** feats, int numOfFeatures, int dim,
+		int* similarImages, int maxSimilarImages);
+
+#endif /* SPQUERYSERVER_H_ */
@@ -11,6 +11,7 @@ extern "C" {
 int main(int argc, char* argv[]) {
 	// init
 	SP_CONFIG_MSG configMsg;
+	int result = 0;
 	SPConfig config = spInit(argc, argv);
 	if (!config) return -1;
 
@@ -19,7 +20,7 @@ int main(int argc, char* argv[]) {
 		sp::ImageProc imageProc(config);
 
 		// pre-processing
-		SPKDTreeNode* featsTree = spPreprocessing(imageProc, config);
+		SPKDTree* featsTree = spPreprocessing(imageProc, config);
 		if (!featsTree) {
 			spConfigDestroy(config);
 			return -1;
@@ -36,6 +37,18 @@ int main(int argc, char* argv[]) {
 		if (!similarImages || configMsg != SP_CONFIG_SUCCESS)
 			spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ - 2);
 
+		// server mode - answer queries over a socket until stopped
+		else if (spInitServerPath(argc, argv)) {
+			if (spServe(spInitServerPath(argc, argv), imageProc, featsTree, config) == -1)
+				result = -1;
+		}
+
+		// batch mode - answer all the queries of the queries file
+		else if (spInitBatchPath(argc, argv)) {
+			if (spBatchQuery(spInitBatchPath(argc, argv), imageProc, featsTree, config) == -1)
+				result = -1;
+		}
+
 		// query and find similar images
 		else {
 			queryFeats = spQuery(&queryNumOfFeatures, queryFilename, imageProc);
@@ -64,6 +77,6 @@ int main(int argc, char* argv[]) {
 		return -1;
 	}
 
-	return 0;
+	return result;
 
 }
@@ -1,6 +1,8 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <csignal>
+#include <pthread.h>
 #include "main_aux.h"
 
 /*
@@ -11,22 +13,50 @@ bool streq(const char* str1, const char* str2) {
 }
 
 
+/*
+ * parses the command line: -c <config_filename>, and -b <queries_filename> or -s <socket_filename>, all optional
+ * sets configFile, batchFile and socketFile to the given filenames (NULL if not given)
+ * returns false on wrong usage
+ */
+bool spParseArgs(int argc, char* argv[], const char** configFile, const char** batchFile, const char** socketFile) {
+	*configFile = NULL;
+	*batchFile = NULL;
+	*socketFile = NULL;
+	if (argc % 2 != 1)
+		return false;
+	for (int i=1; i<argc; i+=2) {
+		if (streq(argv[i],"-c") && !*configFile)
+			*configFile = argv[i+1];
+		else if (streq(argv[i],"-b") && !*batchFile && !*socketFile)
+			*batchFile = argv[i+1];
+		else if (streq(argv[i],"-s") && !*batchFile && !*socketFile)
+			*socketFile = argv[i+1];
+		else
+			return false;
+	}
+	return true;
+}
+
 SPConfig spInit(int argc, char* argv[]) {
 	// invalid arguments
-	if ((argc != 1) && !(argc == 3 && strcmp(argv[1],"-c") == 0)) {
+	const char* configArg;
+	const char* batchArg;
+	const char* socketArg;
+	if (!spParseArgs(argc, argv, &configArg, &batchArg, &socketArg)) {
 		printf("%s\n",ERRORMSG_INIT_USAGE);
 		return NULL;
 	}
 
 	/*** parse arguments and load configuration file ***/
 	char configFile[STR_LEN];
-	char msg[STR_LEN];
-	if (argc == 1) { // no config file passed
+	char msg[2 * STR_LEN];
+	if (!configArg) { // no config file passed
 		strcpy(configFile,CONFIG_DEFAULT_FILE);
 		sprintf(msg, ERRORMSG_CONFIG_DEFAULT, configFile);
 	}
 	else { // config file passed as argument
-		strcpy(configFile, argv[2]);
+		strncpy(configFile, configArg, STR_LEN - 1);
+		configFile[STR_LEN - 1] = '\0';
 		sprintf(msg, ERRORMSG_CONFIG_FILE, configFile);
 	}
 
@@ -50,9 +80,37 @@ SPConfig spInit(int argc, char* argv[]) {
 		return NULL;
 	}
 
+	/*** select distance kernel ***/
+	sprintf(msg, INFOMSG_DISTANCE_KERNEL, spDistanceKernelName(spDistanceInit()));
+	spLoggerPrintInfo(msg);
+
+	/*** select bounded priority queue implementation (before any queue is created) ***/
+	bool heap = spConfigIsBPQueueHeap(config, &configMsg);
+	spBPQueueSetImplementation(heap ? SP_BPQUEUE_HEAP : SP_BPQUEUE_SORTED);
+	sprintf(msg, INFOMSG_BPQUEUE_IMPL, heap ? "heap" : "sorted array");
+	spLoggerPrintInfo(msg);
+
 	return config;
 }
 
+const char* spInitBatchPath(int argc, char* argv[]) {
+	const char* configArg;
+	const char* batchArg;
+	const char* socketArg;
+	if (!spParseArgs(argc, argv, &configArg, &batchArg, &socketArg))
+		return NULL;
+	return batchArg;
+}
+
+const char* spInitServerPath(int argc, char* argv[]) {
+	const char* configArg;
+	const char* batchArg;
+	const char* socketArg;
+	if (!spParseArgs(argc, argv, &configArg, &batchArg, &socketArg))
+		return NULL;
+	return socketArg;
+}
+
 void destroySPPoint1D(SPPoint **DB, int dim) {
 	if (DB) {
 		for (int i=0; i<dim; i++)
@@ -72,11 +130,15 @@ void destroySPPoint2D(SPPoint ***DB, int dim, int *dim2) {
 }
 
 
-SPPoint** spLoadFeaturesFile(int index, int* numOfFeatures, const SPConfig config) {
+/*
+ * Loads the features file of image index and appends its features to store
+ * returns the number of loaded features, -1 on failure
+ */
+int spLoadFeaturesFile(int index, SPFeatureStore* store, const SPConfig config) {
 	// validate parameters
-	if (!numOfFeatures || !config) {
+	if (!store || !config) {
 		spLoggerPrintWarning(ERRORMSG_NULL_ARGS,__FILE__,__func__,__LINE__);
-		return NULL;
+		return -1;
 	}
 
 	// get features file filename
@@ -90,66 +152,19 @@ SPPoint** spLoadFeaturesFile(int index, int* numOfFeatures, const SPConfig confi
 		else
 			strcpy(msg,ERRORMSG_UNKOWN);
 		spLoggerPrintWarning(msg,__FILE__,__func__,__LINE__);
-		return NULL;
-	}
-
-	// open features file
-	FILE* featsFile = fopen(filename, "r");
-	if (!featsFile) {
-		sprintf(msg,ERRORMSG_FEATS_LOAD_OPEN,filename);
-		spLoggerPrintWarning(msg,__FILE__,__func__,__LINE__);
-		return NULL;
-	}
-
-	// allocate featutres
-	fscanf(featsFile,"%d\n", numOfFeatures);
-	sprintf(msg, DEBUGMSG_FEATS_EXPECTED_NOF, *numOfFeatures);
-	spLoggerPrintDebug(msg,__FILE__,__func__,__LINE__);
-
-	SPPoint** feats = (SPPoint**) malloc(sizeof(*feats) * *numOfFeatures);
-	if (!feats) {
-		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ - 2);
-		fclose(featsFile);
-		return NULL;
-	}
-
-	// allocate feature temporary array
-	int PCADim = spConfigGetPCADim(config, &configMsg); // ###no msg validation
-	double* arr = (double*) malloc(sizeof(double) * PCADim);
-	if (!arr) {
-		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ - 2);
-		free(feats);
-		fclose(featsFile);
-		return NULL;
-	}
-
-	// read features data from file
-	int i=0, j=0;
-	while (fscanf(featsFile,"%lf ", arr + (j++))>0) {
-		if (j == PCADim) {
-			if (i++ >= *numOfFeatures) break; // overflow
-			feats[i-1] = spPointCreate(arr,PCADim,index);
-			j = 0;
-		}
+		return -1;
 	}
-	fclose(featsFile);
-	free(arr);
 
-	// to many or not enough data values
-	sprintf(msg, DEBUGMSG_FEATS_LOADED_NOF, i);
-	spLoggerPrintDebug(msg,__FILE__,__func__,__LINE__);
-
-	if (i != *numOfFeatures || j != 1) {
-		spLoggerPrintError(ERRORMSG_FEATS_LOAD_FRMT,__FILE__,__func__,__LINE__);
-		destroySPPoint1D(feats, *numOfFeatures);
-		return NULL;
-	}
+	// read the features file (binary, or the old text format) straight into the store
+	int numOfFeatures = spFeaturesFileLoad(filename, store, index);
+	if (numOfFeatures == -1)
+		return -1;
 
 	// success message
 	sprintf(msg, INFOMSG_FEATS_LOAD_SUCCESS, index);
 	spLoggerPrintInfo(msg);
 
-	return feats;
+	return numOfFeatures;
 }
 
 
@@ -179,31 +194,137 @@ void spSaveFeaturesFile(int index, SPPoint** feats, int numOfFeatures, const SPC
 		return;
 	}
 
-	// open features file
-	FILE* featsFile = fopen(filename, "w");
-	if (!featsFile) {
-		sprintf(msg,ERRORMSG_FEATS_SAVE_OPEN,filename);
-		spLoggerPrintWarning(msg,__FILE__,__func__,__LINE__);
+	// write features data to a binary features file
+	int PCADim = spConfigGetPCADim(config, &configMsg); // ###no msg validation
+	SP_FEATURES_DTYPE dtype = spConfigIsFeaturesFloat32(config, &configMsg) ? SP_FEATURES_FLOAT32 : SP_FEATURES_FLOAT64;
+	if (spFeaturesFileSave(filename, feats, numOfFeatures, PCADim, dtype) == -1)
 		return;
-	}
 
-	// write features data to file
-	int PCADim = spConfigGetPCADim(config, &configMsg); // ###no msg validation
-	fprintf(featsFile,"%d\n", numOfFeatures);
-	for (int i=0; i<numOfFeatures; i++) {
-		for (int j=0; j<PCADim; j++)
-			fprintf(featsFile,"%lf ", spPointGetAxisCoor(feats[i],j));
-		fprintf(featsFile,"\n");
+	// success message
+	sprintf(msg, INFOMSG_FEATS_SAVE_SUCCESS, index);
+	spLoggerPrintInfo(msg);
+}
+
+/*
+ * The features of a batch of consecutive images, extracted on several threads
+ */
+struct SPExtractionBatch {
+	sp::ImageProc* imageProc;
+	SPConfig config;
+	int first;				// the index of the first image of the batch
+	SPPoint*** feats;		// feats[i] holds the features of image first+i (NULL on failure)
+	int* numOfFeatures;		// numOfFeatures[i] is the number of features of image first+i
+};
+
+/*
+ * Extracts the features of image first+task of the batch (a task of spParallelFor),
+ * from the descriptors imageProc kept when fitting the PCA if it has them
+ */
+void spExtractImageTask(void* arg, int task) {
+	SPExtractionBatch* batch = (SPExtractionBatch*) arg;
+	int index = batch->first + task;
+	char imagePath[STR_LEN];
+	batch->numOfFeatures[task] = -1;
+	batch->feats[task] = batch->imageProc->getCachedImageFeatures(index, &batch->numOfFeatures[task]);
+	if (batch->feats[task])
+		return;
+	if (spConfigGetImagePath(imagePath, batch->config, index) != SP_CONFIG_SUCCESS) {
+		// failed getting image path
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return;
 	}
+	batch->feats[task] = batch->imageProc->getImageFeatures(imagePath, index, &batch->numOfFeatures[task]);
+}
 
-	fclose(featsFile);
+/*
+ * Extracts the features of all the images and appends them to store, saving the features
+ * file of every image if saveFiles.
+ * The images are extracted in batches of SP_EXTRACTION_IMAGES_PER_THREAD images per thread:
+ * the images of a batch are extracted on numOfThreads threads, and then their features are
+ * appended and saved on the calling thread in the order of the images. So the store is the same
+ * for any number of threads, and only the features of one batch are held outside the store.
+ * Images described when fitting the PCA are not read and described again, and the kept
+ * descriptors are released when done.
+ * returns 0 on success, -1 on failure
+ */
+int spExtractFeatures(sp::ImageProc& imageProc, const SPConfig config, SPFeatureStore* store,
+		int numOfThreads, bool saveFiles) {
+	SP_CONFIG_MSG configMsg;
+	char msg[STR_LEN];
+	int numOfImages = spConfigGetNumOfImages(config, &configMsg);
+	sprintf(msg, INFOMSG_EXTRACTION, numOfImages, numOfThreads);
+	spLoggerPrintInfo(msg);
 
-	// success message
-	sprintf(msg, INFOMSG_FEATS_SAVE_SUCCESS, index);
+	int batchSize = numOfThreads * SP_EXTRACTION_IMAGES_PER_THREAD;
+	SPPoint*** feats = (SPPoint***) malloc(batchSize * sizeof(SPPoint**));
+	int* numOfFeatures = (int*) malloc(batchSize * sizeof(int));
+	if (!feats || !numOfFeatures) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		free(feats);
+		free(numOfFeatures);
+		return -1;
+	}
+	SPExtractionBatch batch = {&imageProc, config, 0, feats, numOfFeatures};
+
+	bool success = true;
+	for (; success && batch.first < numOfImages; batch.first += batchSize) {
+		int size = numOfImages - batch.first < batchSize ? numOfImages - batch.first : batchSize;
+		spParallelFor(size, numOfThreads, spExtractImageTask, &batch);
+
+		// save and copy to store in order, and free the points
+		for (int i=0; i<size; i++) {
+			int index = batch.first + i;
+			if (success && feats[i]) {
+				if (saveFiles)
+					spSaveFeaturesFile(index, feats[i], numOfFeatures[i], config);
+				for (int j=0; j<numOfFeatures[i]; j++)
+					success = success && spFeatureStoreAppendPoint(store, feats[i][j]) != -1;
+			}
+			else if (success) {
+				success = false;
+				sprintf(msg, ERRORMSG_FEATS_GET, index);
+				spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+			}
+			destroySPPoint1D(feats[i], numOfFeatures[i]);
+		}
+	}
+	free(feats);
+	free(numOfFeatures);
+	imageProc.releaseCachedFeatures();
+	return success ? 0 : -1;
+}
+
+/*
+ * Builds the product quantization index searched instead of the tree (see spKDTreeSetPQIndex)
+ * on numOfThreads threads. The tree is destroyed on failure
+ */
+int spSetPQIndex(SPKDTree* featsTree, int numOfSubspaces, int numOfCandidates, int numOfThreads) {
+	char msg[STR_LEN];
+	sprintf(msg, INFOMSG_PQ_INDEX, numOfSubspaces, numOfThreads);
 	spLoggerPrintInfo(msg);
+	if (spKDTreeSetPQIndex(featsTree, numOfSubspaces, numOfCandidates, numOfThreads) == -1) {
+		spLoggerPrintError(ERRORMSG_PQ_INDEX_CREATE, __FILE__, __func__, __LINE__);
+		spKDTreeDestroy(featsTree);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Quantizes the features of the tree, scanned at the leaves instead of the coordinates
+ * (see spKDTreeSetQuantized). The tree is destroyed on failure
+ */
+int spSetQuantized(SPKDTree* featsTree, int numOfCandidates) {
+	spLoggerPrintInfo(INFOMSG_QUANTIZED);
+	if (spKDTreeSetQuantized(featsTree, true, numOfCandidates) == -1) {
+		spLoggerPrintError(ERRORMSG_QUANTIZED_CREATE, __FILE__, __func__, __LINE__);
+		spKDTreeDestroy(featsTree);
+		return -1;
+	}
+	return 0;
 }
 
-SPKDTreeNode* spPreprocessing(sp::ImageProc imageProc, const SPConfig config) {
+SPKDTree* spPreprocessing(sp::ImageProc& imageProc, const SPConfig config) {
 	// validate parameters
 	if (!config) {
 		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
@@ -226,65 +347,202 @@ SPKDTreeNode* spPreprocessing(sp::ImageProc imageProc, const SPConfig config) {
 		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
 		return NULL;
 	}
+	// get PCA dimension
+	int PCADim = spConfigGetPCADim(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
 
-	// allocate features DB
-	SPPoint*** featsDB = (SPPoint***) malloc(numOfImages*sizeof(SPPoint**));
-	if (!featsDB) {
-		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ - 2);
+	// get the number of leaves checked by a search (0 - exact search)
+	int maxLeafChecks = spConfigGetKDTreeMaxLeafChecks(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
 		return NULL;
 	}
+	if (maxLeafChecks > 0) {
+		sprintf(msg, INFOMSG_KDTREE_APPROXIMATE, maxLeafChecks);
+		spLoggerPrintInfo(msg);
+	}
 
-	// allocate numOfFeatures DB
-	char imagePath[STR_LEN];
-	int* numOfFeatures = (int*) malloc(numOfImages * sizeof(int));
-	if (!numOfFeatures) {
-		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ - 2);
-		free(featsDB);
+	// get the product quantization index searched instead of the tree (0 subspaces - no index)
+	int pqSubspaces = spConfigGetPQNumOfSubspaces(config, &configMsg);
+	int pqCandidates = spConfigGetPQRerankCandidates(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
 		return NULL;
 	}
+	if (pqSubspaces > 0 && pqCandidates > 0) {
+		sprintf(msg, INFOMSG_PQ_INDEX_RERANK, pqCandidates);
+		spLoggerPrintInfo(msg);
+	}
 
-	// populate features DB
-	for (int i=0; i<numOfImages; i++) {
-		// extract and save
-		if (spConfigIsExtractionMode(config, &configMsg)) { // ###no msg validation
-			if (spConfigGetImagePath(imagePath, config, i) != SP_CONFIG_SUCCESS) {
-				// failed getting image path
-				spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
-				featsDB[i] = NULL;
-			}
-			else {
-				numOfFeatures[i] = spConfigGetNumOfFeatures(config, &configMsg);
-				featsDB[i] = imageProc.getImageFeatures(imagePath, i, numOfFeatures + i);
-				spSaveFeaturesFile(i, featsDB[i], numOfFeatures[i], config);
-			}
+	// get the quantized codes scanned at the leaves instead of the coordinates
+	bool quantized = spConfigIsQuantizedFeatures(config, &configMsg);
+	int quantizedCandidates = spConfigGetQuantizedRerankCandidates(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+	if (quantized && quantizedCandidates > 0) {
+		sprintf(msg, INFOMSG_QUANTIZED_RERANK, quantizedCandidates);
+		spLoggerPrintInfo(msg);
+	}
+
+	// get the number of randomized trees (a forest is never loaded from the index file)
+	int numOfTrees = spConfigGetKDTreeNumOfTrees(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return NULL;
+	}
+
+	// get the precision of the features (a tree of floats is never loaded from the index file either)
+	bool float32 = spConfigIsFeaturesFloat32(config, &configMsg);
+	if (float32)
+		spLoggerPrintInfo(INFOMSG_FEATURES_FLOAT32);
+	bool indexed = numOfTrees == 1 && !float32 && spConfigIsKDTreeFlatLayout(config, &configMsg);
+
+	// load the kd tree from the index file, unless the features are extracted again
+	KD_INDEX_MODE indexMode = spConfigGetKDTreeIndexMode(config, &configMsg);
+	char indexPath[STR_LEN];
+	spConfigGetKDTreeIndexPath(indexPath, config);
+	if (indexMode != KD_INDEX_REBUILD && !indexed) {
+		sprintf(msg, WARNINGMSG_KDTREE_INDEX_UNUSED, indexPath);
+		spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+	}
+	if (indexMode == KD_INDEX_LOAD && !spConfigIsExtractionMode(config, &configMsg) && indexed) {
+		SPKDTree* featsTree = spKDTreeIndexLoad(indexPath, PCADim, splitMethod,
+				spConfigGetKDTreeLeafSize(config, &configMsg), numOfImages);
+		if (featsTree) {
+			sprintf(msg, INFOMSG_KDTREE_INDEX_LOAD, indexPath);
+			spLoggerPrintInfo(msg);
+			spKDTreeSetSearch(featsTree, spKDTreeSearchForDim(PCADim));
+			spKDTreeSetMaxLeafChecks(featsTree, maxLeafChecks);
+			if (pqSubspaces > 0 && spSetPQIndex(featsTree, pqSubspaces, pqCandidates,
+					spParallelNumOfThreads(spConfigGetNumOfThreads(config, &configMsg))) == -1)
+				return NULL;
+			if (quantized && spSetQuantized(featsTree, quantizedCandidates) == -1)
+				return NULL;
+			spLoggerPrintInfo(INFOMSG_DONE_PRE);
+			return featsTree;
 		}
+		sprintf(msg, WARNINGMSG_KDTREE_INDEX_LOAD, indexPath);
+		spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+	}
 
-		// load
-		else
-			featsDB[i] = spLoadFeaturesFile(i, numOfFeatures + i, config);
+	// allocate features store - all features of all images in one block
+	SPFeatureStore* featsStore = spFeatureStoreCreateWithPrecision(PCADim,
+			numOfImages * spConfigGetNumOfFeatures(config, &configMsg),
+			float32 ? SP_FEATURE_STORE_FLOAT32 : SP_FEATURE_STORE_FLOAT64);
+	if (!featsStore) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__ - 3);
+		return NULL;
+	}
 
-		// failed extracting / loading
-		if (!featsDB[i]) {
+	// populate features store - from one feature database, or from a features file per image
+	bool extractionMode = spConfigIsExtractionMode(config, &configMsg); // ###no msg validation
+	bool featuresDB = spConfigIsFeaturesDB(config, &configMsg);
+	bool loadDB = featuresDB && !extractionMode;
+	char dbPath[STR_LEN];
+	spConfigGetFeaturesDBPath(dbPath, config);
+	if (loadDB) {
+		int numOfFeatures = spFeaturesFileLoadDB(dbPath, featsStore, numOfImages);
+		if (numOfFeatures == -1) {
+			sprintf(msg, ERRORMSG_FEATS_DB_GET, dbPath);
+			spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+			spFeatureStoreDestroy(featsStore);
+			return NULL;
+		}
+		sprintf(msg, INFOMSG_FEATS_DB_LOAD_SUCCESS, numOfFeatures, dbPath);
+		spLoggerPrintInfo(msg);
+	}
+	int numOfThreads = spParallelNumOfThreads(spConfigGetNumOfThreads(config, &configMsg));
+	if (extractionMode && spExtractFeatures(imageProc, config, featsStore, numOfThreads, !featuresDB) == -1) {
+		spFeatureStoreDestroy(featsStore);
+		return NULL;
+	}
+	for (int i=0; i<numOfImages && !extractionMode && !loadDB; i++) {
+		// failed loading
+		if (spLoadFeaturesFile(i, featsStore, config) == -1) {
 			sprintf(msg,ERRORMSG_FEATS_GET,i);
 			spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
-			destroySPPoint2D(featsDB, i+1, numOfFeatures);
+			spFeatureStoreDestroy(featsStore);
 			return NULL;
 		}
 	}
 
-	// create KD tree out of all features
-	SPKDTreeNode* featsTree = fullKDTreeCreator(featsDB ,numOfImages, numOfFeatures, splitMethod);
+	// save all the extracted features to the feature database (before the tree reorders the store)
+	if (featuresDB && extractionMode &&
+			spFeaturesFileSaveDB(dbPath, featsStore, numOfImages, float32 ? SP_FEATURES_FLOAT32 : SP_FEATURES_FLOAT64) == 0) {
+		sprintf(msg, INFOMSG_FEATS_DB_SAVE_SUCCESS, spFeatureStoreGetSize(featsStore), dbPath);
+		spLoggerPrintInfo(msg);
+	}
+
+	// search only the product quantization index of the features, unless the tree is saved to the index file
+	SPKDTree* featsTree;
+	if (pqSubspaces > 0 && !(indexMode != KD_INDEX_REBUILD && indexed)) {
+		spLoggerPrintInfo(INFOMSG_PQ_INDEX_ONLY);
+		sprintf(msg, INFOMSG_PQ_INDEX, pqSubspaces, numOfThreads);
+		spLoggerPrintInfo(msg);
+		if (!(featsTree = spKDTreeInitPQ(featsStore, pqSubspaces, pqCandidates, numOfThreads))) {
+			spLoggerPrintError(ERRORMSG_PQ_INDEX_CREATE, __FILE__, __func__, __LINE__);
+			return NULL;
+		}
+		if (pqCandidates == 0)
+			spLoggerPrintInfo(INFOMSG_PQ_INDEX_RELEASE);
+		spLoggerPrintInfo(INFOMSG_DONE_PRE);
+		return featsTree;
+	}
+
+	// create KD tree out of all features (the tree takes the store)
+	if (numOfTrees > 1) {
+		int leafSize = spConfigGetKDTreeLeafSize(config, &configMsg);
+		sprintf(msg, INFOMSG_KDTREE_FOREST, numOfTrees, leafSize, numOfThreads);
+		spLoggerPrintInfo(msg);
+		featsTree = spKDTreeInitForest(featsStore, leafSize, numOfTrees, numOfThreads);
+	}
+	else if (spConfigIsKDTreeFlatLayout(config, &configMsg)) {
+		int leafSize = spConfigGetKDTreeLeafSize(config, &configMsg);
+		sprintf(msg, INFOMSG_KDTREE_FLAT, leafSize, numOfThreads);
+		spLoggerPrintInfo(msg);
+		if (spConfigIsKDTreeInPlaceBuild(config, &configMsg))
+			featsTree = spKDTreeInitFlatInPlace(splitMethod, featsStore, leafSize, numOfThreads);
+		else
+			featsTree = spKDTreeInitFlatParallel(splitMethod, featsStore, leafSize, numOfThreads);
+	}
+	else {
+		if (spConfigGetKDTreeLeafSize(config, &configMsg) != SP_CONFIG_DEFAULT_KD_TREE_LEAF_SIZE ||
+				spConfigIsKDTreeInPlaceBuild(config, &configMsg))
+			spLoggerPrintWarning(WARNINGMSG_KDTREE_FLAT_UNUSED, __FILE__, __func__, __LINE__);
+		featsTree = spKDTreeInit(splitMethod, featsStore);
+	}
 	if (!featsTree) {
 		spLoggerPrintError(ERRORMSG_KDTREE_CREATE, __FILE__, __func__, __LINE__);
-		destroySPPoint2D(featsDB, numOfImages, numOfFeatures);
 		return NULL;
 	}
+	// search with the core specialized to the PCA dimension, or best-bin-first
+	spKDTreeSetSearch(featsTree, spKDTreeSearchForDim(PCADim));
+	spKDTreeSetMaxLeafChecks(featsTree, maxLeafChecks);
+	if (pqSubspaces > 0 && spSetPQIndex(featsTree, pqSubspaces, pqCandidates, numOfThreads) == -1)
+		return NULL;
+	if (quantized && spSetQuantized(featsTree, quantizedCandidates) == -1)
+		return NULL;
+
+	// save the kd tree for the next runs
+	if (indexMode != KD_INDEX_REBUILD && indexed) {
+		if (spKDTreeIndexSave(featsTree, indexPath, splitMethod, numOfImages) == 0) {
+			sprintf(msg, INFOMSG_KDTREE_INDEX_SAVE, indexPath);
+			spLoggerPrintInfo(msg);
+		}
+		else {
+			sprintf(msg, WARNINGMSG_KDTREE_INDEX_SAVE, indexPath);
+			spLoggerPrintWarning(msg, __FILE__, __func__, __LINE__);
+		}
+	}
 
-	// free featsDB but leave points (to be freed when tree is destroyed)
-	for (int i=0; i<numOfImages; i++)
-		free(featsDB[i]);
-	free(featsDB);
-	free(numOfFeatures);
+	// keep only the quantized codes of the features, unless they are re-ranked
+	if (quantized && quantizedCandidates == 0 && spKDTreeReleaseFeatures(featsTree) == 1)
+		spLoggerPrintInfo(INFOMSG_QUANTIZED_RELEASE);
 
 	spLoggerPrintInfo(INFOMSG_DONE_PRE);
 	return featsTree;
@@ -318,7 +576,7 @@ SPPoint** spQuery(int* queryNumOfFeatures, char* queryFilename, sp::ImageProc im
 }
 
 int spFindSimilarImages(int* similarImages, SPPoint** queryFeats, int queryNumOfFeatures,
-		SPKDTreeNode* featsTree, const SPConfig config) {
+		SPKDTree* featsTree, const SPConfig config) {
 	// validate parameters
 	if (!similarImages || !queryFeats || !featsTree || !config) {
 		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
@@ -342,9 +600,11 @@ int spFindSimilarImages(int* similarImages, SPPoint** queryFeats, int queryNumOf
 		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
 		return -1;
 	}
+	int numOfThreads = spParallelNumOfThreads(spConfigGetNumOfThreads(config, &msg));
 
-	// find nearest images
-	if (closestImagesSearch(kNN, similarImages, numOfSimilarImages, queryFeats, queryNumOfFeatures, featsTree, numOfImages) == -1) {
+	// find nearest images - the features of the query are searched for on several threads
+	if (closestImagesSearchParallel(kNN, similarImages, numOfSimilarImages, queryFeats, queryNumOfFeatures,
+			featsTree, numOfImages, numOfThreads) == -1) {
 		spLoggerPrintError(ERRORMSG_COLSEST_IMAGE_SEARCH, __FILE__, __func__, __LINE__);
 		return -1;
 	}
@@ -396,3 +656,192 @@ int spShowResults(int* similarImages, char* imageFilename, sp::ImageProc imagePr
 
 	return 0;
 }
+
+/*
+ * A batch of queries, answered on several threads
+ */
+struct SPQueryBatch {
+	sp::ImageProc* imageProc;
+	SPKDTreeSearchContext** contexts;	// contexts[t] is the search context of thread t
+	int numOfSimilarImages;
+	char (*queries)[STR_LEN];	// queries[i] is the path of query i of the batch
+	int* similarImages;			// similarImages + i*numOfSimilarImages holds the results of query i
+	bool* answered;				// answered[i] is false if query i failed
+};
+
+/*
+ * Extracts the features of query task of the batch and finds its similar images
+ * with the search context of the thread (a task of spParallelForThreads)
+ */
+void spBatchQueryTask(void* arg, int task, int thread) {
+	SPQueryBatch* batch = (SPQueryBatch*) arg;
+	int queryNumOfFeatures = 0;
+	SPPoint** queryFeats = batch->imageProc->getImageFeatures(batch->queries[task], 0, &queryNumOfFeatures);
+	batch->answered[task] = queryFeats &&
+			closestImagesSearchContext(batch->contexts[thread], batch->similarImages + task * batch->numOfSimilarImages,
+					batch->numOfSimilarImages, queryFeats, queryNumOfFeatures) != -1;
+	if (queryFeats && !batch->answered[task])
+		spLoggerPrintError(ERRORMSG_COLSEST_IMAGE_SEARCH, __FILE__, __func__, __LINE__);
+	destroySPPoint1D(queryFeats, queryNumOfFeatures);
+}
+
+/*
+ * Reads the next non-empty line of queriesFile into query, without the line break
+ * returns false at the end of the file
+ */
+bool spReadQuery(FILE* queriesFile, char* query) {
+	while (fgets(query, STR_LEN, queriesFile)) {
+		query[strcspn(query, "\r\n")] = '\0';
+		if (query[0] != '\0')
+			return true;
+	}
+	return false;
+}
+
+int spBatchQuery(const char* batchPath, sp::ImageProc& imageProc, SPKDTree* featsTree, const SPConfig config) {
+	// validate parameters
+	if (!batchPath || !featsTree || !config) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// get configuration parameters
+	SP_CONFIG_MSG configMsg;
+	char msg[2 * STR_LEN];
+	int numOfSimilarImages = spConfigGetNumOfSimilarImages(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	int kNN = spConfigGetKNN(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	int numOfImages = spConfigGetNumOfImages(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	int numOfThreads = spParallelNumOfThreads(spConfigGetNumOfThreads(config, &configMsg));
+
+	// open the queries file
+	bool fromStdin = streq(batchPath, BATCH_STDIN_STR);
+	FILE* queriesFile = fromStdin ? stdin : fopen(batchPath, "r");
+	if (!queriesFile) {
+		sprintf(msg, ERRORMSG_BATCH_OPEN, batchPath);
+		spLoggerPrintError(msg, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// allocate one batch, and a search context for every thread
+	int batchSize = numOfThreads * SP_BATCH_QUERIES_PER_THREAD;
+	char (*queries)[STR_LEN] = (char (*)[STR_LEN]) malloc(batchSize * sizeof(*queries));
+	int* similarImages = (int*) malloc(batchSize * numOfSimilarImages * sizeof(int));
+	bool* answered = (bool*) malloc(batchSize * sizeof(bool));
+	SPKDTreeSearchContext** contexts = (SPKDTreeSearchContext**) calloc(numOfThreads, sizeof(SPKDTreeSearchContext*));
+	bool allocated = queries && similarImages && answered && contexts;
+	for (int i=0; allocated && i<numOfThreads; i++)
+		allocated = (contexts[i] = spKDTreeSearchContextCreate(featsTree, kNN, numOfImages)) != NULL;
+	if (!allocated) {
+		spLoggerPrintError(ERRORMSG_ALLOCATION, __FILE__, __func__, __LINE__);
+		for (int i=0; contexts && i<numOfThreads; i++)
+			spKDTreeSearchContextDestroy(contexts[i]);
+		free(contexts);
+		free(queries);
+		free(similarImages);
+		free(answered);
+		if (!fromStdin) fclose(queriesFile);
+		return -1;
+	}
+	SPQueryBatch batch = {&imageProc, contexts, numOfSimilarImages, queries, similarImages, answered};
+	sprintf(msg, INFOMSG_BATCH, numOfThreads);
+	spLoggerPrintInfo(msg);
+
+	// answer the queries batch by batch, and print the results in the order of the queries:
+	// a line per query - the query path and the indices of its similar images, tab separated
+	int numOfQueries = 0, numOfFailed = 0;
+	bool more = true;
+	while (more) {
+		int size = 0;
+		while (size < batchSize && (more = spReadQuery(queriesFile, queries[size])))
+			size++;
+		spParallelForThreads(size, numOfThreads, spBatchQueryTask, &batch);
+		for (int i=0; i<size; i++) {
+			printf("%s", queries[i]);
+			if (answered[i]) {
+				for (int j=0; j<numOfSimilarImages; j++)
+					printf("\t%d", similarImages[i * numOfSimilarImages + j]);
+			}
+			else {
+				printf("\t%s", OUTPUTMSG_BATCH_FAILED);
+				numOfFailed++;
+			}
+			printf("\n");
+		}
+		fflush(stdout);
+		numOfQueries += size;
+	}
+	sprintf(msg, INFOMSG_BATCH_DONE, numOfQueries, numOfFailed);
+	spLoggerPrintInfo(msg);
+
+	for (int i=0; i<numOfThreads; i++)
+		spKDTreeSearchContextDestroy(contexts[i]);
+	free(contexts);
+	free(queries);
+	free(similarImages);
+	free(answered);
+	if (!fromStdin) fclose(queriesFile);
+	return 0;
+}
+
+/*
+ * Extracts the features of a query image of the query server (an SPQueryExtractFunc)
+ */
+SPPoint** spServerExtract(void* arg, const char* path, int* numOfFeatures) {
+	return ((sp::ImageProc*) arg)->getImageFeatures(path, 0, numOfFeatures);
+}
+
+int spServe(const char* socketPath, sp::ImageProc& imageProc, SPKDTree* featsTree, const SPConfig config) {
+	// validate parameters
+	if (!socketPath || !featsTree || !config) {
+		spLoggerPrintError(ERRORMSG_NULL_ARGS, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+
+	// get configuration parameters
+	SP_CONFIG_MSG configMsg;
+	char msg[2 * STR_LEN];
+	int numOfSimilarImages = spConfigGetNumOfSimilarImages(config, &configMsg);
+	int kNN = spConfigGetKNN(config, &configMsg);
+	int numOfImages = spConfigGetNumOfImages(config, &configMsg);
+	if (configMsg != SP_CONFIG_SUCCESS) {
+		spLoggerPrintError(ERRORMSG_CONFIG_GET, __FILE__, __func__, __LINE__);
+		return -1;
+	}
+	int numOfThreads = spParallelNumOfThreads(spConfigGetNumOfThreads(config, &configMsg));
+
+	// block SIGINT and SIGTERM - the workers inherit the mask, and this thread waits for them
+	sigset_t signals, oldSignals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &oldSignals);
+	SPQueryServer* server = spQueryServerCreate(socketPath, featsTree, kNN, numOfSimilarImages, numOfImages,
+			numOfThreads, spServerExtract, &imageProc);
+	if (!server) {
+		pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+		return -1;
+	}
+	sprintf(msg, INFOMSG_QUERY_SERVER, socketPath, numOfThreads);
+	spLoggerPrintInfo(msg);
+
+	// answer until stopped
+	int signal;
+	sigwait(&signals, &signal);
+	spQueryServerDestroy(server);
+	pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+	sprintf(msg, INFOMSG_QUERY_SERVER_STOP, socketPath);
+	spLoggerPrintInfo(msg);
+	return 0;
+}
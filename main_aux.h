@@ -7,34 +7,68 @@ extern "C" {
 #include "SPConfig.h"
 #include "SPPoint.h"
 #include "SPConsts.h"
+#include "SPDistance.h"
+#include "SPFeatureStore.h"
+#include "SPFeaturesFile.h"
 #include "SPKDTree.h"
+#include "SPKDTreeIndex.h"
+#include "SPKDTreeSearch.h"
+#include "SPParallel.h"
+#include "SPQueryServer.h"
 }
 
 
-/* Load configuration file and initialize logger
+/* Load configuration file, initialize logger and select the distance kernel
  * Validates input argument are of correct format
  *
  * @param argc - the number of arguments passed to the main function
- * 				 must be either 1 or 3 (otherwise fails)
+ * 				 must be either 1, 3 or 5 (otherwise fails)
  * @param argv - array of strings passed to the main function
- * 				 if argc is 3 then argv[1] must be "-c" (otherwise fails)
- * 				 and argv[2] contains a path to the requested configuration file
+ * 				 pairs of a flag and a value, each flag at most once (otherwise fails):
+ * 				 "-c" followed by a path to the requested configuration file
+ * 				 "-b" followed by a path to a queries file (see spInitBatchPath)
+ * 				 "-s" followed by a path to a query socket (see spInitServerPath), not with "-b"
  *
  * @return loaded configuration file on success
  * 		   and NULL on failure (wrong usage, non existent configuration file)
  */
 SPConfig spInit(int argc, char* argv[]);
 
+/* Returns the queries file passed with "-b" - batch mode
+ *
+ * @param argc - the number of arguments passed to the main function
+ * @param argv - array of strings passed to the main function
+ *
+ * @return the path of the queries file (BATCH_STDIN_STR for the standard input)
+ * 		   and NULL if not passed or on wrong usage
+ */
+const char* spInitBatchPath(int argc, char* argv[]);
+
+/* Returns the query socket passed with "-s" - server mode
+ *
+ * @param argc - the number of arguments passed to the main function
+ * @param argv - array of strings passed to the main function
+ *
+ * @return the path of the query socket, and NULL if not passed or on wrong usage
+ */
+const char* spInitServerPath(int argc, char* argv[]);
+
 /* Pre-process data structure for nearest image search
  *
  * @param NOFptr - return parameter - pointer to array holding number of features per image
  * @param imageProc - an open imageProc object for processing images
  * @param config - configuration structure
  *
- * @return KD tree containing all features
+ * @return KD tree containing all features (held in one feature store), searching
+ * 		   with the search core specialized to the PCA dimension.
+ * 		   Depending on spKDTreeIndexMode the tree is loaded from / saved to the index file
+ * 		   With spFeaturesDB the features are loaded from / saved to one feature database
+ * 		   instead of a features file per image
+ * 		   With spPQNumOfSubspaces the tree has a product quantization index, searched instead of the tree
+ * 		   With spQuantizedFeatures the leaves of the tree are scanned by one byte codes of the features
  * 		   returns NULL on failure
  */
-SPKDTreeNode* spPreprocessing(sp::ImageProc imageProc, const SPConfig config);
+SPKDTree* spPreprocessing(sp::ImageProc& imageProc, const SPConfig config);
 
 /* Queries user for image and processes image features.
  *
@@ -49,6 +83,7 @@ SPKDTreeNode* spPreprocessing(sp::ImageProc imageProc, const SPConfig config);
 SPPoint** spQuery(int* queryNumOfFeatures, char* queryFilename, sp::ImageProc imageProc);
 
 /* Finds k (specified in the configuration file) most similar images to query image
+ * The features of the query image are searched for on spNumOfThreads threads (see closestImagesSearchParallel)
  *
  * @param similarImages - return parameter - array of size k containing the indices of
  * 						  the k closest images to the query image.
@@ -60,7 +95,7 @@ SPPoint** spQuery(int* queryNumOfFeatures, char* queryFilename, sp::ImageProc im
  * @return 0 on success, -1 otherwise
  */
 int spFindSimilarImages(int* similarImages, SPPoint** queryFeats, int queryNumOfFeatures,
-		SPKDTreeNode* featsTree, const SPConfig config);
+		SPKDTree* featsTree, const SPConfig config);
 
 /* Displays similar images results - has 2 modes:
  * 1. Minimal-Gui - graphicaly displays similar images. Press any key to move to next image
@@ -76,6 +111,37 @@ int spFindSimilarImages(int* similarImages, SPPoint** queryFeats, int queryNumOf
 int spShowResults(int* similarImages, char* imageFilename,
 		sp::ImageProc imageProc, const SPConfig config);
 
+/* Answers a batch of queries non-interactively - batch mode
+ * Reads query image paths from the queries file, one per line (empty lines are skipped),
+ * and extracts their features and finds their similar images on spNumOfThreads threads,
+ * SP_BATCH_QUERIES_PER_THREAD queries per thread at a time.
+ * Prints a line per query in the order of the queries file: the query path and the indices of
+ * its similar images (most similar first), tab separated. A query which could not be processed
+ * is printed with OUTPUTMSG_BATCH_FAILED instead of the indices.
+ *
+ * @param batchPath - path of the queries file, or BATCH_STDIN_STR for the standard input
+ * @param imageProc - an open imageProc object for processing images
+ * @param featsTree - KD tree containing all features
+ * @param config - configuration structure
+ *
+ * @return 0 on success, -1 otherwise (failed queries are not a failure)
+ */
+int spBatchQuery(const char* batchPath, sp::ImageProc& imageProc, SPKDTree* featsTree, const SPConfig config);
+
+/* Answers queries over a Unix domain socket until SIGINT or SIGTERM - server mode
+ * Listens on socketPath and answers the requests of the clients (see SPQueryServer) on
+ * spNumOfThreads worker threads, all searching featsTree. Query image paths are extracted
+ * with imageProc.
+ *
+ * @param socketPath - path of the query socket
+ * @param imageProc - an open imageProc object for processing images
+ * @param featsTree - KD tree containing all features
+ * @param config - configuration structure
+ *
+ * @return 0 when stopped by a signal, -1 otherwise
+ */
+int spServe(const char* socketPath, sp::ImageProc& imageProc, SPKDTree* featsTree, const SPConfig config);
+
 /* Frees memory of a 1D SPPoint array of size dim
  * Assumes dim is the correct dimension of the array
  *
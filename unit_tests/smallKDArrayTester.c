@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../SPPoint.h"
+#include "../SPFeatureStore.h"
 #include "../SPKDArray.h"
 #include "../SPLogger.h"
 
@@ -18,12 +19,13 @@ void printKDArray(SPKDArray* kdA){
         int j = 0;
         int n = spKDArrayGetSize(kdA);
         int d = spKDArrayGetDimension(kdA);
-        SPPoint** p = spKDArrayGetArray(kdA);
+        SPFeatureStore* store = spKDArrayGetStore(kdA);
+        int* p = spKDArrayGetRows(kdA);
         printf("There are %d points with %d dimensions:", n , d);
         for(i = 0; i < n ; i++){
             printf("\nPoint %d: ",i);
             for(j = 0; j<d;j++){
-                printf("%f , ", spPointGetAxisCoor(p[i], j));
+                printf("%f , ", spFeatureStoreGetAxisCoor(store, p[i], j));
             }
         }
         printf("\n\nIndices by dimensions:");
@@ -57,7 +59,10 @@ int main()
     coor[0] = 4; coor[1] = 4;  coor[2] = 0;
     dataCopy[6] = spPointCreate(coor, dim, index); index++;
 
-    SPKDArray* kdA = spKDArrayInit(dataCopy, size1);
+    SPFeatureStore* store = spFeatureStoreCreate(dim, size1);
+    for(int i = 0; i < size1; i++)
+        spFeatureStoreAppendPoint(store, dataCopy[i]);
+    SPKDArray* kdA = spKDArrayInit(store, NULL, size1);
     printf("kdA: ");
     printKDArray(kdA);
     SPKDArray** kdA1 = spKDArraySplit(kdA ,1);
@@ -107,6 +112,7 @@ int main()
     spLoggerDestroy();
     free(coor);
     destroyPointArray(dataCopy , size1);
+    spFeatureStoreDestroy(store);
     return 0;
 }
 
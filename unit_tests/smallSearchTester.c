@@ -53,9 +53,9 @@ int main()
     coor[0] = 10; coor[1] = 0;  coor[2] = 0;
     m[index][2] = spPointCreate(coor, dim, index);
 
-    SPKDTreeNode* tIncremental = fullKDTreeCreator(m , numOfImages, numOfFeatures, INCREMENTAL);
-    SPKDTreeNode* tRandom = fullKDTreeCreator(m , numOfImages, numOfFeatures, RANDOM);
-    SPKDTreeNode* tSpread = fullKDTreeCreator(m , numOfImages, numOfFeatures, MAX_SPREAD);
+    SPKDTree* tIncremental = fullKDTreeCreator(m , numOfImages, numOfFeatures, INCREMENTAL);
+    SPKDTree* tRandom = fullKDTreeCreator(m , numOfImages, numOfFeatures, RANDOM);
+    SPKDTree* tSpread = fullKDTreeCreator(m , numOfImages, numOfFeatures, MAX_SPREAD);
 
     for(int i = 0; i<numOfImages; i++){
         printf("\nImage %d:\n", i);
@@ -75,6 +75,14 @@ int main()
         printf("%d , ", closest1[i]);
 
     free (closest1);
+    for(int i = 0; i < numOfImages; i++){
+        for(int j = 0; j < numOfFeatures[i]; j++)
+            spPointDestroy(m[i][j]); // The trees hold copies of the points
+        free(m[i]);
+    }
+    free(m);
+    free(numOfFeatures);
+    free(coor);
     spKDTreeDestroy(tIncremental);
     spKDTreeDestroy(tRandom);
     spKDTreeDestroy(tSpread);
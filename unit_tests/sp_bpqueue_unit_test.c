@@ -0,0 +1,151 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+#include "../SPBPriorityQueue.h"
+
+#define BPQUEUE_TEST_OPERATIONS 2000
+
+static const SP_BPQUEUE_IMPL impls[] = {SP_BPQUEUE_SORTED, SP_BPQUEUE_HEAP};
+
+// Creates a queue of the given implementation
+static SPBPQueue* createQueue(int maxSize, SP_BPQUEUE_IMPL impl) {
+	spBPQueueSetImplementation(impl);
+	return spBPQueueCreate(maxSize);
+}
+
+// Checks both queues report the same size, lowest and highest elements
+static bool sameState(SPBPQueue* expected, SPBPQueue* actual) {
+	BPQueueElement e, a;
+	ASSERT_TRUE(spBPQueueSize(expected) == spBPQueueSize(actual));
+	ASSERT_TRUE(spBPQueueIsEmpty(expected) == spBPQueueIsEmpty(actual));
+	ASSERT_TRUE(spBPQueueIsFull(expected) == spBPQueueIsFull(actual));
+	ASSERT_TRUE(spBPQueueMaxValue(expected) == spBPQueueMaxValue(actual));
+	ASSERT_TRUE(spBPQueuePeekLast(expected, &e) == spBPQueuePeekLast(actual, &a));
+	if (!spBPQueueIsEmpty(expected))
+		ASSERT_TRUE(e.index == a.index && e.value == a.value);
+	ASSERT_TRUE(spBPQueueMinValue(expected) == spBPQueueMinValue(actual));
+	ASSERT_TRUE(spBPQueuePeek(expected, &e) == spBPQueuePeek(actual, &a));
+	if (!spBPQueueIsEmpty(expected))
+		ASSERT_TRUE(e.index == a.index && e.value == a.value);
+	return true;
+}
+
+// Elements leave the queue from the lowest, equal values from the lowest index
+static bool orderTest() {
+	for (int m=0; m<2; m++) {
+		SPBPQueue* bpq = createQueue(4, impls[m]);
+		BPQueueElement e;
+		ASSERT_TRUE(spBPQueueGetMaxSize(bpq) == 4);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 5, 2.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 1, 3.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 3, 2.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 2, 1.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueIsFull(bpq));
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 0, 3.0) == SP_BPQUEUE_SUCCESS); // replaces (1, 3.0)
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 4, 2.5) == SP_BPQUEUE_SUCCESS); // replaces (0, 3.0)
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 9, 2.5) == SP_BPQUEUE_SUCCESS); // ignored
+		ASSERT_TRUE(spBPQueueMaxValue(bpq) == 2.5);
+		int indices[] = {2, 3, 5, 4};
+		double values[] = {1.0, 2.0, 2.0, 2.5};
+		for (int i=0; i<4; i++) {
+			ASSERT_TRUE(spBPQueuePeek(bpq, &e) == SP_BPQUEUE_SUCCESS);
+			ASSERT_TRUE(e.index == indices[i] && e.value == values[i]);
+			ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_SUCCESS);
+		}
+		ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_EMPTY);
+		ASSERT_TRUE(spBPQueuePeek(bpq, &e) == SP_BPQUEUE_EMPTY);
+		spBPQueueDestroy(bpq);
+	}
+	return true;
+}
+
+// A queue of one element keeps the lowest element, equal values the lowest index
+static bool runningMinTest() {
+	for (int m=0; m<2; m++) {
+		SPBPQueue* bpq = createQueue(1, impls[m]);
+		BPQueueElement e;
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 4, 3.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 6, 5.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 2, 3.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueEnqueue(bpq, 3, 3.0) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueSize(bpq) == 1);
+		ASSERT_TRUE(spBPQueuePeek(bpq, &e) == SP_BPQUEUE_SUCCESS && e.index == 2 && e.value == 3.0);
+		ASSERT_TRUE(spBPQueueMaxValue(bpq) == 3.0 && spBPQueueMinValue(bpq) == 3.0);
+		ASSERT_TRUE(spBPQueueDequeue(bpq) == SP_BPQUEUE_SUCCESS);
+		ASSERT_TRUE(spBPQueueIsEmpty(bpq));
+		spBPQueueDestroy(bpq);
+	}
+	return true;
+}
+
+// The heap (and the small queues up to SP_BPQUEUE_SMALL_MAX elements) holds exactly the elements
+// the sorted array holds, through any sequence of operations
+static bool sameElementsTest() {
+	int sizes[] = {1, 2, 5, SP_BPQUEUE_SMALL_MAX, SP_BPQUEUE_SMALL_MAX + 1, 100};
+	srand(3);
+	for (int s=0; s<6; s++) {
+		SPBPQueue* expected = createQueue(sizes[s], SP_BPQUEUE_SORTED);
+		SPBPQueue* actual = createQueue(sizes[s], SP_BPQUEUE_HEAP);
+		for (int op=0; op<BPQUEUE_TEST_OPERATIONS; op++) {
+			int r = rand() % 10;
+			if (r == 0) {
+				ASSERT_TRUE(spBPQueueDequeue(expected) == spBPQueueDequeue(actual));
+			}
+			else if (r == 1 && op % 7 == 0) {
+				spBPQueueClear(expected);
+				spBPQueueClear(actual);
+			}
+			else { // few distinct values, so there are many ties
+				int index = rand() % 50;
+				double value = rand() % 20;
+				ASSERT_TRUE(spBPQueueEnqueue(expected, index, value) == spBPQueueEnqueue(actual, index, value));
+			}
+			if (op % 3 == 0)
+				ASSERT_TRUE(sameState(expected, actual));
+			else
+				ASSERT_TRUE(spBPQueueMaxValue(expected) == spBPQueueMaxValue(actual));
+		}
+		// a copy keeps the implementation and the elements
+		ASSERT_TRUE(spBPQueueSetImplementation(SP_BPQUEUE_SORTED));
+		SPBPQueue* copy = spBPQueueCopy(actual);
+		ASSERT_TRUE(copy != NULL);
+		for (int i=0; i<sizes[s]; i++) {
+			ASSERT_TRUE(spBPQueueEnqueue(expected, i, i % 3) == SP_BPQUEUE_SUCCESS);
+			ASSERT_TRUE(spBPQueueEnqueue(copy, i, i % 3) == SP_BPQUEUE_SUCCESS);
+		}
+		while (!spBPQueueIsEmpty(expected)) {
+			ASSERT_TRUE(sameState(expected, copy));
+			spBPQueueDequeue(expected);
+			spBPQueueDequeue(copy);
+		}
+		ASSERT_TRUE(spBPQueueIsEmpty(copy));
+		spBPQueueDestroy(copy);
+		spBPQueueDestroy(expected);
+		spBPQueueDestroy(actual);
+	}
+	return true;
+}
+
+// Invalid arguments
+static bool invalidArgsTest() {
+	BPQueueElement e;
+	ASSERT_TRUE(spBPQueueSetImplementation(SP_BPQUEUE_HEAP));
+	ASSERT_FALSE(spBPQueueSetImplementation((SP_BPQUEUE_IMPL) 7));
+	ASSERT_TRUE(spBPQueueGetImplementation() == SP_BPQUEUE_HEAP);
+	ASSERT_TRUE(spBPQueueCreate(0) == NULL);
+	ASSERT_TRUE(spBPQueueCopy(NULL) == NULL);
+	ASSERT_TRUE(spBPQueueEnqueue(NULL, 0, 0) == SP_BPQUEUE_INVALID_ARGUMENT);
+	ASSERT_TRUE(spBPQueueDequeue(NULL) == SP_BPQUEUE_INVALID_ARGUMENT);
+	ASSERT_TRUE(spBPQueuePeek(NULL, &e) == SP_BPQUEUE_INVALID_ARGUMENT);
+	ASSERT_TRUE(spBPQueuePeekLast(NULL, &e) == SP_BPQUEUE_INVALID_ARGUMENT);
+	return true;
+}
+
+int main() {
+	RUN_TEST(orderTest);
+	RUN_TEST(runningMinTest);
+	RUN_TEST(sameElementsTest);
+	RUN_TEST(invalidArgsTest);
+	return 0;
+}
@@ -42,6 +42,26 @@ bool spInitTest() {
 	// init with non existent config file
 	ASSERT_FALSE(spInitConfigFname(TEST_DIR "blaaa.config"));
 
+	// batch mode
+	char* batchArgs[5] = {NULL, (char*) "-b", (char*) BATCH_STDIN_STR, (char*) "-c", (char*) TEST_DIR "myconfig.config"};
+	ASSERT_TRUE(spInitBatchPath(5, batchArgs) && strcmp(spInitBatchPath(5, batchArgs), BATCH_STDIN_STR) == 0);
+	ASSERT_FALSE(spInitBatchPath(3, batchArgs + 2));
+	config = spInit(5, batchArgs);
+	ASSERT_TRUE(config);
+	spConfigDestroy(config);
+	spLoggerDestroy();
+	batchArgs[3] = (char*) "-b"; // "-b" twice
+	ASSERT_FALSE(spInitBatchPath(5, batchArgs));
+	ASSERT_FALSE(spInit(5, batchArgs));
+
+	// server mode, not together with batch mode
+	char* serverArgs[5] = {NULL, (char*) "-s", (char*) "cbir.sock", (char*) "-c", (char*) TEST_DIR "myconfig.config"};
+	ASSERT_TRUE(spInitServerPath(5, serverArgs) && strcmp(spInitServerPath(5, serverArgs), "cbir.sock") == 0);
+	ASSERT_FALSE(spInitBatchPath(5, serverArgs));
+	serverArgs[3] = (char*) "-b";
+	ASSERT_FALSE(spInitServerPath(5, serverArgs));
+	ASSERT_FALSE(spInit(5, serverArgs));
+
 	return true;
 }
 
@@ -50,7 +70,7 @@ bool preprocessingTest() {
 	SPConfig config = spInitConfigFname(TEST_DIR "myconfig.config");
 	ASSERT_TRUE(config);
 	sp::ImageProc imageProc(config);
-	SPKDTreeNode* featsTree = spPreprocessing(imageProc, config);
+	SPKDTree* featsTree = spPreprocessing(imageProc, config);
 	ASSERT_TRUE(featsTree);
 
 	// cleanup
@@ -89,7 +109,7 @@ bool basicCompleteTest() {
 	SPConfig config = spInitConfigFname(TEST_DIR "myconfig.config");
 	ASSERT_TRUE(config);
 	sp::ImageProc imageProc(config);
-	SPKDTreeNode* featsTree = spPreprocessing(imageProc, config);
+	SPKDTree* featsTree = spPreprocessing(imageProc, config);
 	ASSERT_TRUE(featsTree);
 
 	// get interesting parameters
@@ -126,7 +146,7 @@ bool selfImageTestConfigFname(const char* configFname) {
 	SPConfig config = spInitConfigFname(configFname);
 	ASSERT_TRUE(config);
 	sp::ImageProc imageProc(config);
-	SPKDTreeNode* featsTree = spPreprocessing(imageProc, config);
+	SPKDTree* featsTree = spPreprocessing(imageProc, config);
 	ASSERT_TRUE(featsTree);
 
 	// get interesting parameters
@@ -67,12 +67,26 @@ static bool vaildArgConfigTest() {
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgPCADimension1.config", SP_CONFIG_INVALID_INTEGER));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgPCADimension2.config", SP_CONFIG_INVALID_INTEGER));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKNN.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeLeafSize.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgNumOfThreads.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeMaxLeafChecks.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeNumOfTrees.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgPQNumOfSubspaces.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgPQRerankCandidates.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgQuantizedRerankCandidates.config", SP_CONFIG_INVALID_INTEGER));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgPCADescriptorCache.config", SP_CONFIG_INVALID_INTEGER));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgLoggerLevel1.config", SP_CONFIG_INVALID_INTEGER));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgLoggerLevel2.config", SP_CONFIG_INVALID_INTEGER));
 
 	// boolean arguments
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgExtractionMode.config", SP_CONFIG_INVALID_BOOL));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgMinimalGUI.config", SP_CONFIG_INVALID_BOOL));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeFlatLayout.config", SP_CONFIG_INVALID_BOOL));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeInPlaceBuild.config", SP_CONFIG_INVALID_BOOL));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgBPQueueHeap.config", SP_CONFIG_INVALID_BOOL));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgFeaturesDB.config", SP_CONFIG_INVALID_BOOL));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgFeaturesFloat32.config", SP_CONFIG_INVALID_BOOL));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgQuantizedFeatures.config", SP_CONFIG_INVALID_BOOL));
 
 	// string arguments
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgImagesSuffix1.config", SP_CONFIG_INVALID_STRING));
@@ -82,6 +96,8 @@ static bool vaildArgConfigTest() {
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgPCAFilename.config", SP_CONFIG_INVALID_STRING));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgLoggerFilename.config", SP_CONFIG_INVALID_STRING));
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeSplitMethod.config", SP_CONFIG_INVALID_STRING));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeIndexMode.config", SP_CONFIG_INVALID_STRING));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "invalidArgKDTreeIndexFilename.config", SP_CONFIG_INVALID_STRING));
 
 	//empty arguments
 	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "emptyArgNumOfFeatures.config", SP_CONFIG_INVALID_INTEGER));
@@ -99,6 +115,8 @@ static bool defaultValConfigTest() {
 
 	ASSERT_TRUE(spConfigIsExtractionMode(config, &msg) == SP_CONFIG_DEFAULT_EXTRACTION_MODE);
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsFeaturesDB(config, &msg) == SP_CONFIG_DEFAULT_FEATURES_DB);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(spConfigMinimalGui(config, &msg) == SP_CONFIG_DEFAULT_MINIMAL_GUI);
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(spConfigGetNumOfFeatures(config, &msg) == SP_CONFIG_DEFAULT_NUM_OF_FEATURES);
@@ -107,6 +125,34 @@ static bool defaultValConfigTest() {
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(spConfigGetPCADim(config, &msg) == SP_CONFIG_DEFAULT_PCA_DIMENSIONS);
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsKDTreeFlatLayout(config, &msg) == SP_CONFIG_DEFAULT_KD_TREE_FLAT_LAYOUT);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeLeafSize(config, &msg) == SP_CONFIG_DEFAULT_KD_TREE_LEAF_SIZE);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetNumOfThreads(config, &msg) == SP_CONFIG_DEFAULT_NUM_OF_THREADS);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeMaxLeafChecks(config, &msg) == SP_CONFIG_DEFAULT_KD_TREE_MAX_LEAF_CHECKS);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeNumOfTrees(config, &msg) == SP_CONFIG_DEFAULT_KD_TREE_NUM_OF_TREES);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetPQNumOfSubspaces(config, &msg) == SP_CONFIG_DEFAULT_PQ_NUM_OF_SUBSPACES);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetPQRerankCandidates(config, &msg) == SP_CONFIG_DEFAULT_PQ_RERANK_CANDIDATES);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsQuantizedFeatures(config, &msg) == SP_CONFIG_DEFAULT_QUANTIZED_FEATURES);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetQuantizedRerankCandidates(config, &msg) == SP_CONFIG_DEFAULT_QUANTIZED_RERANK_CANDIDATES);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetPCADescriptorCache(config, &msg) == SP_CONFIG_DEFAULT_PCA_DESCRIPTOR_CACHE);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsKDTreeInPlaceBuild(config, &msg) == SP_CONFIG_DEFAULT_KD_TREE_IN_PLACE_BUILD);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsBPQueueHeap(config, &msg) == SP_CONFIG_DEFAULT_BPQUEUE_HEAP);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsFeaturesFloat32(config, &msg) == SP_CONFIG_DEFAULT_FEATURES_FLOAT32);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeIndexMode(config, &msg) == SP_CONFIG_DEFAULT_KD_TREE_INDEX_MODE);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 
 	//SP_CONFIG_DEFAULT_KNN 1
 	//SP_CONFIG_DEFAULT_KD_TREE_SPLIT_METHOD MAX_SPREAD
@@ -117,6 +163,38 @@ static bool defaultValConfigTest() {
 	return true;
 }
 
+// The quantized features and the index file turn the flat layout on, unless it is turned off
+static bool flatLayoutConflictConfigTest() {
+	SP_CONFIG_MSG msg;
+	SPConfig config = spConfigCreate(CONFIG_TEST_DIR "impliedKDTreeFlatLayoutQuantized.config", &msg);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsQuantizedFeatures(config, &msg) == true);
+	ASSERT_TRUE(spConfigIsKDTreeFlatLayout(config, &msg) == true);
+	spConfigDestroy(config);
+	config = spConfigCreate(CONFIG_TEST_DIR "impliedKDTreeFlatLayoutIndex.config", &msg);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsKDTreeFlatLayout(config, &msg) == true);
+	spConfigDestroy(config);
+	config = spConfigCreate(CONFIG_TEST_DIR "basicConfigTest1.config", &msg);
+	ASSERT_TRUE(spConfigIsKDTreeFlatLayout(config, &msg) == false);
+	spConfigDestroy(config);
+
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "conflictKDTreeFlatLayoutQuantized.config", SP_CONFIG_CONFLICT));
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "conflictKDTreeFlatLayoutIndex.config", SP_CONFIG_CONFLICT));
+	return true;
+}
+
+// The quantized features are of a single tree
+static bool quantizedForestConflictConfigTest() {
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "conflictQuantizedForest.config", SP_CONFIG_CONFLICT));
+	return true;
+}
+
+static bool quantizedPQConflictConfigTest() {
+	ASSERT_TRUE(createConfigMsg(CONFIG_TEST_DIR "conflictQuantizedPQ.config", SP_CONFIG_CONFLICT));
+	return true;
+}
+
 static bool valueConfigTest() {
 	SP_CONFIG_MSG msg;
 	SPConfig config = spConfigCreate(CONFIG_TEST_DIR "testValueConfig.config",&msg);
@@ -124,8 +202,38 @@ static bool valueConfigTest() {
 
 	ASSERT_TRUE(spConfigIsExtractionMode(config, &msg) == false);
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsFeaturesDB(config, &msg) == true);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsFeaturesFloat32(config, &msg) == true);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(spConfigMinimalGui(config, &msg) == true);
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsKDTreeFlatLayout(config, &msg) == true);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeLeafSize(config, &msg) == 16);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetNumOfThreads(config, &msg) == 4);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeMaxLeafChecks(config, &msg) == 64);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeNumOfTrees(config, &msg) == 4);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetPQNumOfSubspaces(config, &msg) == 10);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetPQRerankCandidates(config, &msg) == 100);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsQuantizedFeatures(config, &msg) == false);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetQuantizedRerankCandidates(config, &msg) == 50);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetPCADescriptorCache(config, &msg) == 0);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsKDTreeInPlaceBuild(config, &msg) == true);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigIsBPQueueHeap(config, &msg) == false);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(spConfigGetKDTreeIndexMode(config, &msg) == KD_INDEX_LOAD);
+	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(spConfigGetNumOfFeatures(config, &msg) == 5);
 	ASSERT_TRUE(msg == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(spConfigGetPCADim(config, &msg) == 11);
@@ -142,6 +250,10 @@ static bool valueConfigTest() {
 	ASSERT_TRUE(strcmp(output,"./images/img3.feats") == 0);
 	ASSERT_TRUE(spConfigGetPCAPath(output, config) == SP_CONFIG_SUCCESS);
 	ASSERT_TRUE(strcmp(output,"./images/pssca.yml") == 0);
+	ASSERT_TRUE(spConfigGetFeaturesDBPath(output, config) == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(strcmp(output,"./images/all.db") == 0);
+	ASSERT_TRUE(spConfigGetKDTreeIndexPath(output, config) == SP_CONFIG_SUCCESS);
+	ASSERT_TRUE(strcmp(output,"./images/feats.index") == 0);
 
 	spConfigDestroy(config);
 	return true;
@@ -156,5 +268,8 @@ int main() {
 	RUN_TEST(vaildArgConfigTest);
 	RUN_TEST(defaultValConfigTest);
 	RUN_TEST(valueConfigTest);
+	RUN_TEST(flatLayoutConflictConfigTest);
+	RUN_TEST(quantizedForestConflictConfigTest);
+	RUN_TEST(quantizedPQConflictConfigTest);
 	return 0;
 }
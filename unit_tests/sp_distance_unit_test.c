@@ -0,0 +1,221 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+#include "../SPDistance.h"
+
+#define DISTANCE_TEST_MAX_DIM 32
+#define DISTANCE_TEST_ROWS 50
+#define DISTANCE_TEST_STRIDE 36 // larger than the padded length of every tested dimension
+#define DISTANCE_TEST_THREADS 4
+
+static const SP_DISTANCE_KERNEL kernels[] = {SP_DISTANCE_SCALAR, SP_DISTANCE_SSE2, SP_DISTANCE_AVX2, SP_DISTANCE_AVX512};
+static const int numOfKernels = sizeof(kernels) / sizeof(kernels[0]);
+
+// Fills dim random coordinates followed by zero padding up to length
+static void fillRandom(double* data, int dim, int length) {
+	for (int i=0; i<length; i++)
+		data[i] = i < dim ? ((double) rand() / RAND_MAX - 0.5) * 200 : 0;
+}
+
+// Threads calculating distances before any kernel was selected - the first distances select the
+// best kernel once, and every thread gets the exact distance
+static void* firstUseThread(void* arg) {
+	double a[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 0};
+	double b[12] = {0};
+	bool* passed = (bool*) arg;
+	*passed = true;
+	for (int i=0; i<1000; i++)
+		*passed = *passed && spDistanceL2Squared(a, b, 10) == 385;
+	return NULL;
+}
+
+static bool concurrentFirstUseTest() {
+	pthread_t threads[DISTANCE_TEST_THREADS];
+	bool passed[DISTANCE_TEST_THREADS];
+	for (int i=0; i<DISTANCE_TEST_THREADS; i++)
+		ASSERT_TRUE(pthread_create(threads + i, NULL, firstUseThread, passed + i) == 0);
+	for (int i=0; i<DISTANCE_TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	for (int i=0; i<DISTANCE_TEST_THREADS; i++)
+		ASSERT_TRUE(passed[i]);
+	ASSERT_TRUE(spDistanceGetKernel() == spDistanceInit());
+	return true;
+}
+
+// The scalar kernel is always available and selectable
+static bool basicDistanceTest() {
+	ASSERT_TRUE(spDistanceIsSupported(SP_DISTANCE_SCALAR));
+	ASSERT_TRUE(spDistanceIsSupported(spDistanceInit()));
+	ASSERT_TRUE(spDistanceSetKernel(SP_DISTANCE_SCALAR));
+	ASSERT_TRUE(spDistanceGetKernel() == SP_DISTANCE_SCALAR);
+	ASSERT_TRUE(spDistancePaddedDim(1) == 4);
+	ASSERT_TRUE(spDistancePaddedDim(12) == 12);
+	ASSERT_TRUE(spDistancePaddedDim(13) == 16);
+	return true;
+}
+
+// Distances with exact values
+static bool scalarDistanceTest() {
+	double a[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 0};
+	double b[12] = {1, 0, 3, 0, 5, 0, 7, 0, 9, 0, 0, 0};
+	ASSERT_TRUE(spDistanceSetKernel(SP_DISTANCE_SCALAR));
+	ASSERT_TRUE(spDistanceL2Squared(a, a, 10) == 0);
+	ASSERT_TRUE(spDistanceL2Squared(a, b, 10) == 4 + 16 + 36 + 64 + 100);
+	ASSERT_TRUE(spDistanceL2Squared(b, a, 10) == 4 + 16 + 36 + 64 + 100);
+	ASSERT_TRUE(spDistanceL2Squared(a, b, 1) == 0);
+	ASSERT_TRUE(spDistanceL2Squared(a, b, 2) == 4);
+	return true;
+}
+
+// Every supported kernel returns exactly the scalar result, in all the PCA dimensions and around them
+static bool kernelsBitExactTest() {
+	double a[DISTANCE_TEST_MAX_DIM], b[DISTANCE_TEST_MAX_DIM];
+	srand(2016);
+	for (int dim=1; dim<=DISTANCE_TEST_MAX_DIM; dim++) {
+		for (int t=0; t<20; t++) {
+			fillRandom(a, dim, spDistancePaddedDim(dim));
+			fillRandom(b, dim, spDistancePaddedDim(dim));
+			ASSERT_TRUE(spDistanceSetKernel(SP_DISTANCE_SCALAR));
+			double expected = spDistanceL2Squared(a, b, dim);
+			for (int k=0; k<numOfKernels; k++) {
+				if (!spDistanceSetKernel(kernels[k]))
+					continue;
+				ASSERT_TRUE(spDistanceGetKernel() == kernels[k]);
+				ASSERT_TRUE(spDistanceL2Squared(a, b, dim) == expected);
+			}
+		}
+	}
+	return true;
+}
+
+// The batched distances match the single distances for every supported kernel
+static bool batchDistanceTest() {
+	static double rows[DISTANCE_TEST_ROWS * DISTANCE_TEST_STRIDE];
+	double query[DISTANCE_TEST_MAX_DIM], distances[DISTANCE_TEST_ROWS];
+	srand(2017);
+	for (int dim=10; dim<=28; dim++) {
+		fillRandom(query, dim, spDistancePaddedDim(dim));
+		for (int i=0; i<DISTANCE_TEST_ROWS; i++)
+			fillRandom(rows + i * DISTANCE_TEST_STRIDE, dim, DISTANCE_TEST_STRIDE);
+		for (int k=0; k<numOfKernels; k++) {
+			if (!spDistanceSetKernel(kernels[k]))
+				continue;
+			spDistanceL2SquaredBatch(query, rows, DISTANCE_TEST_STRIDE, DISTANCE_TEST_ROWS, dim, distances);
+			for (int i=0; i<DISTANCE_TEST_ROWS; i++)
+				ASSERT_TRUE(distances[i] == spDistanceL2Squared(query, rows + i * DISTANCE_TEST_STRIDE, dim));
+		}
+	}
+	return true;
+}
+
+// Every supported float kernel returns exactly the scalar float result, close to the double distance
+static bool floatKernelsBitExactTest() {
+	double a[DISTANCE_TEST_MAX_DIM], b[DISTANCE_TEST_MAX_DIM];
+	float floatA[DISTANCE_TEST_MAX_DIM], floatB[DISTANCE_TEST_MAX_DIM];
+	srand(2018);
+	for (int dim=1; dim<=DISTANCE_TEST_MAX_DIM; dim++) {
+		for (int t=0; t<20; t++) {
+			fillRandom(a, dim, spDistancePaddedDim(dim));
+			fillRandom(b, dim, spDistancePaddedDim(dim));
+			for (int i=0; i<spDistancePaddedDim(dim); i++) {
+				floatA[i] = (float) a[i];
+				floatB[i] = (float) b[i];
+			}
+			ASSERT_TRUE(spDistanceSetKernel(SP_DISTANCE_SCALAR));
+			double expected = spDistanceL2SquaredFloat(floatA, floatB, dim);
+			double exact = spDistanceL2Squared(a, b, dim);
+			ASSERT_TRUE(expected - exact <= 1e-5 * exact && exact - expected <= 1e-5 * exact);
+			for (int k=0; k<numOfKernels; k++) {
+				if (!spDistanceSetKernel(kernels[k]))
+					continue;
+				ASSERT_TRUE(spDistanceL2SquaredFloat(floatA, floatB, dim) == expected);
+			}
+		}
+	}
+	return true;
+}
+
+// The batched float distances match the single float distances for every supported kernel
+static bool batchFloatDistanceTest() {
+	static double rows[DISTANCE_TEST_ROWS * DISTANCE_TEST_STRIDE];
+	static float floatRows[DISTANCE_TEST_ROWS * DISTANCE_TEST_STRIDE];
+	double query[DISTANCE_TEST_MAX_DIM], distances[DISTANCE_TEST_ROWS];
+	float floatQuery[DISTANCE_TEST_MAX_DIM];
+	srand(2019);
+	for (int dim=10; dim<=28; dim++) {
+		fillRandom(query, dim, spDistancePaddedDim(dim));
+		for (int i=0; i<spDistancePaddedDim(dim); i++)
+			floatQuery[i] = (float) query[i];
+		for (int i=0; i<DISTANCE_TEST_ROWS; i++)
+			fillRandom(rows + i * DISTANCE_TEST_STRIDE, dim, DISTANCE_TEST_STRIDE);
+		for (int i=0; i<DISTANCE_TEST_ROWS * DISTANCE_TEST_STRIDE; i++)
+			floatRows[i] = (float) rows[i];
+		for (int k=0; k<numOfKernels; k++) {
+			if (!spDistanceSetKernel(kernels[k]))
+				continue;
+			spDistanceL2SquaredBatchFloat(floatQuery, floatRows, DISTANCE_TEST_STRIDE, DISTANCE_TEST_ROWS, dim, distances);
+			for (int i=0; i<DISTANCE_TEST_ROWS; i++)
+				ASSERT_TRUE(distances[i] == spDistanceL2SquaredFloat(floatQuery, floatRows + i * DISTANCE_TEST_STRIDE, dim));
+		}
+	}
+	return true;
+}
+
+// Every supported code kernel returns the exact integer sum, also at the limits of the query range and the scales
+static bool codeKernelsExactTest() {
+	static unsigned char rows[DISTANCE_TEST_ROWS * SP_DISTANCE_CODE_MAX_DIM];
+	static short query[SP_DISTANCE_CODE_MAX_DIM];
+	static short scales[SP_DISTANCE_CODE_MAX_DIM];
+	double distances[DISTANCE_TEST_ROWS];
+	int dims[] = {1, 10, 15, 16, 17, 20, 28, 31, 32, 33, 48, SP_DISTANCE_CODE_MAX_DIM};
+	ASSERT_TRUE(spDistancePaddedCodeDim(1) == 16 && spDistancePaddedCodeDim(32) == 32 && spDistancePaddedCodeDim(33) == 48);
+	srand(2020);
+	for (unsigned int d=0; d<sizeof(dims) / sizeof(dims[0]); d++) {
+		int dim = dims[d], stride = spDistancePaddedCodeDim(dim);
+		for (int i=0; i<stride; i++) { // random codes over the whole query range (its maximum for dimension 1)
+			query[i] = i >= dim ? 0 : d == 0 ? SP_DISTANCE_CODE_QUERY_MAX :
+					SP_DISTANCE_CODE_QUERY_MIN + rand() % (SP_DISTANCE_CODE_QUERY_MAX - SP_DISTANCE_CODE_QUERY_MIN + 1);
+			scales[i] = rand() % (SP_DISTANCE_CODE_SCALE_MAX + 1); // the padding too, its codes are zeros
+		}
+		for (int r=0; r<DISTANCE_TEST_ROWS; r++)
+			for (int i=0; i<stride; i++)
+				rows[r * stride + i] = i >= dim ? 0 : r == 0 ? 0 : r == 1 ? 255 : rand() % 256;
+		if (dim == SP_DISTANCE_CODE_MAX_DIM) { // the largest sums - rows 0 and 1 differ by 4095 and -4088
+			for (int i=0; i<dim; i++) {
+				query[i] = i % 2 == 0 ? SP_DISTANCE_CODE_QUERY_MAX : SP_DISTANCE_CODE_QUERY_MIN;
+				scales[i] = SP_DISTANCE_CODE_SCALE_MAX;
+				rows[i] = i % 2 == 0 ? 0 : 255;
+				rows[stride + i] = i % 2 == 0 ? 0 : 255;
+			}
+		}
+		for (int k=0; k<numOfKernels; k++) {
+			if (!spDistanceSetKernel(kernels[k]))
+				continue;
+			spDistanceL2SquaredBatchCode(query, scales, rows, stride, DISTANCE_TEST_ROWS, dim, distances);
+			for (int r=0; r<DISTANCE_TEST_ROWS; r++) {
+				long long expected = 0;
+				for (int i=0; i<dim; i++) {
+					long long diff = query[i] - scales[i] * rows[r * stride + i];
+					expected += diff * diff;
+				}
+				ASSERT_TRUE(distances[r] == (double) expected);
+			}
+		}
+	}
+	return true;
+}
+
+int main() {
+	RUN_TEST(concurrentFirstUseTest); // before anything selects a kernel
+	printf("Best distance kernel: %s\n", spDistanceKernelName(spDistanceInit()));
+	RUN_TEST(basicDistanceTest);
+	RUN_TEST(scalarDistanceTest);
+	RUN_TEST(kernelsBitExactTest);
+	RUN_TEST(batchDistanceTest);
+	RUN_TEST(floatKernelsBitExactTest);
+	RUN_TEST(batchFloatDistanceTest);
+	RUN_TEST(codeKernelsExactTest);
+	return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+#include "../SPPoint.h"
+#include "../SPFeatureStore.h"
+#include "../SPFeaturesFile.h"
+
+#define FEATS_TEST_FILE "./unit_tests/sp_features_file_test.feats"
+#define FEATS_TEST_DIM 13
+#define FEATS_TEST_NUM 40
+#define FEATS_TEST_INDEX 7
+#define FEATS_TEST_DB "./unit_tests/sp_features_file_test.db"
+#define FEATS_TEST_DB_ROWS 5000 // more than one chunk
+#define FEATS_TEST_DB_IMAGES 37
+
+// Random features of dimension FEATS_TEST_DIM
+static SPPoint** randomFeatures() {
+	SPPoint** feats = (SPPoint**) malloc(FEATS_TEST_NUM * sizeof(SPPoint*));
+	double data[FEATS_TEST_DIM];
+	for (int i=0; i<FEATS_TEST_NUM; i++) {
+		for (int j=0; j<FEATS_TEST_DIM; j++)
+			data[j] = ((double) rand() / RAND_MAX - 0.5) * 200;
+		feats[i] = spPointCreate(data, FEATS_TEST_DIM, FEATS_TEST_INDEX);
+	}
+	return feats;
+}
+
+static void destroyFeatures(SPPoint** feats) {
+	for (int i=0; i<FEATS_TEST_NUM; i++)
+		spPointDestroy(feats[i]);
+	free(feats);
+}
+
+// Writes text to the test file
+static bool writeTestFile(const char* text) {
+	FILE* file = fopen(FEATS_TEST_FILE, "w");
+	ASSERT_TRUE(file != NULL);
+	fputs(text, file);
+	fclose(file);
+	return true;
+}
+
+// Checks a file is not read, and appends nothing after the rows already in the store
+static bool loadFails(int dim) {
+	SPFeatureStore* store = spFeatureStoreCreate(dim, 0);
+	ASSERT_TRUE(spFeaturesFileLoad(FEATS_TEST_FILE, store, FEATS_TEST_INDEX) == -1);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// Binary files keep the exact coordinates (or their float32 rounding)
+static bool binaryRoundTripTest() {
+	SP_FEATURES_DTYPE dtypes[] = {SP_FEATURES_FLOAT64, SP_FEATURES_FLOAT32};
+	srand(1);
+	SPPoint** feats = randomFeatures();
+	for (int t=0; t<2; t++) {
+		ASSERT_TRUE(spFeaturesFileSave(FEATS_TEST_FILE, feats, FEATS_TEST_NUM, FEATS_TEST_DIM, dtypes[t]) == 0);
+		SPFeatureStore* store = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+		ASSERT_TRUE(spFeaturesFileLoad(FEATS_TEST_FILE, store, FEATS_TEST_INDEX) == FEATS_TEST_NUM);
+		ASSERT_TRUE(spFeaturesFileLoad(FEATS_TEST_FILE, store, FEATS_TEST_INDEX + 1) == FEATS_TEST_NUM);
+		ASSERT_TRUE(spFeatureStoreGetSize(store) == 2 * FEATS_TEST_NUM);
+		for (int i=0; i<2 * FEATS_TEST_NUM; i++) {
+			ASSERT_TRUE(spFeatureStoreGetIndex(store, i) == FEATS_TEST_INDEX + i / FEATS_TEST_NUM);
+			for (int j=0; j<FEATS_TEST_DIM; j++) {
+				double expected = spPointGetAxisCoor(feats[i % FEATS_TEST_NUM], j);
+				if (dtypes[t] == SP_FEATURES_FLOAT32)
+					expected = (float) expected;
+				ASSERT_TRUE(spFeatureStoreGetAxisCoor(store, i, j) == expected);
+			}
+		}
+		spFeatureStoreDestroy(store);
+	}
+
+	// no features
+	ASSERT_TRUE(spFeaturesFileSave(FEATS_TEST_FILE, NULL, 0, FEATS_TEST_DIM, SP_FEATURES_FLOAT64) == 0);
+	SPFeatureStore* store = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+	ASSERT_TRUE(spFeaturesFileLoad(FEATS_TEST_FILE, store, FEATS_TEST_INDEX) == 0);
+	ASSERT_TRUE(spFeatureStoreGetSize(store) == 0);
+	spFeatureStoreDestroy(store);
+
+	// invalid arguments
+	ASSERT_TRUE(spFeaturesFileSave(FEATS_TEST_FILE, feats, FEATS_TEST_NUM, FEATS_TEST_DIM + 1, SP_FEATURES_FLOAT64) == -1);
+	ASSERT_TRUE(spFeaturesFileSave(NULL, feats, FEATS_TEST_NUM, FEATS_TEST_DIM, SP_FEATURES_FLOAT64) == -1);
+	ASSERT_TRUE(spFeaturesFileLoad(NULL, store, FEATS_TEST_INDEX) == -1);
+	destroyFeatures(feats);
+	remove(FEATS_TEST_FILE);
+	return true;
+}
+
+// Binary files with a wrong dimension or size are not read
+static bool binaryInvalidTest() {
+	srand(2);
+	SPPoint** feats = randomFeatures();
+	ASSERT_TRUE(spFeaturesFileSave(FEATS_TEST_FILE, feats, FEATS_TEST_NUM, FEATS_TEST_DIM, SP_FEATURES_FLOAT64) == 0);
+	ASSERT_TRUE(loadFails(FEATS_TEST_DIM - 1));
+
+	// trailing data
+	FILE* file = fopen(FEATS_TEST_FILE, "ab");
+	ASSERT_TRUE(file != NULL);
+	fputc(0, file);
+	fclose(file);
+	ASSERT_TRUE(loadFails(FEATS_TEST_DIM));
+
+	// truncated
+	ASSERT_TRUE(spFeaturesFileSave(FEATS_TEST_FILE, feats, FEATS_TEST_NUM - 1, FEATS_TEST_DIM, SP_FEATURES_FLOAT64) == 0);
+	file = fopen(FEATS_TEST_FILE, "r+b");
+	ASSERT_TRUE(file != NULL);
+	unsigned char count[4] = {FEATS_TEST_NUM, 0, 0, 0}; // claims one more feature than written
+	ASSERT_TRUE(fseek(file, 20, SEEK_SET) == 0);
+	ASSERT_TRUE(fwrite(count, 1, 4, file) == 4);
+	fclose(file);
+	ASSERT_TRUE(loadFails(FEATS_TEST_DIM));
+
+	ASSERT_TRUE(remove(FEATS_TEST_FILE) == 0);
+	ASSERT_TRUE(loadFails(FEATS_TEST_DIM)); // missing
+	destroyFeatures(feats);
+	return true;
+}
+
+// The old text format is still read
+static bool textFallbackTest() {
+	ASSERT_TRUE(writeTestFile("2\n1.500000 -2.000000 3.250000 \n4.000000 5.000000 -6.125000 \n"));
+	SPFeatureStore* store = spFeatureStoreCreate(3, 0);
+	ASSERT_TRUE(spFeaturesFileLoad(FEATS_TEST_FILE, store, FEATS_TEST_INDEX) == 2);
+	ASSERT_TRUE(spFeatureStoreGetSize(store) == 2);
+	ASSERT_TRUE(spFeatureStoreGetAxisCoor(store, 0, 0) == 1.5 && spFeatureStoreGetAxisCoor(store, 0, 2) == 3.25);
+	ASSERT_TRUE(spFeatureStoreGetAxisCoor(store, 1, 1) == 5 && spFeatureStoreGetAxisCoor(store, 1, 2) == -6.125);
+	ASSERT_TRUE(spFeatureStoreGetIndex(store, 1) == FEATS_TEST_INDEX);
+	spFeatureStoreDestroy(store);
+
+	ASSERT_TRUE(writeTestFile("2\n1 2 3\n4 5\n")); // not enough values
+	ASSERT_TRUE(loadFails(3));
+	ASSERT_TRUE(writeTestFile("1\n1 2 3\n4 5 6\n")); // too many values
+	ASSERT_TRUE(loadFails(3));
+	ASSERT_TRUE(writeTestFile("features\n")); // no count
+	ASSERT_TRUE(loadFails(3));
+	remove(FEATS_TEST_FILE);
+	return true;
+}
+
+// The database holds the rows grouped by image, in their order within every image
+static bool databaseRoundTripTest() {
+	SP_FEATURES_DTYPE dtypes[] = {SP_FEATURES_FLOAT64, SP_FEATURES_FLOAT32};
+	double data[FEATS_TEST_DIM];
+	srand(3);
+	SPFeatureStore* store = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+	for (int i=0; i<FEATS_TEST_DB_ROWS; i++) {
+		for (int j=0; j<FEATS_TEST_DIM; j++)
+			data[j] = ((double) rand() / RAND_MAX - 0.5) * 200;
+		spFeatureStoreAppend(store, data, (rand() % FEATS_TEST_DB_IMAGES) & ~1); // odd images have no features
+	}
+	for (int t=0; t<2; t++) {
+		ASSERT_TRUE(spFeaturesFileSaveDB(FEATS_TEST_DB, store, FEATS_TEST_DB_IMAGES, dtypes[t]) == 0);
+		SPFeatureStore* loaded = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+		ASSERT_TRUE(spFeaturesFileLoadDB(FEATS_TEST_DB, loaded, FEATS_TEST_DB_IMAGES) == FEATS_TEST_DB_ROWS);
+		ASSERT_TRUE(spFeatureStoreGetSize(loaded) == FEATS_TEST_DB_ROWS);
+		int row = 0;
+		for (int image=0; image<FEATS_TEST_DB_IMAGES; image++) {
+			for (int i=0; i<FEATS_TEST_DB_ROWS; i++) {
+				if (spFeatureStoreGetIndex(store, i) != image)
+					continue;
+				ASSERT_TRUE(spFeatureStoreGetIndex(loaded, row) == image);
+				for (int j=0; j<FEATS_TEST_DIM; j++) {
+					double expected = spFeatureStoreGetAxisCoor(store, i, j);
+					if (dtypes[t] == SP_FEATURES_FLOAT32)
+						expected = (float) expected;
+					ASSERT_TRUE(spFeatureStoreGetAxisCoor(loaded, row, j) == expected);
+				}
+				row++;
+			}
+		}
+		spFeatureStoreDestroy(loaded);
+	}
+
+	// a database of another number of images or dimension is not read
+	SPFeatureStore* loaded = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+	ASSERT_TRUE(spFeaturesFileLoadDB(FEATS_TEST_DB, loaded, FEATS_TEST_DB_IMAGES + 1) == -1);
+	spFeatureStoreDestroy(loaded);
+	loaded = spFeatureStoreCreate(FEATS_TEST_DIM + 1, 0);
+	ASSERT_TRUE(spFeaturesFileLoadDB(FEATS_TEST_DB, loaded, FEATS_TEST_DB_IMAGES) == -1);
+	spFeatureStoreDestroy(loaded);
+
+	// nor a damaged one
+	FILE* file = fopen(FEATS_TEST_DB, "r+b");
+	ASSERT_TRUE(file != NULL);
+	unsigned char count[8] = {0, 0, 1, 0, 0, 0, 0, 0}; // more features than the offset table covers
+	ASSERT_TRUE(fseek(file, 24, SEEK_SET) == 0);
+	ASSERT_TRUE(fwrite(count, 1, 8, file) == 8);
+	fclose(file);
+	loaded = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+	ASSERT_TRUE(spFeaturesFileLoadDB(FEATS_TEST_DB, loaded, FEATS_TEST_DB_IMAGES) == -1);
+	spFeatureStoreDestroy(loaded);
+	remove(FEATS_TEST_DB);
+
+	// image indices out of range are not saved
+	ASSERT_TRUE(spFeaturesFileSaveDB(FEATS_TEST_DB, store, FEATS_TEST_DB_IMAGES - 1, SP_FEATURES_FLOAT64) == -1);
+	ASSERT_TRUE(fopen(FEATS_TEST_DB, "rb") == NULL);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// A float32 store holds the coordinates rounded to float, and its database loads back into stores of both precisions
+static bool floatStoreDatabaseTest() {
+	SP_FEATURE_STORE_PRECISION precisions[] = {SP_FEATURE_STORE_FLOAT64, SP_FEATURE_STORE_FLOAT32};
+	double data[FEATS_TEST_DIM];
+	srand(4);
+	SPFeatureStore* store = spFeatureStoreCreateWithPrecision(FEATS_TEST_DIM, 0, SP_FEATURE_STORE_FLOAT32);
+	SPFeatureStore* doubleStore = spFeatureStoreCreate(FEATS_TEST_DIM, 0);
+	for (int i=0; i<FEATS_TEST_DB_ROWS; i++) {
+		for (int j=0; j<FEATS_TEST_DIM; j++)
+			data[j] = ((double) rand() / RAND_MAX - 0.5) * 200;
+		int index = rand() % FEATS_TEST_DB_IMAGES;
+		spFeatureStoreAppend(store, data, index);
+		spFeatureStoreAppend(doubleStore, data, index);
+	}
+	ASSERT_TRUE(spFeatureStoreGetPrecision(store) == SP_FEATURE_STORE_FLOAT32);
+	ASSERT_TRUE(spFeatureStoreGetData(store) == NULL && spFeatureStoreGetDataFloat(store) != NULL);
+	for (int i=0; i<FEATS_TEST_DB_ROWS; i++) {
+		spFeatureStoreCopyRow(store, i, data);
+		const float* row = spFeatureStoreGetRowFloat(store, i);
+		for (int j=0; j<FEATS_TEST_DIM; j++)
+			ASSERT_TRUE(data[j] == row[j] && row[j] == (float) spFeatureStoreGetAxisCoor(doubleStore, i, j));
+		for (int j=FEATS_TEST_DIM; j<spFeatureStoreGetStride(store); j++)
+			ASSERT_TRUE(row[j] == 0);
+	}
+
+	ASSERT_TRUE(spFeaturesFileSaveDB(FEATS_TEST_DB, store, FEATS_TEST_DB_IMAGES, SP_FEATURES_FLOAT32) == 0);
+	for (int p=0; p<2; p++) {
+		SPFeatureStore* loaded = spFeatureStoreCreateWithPrecision(FEATS_TEST_DIM, 0, precisions[p]);
+		ASSERT_TRUE(spFeaturesFileLoadDB(FEATS_TEST_DB, loaded, FEATS_TEST_DB_IMAGES) == FEATS_TEST_DB_ROWS);
+		int row = 0;
+		for (int image=0; image<FEATS_TEST_DB_IMAGES; image++) {
+			for (int i=0; i<FEATS_TEST_DB_ROWS; i++) {
+				if (spFeatureStoreGetIndex(store, i) != image)
+					continue;
+				ASSERT_TRUE(spFeatureStoreGetIndex(loaded, row) == image);
+				for (int j=0; j<FEATS_TEST_DIM; j++)
+					ASSERT_TRUE(spFeatureStoreGetAxisCoor(loaded, row, j) == spFeatureStoreGetAxisCoor(store, i, j));
+				row++;
+			}
+		}
+		spFeatureStoreDestroy(loaded);
+	}
+	remove(FEATS_TEST_DB);
+	ASSERT_TRUE(spFeatureStoreCreateWithPrecision(FEATS_TEST_DIM, 0, (SP_FEATURE_STORE_PRECISION) 2) == NULL);
+	spFeatureStoreDestroy(store);
+	spFeatureStoreDestroy(doubleStore);
+	return true;
+}
+
+int main() {
+	RUN_TEST(binaryRoundTripTest);
+	RUN_TEST(binaryInvalidTest);
+	RUN_TEST(textFallbackTest);
+	RUN_TEST(databaseRoundTripTest);
+	RUN_TEST(floatStoreDatabaseTest);
+	return 0;
+}
@@ -0,0 +1,1183 @@
+#include <cstdlib>
+#include <cstdio>
+#include <limits>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+extern "C" {
+#include "../SPKDTreeSearch.h"
+#include "../SPKDTreeInternal.h"
+#include "../SPKDTreeIndex.h"
+#include "../SPParallel.h"
+#include "../SPConsts.h"
+}
+
+#define SEARCH_TEST_POINTS 300
+#define SEARCH_TEST_QUERIES 30
+#define SEARCH_TEST_IMAGES 10
+#define SEARCH_TEST_KNN 5
+#define SEARCH_TEST_THREADS 4
+#define SEARCH_TEST_INDEX "./unit_tests/sp_kdtree_search_test.index"
+
+static double randomCoor() {
+	return ((double) rand() / RAND_MAX - 0.5) * 200;
+}
+
+// Random store of dimension dim
+static SPFeatureStore* randomStore(int dim) {
+	SPFeatureStore* store = spFeatureStoreCreate(dim, SEARCH_TEST_POINTS);
+	double data[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX];
+	for (int i=0; i<SEARCH_TEST_POINTS; i++) {
+		for (int j=0; j<dim; j++)
+			data[j] = randomCoor();
+		spFeatureStoreAppend(store, data, rand() % SEARCH_TEST_IMAGES);
+	}
+	return store;
+}
+
+// Random store of dimension dim with few distinct coordinates, so many points have equal coordinates
+static SPFeatureStore* coarseStore(int dim) {
+	SPFeatureStore* store = spFeatureStoreCreate(dim, SEARCH_TEST_POINTS);
+	double data[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX];
+	for (int i=0; i<SEARCH_TEST_POINTS; i++) {
+		for (int j=0; j<dim; j++)
+			data[j] = rand() % 4;
+		spFeatureStoreAppend(store, data, rand() % SEARCH_TEST_IMAGES);
+	}
+	return store;
+}
+
+// Random store of dimension dim whose coordinates are rounded to float, held in the given precision
+static SPFeatureStore* roundedStore(int dim, SP_FEATURE_STORE_PRECISION precision) {
+	SPFeatureStore* store = spFeatureStoreCreateWithPrecision(dim, SEARCH_TEST_POINTS, precision);
+	double data[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX];
+	for (int i=0; i<SEARCH_TEST_POINTS; i++) {
+		for (int j=0; j<dim; j++)
+			data[j] = (float) randomCoor();
+		spFeatureStoreAppend(store, data, rand() % SEARCH_TEST_IMAGES);
+	}
+	return store;
+}
+
+// Random tree of dimension dim
+static SPKDTree* randomTree(int dim, KD_METHOD splitMethod) {
+	return spKDTreeInit(splitMethod, randomStore(dim));
+}
+
+// Random point of dimension dim
+static SPPoint* randomPoint(int dim) {
+	double data[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX];
+	for (int j=0; j<dim; j++)
+		data[j] = randomCoor();
+	return spPointCreate(data, dim, 0);
+}
+
+// Checks both queues hold exactly the same elements, and empties them
+static bool sameQueues(SPBPQueue* expected, SPBPQueue* actual) {
+	BPQueueElement e, a;
+	ASSERT_TRUE(spBPQueueSize(expected) == spBPQueueSize(actual));
+	while (!spBPQueueIsEmpty(expected)) {
+		spBPQueuePeek(expected, &e);
+		spBPQueuePeek(actual, &a);
+		ASSERT_TRUE(e.index == a.index && e.value == a.value);
+		spBPQueueDequeue(expected);
+		spBPQueueDequeue(actual);
+	}
+	return true;
+}
+
+// Dimensions without a specialization use the generic search
+static bool searchSelectionTest() {
+	ASSERT_TRUE(spKDTreeSearchForDim(SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN - 1) == kNearestNeighboursTree);
+	ASSERT_TRUE(spKDTreeSearchForDim(SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX + 1) == kNearestNeighboursTree);
+	for (int dim=SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN; dim<=SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX; dim++)
+		ASSERT_TRUE(spKDTreeSearchForDim(dim) != kNearestNeighboursTree);
+	return true;
+}
+
+// The specialized search rejects points and trees of other dimensions
+static bool searchDimensionMismatchTest() {
+	srand(1);
+	SPKDTree* tree = randomTree(12, MAX_SPREAD);
+	SPPoint* point = randomPoint(13);
+	SPBPQueue* bpq = spBPQueueCreate(SEARCH_TEST_KNN);
+	ASSERT_TRUE(spKDTreeSearchForDim(12)(bpq, tree, point) == -1);
+	ASSERT_TRUE(spKDTreeSearchForDim(13)(bpq, tree, point) == -1);
+	ASSERT_TRUE(spKDTreeSearchForDim(12)(NULL, tree, point) == -1);
+	ASSERT_TRUE(spBPQueueIsEmpty(bpq));
+	spBPQueueDestroy(bpq);
+	spPointDestroy(point);
+	spKDTreeDestroy(tree);
+	return true;
+}
+
+// The specialized search finds exactly what kNearestNeighboursTree finds, for all dimensions and split methods
+static bool searchSameResultsTest() {
+	KD_METHOD methods[] = {RANDOM, MAX_SPREAD, INCREMENTAL};
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(2);
+	for (int dim=SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN; dim<=SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX; dim++) {
+		for (int m=0; m<3; m++) {
+			SPKDTree* tree = randomTree(dim, methods[m]);
+			ASSERT_TRUE(tree != NULL);
+			for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+				SPPoint* point = randomPoint(dim);
+				ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+				ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, tree, point) == 1);
+				ASSERT_TRUE(sameQueues(expected, actual));
+				spPointDestroy(point);
+			}
+			spKDTreeDestroy(tree);
+		}
+	}
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// The search before the bound of a subtree was kept along the recursion - minDistanceSquared at every node
+static void fullBoundRecursion(SPBPQueue* bpq, SPFeatureStore* store, SPKDTreeNode* curr, SPPoint* point,
+		const double* query, double* highLimit, double* lowLimit, int* highLimitUse, int* lowLimitUse) {
+	if (curr->row != -1) {
+		spBPQueueEnqueue(bpq, spFeatureStoreGetIndex(store, curr->row), spFeatureStoreL2SquaredDistance(store, curr->row, query));
+		return;
+	}
+	int i = curr->dim - 1;
+	double limit = highLimit[i];
+	int limitUse = highLimitUse[i];
+	highLimit[i] = curr->val;
+	highLimitUse[i] = 1;
+	if (!spBPQueueIsFull(bpq) || minDistanceSquared(point, highLimit, lowLimit, highLimitUse, lowLimitUse) < spBPQueueMaxValue(bpq))
+		fullBoundRecursion(bpq, store, curr->left, point, query, highLimit, lowLimit, highLimitUse, lowLimitUse);
+	highLimit[i] = limit;
+	highLimitUse[i] = limitUse;
+	limit = lowLimit[i];
+	limitUse = lowLimitUse[i];
+	lowLimit[i] = curr->val;
+	lowLimitUse[i] = 1;
+	if (!spBPQueueIsFull(bpq) || minDistanceSquared(point, highLimit, lowLimit, highLimitUse, lowLimitUse) < spBPQueueMaxValue(bpq))
+		fullBoundRecursion(bpq, store, curr->right, point, query, highLimit, lowLimit, highLimitUse, lowLimitUse);
+	lowLimit[i] = limit;
+	lowLimitUse[i] = limitUse;
+}
+
+// Keeping the bound along the recursion skips exactly the subtrees minDistanceSquared skips, also with many ties
+static bool boundSameResultsTest() {
+	int dims[] = {3, 10, 28};
+	double query[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX + SP_DISTANCE_PAD] = {0};
+	double highLimit[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX], lowLimit[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX];
+	int highLimitUse[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX], lowLimitUse[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX];
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(17);
+	for (int d=0; d<3; d++) {
+		for (int coarse=0; coarse<2; coarse++) {
+			SPKDTree* tree = spKDTreeInit(MAX_SPREAD, coarse ? coarseStore(dims[d]) : randomStore(dims[d]));
+			ASSERT_TRUE(tree != NULL);
+			for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+				for (int i=0; i<dims[d]; i++) {
+					query[i] = coarse ? rand() % 4 : randomCoor();
+					highLimitUse[i] = 0;
+					lowLimitUse[i] = 0;
+				}
+				SPPoint* point = spPointCreate(query, dims[d], 0);
+				spBPQueueClear(expected);
+				fullBoundRecursion(expected, tree->store, tree->root, point, query, highLimit, lowLimit, highLimitUse, lowLimitUse);
+				SPBPQueue* copy = spBPQueueCopy(expected);
+				ASSERT_TRUE(kNearestNeighboursTree(actual, tree, point) == 1);
+				ASSERT_TRUE(sameQueues(expected, actual));
+				ASSERT_TRUE(spKDTreeSearchForDim(dims[d])(actual, tree, point) == 1);
+				ASSERT_TRUE(sameQueues(copy, actual));
+				spBPQueueDestroy(copy);
+				spPointDestroy(point);
+			}
+			spKDTreeDestroy(tree);
+		}
+	}
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// The flat layout finds exactly what the pointer layout finds, with any leaf size, with both search cores
+static bool flatSameResultsTest() {
+	KD_METHOD methods[] = {RANDOM, MAX_SPREAD, INCREMENTAL};
+	int dims[] = {3, 10, 20, 28};
+	int leafSizes[] = {1, 2, 8, SEARCH_TEST_POINTS};
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	for (int d=0; d<4; d++) {
+		for (int m=0; m<3; m++) {
+			for (int l=0; l<4; l++) {
+				srand(4 + d);
+				SPKDTree* tree = randomTree(dims[d], methods[m]);
+				srand(4 + d);
+				SPKDTree* flatTree = spKDTreeInitFlat(methods[m], randomStore(dims[d]), leafSizes[l]);
+				ASSERT_TRUE(tree != NULL && flatTree != NULL);
+				for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+					SPPoint* point = randomPoint(dims[d]);
+					ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+					ASSERT_TRUE(kNearestNeighboursTree(actual, flatTree, point) == 1);
+					ASSERT_TRUE(sameQueues(expected, actual));
+					if (spKDTreeSearchForDim(dims[d]) != kNearestNeighboursTree) {
+						ASSERT_TRUE(kNearestNeighboursTree(expected, flatTree, point) == 1);
+						ASSERT_TRUE(spKDTreeSearchForDim(dims[d])(actual, flatTree, point) == 1);
+						ASSERT_TRUE(sameQueues(expected, actual));
+					}
+					spPointDestroy(point);
+				}
+				spKDTreeDestroy(tree);
+				spKDTreeDestroy(flatTree);
+			}
+		}
+	}
+	ASSERT_TRUE(spKDTreeInitFlat(MAX_SPREAD, randomStore(10), 0) == NULL);
+	ASSERT_TRUE(spKDTreeInitFlat(MAX_SPREAD, NULL, 1) == NULL);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// Checks every point of the flat subtree of node curr is inside the limits of the subtree, and counts the points
+static bool flatSubtreeInLimits(SPKDTree* tree, int curr, double* lowLimit, double* highLimit, int* numOfPoints) {
+	const SPKDTreeFlatNode* node = tree->nodes + curr;
+	int dim = spFeatureStoreGetDimension(tree->store);
+	if (node->dim < 0) {
+		ASSERT_TRUE(-node->dim <= tree->leafSize);
+		for (int row=node->child; row<node->child - node->dim; row++)
+			for (int i=0; i<dim; i++)
+				ASSERT_TRUE(lowLimit[i] <= spFeatureStoreGetAxisCoor(tree->store, row, i) &&
+						spFeatureStoreGetAxisCoor(tree->store, row, i) <= highLimit[i]);
+		*numOfPoints += -node->dim;
+		return true;
+	}
+	double savedLimit = highLimit[node->dim - 1];
+	highLimit[node->dim - 1] = node->val;
+	ASSERT_TRUE(flatSubtreeInLimits(tree, node->child, lowLimit, highLimit, numOfPoints));
+	highLimit[node->dim - 1] = savedLimit;
+	savedLimit = lowLimit[node->dim - 1];
+	lowLimit[node->dim - 1] = node->val;
+	ASSERT_TRUE(flatSubtreeInLimits(tree, node->child + 1, lowLimit, highLimit, numOfPoints));
+	lowLimit[node->dim - 1] = savedLimit;
+	return true;
+}
+
+// The flat build reorders the store so every leaf bucket is a range of consecutive rows inside the limits of its leaf,
+// and keeps every point with its image index
+static bool flatBucketRowsTest() {
+	const int dim = 12, leafSize = 8;
+	double lowLimit[dim], highLimit[dim], data[dim];
+	bool seen[SEARCH_TEST_POINTS] = {false};
+	SPFeatureStore* store = spFeatureStoreCreate(dim, SEARCH_TEST_POINTS);
+	srand(5);
+	for (int row=0; row<SEARCH_TEST_POINTS; row++) { // coordinate 0 is the original row id
+		data[0] = row;
+		for (int j=1; j<dim; j++)
+			data[j] = randomCoor();
+		spFeatureStoreAppend(store, data, row % SEARCH_TEST_IMAGES);
+	}
+	SPKDTree* tree = spKDTreeInitFlat(MAX_SPREAD, store, leafSize);
+	ASSERT_TRUE(tree != NULL && spKDTreeGetStore(tree) == store);
+	ASSERT_TRUE(spFeatureStoreGetSize(store) == SEARCH_TEST_POINTS);
+	for (int row=0; row<SEARCH_TEST_POINTS; row++) {
+		int original = (int) spFeatureStoreGetAxisCoor(store, row, 0);
+		ASSERT_FALSE(seen[original]);
+		seen[original] = true;
+		ASSERT_TRUE(spFeatureStoreGetIndex(store, row) == original % SEARCH_TEST_IMAGES);
+	}
+	for (int i=0; i<dim; i++) {
+		lowLimit[i] = -std::numeric_limits<double>::infinity();
+		highLimit[i] = std::numeric_limits<double>::infinity();
+	}
+	int numOfPoints = 0;
+	ASSERT_TRUE(flatSubtreeInLimits(tree, 0, lowLimit, highLimit, &numOfPoints));
+	ASSERT_TRUE(numOfPoints == SEARCH_TEST_POINTS);
+	spKDTreeDestroy(tree);
+	return true;
+}
+
+// The parallel build gives exactly the tree (nodes and store order) of the serial build, with any number of threads
+static bool flatParallelSameTreeTest() {
+	KD_METHOD methods[] = {RANDOM, MAX_SPREAD, INCREMENTAL};
+	int numOfThreads[] = {2, 3, 8, 64};
+	const int dim = 16, leafSize = 4;
+	for (int m=0; m<3; m++) {
+		for (int t=0; t<4; t++) {
+			srand(6 + m);
+			SPKDTree* tree = spKDTreeInitFlat(methods[m], randomStore(dim), leafSize);
+			srand(6 + m);
+			SPKDTree* parallelTree = spKDTreeInitFlatParallel(methods[m], randomStore(dim), leafSize, numOfThreads[t]);
+			ASSERT_TRUE(tree != NULL && parallelTree != NULL);
+			ASSERT_TRUE(tree->numOfNodes == parallelTree->numOfNodes);
+			for (int i=0; i<tree->numOfNodes; i++)
+				ASSERT_TRUE(tree->nodes[i].val == parallelTree->nodes[i].val && tree->nodes[i].dim == parallelTree->nodes[i].dim &&
+						tree->nodes[i].child == parallelTree->nodes[i].child);
+			for (int row=0; row<SEARCH_TEST_POINTS; row++) {
+				ASSERT_TRUE(spFeatureStoreGetIndex(tree->store, row) == spFeatureStoreGetIndex(parallelTree->store, row));
+				for (int i=0; i<dim; i++)
+					ASSERT_TRUE(spFeatureStoreGetAxisCoor(tree->store, row, i) == spFeatureStoreGetAxisCoor(parallelTree->store, row, i));
+			}
+			spKDTreeDestroy(tree);
+			spKDTreeDestroy(parallelTree);
+		}
+	}
+	return true;
+}
+
+// The in-place build gives the nodes of the kd array build, with the same points in the same order in every bucket
+static bool inPlaceSameTreeTest() {
+	KD_METHOD methods[] = {RANDOM, MAX_SPREAD, INCREMENTAL};
+	int leafSizes[] = {1, 3, 8};
+	int numOfThreads[] = {1, 4};
+	const int dim = 14;
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	for (int coarse=0; coarse<2; coarse++) {
+		for (int m=0; m<3; m++) {
+			for (int l=0; l<3; l++) {
+				for (int t=0; t<2; t++) {
+					srand(7 + m);
+					SPKDTree* tree = spKDTreeInitFlat(methods[m], coarse ? coarseStore(dim) : randomStore(dim), leafSizes[l]);
+					srand(7 + m);
+					SPKDTree* inPlaceTree = spKDTreeInitFlatInPlace(methods[m], coarse ? coarseStore(dim) : randomStore(dim),
+							leafSizes[l], numOfThreads[t]);
+					ASSERT_TRUE(tree != NULL && inPlaceTree != NULL);
+					ASSERT_TRUE(tree->numOfNodes == inPlaceTree->numOfNodes);
+					for (int i=0; i<tree->numOfNodes; i++) {
+						const SPKDTreeFlatNode* node = tree->nodes + i;
+						const SPKDTreeFlatNode* inPlaceNode = inPlaceTree->nodes + i;
+						ASSERT_TRUE(node->dim == inPlaceNode->dim && node->val == inPlaceNode->val);
+						if (node->dim > 0) {
+							ASSERT_TRUE(node->child == inPlaceNode->child);
+							continue;
+						}
+						for (int j=0; j<-node->dim; j++) {
+							ASSERT_TRUE(spFeatureStoreGetIndex(tree->store, node->child + j) ==
+									spFeatureStoreGetIndex(inPlaceTree->store, inPlaceNode->child + j));
+							for (int k=0; k<dim; k++)
+								ASSERT_TRUE(spFeatureStoreGetAxisCoor(tree->store, node->child + j, k) ==
+										spFeatureStoreGetAxisCoor(inPlaceTree->store, inPlaceNode->child + j, k));
+						}
+					}
+					for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+						SPPoint* point = randomPoint(dim);
+						ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+						ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, inPlaceTree, point) == 1);
+						ASSERT_TRUE(sameQueues(expected, actual));
+						spPointDestroy(point);
+					}
+					spKDTreeDestroy(tree);
+					spKDTreeDestroy(inPlaceTree);
+				}
+			}
+		}
+	}
+	ASSERT_TRUE(spKDTreeInitFlatInPlace(MAX_SPREAD, randomStore(10), 0, 1) == NULL);
+	ASSERT_TRUE(spKDTreeInitFlatInPlace(MAX_SPREAD, NULL, 1, 1) == NULL);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// A saved index loads back into the same tree, and is only loaded with the parameters it was saved with
+static bool indexSaveLoadTest() {
+	const int dim = 12, leafSize = 4;
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(11);
+	SPKDTree* tree = spKDTreeInitFlat(INCREMENTAL, randomStore(dim), leafSize);
+	ASSERT_TRUE(spKDTreeIndexSave(tree, SEARCH_TEST_INDEX, INCREMENTAL, SEARCH_TEST_IMAGES) == 0);
+	SPKDTree* loaded = spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, INCREMENTAL, leafSize, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(loaded != NULL);
+	ASSERT_TRUE(loaded->numOfNodes == tree->numOfNodes && loaded->leafSize == tree->leafSize);
+	for (int i=0; i<tree->numOfNodes; i++) {
+		ASSERT_TRUE(loaded->nodes[i].dim == tree->nodes[i].dim && loaded->nodes[i].val == tree->nodes[i].val &&
+				loaded->nodes[i].child == tree->nodes[i].child);
+	}
+	ASSERT_TRUE(spFeatureStoreGetSize(loaded->store) == SEARCH_TEST_POINTS);
+	for (int i=0; i<SEARCH_TEST_POINTS; i++) {
+		ASSERT_TRUE(spFeatureStoreGetIndex(loaded->store, i) == spFeatureStoreGetIndex(tree->store, i));
+		for (int k=0; k<dim; k++)
+			ASSERT_TRUE(spFeatureStoreGetAxisCoor(loaded->store, i, k) == spFeatureStoreGetAxisCoor(tree->store, i, k));
+	}
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		SPPoint* point = randomPoint(dim);
+		ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+		ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, loaded, point) == 1);
+		ASSERT_TRUE(sameQueues(expected, actual));
+		spPointDestroy(point);
+	}
+	// a view can't be changed
+	ASSERT_TRUE(spFeatureStoreAppend(loaded->store, spFeatureStoreGetRow(tree->store, 0), 0) == -1);
+	spKDTreeDestroy(loaded);
+
+	// a header not matching the configuration
+	ASSERT_TRUE(spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim + 1, INCREMENTAL, leafSize, SEARCH_TEST_IMAGES) == NULL);
+	ASSERT_TRUE(spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, MAX_SPREAD, leafSize, SEARCH_TEST_IMAGES) == NULL);
+	ASSERT_TRUE(spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, INCREMENTAL, leafSize + 1, SEARCH_TEST_IMAGES) == NULL);
+	ASSERT_TRUE(spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, INCREMENTAL, leafSize, SEARCH_TEST_IMAGES + 1) == NULL);
+
+	// a damaged node array
+	FILE* file = fopen(SEARCH_TEST_INDEX, "r+b");
+	ASSERT_TRUE(file != NULL);
+	SPKDTreeFlatNode node = tree->nodes[0];
+	node.child = 0; // the root as its own child
+	ASSERT_TRUE(fseek(file, SP_FEATURE_STORE_ALIGNMENT * 2, SEEK_SET) == 0);
+	ASSERT_TRUE(fwrite(&node, sizeof(node), 1, file) == 1);
+	fclose(file);
+	ASSERT_TRUE(spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, INCREMENTAL, leafSize, SEARCH_TEST_IMAGES) == NULL);
+	remove(SEARCH_TEST_INDEX);
+	ASSERT_TRUE(spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, INCREMENTAL, leafSize, SEARCH_TEST_IMAGES) == NULL);
+
+	// only the flat layout is saved
+	SPKDTree* pointerTree = randomTree(dim, INCREMENTAL);
+	ASSERT_TRUE(spKDTreeIndexSave(pointerTree, SEARCH_TEST_INDEX, INCREMENTAL, SEARCH_TEST_IMAGES) == -1);
+	spKDTreeDestroy(pointerTree);
+	spKDTreeDestroy(tree);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// closestImagesSearch returns the same images with the specialized search set on the tree
+static bool closestImagesSameResultsTest() {
+	const int dim = 20, numOfSimilarImages = 3;
+	int expected[numOfSimilarImages], actual[numOfSimilarImages];
+	SPPoint* query[SEARCH_TEST_QUERIES];
+	srand(3);
+	SPKDTree* tree = randomTree(dim, MAX_SPREAD);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++)
+		query[q] = randomPoint(dim);
+	ASSERT_TRUE(closestImagesSearch(SEARCH_TEST_KNN, expected, numOfSimilarImages, query,
+			SEARCH_TEST_QUERIES, tree, SEARCH_TEST_IMAGES) == 1);
+	spKDTreeSetSearch(tree, spKDTreeSearchForDim(dim));
+	ASSERT_TRUE(closestImagesSearch(SEARCH_TEST_KNN, actual, numOfSimilarImages, query,
+			SEARCH_TEST_QUERIES, tree, SEARCH_TEST_IMAGES) == 1);
+	for (int i=0; i<numOfSimilarImages; i++)
+		ASSERT_TRUE(expected[i] == actual[i]);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++)
+		spPointDestroy(query[q]);
+	spKDTreeDestroy(tree);
+	return true;
+}
+
+// A search context gives the same results as the searches allocating their memory, for the generic and the
+// specialized search, in both layouts, when it is reused for many queries
+static bool contextSameResultsTest() {
+	const int dim = 14, numOfSimilarImages = 3;
+	int expected[numOfSimilarImages], actual[numOfSimilarImages];
+	SPBPQueue* bpq = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(4);
+	SPKDTree* trees[] = {randomTree(dim, MAX_SPREAD), spKDTreeInitFlat(MAX_SPREAD, randomStore(dim), 4)};
+	for (int t=0; t<2; t++) {
+		for (int s=0; s<2; s++) {
+			spKDTreeSetSearch(trees[t], s == 0 ? kNearestNeighboursTree : spKDTreeSearchForDim(dim));
+			SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(trees[t], SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+			ASSERT_TRUE(context != NULL);
+			for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+				SPPoint* query[2] = {randomPoint(dim), randomPoint(dim)};
+				ASSERT_TRUE(kNearestNeighboursTree(bpq, trees[t], query[0]) == 1);
+				ASSERT_TRUE(kNearestNeighboursContext(context, query[0]) == 1);
+				ASSERT_TRUE(sameQueues(bpq, spKDTreeSearchContextGetQueue(context)));
+				ASSERT_TRUE(closestImagesSearch(SEARCH_TEST_KNN, expected, numOfSimilarImages, query, 2,
+						trees[t], SEARCH_TEST_IMAGES) == 1);
+				ASSERT_TRUE(closestImagesSearchContext(context, actual, numOfSimilarImages, query, 2) == 1);
+				for (int i=0; i<numOfSimilarImages; i++)
+					ASSERT_TRUE(expected[i] == actual[i]);
+				spPointDestroy(query[0]);
+				spPointDestroy(query[1]);
+			}
+			spKDTreeSearchContextDestroy(context);
+		}
+	}
+
+	// invalid arguments
+	SPPoint* point = randomPoint(dim + 1);
+	SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(trees[0], SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(kNearestNeighboursContext(context, point) == -1);
+	ASSERT_TRUE(kNearestNeighboursContext(NULL, point) == -1);
+	ASSERT_TRUE(closestImagesSearchContext(context, actual, SEARCH_TEST_IMAGES + 1, &point, 1) == -1);
+	ASSERT_TRUE(spKDTreeSearchContextCreate(NULL, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES) == NULL);
+	ASSERT_TRUE(spKDTreeSearchContextCreate(trees[0], 0, SEARCH_TEST_IMAGES) == NULL);
+	ASSERT_TRUE(spKDTreeSearchContextGetQueue(NULL) == NULL);
+	spKDTreeSearchContextDestroy(context);
+	spKDTreeSearchContextDestroy(NULL);
+	spPointDestroy(point);
+	spKDTreeDestroy(trees[0]);
+	spKDTreeDestroy(trees[1]);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+// The queries of contextThreadsTest, answered by spParallelForThreads tasks
+struct ContextThreadsQueries {
+	SPKDTreeSearchContext* contexts[SEARCH_TEST_THREADS];
+	SPPoint* query[SEARCH_TEST_QUERIES];
+	int closest[SEARCH_TEST_QUERIES];
+};
+
+static void contextThreadsTask(void* arg, int task, int thread) {
+	ContextThreadsQueries* queries = (ContextThreadsQueries*) arg;
+	closestImagesSearchContext(queries->contexts[thread], queries->closest + task, 1, queries->query + task, 1);
+}
+
+// Threads searching the same tree at once, each with its own context, find what one thread finds
+static bool contextThreadsTest() {
+	const int dim = 16;
+	ContextThreadsQueries queries;
+	srand(5);
+	SPKDTree* tree = spKDTreeInitFlat(MAX_SPREAD, randomStore(dim), 4);
+	spKDTreeSetSearch(tree, spKDTreeSearchForDim(dim));
+	for (int t=0; t<SEARCH_TEST_THREADS; t++)
+		queries.contexts[t] = spKDTreeSearchContextCreate(tree, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++)
+		queries.query[q] = randomPoint(dim);
+	ASSERT_TRUE(spParallelForThreads(SEARCH_TEST_QUERIES, SEARCH_TEST_THREADS, contextThreadsTask, &queries) == 0);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		int expected;
+		ASSERT_TRUE(closestImagesSearch(SEARCH_TEST_KNN, &expected, 1, queries.query + q, 1, tree, SEARCH_TEST_IMAGES) == 1);
+		ASSERT_TRUE(queries.closest[q] == expected);
+		spPointDestroy(queries.query[q]);
+	}
+	for (int t=0; t<SEARCH_TEST_THREADS; t++)
+		spKDTreeSearchContextDestroy(queries.contexts[t]);
+	spKDTreeDestroy(tree);
+	return true;
+}
+
+// Searching the features of a query on several threads ranks the images exactly as one thread does,
+// ties included (the coarse store has many equal votes)
+static bool parallelSameResultsTest() {
+	const int dim = 12, numOfFeatures = 45;
+	int expected[SEARCH_TEST_IMAGES], actual[SEARCH_TEST_IMAGES];
+	SPPoint* query[numOfFeatures];
+	srand(6);
+	SPKDTree* trees[] = {spKDTreeInitFlat(MAX_SPREAD, randomStore(dim), 4), spKDTreeInitFlat(MAX_SPREAD, coarseStore(dim), 4)};
+	for (int t=0; t<2; t++) {
+		for (int q=0; q<numOfFeatures; q++)
+			query[q] = randomPoint(dim);
+		for (int numOfSimilarImages=1; numOfSimilarImages<=SEARCH_TEST_IMAGES; numOfSimilarImages+=3) {
+			ASSERT_TRUE(closestImagesSearch(SEARCH_TEST_KNN, expected, numOfSimilarImages, query, numOfFeatures,
+					trees[t], SEARCH_TEST_IMAGES) == 1);
+			for (int numOfThreads=1; numOfThreads<=SEARCH_TEST_THREADS + 4; numOfThreads++) {
+				ASSERT_TRUE(closestImagesSearchParallel(SEARCH_TEST_KNN, actual, numOfSimilarImages, query, numOfFeatures,
+						trees[t], SEARCH_TEST_IMAGES, numOfThreads) == 1);
+				for (int i=0; i<numOfSimilarImages; i++)
+					ASSERT_TRUE(expected[i] == actual[i]);
+			}
+		}
+		for (int q=0; q<numOfFeatures; q++)
+			spPointDestroy(query[q]);
+	}
+
+	// contexts of different trees or queue sizes are rejected
+	SPKDTreeSearchContext* contexts[] = {spKDTreeSearchContextCreate(trees[0], SEARCH_TEST_KNN, SEARCH_TEST_IMAGES),
+			spKDTreeSearchContextCreate(trees[1], SEARCH_TEST_KNN, SEARCH_TEST_IMAGES),
+			spKDTreeSearchContextCreate(trees[0], SEARCH_TEST_KNN + 1, SEARCH_TEST_IMAGES)};
+	for (int q=0; q<numOfFeatures; q++)
+		query[q] = randomPoint(dim);
+	ASSERT_TRUE(closestImagesSearchContexts(contexts, 2, actual, 1, query, numOfFeatures) == -1);
+	spKDTreeSearchContextDestroy(contexts[1]);
+	contexts[1] = contexts[2];
+	ASSERT_TRUE(closestImagesSearchContexts(contexts, 2, actual, 1, query, numOfFeatures) == -1);
+	ASSERT_TRUE(closestImagesSearchContexts(contexts, 1, actual, 1, query, numOfFeatures) == 1);
+	ASSERT_TRUE(closestImagesSearchParallel(SEARCH_TEST_KNN, actual, 1, query, numOfFeatures, trees[0], SEARCH_TEST_IMAGES, 0) == -1);
+	for (int q=0; q<numOfFeatures; q++)
+		spPointDestroy(query[q]);
+	spKDTreeSearchContextDestroy(contexts[0]);
+	spKDTreeSearchContextDestroy(contexts[2]);
+	spKDTreeDestroy(trees[0]);
+	spKDTreeDestroy(trees[1]);
+	return true;
+}
+
+// Empties a queue into an array of its values, from the lowest, and returns their number
+static int queueValues(SPBPQueue* bpq, double* values) {
+	int size = 0;
+	for (; !spBPQueueIsEmpty(bpq); size++) {
+		values[size] = spBPQueueMinValue(bpq);
+		spBPQueueDequeue(bpq);
+	}
+	return size;
+}
+
+// The best-bin-first search finds points no closer than the closest points, finds more of the closest points
+// as more leaves are checked, and a search context of a tree with leaf checks finds what it finds
+static bool bestBinFirstTest() {
+	const int dim = 20, numOfChecks = 4;
+	int checks[numOfChecks] = {1, 4, 16, SEARCH_TEST_POINTS};
+	int found[numOfChecks] = {0}, numOfClosest = 0;
+	double expected[SEARCH_TEST_KNN], actual[SEARCH_TEST_KNN];
+	SPBPQueue* bpq = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(7);
+	SPKDTree* trees[] = {randomTree(dim, MAX_SPREAD), spKDTreeInitFlat(MAX_SPREAD, randomStore(dim), 4)};
+	for (int t=0; t<2; t++) {
+		for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+			SPPoint* point = randomPoint(dim);
+			ASSERT_TRUE(kNearestNeighboursTree(bpq, trees[t], point) == 1);
+			numOfClosest += queueValues(bpq, expected);
+			for (int c=0; c<numOfChecks; c++) {
+				ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, trees[t], point, checks[c]) == 1);
+				if (c == 0) // one leaf
+					ASSERT_TRUE(spBPQueueSize(bpq) <= trees[t]->leafSize);
+				int size = queueValues(bpq, actual);
+				for (int i=0; i<size; i++) {
+					ASSERT_TRUE(actual[i] >= expected[i]);
+					found[c] += actual[i] == expected[i];
+				}
+			}
+			spPointDestroy(point);
+		}
+	}
+	for (int c=1; c<numOfChecks; c++)
+		ASSERT_TRUE(found[c] >= found[c-1]);
+	ASSERT_TRUE(found[numOfChecks-1] * 10 >= numOfClosest * 9);
+
+	// the contexts created after the leaf checks are set search best-bin-first
+	for (int t=0; t<2; t++) {
+		SPKDTreeSearchContext* exactContext = spKDTreeSearchContextCreate(trees[t], SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+		spKDTreeSetMaxLeafChecks(trees[t], 4);
+		SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(trees[t], SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+		ASSERT_TRUE(context != NULL);
+		for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+			SPPoint* point = randomPoint(dim);
+			ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, trees[t], point, 4) == 1);
+			ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+			ASSERT_TRUE(sameQueues(bpq, spKDTreeSearchContextGetQueue(context)));
+			ASSERT_TRUE(kNearestNeighboursTree(bpq, trees[t], point) == 1);
+			ASSERT_TRUE(kNearestNeighboursContext(exactContext, point) == 1);
+			ASSERT_TRUE(sameQueues(bpq, spKDTreeSearchContextGetQueue(exactContext)));
+			spPointDestroy(point);
+		}
+		SPKDTreeSearchContext* contexts[] = {context, exactContext}; // contexts of different leaf checks are rejected
+		SPPoint* query[2 * SP_SEARCH_FEATURES_PER_TASK];
+		int closest;
+		for (int q=0; q<2 * SP_SEARCH_FEATURES_PER_TASK; q++)
+			query[q] = randomPoint(dim);
+		ASSERT_TRUE(closestImagesSearchContexts(contexts, 2, &closest, 1, query, 2 * SP_SEARCH_FEATURES_PER_TASK) == -1);
+		for (int q=0; q<2 * SP_SEARCH_FEATURES_PER_TASK; q++)
+			spPointDestroy(query[q]);
+		spKDTreeSetMaxLeafChecks(trees[t], 0);
+		spKDTreeSearchContextDestroy(context);
+		spKDTreeSearchContextDestroy(exactContext);
+	}
+
+	// invalid arguments
+	SPPoint* point = randomPoint(dim + 1);
+	ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, trees[0], point, 4) == -1);
+	spPointDestroy(point);
+	point = randomPoint(dim);
+	ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, trees[0], point, 0) == -1);
+	ASSERT_TRUE(kNearestNeighboursBestBinFirst(NULL, trees[0], point, 4) == -1);
+	ASSERT_TRUE(spBPQueueIsEmpty(bpq));
+	spPointDestroy(point);
+	spKDTreeDestroy(trees[0]);
+	spKDTreeDestroy(trees[1]);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+// Checks that the buckets of every tree of a forest hold every row of the store once
+static bool forestBucketRowsTest(SPKDTree* forest) {
+	int size = spFeatureStoreGetSize(forest->store);
+	int* count = (int*) calloc(size, sizeof(int));
+	for (int t=0; t<forest->numOfTrees; t++) {
+		for (int i=0; i<size; i++)
+			count[i] = 0;
+		for (int i=t*forest->numOfNodes; i<(t+1)*forest->numOfNodes; i++) {
+			SPKDTreeFlatNode* node = &forest->nodes[i];
+			if (node->dim > 0) {
+				ASSERT_TRUE(node->child > i && node->child + 1 < (t+1)*forest->numOfNodes);
+				continue;
+			}
+			ASSERT_TRUE(-node->dim <= forest->leafSize);
+			ASSERT_TRUE(node->child >= t*size && node->child - node->dim <= (t+1)*size);
+			for (int j=node->child; j<node->child - node->dim; j++)
+				count[forest->rows[j]]++;
+		}
+		for (int i=0; i<size; i++)
+			ASSERT_TRUE(count[i] == 1);
+	}
+	for (int i=0; i<size; i++) // the rows of the first tree follow the store
+		ASSERT_TRUE(forest->rows[i] == i);
+	free(count);
+	return true;
+}
+
+static bool forestTest() {
+	const int dim = 20, leafSize = 4, numOfTrees = 4, numOfChecks = 3;
+	int checks[numOfChecks] = {1, 4, 16};
+	int foundTree[numOfChecks] = {0}, foundForest[numOfChecks] = {0};
+	double expected[SEARCH_TEST_KNN], actual[SEARCH_TEST_KNN];
+	SPBPQueue* bpq = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(13);
+	SPFeatureStore* store = randomStore(dim);
+	srand(13);
+	SPKDTree* tree = spKDTreeInitFlatInPlace(MAX_SPREAD, randomStore(dim), leafSize, 1);
+	SPKDTree* forest = spKDTreeInitForest(store, leafSize, numOfTrees, SEARCH_TEST_THREADS);
+	ASSERT_TRUE(tree != NULL && forest != NULL && forest->numOfTrees == numOfTrees);
+	ASSERT_TRUE(forestBucketRowsTest(forest));
+
+	// the exact searches search the first tree, best-bin-first finds more of the closest points in the forest
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		SPPoint* point = randomPoint(dim);
+		ASSERT_TRUE(kNearestNeighboursTree(bpq, tree, point) == 1);
+		queueValues(bpq, expected);
+		ASSERT_TRUE(kNearestNeighboursTree(bpq, forest, point) == 1);
+		ASSERT_TRUE(queueValues(bpq, actual) == SEARCH_TEST_KNN);
+		for (int i=0; i<SEARCH_TEST_KNN; i++)
+			ASSERT_TRUE(actual[i] == expected[i]);
+		ASSERT_TRUE(spKDTreeSearchForDim(dim)(bpq, forest, point) == 1);
+		ASSERT_TRUE(queueValues(bpq, actual) == SEARCH_TEST_KNN);
+		for (int i=0; i<SEARCH_TEST_KNN; i++)
+			ASSERT_TRUE(actual[i] == expected[i]);
+		for (int c=0; c<numOfChecks; c++) {
+			ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, tree, point, checks[c]) == 1);
+			int size = queueValues(bpq, actual);
+			for (int i=0; i<size; i++)
+				foundTree[c] += actual[i] == expected[i];
+			ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, forest, point, checks[c]) == 1);
+			// a row found by several trees is in the queue once (the random points are at distinct distances)
+			BPQueueElement elements[SEARCH_TEST_KNN];
+			SPBPQueue* copy = spBPQueueCopy(bpq);
+			for (size=0; !spBPQueueIsEmpty(copy); size++) {
+				spBPQueuePeek(copy, &elements[size]);
+				spBPQueueDequeue(copy);
+				for (int j=0; j<size; j++)
+					ASSERT_TRUE(elements[j].index != elements[size].index || elements[j].value != elements[size].value);
+			}
+			spBPQueueDestroy(copy);
+			size = queueValues(bpq, actual);
+			for (int i=0; i<size; i++) {
+				ASSERT_TRUE(actual[i] >= expected[i]);
+				foundForest[c] += actual[i] == expected[i];
+			}
+		}
+		spPointDestroy(point);
+	}
+	for (int c=1; c<numOfChecks; c++)
+		ASSERT_TRUE(foundForest[c] >= foundForest[c-1]);
+	ASSERT_TRUE(foundForest[numOfChecks-1] >= foundTree[numOfChecks-1]);
+
+	// the contexts of a forest search it like kNearestNeighboursBestBinFirst
+	spKDTreeSetMaxLeafChecks(forest, 4);
+	SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(forest, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		SPPoint* point = randomPoint(dim);
+		ASSERT_TRUE(kNearestNeighboursBestBinFirst(bpq, forest, point, 4) == 1);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		ASSERT_TRUE(sameQueues(bpq, spKDTreeSearchContextGetQueue(context)));
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+
+	// a forest is not saved to the index file
+	ASSERT_TRUE(spKDTreeIndexSave(forest, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == -1);
+	remove(SEARCH_TEST_INDEX);
+
+	// invalid arguments
+	ASSERT_TRUE(spKDTreeInitForest(NULL, leafSize, numOfTrees, 1) == NULL);
+	ASSERT_TRUE(spKDTreeInitForest(randomStore(dim), 0, numOfTrees, 1) == NULL);
+	ASSERT_TRUE(spKDTreeInitForest(randomStore(dim), leafSize, 0, 1) == NULL);
+	spKDTreeDestroy(forest);
+	spKDTreeDestroy(tree);
+	spBPQueueDestroy(bpq);
+	return true;
+}
+
+// A float32 store holds the coordinates rounded to float: its trees split like the trees of a float64 store of the
+// rounded coordinates, and the searches of its trees find the closest points by the float distances
+static bool floatStoreTest() {
+	const int leafSize = 4;
+	double query[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX + SP_DISTANCE_PAD];
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	for (int dim=SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MIN; dim<=SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX; dim++) {
+		srand(14 + dim);
+		SPKDTree* tree = spKDTreeInitFlatInPlace(MAX_SPREAD, roundedStore(dim, SP_FEATURE_STORE_FLOAT64), leafSize, 1);
+		srand(14 + dim);
+		SPKDTree* floatTree = spKDTreeInitFlatInPlace(MAX_SPREAD, roundedStore(dim, SP_FEATURE_STORE_FLOAT32),
+				leafSize, SEARCH_TEST_THREADS);
+		srand(14 + dim);
+		SPKDTree* floatPointerTree = spKDTreeInit(MAX_SPREAD, roundedStore(dim, SP_FEATURE_STORE_FLOAT32));
+		ASSERT_TRUE(tree != NULL && floatTree != NULL && floatPointerTree != NULL);
+		ASSERT_TRUE(spFeatureStoreGetPrecision(floatTree->store) == SP_FEATURE_STORE_FLOAT32);
+		ASSERT_TRUE(spFeatureStoreGetData(floatTree->store) == NULL && spFeatureStoreGetDataFloat(floatTree->store) != NULL);
+		ASSERT_TRUE(tree->numOfNodes == floatTree->numOfNodes);
+		for (int i=0; i<tree->numOfNodes; i++) {
+			ASSERT_TRUE(tree->nodes[i].dim == floatTree->nodes[i].dim && tree->nodes[i].val == floatTree->nodes[i].val);
+			ASSERT_TRUE(tree->nodes[i].child == floatTree->nodes[i].child);
+		}
+
+		for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+			SPPoint* point = randomPoint(dim);
+			for (int i=0; i<spFeatureStoreGetStride(floatTree->store); i++)
+				query[i] = i < dim ? spPointGetAxisCoor(point, i) : 0;
+			for (int row=0; row<SEARCH_TEST_POINTS; row++)
+				spBPQueueEnqueue(expected, spFeatureStoreGetIndex(floatTree->store, row),
+						spFeatureStoreL2SquaredDistance(floatTree->store, row, query));
+			SPBPQueue* copy = spBPQueueCopy(expected);
+			ASSERT_TRUE(kNearestNeighboursTree(actual, floatTree, point) == 1);
+			ASSERT_TRUE(sameQueues(copy, actual));
+			spBPQueueDestroy(copy);
+			copy = spBPQueueCopy(expected);
+			ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, floatTree, point) == 1);
+			ASSERT_TRUE(sameQueues(copy, actual));
+			spBPQueueDestroy(copy);
+			ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, floatPointerTree, point) == 1);
+			ASSERT_TRUE(sameQueues(expected, actual));
+			spPointDestroy(point);
+		}
+
+		// the index file holds doubles only
+		ASSERT_TRUE(spKDTreeIndexSave(floatTree, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == -1);
+		spKDTreeDestroy(tree);
+		spKDTreeDestroy(floatTree);
+		spKDTreeDestroy(floatPointerTree);
+	}
+	remove(SEARCH_TEST_INDEX);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// The product quantization index answers the search contexts of the tree, and re-ranking all the points by their
+// exact distances finds exactly what the tree finds, also from the mapped feature store of a loaded tree
+static bool pqIndexTest() {
+	const int dim = 16, leafSize = 4, numOfSubspaces = 8;
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(15);
+	SPKDTree* tree = spKDTreeInitFlatInPlace(MAX_SPREAD, randomStore(dim), leafSize, 1);
+	ASSERT_TRUE(tree != NULL);
+	SPPoint* point = randomPoint(dim);
+	ASSERT_TRUE(kNearestNeighboursPQ(actual, tree, point) == -1); // no index
+	ASSERT_TRUE(spKDTreeSetPQIndex(tree, dim + 1, 0, 1) == -1);
+	ASSERT_TRUE(spKDTreeSetPQIndex(NULL, numOfSubspaces, 0, 1) == -1);
+	ASSERT_TRUE(spKDTreeSetPQIndex(tree, numOfSubspaces, 0, SEARCH_TEST_THREADS) == 1);
+	ASSERT_TRUE(spPQIndexGetSize(tree->pq) == SEARCH_TEST_POINTS);
+	SPPoint* other = randomPoint(dim + 1);
+	ASSERT_TRUE(kNearestNeighboursPQ(actual, tree, other) == -1);
+	spPointDestroy(other);
+	spPointDestroy(point);
+
+	// approximate distances, the same with and without a search context
+	SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(tree, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	float table[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX * SP_PQ_INDEX_CENTROIDS];
+	double query[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX + SP_DISTANCE_PAD];
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		point = randomPoint(dim);
+		for (int i=0; i<dim; i++)
+			query[i] = spPointGetAxisCoor(point, i);
+		spPQIndexDistanceTable(tree->pq, query, table);
+		for (int row=0; row<SEARCH_TEST_POINTS; row++)
+			spBPQueueEnqueue(expected, spFeatureStoreGetIndex(tree->store, row), spPQIndexDistance(tree->pq, table, row));
+		ASSERT_TRUE(kNearestNeighboursPQ(actual, tree, point) == 1);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		BPQueueElement e, a;
+		for (int i=0; i<SEARCH_TEST_KNN; i++) { // the same distances, equal distances may be of other images
+			spBPQueuePeek(expected, &e);
+			spBPQueuePeek(actual, &a);
+			ASSERT_TRUE(e.value == a.value);
+			spBPQueueDequeue(expected);
+			spBPQueueDequeue(actual);
+		}
+		ASSERT_TRUE(kNearestNeighboursPQ(actual, tree, point) == 1);
+		ASSERT_TRUE(sameQueues(actual, spKDTreeSearchContextGetQueue(context)));
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+
+	// all the points re-ranked, on the tree and on the tree loaded from the index file
+	ASSERT_TRUE(spKDTreeIndexSave(tree, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == 0);
+	SPKDTree* loaded = spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, MAX_SPREAD, leafSize, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(loaded != NULL);
+	ASSERT_TRUE(spKDTreeSetPQIndex(tree, numOfSubspaces, SEARCH_TEST_POINTS, SEARCH_TEST_THREADS) == 1);
+	ASSERT_TRUE(spKDTreeSetPQIndex(loaded, numOfSubspaces / 2, SEARCH_TEST_POINTS, 1) == 1);
+	context = spKDTreeSearchContextCreate(loaded, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		point = randomPoint(dim);
+		ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+		SPBPQueue* copy = spBPQueueCopy(expected);
+		ASSERT_TRUE(kNearestNeighboursPQ(actual, tree, point) == 1);
+		ASSERT_TRUE(sameQueues(copy, actual));
+		spBPQueueDestroy(copy);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		ASSERT_TRUE(sameQueues(expected, spKDTreeSearchContextGetQueue(context)));
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+	remove(SEARCH_TEST_INDEX);
+
+	// without the index the contexts search the tree again
+	ASSERT_TRUE(spKDTreeSetPQIndex(loaded, 0, 0, 1) == 1 && loaded->pq == NULL);
+	context = spKDTreeSearchContextCreate(loaded, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL && context->pqTable == NULL);
+	spKDTreeSearchContextDestroy(context);
+	spKDTreeDestroy(loaded);
+	spKDTreeDestroy(tree);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// A tree without nodes is searched by its product quantization index alone: without re-ranking the coordinates are
+// freed and the search contexts find the closest points by the codes, and re-ranking all the points finds exactly
+// what a tree of the same points finds
+static bool pqTreeTest() {
+	const int dim = 16, numOfSubspaces = 8;
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	ASSERT_TRUE(spKDTreeInitPQ(NULL, numOfSubspaces, 0, 1) == NULL);
+	srand(16);
+	ASSERT_TRUE(spKDTreeInitPQ(randomStore(dim), dim + 1, 0, 1) == NULL);
+	SPKDTree* pqTree = spKDTreeInitPQ(randomStore(dim), numOfSubspaces, 0, SEARCH_TEST_THREADS);
+	ASSERT_TRUE(pqTree != NULL && pqTree->root == NULL && pqTree->nodes == NULL && pqTree->pq != NULL);
+	ASSERT_TRUE(spFeatureStoreGetData(pqTree->store) == NULL && spFeatureStoreGetSize(pqTree->store) == SEARCH_TEST_POINTS);
+	double zeros[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX] = {0};
+	ASSERT_TRUE(spFeatureStoreAppend(pqTree->store, zeros, 0) == -1);
+
+	// the searches that need nodes fail, and the index is kept
+	SPPoint* point = randomPoint(dim);
+	ASSERT_TRUE(kNearestNeighboursTree(actual, pqTree, point) == -1);
+	ASSERT_TRUE(kNearestNeighboursBestBinFirst(actual, pqTree, point, 4) == -1);
+	ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, pqTree, point) == -1);
+	ASSERT_TRUE(spKDTreeSetQuantized(pqTree, true, 0) == -1);
+	ASSERT_TRUE(spKDTreeSetPQIndex(pqTree, numOfSubspaces / 2, 0, 1) == -1);
+	ASSERT_TRUE(spKDTreeIndexSave(pqTree, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == -1);
+	ASSERT_TRUE(spBPQueueIsEmpty(actual) && spPQIndexGetNumOfSubspaces(pqTree->pq) == numOfSubspaces);
+	spPointDestroy(point);
+
+	// approximate distances, from the codes of all the rows
+	SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(pqTree, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	float table[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX * SP_PQ_INDEX_CENTROIDS];
+	double query[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX + SP_DISTANCE_PAD];
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		point = randomPoint(dim);
+		for (int i=0; i<dim; i++)
+			query[i] = spPointGetAxisCoor(point, i);
+		spPQIndexDistanceTable(pqTree->pq, query, table);
+		for (int row=0; row<SEARCH_TEST_POINTS; row++)
+			spBPQueueEnqueue(expected, spFeatureStoreGetIndex(pqTree->store, row), spPQIndexDistance(pqTree->pq, table, row));
+		ASSERT_TRUE(pqTree->search(actual, pqTree, point) == 1);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		ASSERT_TRUE(sameQueues(actual, spKDTreeSearchContextGetQueue(context)));
+		spBPQueueClear(actual);
+		ASSERT_TRUE(kNearestNeighboursPQ(actual, pqTree, point) == 1);
+		BPQueueElement e, a;
+		for (int i=0; i<SEARCH_TEST_KNN; i++) { // the same distances, equal distances may be of other images
+			spBPQueuePeek(expected, &e);
+			spBPQueuePeek(actual, &a);
+			ASSERT_TRUE(e.value == a.value);
+			spBPQueueDequeue(expected);
+			spBPQueueDequeue(actual);
+		}
+		spBPQueueClear(expected);
+		spBPQueueClear(actual);
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+	spKDTreeDestroy(pqTree);
+
+	// all the points re-ranked, the coordinates are kept
+	srand(17);
+	pqTree = spKDTreeInitPQ(randomStore(dim), numOfSubspaces, SEARCH_TEST_POINTS, SEARCH_TEST_THREADS);
+	srand(17);
+	SPKDTree* tree = randomTree(dim, MAX_SPREAD);
+	ASSERT_TRUE(pqTree != NULL && tree != NULL && spFeatureStoreGetData(pqTree->store) != NULL);
+	context = spKDTreeSearchContextCreate(pqTree, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		point = randomPoint(dim);
+		ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		ASSERT_TRUE(sameQueues(expected, spKDTreeSearchContextGetQueue(context)));
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+	spKDTreeDestroy(tree);
+	spKDTreeDestroy(pqTree);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// The quantized codes answer the search contexts of a single flat tree, and re-ranking all the points by their
+// exact distances finds exactly what the tree finds, also from the mapped feature store of a loaded tree
+static bool quantizedTest() {
+	const int dim = 20, leafSize = 8;
+	SPBPQueue* expected = spBPQueueCreate(SEARCH_TEST_KNN);
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(16);
+	SPKDTree* pointerTree = spKDTreeInit(MAX_SPREAD, randomStore(dim));
+	SPKDTree* forest = spKDTreeInitForest(randomStore(dim), leafSize, 2, 1);
+	ASSERT_TRUE(spKDTreeSetQuantized(pointerTree, true, 0) == -1 && pointerTree->quantized == NULL);
+	ASSERT_TRUE(spKDTreeSetQuantized(forest, true, 0) == -1 && forest->quantized == NULL);
+	ASSERT_TRUE(spKDTreeSetQuantized(NULL, true, 0) == -1);
+	spKDTreeDestroy(pointerTree);
+	spKDTreeDestroy(forest);
+	SPKDTree* tree = spKDTreeInitFlatInPlace(MAX_SPREAD, randomStore(dim), leafSize, 1);
+	ASSERT_TRUE(tree != NULL);
+	SPPoint* point = randomPoint(dim);
+	ASSERT_TRUE(kNearestNeighboursQuantized(actual, tree, point) == -1); // no codes
+	ASSERT_TRUE(spKDTreeSetQuantized(tree, true, 0) == 1);
+	ASSERT_TRUE(spQuantizedStoreGetSize(tree->quantized) == SEARCH_TEST_POINTS);
+	SPPoint* other = randomPoint(dim + 1);
+	ASSERT_TRUE(kNearestNeighboursQuantized(actual, tree, other) == -1);
+	spPointDestroy(other);
+	spPointDestroy(point);
+
+	// approximate distances, the same with and without a search context, and every closest point found is
+	// at least as far as the closest points of all the codes
+	SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(tree, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL && context->codeQuery != NULL);
+	double query[SP_CONFIG_CONSTRAINT_PCA_DIMENSIONS_MAX], distances[SEARCH_TEST_POINTS];
+	short code[SP_DISTANCE_CODE_MAX_DIM];
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		point = randomPoint(dim);
+		for (int i=0; i<dim; i++)
+			query[i] = spPointGetAxisCoor(point, i);
+		spQuantizedStoreQuantizeQuery(tree->quantized, query, code);
+		spQuantizedStoreL2SquaredDistances(tree->quantized, 0, SEARCH_TEST_POINTS, code, distances);
+		for (int row=0; row<SEARCH_TEST_POINTS; row++)
+			spBPQueueEnqueue(expected, spFeatureStoreGetIndex(tree->store, row), distances[row]);
+		ASSERT_TRUE(kNearestNeighboursQuantized(actual, tree, point) == 1);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		BPQueueElement e, a;
+		for (int i=0; i<SEARCH_TEST_KNN; i++) {
+			spBPQueuePeek(expected, &e);
+			spBPQueuePeek(actual, &a);
+			ASSERT_TRUE(e.value <= a.value);
+			spBPQueueDequeue(expected);
+			spBPQueueDequeue(actual);
+		}
+		ASSERT_TRUE(kNearestNeighboursQuantized(actual, tree, point) == 1);
+		ASSERT_TRUE(sameQueues(actual, spKDTreeSearchContextGetQueue(context)));
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+
+	// all the points re-ranked, on the tree and on the tree loaded from the index file
+	ASSERT_TRUE(spKDTreeIndexSave(tree, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == 0);
+	SPKDTree* loaded = spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, MAX_SPREAD, leafSize, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(loaded != NULL);
+	ASSERT_TRUE(spKDTreeSetQuantized(tree, true, SEARCH_TEST_POINTS) == 1);
+	ASSERT_TRUE(spKDTreeSetQuantized(loaded, true, SEARCH_TEST_POINTS) == 1);
+	context = spKDTreeSearchContextCreate(loaded, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		point = randomPoint(dim);
+		ASSERT_TRUE(kNearestNeighboursTree(expected, tree, point) == 1);
+		SPBPQueue* copy = spBPQueueCopy(expected);
+		ASSERT_TRUE(kNearestNeighboursQuantized(actual, tree, point) == 1);
+		ASSERT_TRUE(sameQueues(copy, actual));
+		spBPQueueDestroy(copy);
+		ASSERT_TRUE(kNearestNeighboursContext(context, point) == 1);
+		ASSERT_TRUE(sameQueues(expected, spKDTreeSearchContextGetQueue(context)));
+		spPointDestroy(point);
+	}
+	spKDTreeSearchContextDestroy(context);
+	remove(SEARCH_TEST_INDEX);
+
+	// a product quantization index is searched first, and without the codes the contexts search the tree again
+	ASSERT_TRUE(spKDTreeSetPQIndex(loaded, 4, 0, 1) == 1);
+	context = spKDTreeSearchContextCreate(loaded, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL && context->pqTable != NULL && context->codeQuery == NULL);
+	spKDTreeSearchContextDestroy(context);
+	ASSERT_TRUE(spKDTreeSetPQIndex(loaded, 0, 0, 1) == 1);
+	ASSERT_TRUE(spKDTreeSetQuantized(loaded, false, 0) == 1 && loaded->quantized == NULL);
+	context = spKDTreeSearchContextCreate(loaded, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL && context->codeQuery == NULL && context->candidates == NULL);
+	spKDTreeSearchContextDestroy(context);
+	spKDTreeDestroy(loaded);
+	spKDTreeDestroy(tree);
+	spBPQueueDestroy(expected);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+// Freeing the coordinates of a quantized tree keeps its approximate search: the tree and its search contexts find
+// what they found before, and the functions reading the coordinates fail
+static bool quantizedReleaseTest() {
+	const int dim = 20, leafSize = 8;
+	SPBPQueue* actual = spBPQueueCreate(SEARCH_TEST_KNN);
+	srand(16);
+	SPKDTree* tree = spKDTreeInitFlatInPlace(MAX_SPREAD, randomStore(dim), leafSize, 1);
+	ASSERT_TRUE(tree != NULL);
+	ASSERT_TRUE(spKDTreeReleaseFeatures(NULL) == -1);
+	ASSERT_TRUE(spKDTreeReleaseFeatures(tree) == -1); // no codes
+	ASSERT_TRUE(spKDTreeSetQuantized(tree, true, SEARCH_TEST_POINTS) == 1);
+	ASSERT_TRUE(spKDTreeReleaseFeatures(tree) == -1); // re-ranked
+	ASSERT_TRUE(spKDTreeSetQuantized(tree, true, 0) == 1);
+	ASSERT_TRUE(spKDTreeIndexSave(tree, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == 0);
+	SPPoint* points[SEARCH_TEST_QUERIES];
+	SPBPQueue* before[SEARCH_TEST_QUERIES];
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		points[q] = randomPoint(dim);
+		spBPQueueClear(actual);
+		ASSERT_TRUE(kNearestNeighboursQuantized(actual, tree, points[q]) == 1);
+		before[q] = spBPQueueCopy(actual);
+	}
+
+	ASSERT_TRUE(spKDTreeReleaseFeatures(tree) == 1);
+	ASSERT_TRUE(spFeatureStoreIsReleased(tree->store) && spFeatureStoreGetData(tree->store) == NULL);
+	ASSERT_TRUE(tree->search == kNearestNeighboursQuantized);
+	ASSERT_TRUE(kNearestNeighboursTree(actual, tree, points[0]) == -1);
+	ASSERT_TRUE(kNearestNeighboursBestBinFirst(actual, tree, points[0], 4) == -1);
+	ASSERT_TRUE(spKDTreeSearchForDim(dim)(actual, tree, points[0]) == -1);
+	ASSERT_TRUE(spKDTreeSetQuantized(tree, false, 0) == -1 && tree->quantized != NULL);
+	ASSERT_TRUE(spKDTreeSetPQIndex(tree, 4, 0, 1) == -1 && tree->pq == NULL);
+	ASSERT_TRUE(spKDTreeIndexSave(tree, SEARCH_TEST_INDEX, MAX_SPREAD, SEARCH_TEST_IMAGES) == -1);
+	SPKDTreeSearchContext* context = spKDTreeSearchContextCreate(tree, SEARCH_TEST_KNN, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(context != NULL);
+	for (int q=0; q<SEARCH_TEST_QUERIES; q++) {
+		SPBPQueue* copy = spBPQueueCopy(before[q]);
+		spBPQueueClear(actual);
+		ASSERT_TRUE(tree->search(actual, tree, points[q]) == 1);
+		ASSERT_TRUE(sameQueues(copy, actual));
+		ASSERT_TRUE(kNearestNeighboursContext(context, points[q]) == 1);
+		ASSERT_TRUE(sameQueues(before[q], spKDTreeSearchContextGetQueue(context)));
+		spBPQueueDestroy(copy);
+		spBPQueueDestroy(before[q]);
+		spPointDestroy(points[q]);
+	}
+	spKDTreeSearchContextDestroy(context);
+	spKDTreeDestroy(tree);
+
+	// the mapped coordinates of a loaded tree are kept
+	SPKDTree* loaded = spKDTreeIndexLoad(SEARCH_TEST_INDEX, dim, MAX_SPREAD, leafSize, SEARCH_TEST_IMAGES);
+	ASSERT_TRUE(loaded != NULL);
+	ASSERT_TRUE(spKDTreeSetQuantized(loaded, true, 0) == 1);
+	ASSERT_TRUE(spKDTreeReleaseFeatures(loaded) == 0 && spFeatureStoreGetData(loaded->store) != NULL);
+	spKDTreeDestroy(loaded);
+	remove(SEARCH_TEST_INDEX);
+	spBPQueueDestroy(actual);
+	return true;
+}
+
+int main() {
+	RUN_TEST(searchSelectionTest);
+	RUN_TEST(searchDimensionMismatchTest);
+	RUN_TEST(searchSameResultsTest);
+	RUN_TEST(boundSameResultsTest);
+	RUN_TEST(flatSameResultsTest);
+	RUN_TEST(flatBucketRowsTest);
+	RUN_TEST(flatParallelSameTreeTest);
+	RUN_TEST(inPlaceSameTreeTest);
+	RUN_TEST(indexSaveLoadTest);
+	RUN_TEST(closestImagesSameResultsTest);
+	RUN_TEST(contextSameResultsTest);
+	RUN_TEST(contextThreadsTest);
+	RUN_TEST(parallelSameResultsTest);
+	RUN_TEST(bestBinFirstTest);
+	RUN_TEST(forestTest);
+	RUN_TEST(floatStoreTest);
+	RUN_TEST(pqIndexTest);
+	RUN_TEST(pqTreeTest);
+	RUN_TEST(quantizedTest);
+	RUN_TEST(quantizedReleaseTest);
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+#include "../SPPQIndex.h"
+#include "../SPFeatureStore.h"
+#include "../SPBPriorityQueue.h"
+
+#define PQ_TEST_DIM 10
+#define PQ_TEST_SUBSPACES 4 // subspaces of 3, 2, 3 and 2 dimensions
+#define PQ_TEST_ROWS 2000
+#define PQ_TEST_KNN 12
+
+// A store of numOfRows random rows, with image index i % 7 for row i
+static SPFeatureStore* randomStore(int dim, int numOfRows) {
+	SPFeatureStore* store = spFeatureStoreCreate(dim, numOfRows);
+	double row[PQ_TEST_DIM];
+	for (int i = 0; i < numOfRows && store != NULL; i++) {
+		for (int j = 0; j < dim; j++)
+			row[j] = ((double) rand() / RAND_MAX - 0.5) * 200;
+		spFeatureStoreAppend(store, row, i % 7);
+	}
+	return store;
+}
+
+// Invalid arguments create no index
+static bool invalidArgsTest() {
+	SPFeatureStore* empty = spFeatureStoreCreate(PQ_TEST_DIM, 0);
+	SPFeatureStore* store = randomStore(PQ_TEST_DIM, 10);
+	ASSERT_TRUE(spPQIndexCreate(NULL, 2, 100, 1) == NULL);
+	ASSERT_TRUE(spPQIndexCreate(empty, 2, 100, 1) == NULL);
+	ASSERT_TRUE(spPQIndexCreate(store, 0, 100, 1) == NULL);
+	ASSERT_TRUE(spPQIndexCreate(store, PQ_TEST_DIM + 1, 100, 1) == NULL);
+	ASSERT_TRUE(spPQIndexCreate(store, 2, 0, 1) == NULL);
+	ASSERT_TRUE(spPQIndexGetNumOfSubspaces(NULL) == 0);
+	ASSERT_TRUE(spPQIndexGetSize(NULL) == 0);
+	spPQIndexDestroy(NULL);
+	spFeatureStoreDestroy(empty);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// With fewer distinct rows than centroids every row is a centroid, so the distances are exact
+static bool exactCodebookTest() {
+	double points[4][4] = {{0, 0, 0, 0}, {1, 2, 3, 4}, {-5, 5, -5, 5}, {8, 0, 0, 8}};
+	SPFeatureStore* store = spFeatureStoreCreate(4, 40);
+	for (int i = 0; i < 40; i++)
+		spFeatureStoreAppend(store, points[i % 4], i % 4);
+	SPPQIndex* pq = spPQIndexCreate(store, 2, SP_PQ_INDEX_TRAINING_ROWS, 2);
+	ASSERT_TRUE(pq != NULL);
+	ASSERT_TRUE(spPQIndexGetNumOfSubspaces(pq) == 2);
+	ASSERT_TRUE(spPQIndexGetSize(pq) == 40);
+	ASSERT_TRUE(spPQIndexGetTableSize(pq) == 2 * SP_PQ_INDEX_CENTROIDS);
+	float table[2 * SP_PQ_INDEX_CENTROIDS];
+	for (int q = 0; q < 4; q++) {
+		spPQIndexDistanceTable(pq, points[q], table);
+		for (int i = 0; i < 40; i++) {
+			// same points have the same codes
+			ASSERT_TRUE(memcmp(spPQIndexGetCode(pq, i), spPQIndexGetCode(pq, i % 4), 2) == 0);
+			ASSERT_TRUE(spPQIndexDistance(pq, table, i) ==
+					spFeatureStoreL2SquaredDistance(store, i, spFeatureStoreGetRow(store, q)));
+		}
+	}
+	spPQIndexDestroy(pq);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// Every row is encoded by the centroids closest to it, and the distance is the sum of its table entries
+static bool encodingTest() {
+	SPFeatureStore* store = randomStore(PQ_TEST_DIM, PQ_TEST_ROWS);
+	SPPQIndex* pq = spPQIndexCreate(store, PQ_TEST_SUBSPACES, 500, 4);
+	ASSERT_TRUE(pq != NULL);
+	float table[PQ_TEST_SUBSPACES * SP_PQ_INDEX_CENTROIDS];
+	for (int i = 0; i < PQ_TEST_ROWS; i += 37) {
+		spPQIndexDistanceTable(pq, spFeatureStoreGetRow(store, i), table);
+		const unsigned char* code = spPQIndexGetCode(pq, i);
+		double sum = 0;
+		for (int m = 0; m < PQ_TEST_SUBSPACES; m++) {
+			const float* entries = table + m * SP_PQ_INDEX_CENTROIDS;
+			for (int c = 0; c < SP_PQ_INDEX_CENTROIDS; c++)
+				ASSERT_TRUE(entries[code[m]] <= entries[c]);
+			sum += entries[code[m]];
+		}
+		ASSERT_TRUE(spPQIndexDistance(pq, table, i) - sum < 1e-3 && sum - spPQIndexDistance(pq, table, i) < 1e-3);
+	}
+	spPQIndexDestroy(pq);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// The codebooks do not depend on the number of threads
+static bool threadsTest() {
+	SPFeatureStore* store = randomStore(PQ_TEST_DIM, PQ_TEST_ROWS);
+	SPPQIndex* serial = spPQIndexCreate(store, PQ_TEST_SUBSPACES, 500, 1);
+	SPPQIndex* parallel = spPQIndexCreate(store, PQ_TEST_SUBSPACES, 500, 4);
+	ASSERT_TRUE(serial != NULL && parallel != NULL);
+	for (int i = 0; i < PQ_TEST_ROWS; i++)
+		ASSERT_TRUE(memcmp(spPQIndexGetCode(serial, i), spPQIndexGetCode(parallel, i), PQ_TEST_SUBSPACES) == 0);
+	spPQIndexDestroy(serial);
+	spPQIndexDestroy(parallel);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// The search finds the rows of the smallest approximate distances
+static bool searchTest() {
+	SPFeatureStore* store = randomStore(PQ_TEST_DIM, PQ_TEST_ROWS);
+	SPPQIndex* pq = spPQIndexCreate(store, PQ_TEST_SUBSPACES, SP_PQ_INDEX_TRAINING_ROWS, 2);
+	SPBPQueue* bpq = spBPQueueCreate(PQ_TEST_KNN);
+	SPBPQueue* expected = spBPQueueCreate(PQ_TEST_KNN);
+	ASSERT_TRUE(pq != NULL && bpq != NULL && expected != NULL);
+	float table[PQ_TEST_SUBSPACES * SP_PQ_INDEX_CENTROIDS];
+	double query[PQ_TEST_DIM];
+	for (int q = 0; q < 20; q++) {
+		for (int j = 0; j < PQ_TEST_DIM; j++)
+			query[j] = ((double) rand() / RAND_MAX - 0.5) * 200;
+		spPQIndexDistanceTable(pq, query, table);
+		spBPQueueClear(bpq);
+		spBPQueueClear(expected);
+		spPQIndexSearch(pq, table, bpq);
+		for (int i = 0; i < PQ_TEST_ROWS; i++)
+			spBPQueueEnqueue(expected, i, spPQIndexDistance(pq, table, i));
+		ASSERT_TRUE(spBPQueueSize(bpq) == PQ_TEST_KNN);
+		BPQueueElement a, b;
+		while (!spBPQueueIsEmpty(expected)) {
+			spBPQueuePeek(bpq, &a);
+			spBPQueuePeek(expected, &b);
+			ASSERT_TRUE(a.index == b.index && a.value == b.value);
+			spBPQueueDequeue(bpq);
+			spBPQueueDequeue(expected);
+		}
+	}
+	spBPQueueDestroy(bpq);
+	spBPQueueDestroy(expected);
+	spPQIndexDestroy(pq);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+int main() {
+	RUN_TEST(invalidArgsTest);
+	RUN_TEST(exactCodebookTest);
+	RUN_TEST(encodingTest);
+	RUN_TEST(threadsTest);
+	RUN_TEST(searchTest);
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+#include "../SPQuantizedStore.h"
+#include "../SPFeatureStore.h"
+#include "../SPDistance.h"
+
+#define QUANTIZED_TEST_DIM 20 // padded to 32 codes
+#define QUANTIZED_TEST_ROWS 500
+
+// A store of numOfRows random rows, dimension j in the range -10*(j+1) ... 10*(j+1)
+static SPFeatureStore* randomStore(int numOfRows, SP_FEATURE_STORE_PRECISION precision) {
+	SPFeatureStore* store = spFeatureStoreCreateWithPrecision(QUANTIZED_TEST_DIM, numOfRows, precision);
+	double row[QUANTIZED_TEST_DIM];
+	for (int i = 0; i < numOfRows && store != NULL; i++) {
+		for (int j = 0; j < QUANTIZED_TEST_DIM; j++)
+			row[j] = ((double) rand() / RAND_MAX - 0.5) * 20 * (j + 1);
+		spFeatureStoreAppend(store, row, i);
+	}
+	return store;
+}
+
+// Invalid arguments create no store
+static bool invalidArgsTest() {
+	SPFeatureStore* empty = spFeatureStoreCreate(QUANTIZED_TEST_DIM, 0);
+	ASSERT_TRUE(spQuantizedStoreCreate(NULL) == NULL);
+	ASSERT_TRUE(spQuantizedStoreCreate(empty) == NULL);
+	ASSERT_TRUE(spQuantizedStoreGetDimension(NULL) == -1);
+	ASSERT_TRUE(spQuantizedStoreGetStride(NULL) == -1);
+	ASSERT_TRUE(spQuantizedStoreGetSize(NULL) == 0);
+	spQuantizedStoreDestroy(NULL);
+	spFeatureStoreDestroy(empty);
+	return true;
+}
+
+// Every coordinate is within half a code of its code, a code of a dimension is as wide as its range needs,
+// and the widest dimension spans all the codes
+static bool calibrationTest() {
+	SPFeatureStore* store = randomStore(QUANTIZED_TEST_ROWS, SP_FEATURE_STORE_FLOAT64);
+	SPQuantizedStore* quantized = spQuantizedStoreCreate(store);
+	ASSERT_TRUE(quantized != NULL);
+	ASSERT_TRUE(spQuantizedStoreGetDimension(quantized) == QUANTIZED_TEST_DIM);
+	ASSERT_TRUE(spQuantizedStoreGetStride(quantized) == 32);
+	ASSERT_TRUE(spQuantizedStoreGetSize(quantized) == QUANTIZED_TEST_ROWS);
+	double step = spQuantizedStoreGetStep(quantized);
+	ASSERT_TRUE(step > 0);
+	ASSERT_TRUE(spQuantizedStoreGetScale(quantized, 0) == 1);
+	ASSERT_TRUE(spQuantizedStoreGetScale(quantized, QUANTIZED_TEST_DIM / 2 - 1) == 4);
+	ASSERT_TRUE(spQuantizedStoreGetScale(quantized, QUANTIZED_TEST_DIM - 1) == SP_DISTANCE_CODE_SCALE_MAX);
+	bool hasMin = false, hasMax = false;
+	for (int i = 0; i < QUANTIZED_TEST_ROWS; i++) {
+		const unsigned char* code = spQuantizedStoreGetRow(quantized, i);
+		const double* row = spFeatureStoreGetRow(store, i);
+		for (int j = 0; j < QUANTIZED_TEST_DIM; j++) {
+			double width = spQuantizedStoreGetScale(quantized, j) * step;
+			double diff = spQuantizedStoreGetMin(quantized, j) + code[j] * width - row[j];
+			ASSERT_TRUE(diff <= width / 2 + 1e-9 && -diff <= width / 2 + 1e-9);
+			if (j == QUANTIZED_TEST_DIM - 1) {
+				hasMin = hasMin || code[j] == 0;
+				hasMax = hasMax || code[j] == 255;
+			}
+		}
+		for (int j = QUANTIZED_TEST_DIM; j < 32; j++)
+			ASSERT_TRUE(code[j] == 0);
+	}
+	ASSERT_TRUE(hasMin && hasMax);
+	spQuantizedStoreDestroy(quantized);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// A store of equal rows has step 1, scales 1 and codes 0, queries out of the range are clamped
+static bool constantStoreTest() {
+	double row[QUANTIZED_TEST_DIM], query[QUANTIZED_TEST_DIM];
+	short code[32];
+	SPFeatureStore* store = spFeatureStoreCreate(QUANTIZED_TEST_DIM, 3);
+	for (int j = 0; j < QUANTIZED_TEST_DIM; j++) {
+		row[j] = j;
+		query[j] = j % 2 == 0 ? j + 5000.0 : j - 5000.0;
+	}
+	for (int i = 0; i < 3; i++)
+		spFeatureStoreAppend(store, row, i);
+	SPQuantizedStore* quantized = spQuantizedStoreCreate(store);
+	ASSERT_TRUE(quantized != NULL);
+	ASSERT_TRUE(spQuantizedStoreGetStep(quantized) == 1);
+	for (int j = 0; j < QUANTIZED_TEST_DIM; j++) {
+		ASSERT_TRUE(spQuantizedStoreGetScale(quantized, j) == 1);
+		ASSERT_TRUE(spQuantizedStoreGetRow(quantized, 2)[j] == 0);
+	}
+	spQuantizedStoreQuantizeQuery(quantized, query, code);
+	for (int j = 0; j < QUANTIZED_TEST_DIM; j++)
+		ASSERT_TRUE(code[j] == (j % 2 == 0 ? SP_DISTANCE_CODE_QUERY_MAX : SP_DISTANCE_CODE_QUERY_MIN));
+	for (int j = QUANTIZED_TEST_DIM; j < 32; j++)
+		ASSERT_TRUE(code[j] == 0);
+	spQuantizedStoreDestroy(quantized);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+// The distances are the squared distances between the query codes and the scaled row codes times step^2,
+// and close to the exact distances - every coordinate difference is off by at most half a code of the row
+// and half a step of the query
+static bool distancesTest(SP_FEATURE_STORE_PRECISION precision) {
+	SPFeatureStore* store = randomStore(QUANTIZED_TEST_ROWS, precision);
+	SPQuantizedStore* quantized = spQuantizedStoreCreate(store);
+	ASSERT_TRUE(quantized != NULL);
+	double step = spQuantizedStoreGetStep(quantized);
+	double query[32] = {0}, distances[QUANTIZED_TEST_ROWS], row[QUANTIZED_TEST_DIM];
+	short code[32];
+	for (int q = 0; q < 10; q++) {
+		for (int j = 0; j < QUANTIZED_TEST_DIM; j++)
+			query[j] = ((double) rand() / RAND_MAX - 0.5) * 20 * (j + 1);
+		spQuantizedStoreQuantizeQuery(quantized, query, code);
+		spQuantizedStoreL2SquaredDistances(quantized, 0, QUANTIZED_TEST_ROWS, code, distances);
+		for (int i = 0; i < QUANTIZED_TEST_ROWS; i++) {
+			const unsigned char* rowCode = spQuantizedStoreGetRow(quantized, i);
+			long long sum = 0;
+			double lower = 0, upper = 0;
+			spFeatureStoreCopyRow(store, i, row);
+			for (int j = 0; j < QUANTIZED_TEST_DIM; j++) {
+				int scale = spQuantizedStoreGetScale(quantized, j);
+				sum += (code[j] - scale * rowCode[j]) * (code[j] - scale * rowCode[j]);
+				double diff = query[j] < row[j] ? row[j] - query[j] : query[j] - row[j];
+				double error = (scale + 1) * step / 2;
+				double near = diff > error ? diff - error : 0;
+				lower += near * near;
+				upper += (diff + error) * (diff + error);
+			}
+			ASSERT_TRUE(distances[i] == sum * (step * step));
+			ASSERT_TRUE(lower - 1e-9 <= distances[i] && distances[i] <= upper + 1e-9);
+		}
+		// a range of rows gets the distances of the same rows of the whole scan
+		double range[7];
+		spQuantizedStoreL2SquaredDistances(quantized, 100, 7, code, range);
+		for (int i = 0; i < 7; i++)
+			ASSERT_TRUE(range[i] == distances[100 + i]);
+	}
+	spQuantizedStoreDestroy(quantized);
+	spFeatureStoreDestroy(store);
+	return true;
+}
+
+static bool distancesFloat64Test() {
+	return distancesTest(SP_FEATURE_STORE_FLOAT64);
+}
+
+static bool distancesFloat32Test() {
+	return distancesTest(SP_FEATURE_STORE_FLOAT32);
+}
+
+int main() {
+	RUN_TEST(invalidArgsTest);
+	RUN_TEST(calibrationTest);
+	RUN_TEST(constantStoreTest);
+	RUN_TEST(distancesFloat64Test);
+	RUN_TEST(distancesFloat32Test);
+	return 0;
+}
@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "unit_test_util.h" //SUPPORTING MACROS ASSERT_TRUE/ASSERT_FALSE etc..
+#include "../SPPoint.h"
+#include "../SPFeatureStore.h"
+#include "../SPKDTree.h"
+#include "../SPQueryServer.h"
+
+#define SERVER_TEST_SOCKET "./unit_tests/sp_query_server_test.sock"
+#define SERVER_TEST_DIM 12
+#define SERVER_TEST_IMAGES 8
+#define SERVER_TEST_FEATURES 30 // per image
+#define SERVER_TEST_KNN 4
+#define SERVER_TEST_SIMILAR 3
+#define SERVER_TEST_THREADS 3
+#define SERVER_TEST_CLIENTS 6
+#define SERVER_TEST_QUERIES 20 // per client
+
+static double randomCoor() {
+	return ((double) rand() / RAND_MAX - 0.5) * 200;
+}
+
+// Random features of an image
+static SPPoint** randomFeatures(int numOfFeatures, int index) {
+	SPPoint** feats = (SPPoint**) malloc(numOfFeatures * sizeof(SPPoint*));
+	double data[SERVER_TEST_DIM];
+	for (int i=0; i<numOfFeatures; i++) {
+		for (int j=0; j<SERVER_TEST_DIM; j++)
+			data[j] = randomCoor();
+		feats[i] = spPointCreate(data, SERVER_TEST_DIM, index);
+	}
+	return feats;
+}
+
+static void destroyFeatures(SPPoint** feats, int numOfFeatures) {
+	for (int i=0; i<numOfFeatures; i++)
+		spPointDestroy(feats[i]);
+	free(feats);
+}
+
+// The features of the images, and a tree of all of them
+static SPPoint** imageFeats[SERVER_TEST_IMAGES];
+
+static SPKDTree* createTree() {
+	SPFeatureStore* store = spFeatureStoreCreate(SERVER_TEST_DIM, SERVER_TEST_IMAGES * SERVER_TEST_FEATURES);
+	for (int i=0; i<SERVER_TEST_IMAGES; i++) {
+		imageFeats[i] = randomFeatures(SERVER_TEST_FEATURES, i);
+		for (int j=0; j<SERVER_TEST_FEATURES; j++)
+			spFeatureStoreAppendPoint(store, imageFeats[i][j]);
+	}
+	return spKDTreeInitFlat(MAX_SPREAD, store, 4);
+}
+
+static void destroyTree(SPKDTree* tree) {
+	for (int i=0; i<SERVER_TEST_IMAGES; i++)
+		destroyFeatures(imageFeats[i], SERVER_TEST_FEATURES);
+	spKDTreeDestroy(tree);
+}
+
+// Extracts the features of "img<i>" - a copy of the first half of the features of image i
+static SPPoint** testExtract(void* arg, const char* path, int* numOfFeatures) {
+	(void) arg;
+	int index;
+	if (sscanf(path, "img%d", &index) != 1 || index < 0 || index >= SERVER_TEST_IMAGES)
+		return NULL;
+	SPPoint** feats = (SPPoint**) malloc(SERVER_TEST_FEATURES / 2 * sizeof(SPPoint*));
+	for (int i=0; i<SERVER_TEST_FEATURES / 2; i++)
+		feats[i] = spPointCopy(imageFeats[index][i]);
+	*numOfFeatures = SERVER_TEST_FEATURES / 2;
+	return feats;
+}
+
+// Checks the server answers a features query exactly as closestImagesSearch does
+static bool sameAnswer(int fd, SPKDTree* tree, SPPoint** query, int numOfFeatures) {
+	int expected[SERVER_TEST_SIMILAR], actual[SERVER_TEST_SIMILAR];
+	ASSERT_TRUE(closestImagesSearch(SERVER_TEST_KNN, expected, SERVER_TEST_SIMILAR, query, numOfFeatures,
+			tree, SERVER_TEST_IMAGES) != -1);
+	ASSERT_TRUE(spQueryClientSearchFeatures(fd, query, numOfFeatures, SERVER_TEST_DIM,
+			actual, SERVER_TEST_SIMILAR) == SERVER_TEST_SIMILAR);
+	for (int i=0; i<SERVER_TEST_SIMILAR; i++)
+		ASSERT_TRUE(actual[i] == expected[i]);
+	return true;
+}
+
+// Feature queries are answered with the similar images, and invalid queries don't close the connection
+static bool featuresQueryTest() {
+	srand(1);
+	SPKDTree* tree = createTree();
+	SPQueryServer* server = spQueryServerCreate(SERVER_TEST_SOCKET, tree, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, NULL, NULL);
+	ASSERT_TRUE(server != NULL);
+	int fd = spQueryClientConnect(SERVER_TEST_SOCKET);
+	ASSERT_TRUE(fd != -1);
+
+	// the features of an image find the image first
+	int similarImages[SERVER_TEST_SIMILAR];
+	for (int i=0; i<SERVER_TEST_IMAGES; i++) {
+		ASSERT_TRUE(spQueryClientSearchFeatures(fd, imageFeats[i], SERVER_TEST_FEATURES, SERVER_TEST_DIM,
+				similarImages, SERVER_TEST_SIMILAR) == SERVER_TEST_SIMILAR);
+		ASSERT_TRUE(similarImages[0] == i);
+	}
+	for (int q=0; q<10; q++) {
+		SPPoint** query = randomFeatures(5, 0);
+		ASSERT_TRUE(sameAnswer(fd, tree, query, 5));
+		destroyFeatures(query, 5);
+	}
+
+	// a wrong dimension, and a path without an extraction function, fail
+	SPPoint** query = randomFeatures(1, 0);
+	ASSERT_TRUE(spQueryClientSearchFeatures(fd, query, 1, SERVER_TEST_DIM - 1, similarImages, SERVER_TEST_SIMILAR) == -1);
+	ASSERT_TRUE(spQueryClientSearchPath(fd, "img1", similarImages, SERVER_TEST_SIMILAR) == -1);
+	ASSERT_TRUE(sameAnswer(fd, tree, query, 1));
+	destroyFeatures(query, 1);
+
+	close(fd);
+	spQueryServerDestroy(server);
+	ASSERT_TRUE(access(SERVER_TEST_SOCKET, F_OK) == -1);
+	ASSERT_TRUE(spQueryClientConnect(SERVER_TEST_SOCKET) == -1);
+	destroyTree(tree);
+	return true;
+}
+
+// Path queries are extracted with the extraction function of the server
+static bool pathQueryTest() {
+	srand(2);
+	SPKDTree* tree = createTree();
+	SPQueryServer* server = spQueryServerCreate(SERVER_TEST_SOCKET, tree, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, testExtract, NULL);
+	ASSERT_TRUE(server != NULL);
+	int fd = spQueryClientConnect(SERVER_TEST_SOCKET);
+	ASSERT_TRUE(fd != -1);
+	int similarImages[SERVER_TEST_SIMILAR];
+	char path[16];
+	for (int i=0; i<SERVER_TEST_IMAGES; i++) {
+		sprintf(path, "img%d", i);
+		ASSERT_TRUE(spQueryClientSearchPath(fd, path, similarImages, SERVER_TEST_SIMILAR) == SERVER_TEST_SIMILAR);
+		ASSERT_TRUE(similarImages[0] == i);
+	}
+	ASSERT_TRUE(spQueryClientSearchPath(fd, "missing", similarImages, SERVER_TEST_SIMILAR) == -1);
+	ASSERT_TRUE(spQueryClientSearchPath(fd, "img3", similarImages, 1) == 1);
+	ASSERT_TRUE(similarImages[0] == 3);
+	close(fd);
+	spQueryServerDestroy(server);
+	destroyTree(tree);
+	return true;
+}
+
+// The state of a client of concurrentClientsTest
+typedef struct test_client_t {
+	SPKDTree* tree;
+	int seed;
+	bool passed;
+} TestClient;
+
+static bool runClient(TestClient* client) {
+	int fd = spQueryClientConnect(SERVER_TEST_SOCKET);
+	ASSERT_TRUE(fd != -1);
+	unsigned int seed = (unsigned int) client->seed;
+	for (int q=0; q<SERVER_TEST_QUERIES; q++) {
+		// rand is not reentrant, so the query is built from a feature of a random image
+		int image = (int) (rand_r(&seed) % SERVER_TEST_IMAGES);
+		SPPoint** query = (SPPoint**) malloc(2 * sizeof(SPPoint*));
+		query[0] = spPointCopy(imageFeats[image][rand_r(&seed) % SERVER_TEST_FEATURES]);
+		query[1] = spPointCopy(imageFeats[(image + 1) % SERVER_TEST_IMAGES][rand_r(&seed) % SERVER_TEST_FEATURES]);
+		bool same = sameAnswer(fd, client->tree, query, 2);
+		destroyFeatures(query, 2);
+		ASSERT_TRUE(same);
+	}
+	close(fd);
+	return true;
+}
+
+static void* clientThread(void* arg) {
+	TestClient* client = (TestClient*) arg;
+	client->passed = runClient(client);
+	return NULL;
+}
+
+// More clients than workers, all at once
+static bool concurrentClientsTest() {
+	srand(3);
+	SPKDTree* tree = createTree();
+	SPQueryServer* server = spQueryServerCreate(SERVER_TEST_SOCKET, tree, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, testExtract, NULL);
+	ASSERT_TRUE(server != NULL);
+	pthread_t threads[SERVER_TEST_CLIENTS];
+	TestClient clients[SERVER_TEST_CLIENTS];
+	for (int i=0; i<SERVER_TEST_CLIENTS; i++) {
+		clients[i].tree = tree;
+		clients[i].seed = i + 1;
+		clients[i].passed = false;
+		ASSERT_TRUE(pthread_create(threads + i, NULL, clientThread, clients + i) == 0);
+	}
+	for (int i=0; i<SERVER_TEST_CLIENTS; i++)
+		pthread_join(threads[i], NULL);
+	for (int i=0; i<SERVER_TEST_CLIENTS; i++)
+		ASSERT_TRUE(clients[i].passed);
+	spQueryServerDestroy(server);
+	destroyTree(tree);
+	return true;
+}
+
+// Clients that connect and send nothing, more than the workers, don't keep a new client from an answer
+static bool idleClientsTest() {
+	srand(5);
+	SPKDTree* tree = createTree();
+	SPQueryServer* server = spQueryServerCreate(SERVER_TEST_SOCKET, tree, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, NULL, NULL);
+	ASSERT_TRUE(server != NULL);
+	int idle[SERVER_TEST_THREADS + 1];
+	for (int i=0; i<SERVER_TEST_THREADS + 1; i++) {
+		idle[i] = spQueryClientConnect(SERVER_TEST_SOCKET);
+		ASSERT_TRUE(idle[i] != -1);
+	}
+	int fd = spQueryClientConnect(SERVER_TEST_SOCKET);
+	ASSERT_TRUE(fd != -1);
+	SPPoint** query = randomFeatures(3, 0);
+	ASSERT_TRUE(sameAnswer(fd, tree, query, 3));
+	destroyFeatures(query, 3);
+	close(fd);
+	for (int i=0; i<SERVER_TEST_THREADS + 1; i++)
+		close(idle[i]);
+	spQueryServerDestroy(server);
+	destroyTree(tree);
+	return true;
+}
+
+// Invalid servers are not created
+static bool invalidServerTest() {
+	srand(4);
+	SPKDTree* tree = createTree();
+	char longPath[200];
+	memset(longPath, 'a', sizeof(longPath) - 1);
+	longPath[sizeof(longPath) - 1] = '\0';
+	ASSERT_TRUE(spQueryServerCreate(longPath, tree, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, NULL, NULL) == NULL);
+	ASSERT_TRUE(spQueryServerCreate(SERVER_TEST_SOCKET, tree, SERVER_TEST_KNN, SERVER_TEST_IMAGES + 1,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, NULL, NULL) == NULL);
+	ASSERT_TRUE(spQueryServerCreate(SERVER_TEST_SOCKET, tree, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, 0, NULL, NULL) == NULL);
+	ASSERT_TRUE(spQueryServerCreate(SERVER_TEST_SOCKET, NULL, SERVER_TEST_KNN, SERVER_TEST_SIMILAR,
+			SERVER_TEST_IMAGES, SERVER_TEST_THREADS, NULL, NULL) == NULL);
+	ASSERT_TRUE(access(SERVER_TEST_SOCKET, F_OK) == -1);
+	destroyTree(tree);
+	return true;
+}
+
+int main() {
+	RUN_TEST(featuresQueryTest);
+	RUN_TEST(pathQueryTest);
+	RUN_TEST(concurrentClientsTest);
+	RUN_TEST(idleClientsTest);
+	RUN_TEST(invalidServerTest);
+	return 0;
+}
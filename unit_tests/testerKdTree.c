@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../SPPoint.h"
+#include "../SPFeatureStore.h"
 #include "../SPKDArray.h"
 #include "../SPBPriorityQueue.h"
 #include "../SPKDTree.h"
@@ -193,7 +194,7 @@ void treeTesterPoor(int kNN, int numOfClosest, KD_METHOD splitMethod, int search
     m[index][6] = spPointCreate(coor, dim, index);
 
      // Tree creation
-    SPKDTreeNode* t0 = fullKDTreeCreator(m , numOfImagesTest, numOfFeaturesTest, splitMethod);
+    SPKDTree* t0 = fullKDTreeCreator(m , numOfImagesTest, numOfFeaturesTest, splitMethod);
     if(t0 != NULL){
 //        for(int i = 0; i<numOfImagesTest; i++){
 //            printf("\nImage %d:\n", i);
@@ -229,17 +230,15 @@ void treeTesterPoor(int kNN, int numOfClosest, KD_METHOD splitMethod, int search
     }
     else{
         printf("\nTree creation error\n");
-        for(int i = 0; i < numOfImages; i++){
-            for(int j = 0; j < numOfFeatures[i]; j++){
-                spPointDestroy(m[i][j]);
-            }
-        }
     }
 
     free(coor);
     if(t0 != NULL)
         spKDTreeDestroy(t0);
     for(int i = 0; i < numOfImages; i++){
+        for(int j = 0; j < numOfFeatures[i]; j++){
+            spPointDestroy(m[i][j]); // The tree holds copies of the points
+        }
         free(m[i]);
     }
     free(m);
@@ -348,7 +347,7 @@ void treeTesterGood(int kNN, int numOfClosest, KD_METHOD splitMethod, int search
     m[index][6] = spPointCreate(coor, dim, index);
 
     // Tree creation
-    SPKDTreeNode* t0 = fullKDTreeCreator(m , numOfImagesTest, numOfFeaturesTest, splitMethod);
+    SPKDTree* t0 = fullKDTreeCreator(m , numOfImagesTest, numOfFeaturesTest, splitMethod);
     if(t0 != NULL){
 //        for(int i = 0; i<numOfImagesTest; i++){
 //            printf("\nImage %d:\n", i);
@@ -384,17 +383,15 @@ void treeTesterGood(int kNN, int numOfClosest, KD_METHOD splitMethod, int search
     }
     else{
         printf("\nTree creation error\n");
-        for(int i = 0; i < numOfImages; i++){
-            for(int j = 0; j < numOfFeatures[i]; j++){
-                spPointDestroy(m[i][j]);
-            }
-        }
     }
 
     free(coor);
     if(t0 != NULL)
         spKDTreeDestroy(t0);
     for(int i = 0; i < numOfImages; i++){
+        for(int j = 0; j < numOfFeatures[i]; j++){
+            spPointDestroy(m[i][j]); // The tree holds copies of the points
+        }
         free(m[i]);
     }
     free(m);